@@ -147,6 +147,10 @@ static forceinline int32 InterlockedExchange(volatile int32 *target, int32 val){
 }//end: InterlockedExchange()
 
 
+// Full memory barrier (MSVC provides MemoryBarrier() in winnt.h)
+#define MemoryBarrier() __sync_synchronize()
+
+
 #endif //endif compiler decission
 
 
@@ -8,6 +8,7 @@
 #include "strlib.h"
 #ifndef MINICORE
 #include "db.h"
+#include "ers.h"
 #include "socket.h"
 #include "timer.h"
 #include "thread.h"
@@ -259,14 +260,17 @@ int main(int argc, char **argv)
 #endif
 
 	timer_init();
+	ers_init();
 	socket_init();
 
 	do_init(argc,argv);
 
 	// Main runtime cycle
 	while (runflag != CORE_ST_STOP) {
-		int next = do_timer(gettick_nocache());
+		int next;
 
+		tick_begin();
+		next = do_timer(gettick_nocache());
 		do_sockets(next);
 	}
 
@@ -83,6 +83,7 @@
  *  DBNColor        - Enumeration of colors of the nodes.                    *
  *  DBNode          - Structure of a node in RED-BLACK trees.                *
  *  struct db_free  - Structure that holds a deleted node to be freed.       *
+ *  struct db_slot  - Structure of an entry in open-addressing tables.      *
  *  DBMap_impl      - Struture of the database.                              *
  *  stats           - Statistics about the database system.                  *
 \*****************************************************************************/
@@ -153,6 +154,40 @@ struct db_free {
 	DBNode *root;
 };
 
+/**
+ * Minimum capacity of open-addressing tables (power of two).
+ * @private
+ * @see DBMap_impl#slots
+ */
+#define DB_FLAT_MIN 16
+
+/**
+ * State of an entry in open-addressing tables.
+ * Deleted entries keep the probe sequences intact until the next resize.
+ * @private
+ * @see struct db_slot
+ */
+enum db_slot_state {
+	DB_SLOT_EMPTY = 0,
+	DB_SLOT_USED,
+	DB_SLOT_DELETED
+};
+
+/**
+ * An entry of an open-addressing table (DB_OPT_FLAT).
+ * Only integer keys are supported, so the key is kept inline.
+ * @param data Data of this database entry
+ * @param key Key of this database entry (int or unsigned int)
+ * @param state State of the entry
+ * @private
+ * @see DBMap_impl#slots
+ */
+struct db_slot {
+	DBData data;
+	unsigned int key;
+	unsigned int state;
+};
+
 /**
  * Complete database structure.
  * @param vtable Interface of the database
@@ -167,6 +202,13 @@ struct db_free {
  * @param hash Hasher of the database
  * @param release Releaser of the database
  * @param ht Hashtable of RED-BLACK trees
+ * @param slots Open-addressing table (DB_OPT_FLAT only)
+ * @param slot_mask Capacity of slots minus one
+ * @param slot_used Number of used and deleted entries in slots
+ * @param slot_shift Shift that reduces the hash of a key to an index of slots
+ * @param spill Entries added while the full table was locked (DB_OPT_FLAT only)
+ * @param spill_count Number of entries in spill
+ * @param spill_max Current maximum capacity of spill
  * @param type Type of the database
  * @param options Options of the database
  * @param item_count Number of items in the database
@@ -192,6 +234,13 @@ typedef struct DBMap_impl {
 	DBHasher hash;
 	DBReleaser release;
 	DBNode ht[HASH_SIZE];
+	struct db_slot *slots;
+	uint32 slot_mask;
+	uint32 slot_used;
+	unsigned int slot_shift;
+	struct db_slot **spill;
+	uint32 spill_count;
+	uint32 spill_max;
 	DBNode cache;
 	DBType type;
 	DBOptions options;
@@ -336,6 +385,8 @@ static struct db_stats {
  *         NOTE: Keeps the database trees balanced.                          *
 \*****************************************************************************/
 
+static void db_flat_resize(DBMap_impl* db, uint32 count);
+
 /**
  * Rotate a node to the left.
  * @param node Node to be rotated
@@ -816,6 +867,9 @@ static void db_free_unlock(DBMap_impl* db)
 		ers_free(db->nodes, db->free_list[i].node);
 	}
 	db->free_count = 0;
+
+	if (db->spill_count) // open-addressing table that filled up while locked, grow it now
+		db_flat_resize(db, db->item_count);
 }
 
 /*****************************************************************************\
@@ -2231,6 +2285,778 @@ static DBOptions db_obj_options(DBMap *self)
 	return options;
 }
 
+/*****************************************************************************\
+ *  Open-addressing tables (DB_OPT_FLAT), same interface as above.           *
+ *  db_flat_index    - Index of the first entry in the probe sequence.       *
+ *  db_flat_at       - Entry at an iterator position (table, then spill).    *
+ *  db_flat_spill_find - Find the entry of a key in the spill list.          *
+ *  db_flat_find     - Find the entry of a key.                              *
+ *  db_flat_resize   - Rebuild the table with a different capacity.          *
+ *  db_flat_reserve  - Make room for a new entry.                            *
+ *  db_flat_shrink   - Shrink the table if it's mostly empty.                *
+ *  db_flat_insert   - Get the entry of a key, adding it if necessary.       *
+ *  dbit_flat_first  - Fetches the first entry from the database.            *
+ *  dbit_flat_last   - Fetches the last entry from the database.             *
+ *  dbit_flat_next   - Fetches the next entry from the database.             *
+ *  dbit_flat_prev   - Fetches the previous entry from the database.         *
+ *  dbit_flat_exists - Returns true if the current entry exists.             *
+ *  dbit_flat_remove - Remove the current entry from the database.           *
+ *  db_flat_iterator - Return a new database iterator.                       *
+ *  db_flat_exists   - Checks if an entry exists.                            *
+ *  db_flat_get      - Get the data identified by the key.                   *
+ *  db_flat_vgetall  - Get the data of the matched entries.                  *
+ *  db_flat_vensure  - Get the data identified by the key, creating if it    *
+ *           doesn't exist yet.                                              *
+ *  db_flat_put      - Put data identified by the key in the database.       *
+ *  db_flat_remove   - Remove an entry from the database.                    *
+ *  db_flat_vforeach - Apply a function to every entry in the database.      *
+ *  db_flat_vclear   - Remove all entries from the database.                 *
+ *  db_flat_vdestroy - Destroy the database, freeing all the used memory.    *
+ *                                                                           *
+ *  Linear probing over a power-of-two array of entries. Removed entries are *
+ *  marked as deleted and only purged when the table is rebuilt. The table   *
+ *  grows when 3/4 of it is in use and shrinks when less than 1/8 is in use, *
+ *  but never while the database is locked (iterators, foreach), entries    *
+ *  don't move then. When a locked table is 15/16 full, new entries go to a  *
+ *  spill list of separately allocated entries, the table grows and takes   *
+ *  them in when the last lock is released.                                  *
+\*****************************************************************************/
+
+/**
+ * Index of the first entry in the probe sequence of a key (fibonacci hashing).
+ * @param db Database
+ * @param key Key (int or unsigned int)
+ * @return Index in db->slots
+ * @private
+ */
+static inline uint32 db_flat_index(DBMap_impl* db, unsigned int key)
+{
+	return (uint32)(key*0x9E3779B9U) >> db->slot_shift;
+}
+
+/**
+ * Returns the entry at an iterator position.
+ * Positions after the table are the entries of the spill list.
+ * @param db Database
+ * @param i Position
+ * @return Entry or NULL if the position is out of range
+ * @private
+ */
+static inline struct db_slot* db_flat_at(DBMap_impl* db, int64 i)
+{
+	if( i < 0 )
+		return NULL;
+	if( i <= (int64)db->slot_mask )
+		return &db->slots[i];
+	i -= (int64)db->slot_mask + 1;
+	return ( i < (int64)db->spill_count ) ? db->spill[i] : NULL;
+}
+
+/**
+ * Finds the entry of a key in the spill list.
+ * @param db Database
+ * @param key Key (int or unsigned int)
+ * @return Entry or NULL if not found
+ * @private
+ */
+static struct db_slot* db_flat_spill_find(DBMap_impl* db, unsigned int key)
+{
+	uint32 i;
+
+	for( i = 0; i < db->spill_count; i++ ) {
+		if( db->spill[i]->key == key && db->spill[i]->state == DB_SLOT_USED )
+			return db->spill[i];
+	}
+	return NULL;
+}
+
+/**
+ * Finds the entry of a key.
+ * @param db Database
+ * @param key Key (int or unsigned int)
+ * @return Entry or NULL if not found
+ * @private
+ */
+static struct db_slot* db_flat_find(DBMap_impl* db, unsigned int key)
+{
+	uint32 i = db_flat_index(db, key);
+
+	for( ; ; i = (i+1)&db->slot_mask ) {
+		struct db_slot* slot = &db->slots[i];
+
+		if( slot->state == DB_SLOT_EMPTY )
+			break;
+		if( slot->key == key && slot->state == DB_SLOT_USED )
+			return slot;
+	}
+	return db->spill_count ? db_flat_spill_find(db, key) : NULL;
+}
+
+/**
+ * Rebuilds the table with the smallest capacity that keeps it at most half 
+ * full, dropping the deleted entries and taking in the spill list.
+ * NOTE: Entries move, so pointers to their data become invalid.
+ * Must not be called while the database is locked.
+ * @param db Database
+ * @param count Number of entries the table must hold
+ * @private
+ */
+static void db_flat_resize(DBMap_impl* db, uint32 count)
+{
+	struct db_slot* old = db->slots;
+	uint32 old_capacity = old ? db->slot_mask + 1 : 0;
+	uint32 capacity = DB_FLAT_MIN;
+	unsigned int shift = 32;
+	uint32 i, n;
+
+	if( db->free_lock ) {
+		ShowError("db_flat_resize: Database is locked, entries can't be moved.\n"
+				"Database allocated at %s:%d\n",
+				db->alloc_file, db->alloc_line);
+		return;
+	}
+
+	while( capacity < count*2 && capacity < 0x80000000U )
+		capacity <<= 1;
+	for( n = capacity; n > 1; n >>= 1 )
+		--shift;
+
+	CREATE(db->slots, struct db_slot, capacity);// zeroed = DB_SLOT_EMPTY
+	db->slot_mask = capacity - 1;
+	db->slot_shift = shift;
+	db->slot_used = 0;
+	for( i = 0; i < old_capacity; i++ ) {
+		if( old[i].state == DB_SLOT_USED ) {
+			uint32 j = db_flat_index(db, old[i].key);
+
+			while( db->slots[j].state != DB_SLOT_EMPTY )
+				j = (j+1)&db->slot_mask;
+			memcpy(&db->slots[j], &old[i], sizeof(struct db_slot));
+			db->slot_used++;
+		}
+	}
+	for( i = 0; i < db->spill_count; i++ ) {
+		if( db->spill[i]->state == DB_SLOT_USED ) {
+			uint32 j = db_flat_index(db, db->spill[i]->key);
+
+			while( db->slots[j].state != DB_SLOT_EMPTY )
+				j = (j+1)&db->slot_mask;
+			memcpy(&db->slots[j], db->spill[i], sizeof(struct db_slot));
+			db->slot_used++;
+		}
+		aFree(db->spill[i]);
+	}
+	db->spill_count = 0;
+	if( old )
+		aFree(old);
+}
+
+/**
+ * Makes sure there is room for one more entry, growing or cleaning the table.
+ * Does nothing while the database is locked, db_flat_insert spills the entry 
+ * if the table is full and db_free_unlock grows it later.
+ * @param db Database
+ * @private
+ */
+static void db_flat_reserve(DBMap_impl* db)
+{
+	if( db->free_lock == 0 && db->slot_used + 1 > (db->slot_mask + 1)/4*3 )
+		db_flat_resize(db, db->item_count + 1);
+}
+
+/**
+ * Shrinks the table if it's mostly empty and the database is not locked.
+ * @param db Database
+ * @private
+ */
+static void db_flat_shrink(DBMap_impl* db)
+{
+	if( db->free_lock == 0 && db->slot_mask >= DB_FLAT_MIN && db->item_count < (db->slot_mask + 1)/8 )
+		db_flat_resize(db, db->item_count);
+}
+
+/**
+ * Gets the entry of a key, adding an empty entry if it doesn't exist.
+ * Call db_flat_reserve first, the database is locked while inserting.
+ * @param db Database
+ * @param key Key (int or unsigned int)
+ * @param created Set to true if the entry was added
+ * @return Entry
+ * @private
+ */
+static struct db_slot* db_flat_insert(DBMap_impl* db, unsigned int key, bool* created)
+{
+	struct db_slot* deleted = NULL;
+	struct db_slot* slot;
+	uint32 capacity = db->slot_mask + 1;
+	uint32 i;
+
+	for( i = db_flat_index(db, key); ; i = (i+1)&db->slot_mask ) {
+		slot = &db->slots[i];
+		if( slot->state == DB_SLOT_EMPTY )
+			break;
+		if( slot->state == DB_SLOT_DELETED ) {
+			if( deleted == NULL )
+				deleted = slot;// reuse the first deleted entry of the sequence
+		} else if( slot->key == key ) {
+			*created = false;
+			return slot;
+		}
+	}
+	if( db->spill_count && (slot = db_flat_spill_find(db, key)) != NULL ) {
+		*created = false;
+		return slot;
+	}
+	if( deleted )
+		slot = deleted;
+	else if( db->slot_used + 1 > capacity - capacity/16 ) {// full and locked, entries can't move now
+		if( db->spill_count == db->spill_max ) {
+			db->spill_max = db->spill_max ? db->spill_max*2 : 16;
+			RECREATE(db->spill, struct db_slot*, db->spill_max);
+		}
+		CREATE(slot, struct db_slot, 1);
+		db->spill[db->spill_count++] = slot;
+	}
+	else
+		db->slot_used++;
+	slot->key = key;
+	slot->state = DB_SLOT_USED;
+	db->item_count++;
+	*created = true;
+	return slot;
+}
+
+/**
+ * Fetches the first entry in the database.
+ * @param self Iterator
+ * @param out_key Key of the entry
+ * @return Data of the entry
+ * @protected
+ * @see DBIterator#first
+ */
+static DBData* dbit_flat_first(DBIterator *self, DBKey* out_key)
+{
+	DBIterator_impl* it = (DBIterator_impl*)self;
+
+	DB_COUNTSTAT(dbit_first);
+	it->ht_index = -1;// before the first entry
+	return self->next(self, out_key);
+}
+
+/**
+ * Fetches the last entry in the database.
+ * @param self Iterator
+ * @param out_key Key of the entry
+ * @return Data of the entry
+ * @protected
+ * @see DBIterator#last
+ */
+static DBData* dbit_flat_last(DBIterator *self, DBKey* out_key)
+{
+	DBIterator_impl* it = (DBIterator_impl*)self;
+
+	DB_COUNTSTAT(dbit_last);
+	it->ht_index = INT_MAX;// after the last entry
+	return self->prev(self, out_key);
+}
+
+/**
+ * Fetches the next entry in the database.
+ * @param self Iterator
+ * @param out_key Key of the entry
+ * @return Data of the entry
+ * @protected
+ * @see DBIterator#next
+ */
+static DBData* dbit_flat_next(DBIterator *self, DBKey* out_key)
+{
+	DBIterator_impl* it = (DBIterator_impl*)self;
+	DBMap_impl* db = it->db;
+	int64 i;
+
+	DB_COUNTSTAT(dbit_next);
+	for( i = (int64)it->ht_index + 1; i <= (int64)db->slot_mask + db->spill_count; i++ ) {
+		struct db_slot* slot = db_flat_at(db, i);
+
+		if( slot->state == DB_SLOT_USED ) {
+			it->ht_index = (int)i;
+			if( out_key ) {
+				memset(out_key, 0, sizeof(DBKey));
+				out_key->ui = slot->key;
+			}
+			return &slot->data;
+		}
+	}
+	it->ht_index = INT_MAX;
+	return NULL;// not found
+}
+
+/**
+ * Fetches the previous entry in the database.
+ * @param self Iterator
+ * @param out_key Key of the entry
+ * @return Data of the entry
+ * @protected
+ * @see DBIterator#prev
+ */
+static DBData* dbit_flat_prev(DBIterator *self, DBKey* out_key)
+{
+	DBIterator_impl* it = (DBIterator_impl*)self;
+	DBMap_impl* db = it->db;
+	int64 i;
+
+	DB_COUNTSTAT(dbit_prev);
+	i = ( it->ht_index > (int64)db->slot_mask + db->spill_count ) ? (int64)db->slot_mask + db->spill_count : (int64)it->ht_index - 1;
+	for( ; i >= 0; i-- ) {
+		struct db_slot* slot = db_flat_at(db, i);
+
+		if( slot->state == DB_SLOT_USED ) {
+			it->ht_index = (int)i;
+			if( out_key ) {
+				memset(out_key, 0, sizeof(DBKey));
+				out_key->ui = slot->key;
+			}
+			return &slot->data;
+		}
+	}
+	it->ht_index = -1;
+	return NULL;// not found
+}
+
+/**
+ * Returns true if the fetched entry exists.
+ * @param self Iterator
+ * @return true if the entry exists
+ * @protected
+ * @see DBIterator#exists
+ */
+static bool dbit_flat_exists(DBIterator *self)
+{
+	DBIterator_impl* it = (DBIterator_impl*)self;
+	struct db_slot* slot = db_flat_at(it->db, it->ht_index);
+
+	DB_COUNTSTAT(dbit_exists);
+	return ( slot != NULL && slot->state == DB_SLOT_USED );
+}
+
+/**
+ * Removes the current entry from the database.
+ * @param self Iterator
+ * @param out_data Data of the removed entry.
+ * @return 1 if entry was removed, 0 otherwise
+ * @protected
+ * @see DBIterator#remove
+ */
+static int dbit_flat_remove(DBIterator *self, DBData *out_data)
+{
+	DBIterator_impl* it = (DBIterator_impl*)self;
+	DBMap_impl* db = it->db;
+	struct db_slot* slot;
+
+	DB_COUNTSTAT(dbit_remove);
+	if( !self->exists(self) )
+		return 0;
+	slot = db_flat_at(db, it->ht_index);
+	if( out_data )
+		memcpy(out_data, &slot->data, sizeof(DBData));
+	db->release(db_ui2key(slot->key), slot->data, DB_RELEASE_DATA);
+	slot->state = DB_SLOT_DELETED;
+	db->item_count--;
+	return 1;
+}
+
+/**
+ * Returns a new iterator for this database.
+ * The iterator keeps the database locked until it is destroyed, entries 
+ * don't move while it's locked.
+ * @param self Database
+ * @return New iterator
+ * @protected
+ * @see DBMap#iterator
+ */
+static DBIterator *db_flat_iterator(DBMap *self)
+{
+	DBMap_impl* db = (DBMap_impl*)self;
+	DBIterator_impl* it;
+
+	DB_COUNTSTAT(db_iterator);
+	CREATE(it, struct DBIterator_impl, 1);
+	/* Interface of the iterator */
+	it->vtable.first   = dbit_flat_first;
+	it->vtable.last    = dbit_flat_last;
+	it->vtable.next    = dbit_flat_next;
+	it->vtable.prev    = dbit_flat_prev;
+	it->vtable.exists  = dbit_flat_exists;
+	it->vtable.remove  = dbit_flat_remove;
+	it->vtable.destroy = dbit_obj_destroy;
+	/* Initial state (before the first entry) */
+	it->db = db;
+	it->ht_index = -1;
+	it->node = NULL;
+	/* Lock the database */
+	db_free_lock(db);
+	return &it->vtable;
+}
+
+/**
+ * Returns true if the entry exists.
+ * @param self Interface of the database
+ * @param key Key that identifies the entry
+ * @return true is the entry exists
+ * @protected
+ * @see DBMap#exists
+ */
+static bool db_flat_exists(DBMap *self, DBKey key)
+{
+	DBMap_impl* db = (DBMap_impl*)self;
+
+	DB_COUNTSTAT(db_exists);
+	if (db == NULL) return false; // nullpo candidate
+
+	return ( db_flat_find(db, key.ui) != NULL );
+}
+
+/**
+ * Get the data of the entry identified by the key.
+ * @param self Interface of the database
+ * @param key Key that identifies the entry
+ * @return Data of the entry or NULL if not found
+ * @protected
+ * @see DBMap#get
+ */
+static DBData* db_flat_get(DBMap *self, DBKey key)
+{
+	DBMap_impl* db = (DBMap_impl*)self;
+	struct db_slot* slot;
+
+	DB_COUNTSTAT(db_get);
+	if (db == NULL) return NULL; // nullpo candidate
+
+	slot = db_flat_find(db, key.ui);
+	return slot ? &slot->data : NULL;
+}
+
+/**
+ * Get the data of the entries matched by <code>match</code>.
+ * @param self Interface of the database
+ * @param buf Buffer to put the data of the matched entries
+ * @param max Maximum number of data entries to be put into buf
+ * @param match Function that matches the database entries
+ * @param args Extra arguments for match
+ * @return The number of entries that matched
+ * @protected
+ * @see DBMap#vgetall
+ */
+static unsigned int db_flat_vgetall(DBMap *self, DBData **buf, unsigned int max, DBMatcher match, va_list args)
+{
+	DBMap_impl* db = (DBMap_impl*)self;
+	unsigned int ret = 0;
+	uint32 i;
+
+	DB_COUNTSTAT(db_vgetall);
+	if (db == NULL) return 0; // nullpo candidate
+	if (match == NULL) return 0; // nullpo candidate
+
+	db_free_lock(db);
+	for (i = 0; i <= db->slot_mask + db->spill_count; i++) {
+		struct db_slot* slot = db_flat_at(db, i);
+
+		if (slot->state == DB_SLOT_USED) {
+			va_list argscopy;
+			va_copy(argscopy, args);
+			if (match(db_ui2key(slot->key), slot->data, argscopy) == 0) {
+				if (buf && ret < max)
+					buf[ret] = &slot->data;
+				ret++;
+			}
+			va_end(argscopy);
+		}
+	}
+	db_free_unlock(db);
+	return ret;
+}
+
+/**
+ * Get the data of the entry identified by the key.
+ * If the entry does not exist, an entry is added with the data returned by 
+ * <code>create</code>.
+ * @param self Interface of the database
+ * @param key Key that identifies the entry
+ * @param create Function used to create the data if the entry doesn't exist
+ * @param args Extra arguments for create
+ * @return Data of the entry
+ * @protected
+ * @see DBMap#vensure
+ */
+static DBData* db_flat_vensure(DBMap *self, DBKey key, DBCreateData create, va_list args)
+{
+	DBMap_impl* db = (DBMap_impl*)self;
+	struct db_slot* slot;
+	va_list argscopy;
+	DBData data;
+	bool created;
+
+	DB_COUNTSTAT(db_vensure);
+	if (db == NULL) return NULL; // nullpo candidate
+	if (create == NULL) {
+		ShowError("db_ensure: Create function is NULL for db allocated at %s:%d\n",db->alloc_file, db->alloc_line);
+		return NULL; // nullpo candidate
+	}
+
+	if ((slot = db_flat_find(db, key.ui)) != NULL)
+		return &slot->data;
+	if (db->item_count == UINT32_MAX) {
+		ShowError("db_vensure: item_count overflow, aborting item insertion.\n"
+				"Database allocated at %s:%d",
+				db->alloc_file, db->alloc_line);
+		return NULL;
+	}
+
+	// create the data before inserting, in case create uses this database
+	va_copy(argscopy, args);
+	data = create(key, argscopy);
+	va_end(argscopy);
+	db_flat_reserve(db);
+	db_free_lock(db);
+	slot = db_flat_insert(db, key.ui, &created);
+	if (created) {
+		DB_COUNTSTAT(db_node_alloc);
+		slot->data = data;
+	}
+	db_free_unlock(db);
+	return &slot->data;
+}
+
+/**
+ * Put the data identified by the key in the database.
+ * Puts the previous data in out_data, if out_data is not NULL.
+ * @param self Interface of the database
+ * @param key Key that identifies the data
+ * @param data Data to be put in the database
+ * @param out_data Previous data if the entry exists
+ * @return 1 if if the entry already exists, 0 otherwise
+ * @protected
+ * @see DBMap#put
+ */
+static int db_flat_put(DBMap *self, DBKey key, DBData data, DBData *out_data)
+{
+	DBMap_impl* db = (DBMap_impl*)self;
+	struct db_slot* slot;
+	bool created;
+	int retval = 0;
+
+	DB_COUNTSTAT(db_put);
+	if (db == NULL) return 0; // nullpo candidate
+	if (db->global_lock) {
+		ShowError("db_put: Database is being destroyed, aborting entry insertion.\n"
+				"Database allocated at %s:%d\n",
+				db->alloc_file, db->alloc_line);
+		return 0; // nullpo candidate
+	}
+	if (!(db->options&DB_OPT_ALLOW_NULL_DATA) && (data.type == DB_DATA_PTR && data.u.ptr == NULL)) {
+		ShowError("db_put: Attempted to use non-allowed NULL data for db allocated at %s:%d\n",db->alloc_file, db->alloc_line);
+		return 0; // nullpo candidate
+	}
+	if (db->item_count == UINT32_MAX) {
+		ShowError("db_put: item_count overflow, aborting item insertion.\n"
+				"Database allocated at %s:%d",
+				db->alloc_file, db->alloc_line);
+		return 0;
+	}
+
+	db_flat_reserve(db);
+	db_free_lock(db);
+	slot = db_flat_insert(db, key.ui, &created);
+	if (created) {
+		DB_COUNTSTAT(db_node_alloc);
+	} else { // equal entry, replace
+		db->release(db_ui2key(slot->key), slot->data, DB_RELEASE_BOTH);
+		if (out_data)
+			memcpy(out_data, &slot->data, sizeof(*out_data));
+		retval = 1;
+	}
+	slot->data = data;
+	db_free_unlock(db);
+	return retval;
+}
+
+/**
+ * Remove an entry from the database.
+ * Puts the previous data in out_data, if out_data is not NULL.
+ * @param self Interface of the database
+ * @param key Key that identifies the entry
+ * @param out_data Previous data if the entry exists
+ * @return 1 if if the entry already exists, 0 otherwise
+ * @protected
+ * @see DBMap#remove
+ */
+static int db_flat_remove(DBMap *self, DBKey key, DBData *out_data)
+{
+	DBMap_impl* db = (DBMap_impl*)self;
+	struct db_slot* slot;
+
+	DB_COUNTSTAT(db_remove);
+	if (db == NULL) return 0; // nullpo candidate
+	if (db->global_lock) {
+		ShowError("db_remove: Database is being destroyed. Aborting entry deletion.\n"
+				"Database allocated at %s:%d\n",
+				db->alloc_file, db->alloc_line);
+		return 0; // nullpo candidate
+	}
+
+	if ((slot = db_flat_find(db, key.ui)) == NULL)
+		return 0;
+	DB_COUNTSTAT(db_node_free);
+	if (out_data)
+		memcpy(out_data, &slot->data, sizeof(*out_data));
+	db_free_lock(db);
+	db->release(db_ui2key(slot->key), slot->data, DB_RELEASE_DATA);
+	slot->state = DB_SLOT_DELETED;
+	db->item_count--;
+	db_free_unlock(db);
+	db_flat_shrink(db);
+	return 1;
+}
+
+/**
+ * Apply <code>func</code> to every entry in the database.
+ * Returns the sum of values returned by func.
+ * @param self Interface of the database
+ * @param func Function to be applied
+ * @param args Extra arguments for func
+ * @return Sum of the values returned by func
+ * @protected
+ * @see DBMap#vforeach
+ */
+static int db_flat_vforeach(DBMap *self, DBApply func, va_list args)
+{
+	DBMap_impl* db = (DBMap_impl*)self;
+	int sum = 0;
+	uint32 i;
+
+	DB_COUNTSTAT(db_vforeach);
+	if (db == NULL) return 0; // nullpo candidate
+	if (func == NULL) {
+		ShowError("db_foreach: Passed function is NULL for db allocated at %s:%d\n",db->alloc_file, db->alloc_line);
+		return 0; // nullpo candidate
+	}
+
+	db_free_lock(db);
+	for (i = 0; i <= db->slot_mask + db->spill_count; i++) {
+		struct db_slot* slot = db_flat_at(db, i);
+
+		if (slot->state == DB_SLOT_USED) {
+			va_list argscopy;
+			va_copy(argscopy, args);
+			sum += func(db_ui2key(slot->key), &slot->data, argscopy);
+			va_end(argscopy);
+		}
+	}
+	db_free_unlock(db);
+	db_flat_shrink(db);
+	return sum;
+}
+
+/**
+ * Removes all entries from the database.
+ * Before deleting an entry, func is applied to it.
+ * Releases the key and the data.
+ * Returns the sum of values returned by func, if it exists.
+ * @param self Interface of the database
+ * @param func Function to be applied to every entry before deleting
+ * @param args Extra arguments for func
+ * @return Sum of values returned by func
+ * @protected
+ * @see DBMap#vclear
+ */
+static int db_flat_vclear(DBMap *self, DBApply func, va_list args)
+{
+	DBMap_impl* db = (DBMap_impl*)self;
+	int sum = 0;
+	uint32 i;
+
+	DB_COUNTSTAT(db_vclear);
+	if (db == NULL) return 0; // nullpo candidate
+
+	db_free_lock(db);
+	for (i = 0; i <= db->slot_mask + db->spill_count; i++) {
+		struct db_slot* slot = db_flat_at(db, i);
+
+		if (slot->state == DB_SLOT_USED) {
+			if (func) {
+				va_list argscopy;
+				va_copy(argscopy, args);
+				sum += func(db_ui2key(slot->key), &slot->data, argscopy);
+				va_end(argscopy);
+			}
+			// func might have removed the entry (entries don't move while locked)
+			if (slot->state == DB_SLOT_USED) {
+				db->release(db_ui2key(slot->key), slot->data, DB_RELEASE_BOTH);
+				slot->state = DB_SLOT_DELETED;
+				db->item_count--;
+				DB_COUNTSTAT(db_node_free);
+			}
+		}
+	}
+	if (db->item_count == 0) { // everything is deleted, no probe sequences left
+		memset(db->slots, 0, (db->slot_mask + 1)*sizeof(struct db_slot));
+		db->slot_used = 0;
+	}
+	db_free_unlock(db);
+	db_flat_shrink(db);
+	return sum;
+}
+
+/**
+ * Finalize the database, feeing all the memory it uses.
+ * Before deleting an entry, func is applied to it.
+ * Returns the sum of values returned by func, if it exists.
+ * @param self Interface of the database
+ * @param func Function to be applied to every entry before deleting
+ * @param args Extra arguments for func
+ * @return Sum of values returned by func
+ * @protected
+ * @see DBMap#vdestroy
+ */
+static int db_flat_vdestroy(DBMap *self, DBApply func, va_list args)
+{
+	DBMap_impl* db = (DBMap_impl*)self;
+	int sum;
+
+	DB_COUNTSTAT(db_vdestroy);
+	if (db == NULL) return 0; // nullpo candidate
+	if (db->global_lock) {
+		ShowError("db_vdestroy: Database is already locked for destruction. Aborting second database destruction.\n"
+				"Database allocated at %s:%d\n",
+				db->alloc_file, db->alloc_line);
+		return 0;
+	}
+	if (db->free_lock)
+		ShowWarning("db_vdestroy: Database is still in use, %u lock(s) left. Continuing database destruction.\n"
+				"Database allocated at %s:%d\n",
+				db->free_lock, db->alloc_file, db->alloc_line);
+
+#ifdef DB_ENABLE_STATS
+	switch (db->type) {
+		case DB_INT: DB_COUNTSTAT(db_int_destroy); break;
+		case DB_UINT: DB_COUNTSTAT(db_uint_destroy); break;
+	}
+#endif /* DB_ENABLE_STATS */
+	db_free_lock(db);
+	db->global_lock = 1;
+	sum = self->vclear(self, func, args);
+	while (db->spill_count)
+		aFree(db->spill[--db->spill_count]);
+	if (db->spill)
+		aFree(db->spill);
+	db->spill = NULL;
+	aFree(db->slots);
+	db->slots = NULL;
+	db_free_unlock(db);
+	aFree(db);
+	return sum;
+}
+
 /*****************************************************************************\
  *  (5) Section with public functions.
  *  db_fix_options     - Apply database type restrictions to the options.
@@ -2256,6 +3082,7 @@ static DBOptions db_obj_options(DBMap *self)
  * Returns the fixed options according to the database type.
  * Sets required options and unsets unsupported options.
  * For numeric databases DB_OPT_DUP_KEY and DB_OPT_RELEASE_KEY are unset.
+ * For string databases DB_OPT_FLAT is unset.
  * @param type Type of the database
  * @param options Original options of the database
  * @return Fixed options of the database
@@ -2274,8 +3101,8 @@ DBOptions db_fix_options(DBType type, DBOptions options)
 		default:
 			ShowError("db_fix_options: Unknown database type %u with options %x\n", type, options);
 		case DB_STRING:
-		case DB_ISTRING: // String databases, no fix required
-			return options;
+		case DB_ISTRING: // String databases, no open-addressing tables
+			return (DBOptions)(options&~DB_OPT_FLAT);
 	}
 }
 
@@ -2432,6 +3259,18 @@ DBMap *db_alloc(const char *file, int line, DBType type, DBOptions options, unsi
 	db->vtable.size     = db_obj_size;
 	db->vtable.type     = db_obj_type;
 	db->vtable.options  = db_obj_options;
+	if (options&DB_OPT_FLAT) { // Open-addressing table
+		db->vtable.iterator = db_flat_iterator;
+		db->vtable.exists   = db_flat_exists;
+		db->vtable.get      = db_flat_get;
+		db->vtable.vgetall  = db_flat_vgetall;
+		db->vtable.vensure  = db_flat_vensure;
+		db->vtable.put      = db_flat_put;
+		db->vtable.remove   = db_flat_remove;
+		db->vtable.vforeach = db_flat_vforeach;
+		db->vtable.vclear   = db_flat_vclear;
+		db->vtable.vdestroy = db_flat_vdestroy;
+	}
 	/* File and line of allocation */
 	db->alloc_file = file;
 	db->alloc_line = line;
@@ -2441,12 +3280,21 @@ DBMap *db_alloc(const char *file, int line, DBType type, DBOptions options, unsi
 	db->free_max = 0;
 	db->free_lock = 0;
 	/* Other */
-	db->nodes = ers_new(sizeof(struct dbn),"db.c::db_alloc",ERS_OPT_NONE);
+	db->nodes = (options&DB_OPT_FLAT) ? NULL : ers_new(sizeof(struct dbn),"db.c::db_alloc",ERS_OPT_NONE);
 	db->cmp = db_default_cmp(type);
 	db->hash = db_default_hash(type);
 	db->release = db_default_release(type, options);
 	for (i = 0; i < HASH_SIZE; i++)
 		db->ht[i] = NULL;
+	db->slots = NULL;
+	db->slot_mask = 0;
+	db->slot_used = 0;
+	db->slot_shift = 0;
+	db->spill = NULL;
+	db->spill_count = 0;
+	db->spill_max = 0;
+	if (options&DB_OPT_FLAT)
+		db_flat_resize(db, 0);
 	db->cache = NULL;
 	db->type = type;
 	db->options = options;
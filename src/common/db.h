@@ -115,6 +115,12 @@ typedef enum DBType {
  * @param DB_OPT_RELEASE_BOTH Releases both key and data.
  * @param DB_OPT_ALLOW_NULL_KEY Allow NULL keys in the database.
  * @param DB_OPT_ALLOW_NULL_DATA Allow NULL data in the database.
+ * @param DB_OPT_FLAT Keeps the entries in a resizable open-addressing table 
+ *          instead of the hashtable of RED-BLACK trees (DB_INT and DB_UINT 
+ *          databases only). Faster lookups for big databases, but iteration 
+ *          order is arbitrary.
+ *          WARNING: the data pointers returned by the database (get, ensure, 
+ *          iterators...) are only valid until the next entry is added.
  * @public
  * @see #db_fix_options(DBType,DBOptions)
  * @see #db_default_release(DBType,DBOptions)
@@ -128,6 +134,7 @@ typedef enum DBOptions {
 	DB_OPT_RELEASE_BOTH    = 6,
 	DB_OPT_ALLOW_NULL_KEY  = 8,
 	DB_OPT_ALLOW_NULL_DATA = 16,
+	DB_OPT_FLAT            = 32,
 } DBOptions;
 
 /**
@@ -696,6 +703,7 @@ struct DBMap {
  * Returns the fixed options according to the database type.
  * Sets required options and unsets unsupported options.
  * For numeric databases DB_OPT_DUP_KEY and DB_OPT_RELEASE_KEY are unset.
+ * For string databases DB_OPT_FLAT is unset.
  * @param type Type of the database
  * @param options Original options of the database
  * @return Fixed options of the database
@@ -25,7 +25,8 @@
  *  <H2>Disavantages:</H2>                                                   *
  *  - Unused entries are almost inevitable - memory being wasted.            *
  *  - A  manager will only auto-destroy when all of its instances are        *
- *    destroyed so memory will usually only be recovered near the end.       *
+ *    destroyed. Until then, only blocks whose entries have all been free    *
+ *    for a while are released (see ers_reclaim).                            *
  *  - Always wastes space for entries smaller than a pointer.                *
  *                                                                           *
  *  WARNING: The system is not thread-safe at the moment.                    *
@@ -44,18 +45,48 @@
 #include "../common/cbasetypes.h"
 #include "../common/malloc.h" // CREATE, RECREATE, aMalloc, aFree
 #include "../common/showmsg.h" // ShowMessage, ShowError, ShowFatalError, CL_BOLD, CL_NORMAL
+#include "../common/timer.h" // gettick, add_timer_interval
 #include "ers.h"
 
 #ifndef DISABLE_ERS
 
 #define ERS_ROOT_SIZE 256
 #define ERS_BLOCK_ENTRIES 4096
+#define ERS_RECLAIM_INTERVAL 60000 // how often empty blocks are checked (ms)
+#define ERS_RECLAIM_DELAY 300000 // how long a block must stay empty before it's released (ms)
+
+struct ers_block;
 
 struct ers_list
 {
-	struct ers_list *Next;
+	union {
+		struct ers_list *Next; // free entry: next free entry of the block
+		struct ers_block *Block; // entry in use: block it belongs to
+	} u;
+};
+
+// A block of ERS_BLOCK_ENTRIES entries, followed by the entries.
+// Each block keeps its own free entries, so a block whose entries are all
+// free can be released.
+struct ers_block
+{
+	struct ers_block *Next, *Prev;
+
+	// Freed entries of this block
+	struct ers_list *ReuseList;
+
+	// Entries never handed out, at the end of the block
+	unsigned int Fresh;
+
+	// Entries in use
+	unsigned int Used;
+
+	// When the block became empty
+	unsigned int EmptyTick;
 };
 
+typedef struct ers_instance ers_instance_t;
+
 typedef struct ers_cache
 {
 	// Allocated object size, including ers_list size
@@ -64,26 +95,29 @@ typedef struct ers_cache
 	// Number of ers_instances referencing this
 	int ReferenceCount;
 
-	// Reuse linked list
-	struct ers_list *ReuseList;
+	// Instances referencing this
+	ers_instance_t *Instances;
 
-	// Memory blocks array
-	unsigned char **Blocks;
+	// Blocks with used and free entries, full blocks and empty blocks (most recently emptied first)
+	struct ers_block *Partial, *Full, *Empty;
 
-	// Max number of blocks 
-	unsigned int Max;
+	// Number of blocks, and the most there ever were
+	unsigned int Blocks, PeakBlocks;
 
-	// Free objects count
-	unsigned int Free;
-	
-	// Used objects count
-	unsigned int Used;
+	// Number of empty blocks
+	unsigned int EmptyBlocks;
+
+	// Blocks released after being empty for ERS_RECLAIM_DELAY
+	unsigned int Reclaimed;
+
+	// Used objects count, and the most there ever were
+	unsigned int Used, PeakUsed;
 
 	// Linked list
 	struct ers_cache *Next, *Prev;
 } ers_cache_t;
 
-typedef struct
+struct ers_instance
 {
 	// Interface to ERS
 	struct eri VTable;
@@ -99,12 +133,44 @@ typedef struct
 
 	// Count of objects in use, used for detecting memory leaks
 	unsigned int Count;
-} ers_instance_t;
+
+	// The most objects ever in use
+	unsigned int Peak;
+
+	// Instances of the same cache
+	ers_instance_t *Next;
+};
 
 
 // Array containing a pointer for all ers_cache structures
 static ers_cache_t *CacheList;
 
+/// Size of a block of the cache, in bytes.
+#define ers_block_size(cache) ( sizeof(struct ers_block) + (size_t)(cache)->ObjectSize*ERS_BLOCK_ENTRIES )
+
+/// Entry of a block.
+#define ers_block_entry(cache,block,i) ( (struct ers_list *)((unsigned char *)((block) + 1) + (size_t)(i)*(cache)->ObjectSize) )
+
+static void ers_block_link(struct ers_block **list, struct ers_block *block)
+{
+	block->Prev = NULL;
+	block->Next = *list;
+	if (*list)
+		(*list)->Prev = block;
+	*list = block;
+}
+
+static void ers_block_unlink(struct ers_block **list, struct ers_block *block)
+{
+	if (block->Next)
+		block->Next->Prev = block->Prev;
+	if (block->Prev)
+		block->Prev->Next = block->Next;
+	else
+		*list = block->Next;
+	block->Next = block->Prev = NULL;
+}
+
 static ers_cache_t *ers_find_cache(unsigned int size)
 {
 	ers_cache_t *cache;
@@ -116,11 +182,12 @@ static ers_cache_t *ers_find_cache(unsigned int size)
 	CREATE(cache, ers_cache_t, 1);
 	cache->ObjectSize = size;
 	cache->ReferenceCount = 0;
-	cache->ReuseList = NULL;
-	cache->Blocks = NULL;
-	cache->Free = 0;
-	cache->Used = 0;
-	cache->Max = 0;
+	cache->Instances = NULL;
+	cache->Partial = cache->Full = cache->Empty = NULL;
+	cache->Blocks = cache->PeakBlocks = 0;
+	cache->EmptyBlocks = 0;
+	cache->Reclaimed = 0;
+	cache->Used = cache->PeakUsed = 0;
 	
 	if (CacheList == NULL)
 	{
@@ -137,12 +204,21 @@ static ers_cache_t *ers_find_cache(unsigned int size)
 	return cache;
 }
 
-static void ers_free_cache(ers_cache_t *cache, bool remove)
+static void ers_free_blocks(struct ers_block *block)
 {
-	unsigned int i;
+	while (block) {
+		struct ers_block *next = block->Next;
 
-	for (i = 0; i < cache->Used; i++)
-		aFree(cache->Blocks[i]);
+		aFree(block);
+		block = next;
+	}
+}
+
+static void ers_free_cache(ers_cache_t *cache, bool remove)
+{
+	ers_free_blocks(cache->Partial);
+	ers_free_blocks(cache->Full);
+	ers_free_blocks(cache->Empty);
 
 	if (cache->Next)
 		cache->Next->Prev = cache->Prev;
@@ -152,14 +228,15 @@ static void ers_free_cache(ers_cache_t *cache, bool remove)
 	else
 		CacheList = cache->Next;
 
-	aFree(cache->Blocks);
 	aFree(cache);
 }
 
 static void *ers_obj_alloc_entry(ERS self)
 {
 	ers_instance_t *instance = (ers_instance_t *)self;
-	void *ret;
+	ers_cache_t *cache;
+	struct ers_block *block;
+	struct ers_list *entry;
 
 	if (instance == NULL) 
 	{
@@ -167,40 +244,55 @@ static void *ers_obj_alloc_entry(ERS self)
 		return NULL;
 	}
 
-	if (instance->Cache->ReuseList != NULL)
-	{
-		ret = (void *)((unsigned char *)instance->Cache->ReuseList + sizeof(struct ers_list));
-		instance->Cache->ReuseList = instance->Cache->ReuseList->Next;
-	} 
-	else if (instance->Cache->Free > 0) 
-	{
-		instance->Cache->Free--;
-		ret = &instance->Cache->Blocks[instance->Cache->Used - 1][instance->Cache->Free * instance->Cache->ObjectSize + sizeof(struct ers_list)];
-	} 
-	else 
+	cache = instance->Cache;
+	if ((block = cache->Partial) == NULL)
 	{
-		if (instance->Cache->Used == instance->Cache->Max) 
+		if ((block = cache->Empty) != NULL)
+		{// reuse the most recently emptied block
+			ers_block_unlink(&cache->Empty, block);
+			cache->EmptyBlocks--;
+		}
+		else
 		{
-			instance->Cache->Max = (instance->Cache->Max * 4) + 3;
-			RECREATE(instance->Cache->Blocks, unsigned char *, instance->Cache->Max);
+			block = (struct ers_block *)aMalloc(ers_block_size(cache));
+			block->ReuseList = NULL;
+			block->Fresh = ERS_BLOCK_ENTRIES;
+			block->Used = 0;
+			if (++cache->Blocks > cache->PeakBlocks)
+				cache->PeakBlocks = cache->Blocks;
 		}
+		ers_block_link(&cache->Partial, block);
+	}
 
-		CREATE(instance->Cache->Blocks[instance->Cache->Used], unsigned char, instance->Cache->ObjectSize * ERS_BLOCK_ENTRIES);
-		instance->Cache->Used++;
+	if (block->ReuseList != NULL)
+	{
+		entry = block->ReuseList;
+		block->ReuseList = entry->u.Next;
+	}
+	else
+		entry = ers_block_entry(cache, block, ERS_BLOCK_ENTRIES - block->Fresh--);
 
-		instance->Cache->Free = ERS_BLOCK_ENTRIES -1;
-		ret = &instance->Cache->Blocks[instance->Cache->Used - 1][instance->Cache->Free * instance->Cache->ObjectSize + sizeof(struct ers_list)];
+	if (++block->Used == ERS_BLOCK_ENTRIES)
+	{
+		ers_block_unlink(&cache->Partial, block);
+		ers_block_link(&cache->Full, block);
 	}
+	entry->u.Block = block;
 
-	instance->Count++;
+	if (++cache->Used > cache->PeakUsed)
+		cache->PeakUsed = cache->Used;
+	if (++instance->Count > instance->Peak)
+		instance->Peak = instance->Count;
 
-	return ret;
+	return (unsigned char *)entry + sizeof(struct ers_list);
 }
 
 static void ers_obj_free_entry(ERS self, void *entry)
 {
 	ers_instance_t *instance = (ers_instance_t *)self;
 	struct ers_list *reuse = (struct ers_list *)((unsigned char *)entry - sizeof(struct ers_list));
+	struct ers_block *block;
+	ers_cache_t *cache;
 
 	if (instance == NULL) 
 	{
@@ -213,8 +305,28 @@ static void ers_obj_free_entry(ERS self, void *entry)
 		return;
 	}
 
-	reuse->Next = instance->Cache->ReuseList;
-	instance->Cache->ReuseList = reuse;
+	cache = instance->Cache;
+	block = reuse->u.Block;
+	if (block->Used-- == ERS_BLOCK_ENTRIES)
+	{
+		ers_block_unlink(&cache->Full, block);
+		ers_block_link(&cache->Partial, block);
+	}
+	if (block->Used == 0)
+	{// all free, release it if it stays like that
+		ers_block_unlink(&cache->Partial, block);
+		ers_block_link(&cache->Empty, block);
+		block->EmptyTick = gettick();
+		block->ReuseList = NULL;
+		block->Fresh = ERS_BLOCK_ENTRIES;
+		cache->EmptyBlocks++;
+	}
+	else
+	{
+		reuse->u.Next = block->ReuseList;
+		block->ReuseList = reuse;
+	}
+	cache->Used--;
 	instance->Count--;
 }
 
@@ -234,6 +346,7 @@ static size_t ers_obj_entry_size(ERS self)
 static void ers_obj_destroy(ERS self)
 {
 	ers_instance_t *instance = (ers_instance_t *)self;
+	ers_instance_t **prev;
 
 	if (instance == NULL) 
 	{
@@ -245,6 +358,15 @@ static void ers_obj_destroy(ERS self)
 		if (!(instance->Options & ERS_OPT_CLEAR))
 			ShowWarning("Memory leak detected at ERS '%s', %d objects not freed.\n", instance->Name, instance->Count);
 
+	for (prev = &instance->Cache->Instances; *prev; prev = &(*prev)->Next)
+	{
+		if (*prev == instance)
+		{
+			*prev = instance->Next;
+			break;
+		}
+	}
+
 	if (--instance->Cache->ReferenceCount <= 0)
 		ers_free_cache(instance->Cache, true);
 
@@ -270,32 +392,84 @@ ERS ers_new(uint32 size, char *name, enum ERSOptions options)
 
 	instance->Cache = ers_find_cache(size);
 	instance->Cache->ReferenceCount++;
+	instance->Next = instance->Cache->Instances;
+	instance->Cache->Instances = instance;
 
 	instance->Count = 0;
+	instance->Peak = 0;
 
 	return &instance->VTable;
 }
 
+void ers_reclaim(unsigned int tick)
+{
+	ers_cache_t *cache;
+
+	for (cache = CacheList; cache; cache = cache->Next) {
+		struct ers_block *block = cache->Empty;
+
+		if (block == NULL)
+			continue;
+		// keep the most recently emptied block, release the others from the oldest
+		while (block->Next)
+			block = block->Next;
+		while (block != cache->Empty && DIFF_TICK(tick, block->EmptyTick) >= ERS_RECLAIM_DELAY) {
+			struct ers_block *prev = block->Prev;
+
+			ers_block_unlink(&cache->Empty, block);
+			aFree(block);
+			cache->EmptyBlocks--;
+			cache->Blocks--;
+			cache->Reclaimed++;
+			block = prev;
+		}
+	}
+}
+
+static int ers_reclaim_timer(int tid, unsigned int tick, int id, intptr_t data)
+{
+	ers_reclaim(tick);
+	return 0;
+}
+
+void ers_init(void)
+{
+	add_timer_func_list(ers_reclaim_timer, "ers_reclaim_timer");
+	add_timer_interval(gettick() + ERS_RECLAIM_INTERVAL, ers_reclaim_timer, 0, 0, ERS_RECLAIM_INTERVAL);
+}
+
 void ers_report(void)
 {
 	ers_cache_t *cache;
 	int i = 0;
+	size_t total = 0;
+
 	for (cache = CacheList; cache; cache = cache->Next) {
+		ers_instance_t *instance;
+		size_t bytes = cache->Blocks*ers_block_size(cache);
+
+		total += bytes;
 		ShowMessage(CL_BOLD"[Entry manager #%u report]\n"CL_NORMAL, ++i);
 		ShowMessage("\tinstances          : %u\n", cache->ReferenceCount);
-		ShowMessage("\tblock array size   : %u\n", cache->ObjectSize);
-		ShowMessage("\tallocated blocks   : %u\n", cache->Free+cache->Used);
-		ShowMessage("\tentries being used : %u\n", cache->Used);
-		ShowMessage("\tunused entries     : %u\n", cache->Free);
+		ShowMessage("\tentry size         : %u\n", cache->ObjectSize);
+		ShowMessage("\tallocated blocks   : %u (%u empty, peak %u, %u released)\n", cache->Blocks, cache->EmptyBlocks, cache->PeakBlocks, cache->Reclaimed);
+		ShowMessage("\tallocated bytes    : %lu\n", (unsigned long)bytes);
+		ShowMessage("\tentries being used : %u (peak %u)\n", cache->Used, cache->PeakUsed);
+		ShowMessage("\tunused entries     : %u\n", cache->Blocks*ERS_BLOCK_ENTRIES - cache->Used);
+		for (instance = cache->Instances; instance; instance = instance->Next)
+			ShowMessage("\t  %-40s : %u used (peak %u)\n", instance->Name, instance->Count, instance->Peak);
 	}
+	ShowMessage(CL_BOLD"[Entry managers]"CL_NORMAL" %lu bytes allocated in total\n", (unsigned long)total);
 }
 
 void ers_force_destroy_all(void)
 {
-	ers_cache_t *cache;
+	ers_cache_t *cache, *next;
 	
-	for (cache = CacheList; cache; cache = cache->Next)
-			ers_free_cache(cache, false);
+	for (cache = CacheList; cache; cache = next) {
+		next = cache->Next;
+		ers_free_cache(cache, false);
+	}
 }
 
 #endif
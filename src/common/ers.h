@@ -48,6 +48,8 @@
  *  ERS_ALIGNED           - Alignment of the entries in the blocks.          *
  *  ERS                   - Entry manager.                                   *
  *  ers_new               - Allocate an instance of an entry manager.        *
+ *  ers_init              - Start releasing blocks that stay empty.          *
+ *  ers_reclaim           - Release the blocks that stayed empty.            *
  *  ers_report            - Print a report about the current state.          *
  *  ers_force_destroy_all - Force the destruction of all the managers.       *
 \*****************************************************************************/
@@ -127,6 +129,8 @@ typedef struct eri {
 #	define ers_destroy(obj)
 // Disable the public functions
 #	define ers_new(size,name,options) NULL
+#	define ers_init()
+#	define ers_reclaim(tick)
 #	define ers_report()
 #	define ers_force_destroy_all()
 #else /* not DISABLE_ERS */
@@ -149,12 +153,23 @@ typedef struct eri {
  */
 ERS ers_new(uint32 size, char *name, enum ERSOptions options);
 
+/**
+ * Adds the timer that calls ers_reclaim periodically.
+ * Requires the timer system.
+ */
+void ers_init(void);
+
+/**
+ * Releases the blocks of entries that have been completely unused for a while 
+ * (except the most recently emptied block of each manager).
+ * @param tick Current tick
+ */
+void ers_reclaim(unsigned int tick);
+
 /**
  * Print a report about the current state of the Entry Reusage System.
- * Shows information about the global system and each entry manager.
- * The number of entries are checked and a warning is shown if extra reusable 
- * entries are found.
- * The extra entries are included in the count of reusable entries.
+ * Shows the allocated blocks and bytes, used and unused entries of each entry 
+ * manager, with their high-water marks, and the entries used by each instance.
  */
 void ers_report(void);
 
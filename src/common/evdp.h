@@ -35,6 +35,16 @@ void evdp_init();
 void evdp_final();
 
 
+/**
+ * Returns the descriptor of the event dispatcher.
+ *
+ * @note:
+ *	It becomes readable when there are events to report, so the dispatcher
+ *	can be waited on by another event loop (see the io_uring backend of the socket layer).
+ */
+int32 evdp_getfd();
+
+
 /**
  * Will Wait for events.
  *
@@ -48,7 +58,7 @@ void evdp_final();
  *	Upon successfull call (changed connections) this function will write the connection
  *	Identifier & event  to the out_fds array. 
  *
- * @return 	0 -> Timeout, 	> 0 no of changed connections.
+ * @return 	0 -> Timeout (or interrupted by a signal), 	> 0 no of changed connections.
  */
 int32 evdp_wait(EVDP_EVENT *out_fds,	int32 max_events, 	int32 timeout_ticks);
 
@@ -88,6 +98,8 @@ bool evdp_addlistener(int32 fd, EVDP_DATA *ep);
  * @note:
  * 
  * MONITORS by default:	IN, HUP
+ *	Client connections are edge triggered as well, a new event is only reported
+ *	after the connection has been read until recv would block.
  *
  * @return success indicator.
  */
@@ -8,6 +8,8 @@
 //
 //
 
+#ifdef __linux__
+
 #include <stdio.h>
 #include <errno.h>
 #include <string.h>
@@ -23,7 +25,7 @@
 #include "../common/evdp.h"
 
 
-#define EPOLL_MAX_PER_CYCLE 10	// Max Events to coalesc. per cycle. 
+#define EPOLL_MAX_PER_CYCLE 1024	// Max Events to coalesc. per cycle. 
 
 
 static int epoll_fd = -1;
@@ -50,8 +52,15 @@ void evdp_final(){
 }//end: evdp_final()
 
 
+int32 evdp_getfd(){
+	
+	return epoll_fd;
+	
+}//end: evdp_getfd()
+
+
 int32 evdp_wait(EVDP_EVENT *out_fds, int32 max_events, int32 timeout_ticks){
-	struct epoll_event l_events[EPOLL_MAX_PER_CYCLE];
+	static struct epoll_event l_events[EPOLL_MAX_PER_CYCLE];
 	register struct epoll_event *ev;
 	register int nfds, n;
 	
@@ -61,6 +70,8 @@ int32 evdp_wait(EVDP_EVENT *out_fds, int32 max_events, int32 timeout_ticks){
 	nfds = epoll_wait( epoll_fd,  l_events,		max_events,		timeout_ticks);
 	if(nfds == -1){
 		// @TODO: check if core is in shutdown mode.  if - ignroe error.
+		if(errno == EINTR)
+			return 0; // interrupted by a signal, caller will just loop and wait again.
 		
 		ShowFatalError("evdp [EPOLL]: epoll_wait returned bad / unexpected status (errno: %u / %s)\n", errno, strerror(errno));
 		exit(1); //..
@@ -130,7 +141,7 @@ bool evdp_addlistener(int32 fd, EVDP_DATA *ep){
 
 bool evdp_addclient(int32 fd, EVDP_DATA *ep){
 	
-	ep->ev_data.events = EPOLLIN | EPOLLHUP;
+	ep->ev_data.events = EPOLLET | EPOLLIN | EPOLLHUP;
 	ep->ev_data.data.fd = fd;
 	
 	// No check for "added?" here,
@@ -178,7 +189,7 @@ bool evdp_outgoingconnection_established(int32 fd, EVDP_DATA *ep){
 	
 	saved_mask = ep->ev_data.events;
 	
-	ep->ev_data.events = EPOLLIN | EPOLLHUP;
+	ep->ev_data.events = EPOLLET | EPOLLIN | EPOLLHUP;
 	
 	if( epoll_ctl(epoll_fd,  EPOLL_CTL_MOD,  fd, &ep->ev_data) != 0){
 		ep->ev_data.events = saved_mask; // restore old mask.
@@ -230,3 +241,5 @@ void evdp_writable_remove(int32 fd, EVDP_DATA *ep){
 	
 	return;	
 }//end: evdp_writable_remove()
+
+#endif // __linux__
@@ -198,6 +198,59 @@ static struct block *block_malloc(unsigned short hash);
 static void          block_free(struct block *p);
 static size_t        memmgr_usage_bytes;
 
+/* Live heap of each source file, found by the file pointer of the allocation */
+#define MEMMGR_STATS_SIZE 1024 /* power of two, more than the number of source files */
+
+struct memmgr_stats {
+	const char *file;
+	size_t      bytes;       /* Bytes in use */
+	size_t      peak;        /* The most bytes in use since the last reset */
+	uint32      count;       /* Allocations in use */
+	uint64      allocs;      /* Allocations done */
+	uint64      alloc_bytes; /* Bytes allocated */
+};
+
+static struct memmgr_stats memmgr_stats[MEMMGR_STATS_SIZE];
+static struct memmgr_stats memmgr_stats_other = { "(other)" }; /* when the table is full */
+static uint64 memmgr_stats_mark[MEMMGR_STATS_SIZE][2][2]; /* allocs and alloc_bytes at the last report to the console [0] and to a file [1] */
+static time_t memmgr_stats_since;
+
+static struct memmgr_stats *memmgr_stats_get(const char *file)
+{
+	unsigned int i = (unsigned int)(((uintptr_t)file >> 3) * 2654435761U) & (MEMMGR_STATS_SIZE - 1);
+	unsigned int n;
+
+	for( n = 0; n < MEMMGR_STATS_SIZE; n++, i = (i + 1) & (MEMMGR_STATS_SIZE - 1) ) {
+		if( memmgr_stats[i].file == file )
+			return &memmgr_stats[i];
+		if( memmgr_stats[i].file == NULL ) {
+			memmgr_stats[i].file = file;
+			return &memmgr_stats[i];
+		}
+	}
+	return &memmgr_stats_other;
+}
+
+static inline void memmgr_stats_alloc(const char *file, size_t size)
+{
+	struct memmgr_stats *st = memmgr_stats_get(file);
+
+	st->bytes += size;
+	st->count++;
+	st->allocs++;
+	st->alloc_bytes += size;
+	if( st->bytes > st->peak )
+		st->peak = st->bytes;
+}
+
+static inline void memmgr_stats_free(const char *file, size_t size)
+{
+	struct memmgr_stats *st = memmgr_stats_get(file);
+
+	st->bytes -= size;
+	st->count--;
+}
+
 #define block2unit(p, n) ((struct unit_head*)(&(p)->data[ p->unit_size * (n) ]))
 #define memmgr_assert(v) do { if(!(v)) { ShowError("Memory manager: assertion '" #v "' failed!\n"); } } while(0)
 
@@ -248,6 +301,7 @@ void *_mmalloc(size_t size, const char *file, int line, const char *func )
 			p->unit_head.size  = 0;
 			p->unit_head.file  = file;
 			p->unit_head.line  = line;
+			memmgr_stats_alloc(file, size);
 			p->prev = NULL;
 			if (unit_head_large_first == NULL)
 				p->next = NULL;
@@ -318,6 +372,7 @@ void *_mmalloc(size_t size, const char *file, int line, const char *func )
 	head->file  = file;
 	head->line  = line;
 	head->size  = (unsigned short)size;
+	memmgr_stats_alloc(file, size);
 	*(long *)((char *)head + sizeof(struct unit_head) - sizeof(long) + size) = 0xdeadbeaf;
 	return (char *)head + sizeof(struct unit_head) - sizeof(long);
 }
@@ -393,6 +448,7 @@ void _mfree(void *ptr, const char *file, int line, const char *func )
 				head_large->next->prev = head_large->prev;
 			}
 			memmgr_usage_bytes -= head_large->size;
+			memmgr_stats_free(head_large->unit_head.file, head_large->size);
 #ifdef DEBUG_MEMMGR
 			// set freed memory to 0xfd
 			memset(ptr, 0xfd, head_large->size);
@@ -410,6 +466,7 @@ void _mfree(void *ptr, const char *file, int line, const char *func )
 			ShowError("Memory manager: args of aFree 0x%p is overflowed pointer %s line %d\n", ptr, file, line);
 		} else {
 			memmgr_usage_bytes -= head->size;
+			memmgr_stats_free(head->file, head->size);
 			head->block         = NULL;
 #ifdef DEBUG_MEMMGR
 			memset(ptr, 0xfd, block->unit_size - sizeof(struct unit_head) + sizeof(long) );
@@ -519,6 +576,74 @@ size_t memmgr_usage (void)
 	return memmgr_usage_bytes / 1024;
 }
 
+static int memmgr_stats_cmp(const void *a, const void *b)
+{
+	size_t bytes_a = ((const struct memmgr_stats *)a)->bytes;
+	size_t bytes_b = ((const struct memmgr_stats *)b)->bytes;
+
+	return ( bytes_a < bytes_b ) ? 1 : ( bytes_a > bytes_b ) ? -1 : 0;
+}
+
+/// Writes the live heap of each source file, sorted by bytes in use, to fp or the console (fp == NULL).
+/// Entries of the same file (headers are seen through the path of each includer) are merged,
+/// allocs and alloc_bytes of the rows hold the allocations since the last report to the same kind of output.
+static void memmgr_report(FILE *fp, bool reset)
+{
+	static struct memmgr_stats rows[MEMMGR_STATS_SIZE];
+	static time_t last[2];
+	int i, j, num = 0, out = ( fp != NULL );
+	time_t now = time(NULL);
+	double elapsed;
+	char line[256];
+
+	if( last[out] == 0 )
+		last[out] = memmgr_stats_since;
+	elapsed = ( now > last[out] ) ? (double)(now - last[out]) : 1.;
+	for( i = 0; i < MEMMGR_STATS_SIZE; i++ ) {
+		struct memmgr_stats *st = &memmgr_stats[i];
+		uint64 *mark = memmgr_stats_mark[i][out];
+		const char *name;
+
+		if( st->file == NULL || (st->count == 0 && st->allocs == mark[0]) )
+			continue;
+		name = strrchr(st->file, '/');
+		if( name == NULL )
+			name = strrchr(st->file, '\\');
+		name = ( name ) ? name + 1 : st->file;
+		for( j = 0; j < num && strcmp(rows[j].file, name) != 0; j++ )
+			;
+		if( j == num ) {
+			memset(&rows[num], 0, sizeof(rows[num]));
+			rows[num++].file = name;
+		}
+		rows[j].bytes += st->bytes;
+		rows[j].count += st->count;
+		rows[j].peak += st->peak;
+		rows[j].allocs += st->allocs - mark[0];
+		rows[j].alloc_bytes += st->alloc_bytes - mark[1];
+		mark[0] = st->allocs;
+		mark[1] = st->alloc_bytes;
+		if( reset )
+			st->peak = st->bytes;
+	}
+	qsort(rows, num, sizeof(rows[0]), memmgr_stats_cmp);
+
+	snprintf(line, sizeof(line), "%-24s %12s %10s %12s %10s %10s\n", "file", "KB in use", "blocks", "peak KB", "allocs/s", "KB/s");
+	if( fp ) fputs(line, fp); else ShowMessage(CL_BOLD"%s"CL_NORMAL, line);
+	for( i = 0; i < num; i++ ) {
+		snprintf(line, sizeof(line), "%-24s %12.1f %10u %12.1f %10.1f %10.1f\n", rows[i].file, rows[i].bytes/1024., rows[i].count,
+			rows[i].peak/1024., rows[i].allocs/elapsed, rows[i].alloc_bytes/1024./elapsed);
+		if( fp ) fputs(line, fp); else ShowMessage("%s", line);
+	}
+	if( memmgr_stats_other.allocs ) {
+		snprintf(line, sizeof(line), "%-24s %12.1f %10u\n", memmgr_stats_other.file, memmgr_stats_other.bytes/1024., memmgr_stats_other.count);
+		if( fp ) fputs(line, fp); else ShowMessage("%s", line);
+	}
+	snprintf(line, sizeof(line), "%-24s %12.1f (blocks of the memory manager not included)\n", "total", memmgr_usage_bytes/1024.);
+	if( fp ) fputs(line, fp); else ShowMessage("%s", line);
+	last[out] = now;
+}
+
 #ifdef LOG_MEMMGR
 static char memmer_logfile[128];
 static FILE *log_fp;
@@ -645,6 +770,7 @@ static void memmgr_init (void)
 	ShowStatus("Memory manager initialised: "CL_WHITE"%s"CL_RESET"\n", memmer_logfile);
 	memset(hash_unfill, 0, sizeof(hash_unfill));
 #endif /* LOG_MEMMGR */
+	memmgr_stats_since = time(NULL);
 }
 #endif /* USE_MEMMGR */
 
@@ -683,6 +809,39 @@ size_t malloc_usage (void)
 #endif
 }
 
+/// Shows the memory in use by each source file on the console.
+/// @param reset Resets the peaks to the current usage
+void malloc_report(bool reset)
+{
+#ifdef USE_MEMMGR
+	memmgr_report(NULL, reset);
+#else
+	ShowInfo("malloc_report: Only available with the built-in memory manager.\n");
+#endif
+}
+
+/// Appends the memory in use by each source file to a file, with a timestamp.
+/// @return false if the file can't be written
+bool malloc_report_file(const char *filename)
+{
+#ifdef USE_MEMMGR
+	char timestring[32];
+	time_t now = time(NULL);
+	FILE *fp;
+
+	if( (fp = fopen(filename, "a")) == NULL )
+		return false;
+	strftime(timestring, sizeof(timestring), "%Y-%m-%d %H:%M:%S", localtime(&now));
+	fprintf(fp, "[%s]\n", timestring);
+	memmgr_report(fp, false);
+	fprintf(fp, "\n");
+	fclose(fp);
+	return true;
+#else
+	return false;
+#endif
+}
+
 void malloc_final (void)
 {
 #ifdef USE_MEMMGR
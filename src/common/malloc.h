@@ -86,6 +86,8 @@
 void malloc_memory_check(void);
 bool malloc_verify_ptr(void* ptr);
 size_t malloc_usage (void);
+void malloc_report(bool reset);
+bool malloc_report_file(const char *filename);
 void malloc_init (void);
 void malloc_final (void);
 
@@ -16,206 +16,192 @@
 
 #include "../common/cbasetypes.h"
 #include "../common/atomic.h"
-#include "../common/mempool.h"
+#include "../common/spinlock.h"
 #include "../common/showmsg.h"
-#include "../common/raconf.h"
-#include "../common/thread.h"
-#include "../common/malloc.h"
-#include "../common/core.h"
 
 #include "../common/netbuffer.h"
 
 
-// 
+//
 // Buffers are available in the following sizes:
 //	48,		192,	2048,		8192
-//	65536 (inter server connects may use it for charstatus struct..)  
+//	65536 (inter server connects may use it for charstatus struct..)
+//
+// Bigger requests are served by an emergency allocation.
 //
 
 
 ///
 // Implementation:
 //
+// Each size has its own free list, holding up to NETBUFFER_MAX_FREE unused buffers;
+// buffers returned to a full list are freed right away, the rest on shutdown.
+// Buffers are handed to the network I/O threads, which drop their reference
+// once the data is sent, so the lists are guarded by a spinlock and the
+// memory comes from the system allocator (the memory manager isn't thread-safe).
+//
+#define NETBUFFER_NUM_POOLS 5
+#define NETBUFFER_MAX_FREE 1024 // max. unused buffers kept per pool
+
+static const sysint l_poolElemSize[NETBUFFER_NUM_POOLS] = { 48, 192, 2048, 8192, 65536 };
+
+static struct {
+	SPIN_LOCK lock;
+	struct netbuf *free;
+	int32 num_free;
+	volatile int32 num_used;
+	int32 peak_used;
+} l_pool[NETBUFFER_NUM_POOLS];
+
 static volatile int32 l_nEmergencyAllocations = 0; // stats.
-static sysint l_nPools = 0;
-static sysint *l_poolElemSize = NULL;
-static mempool *l_pool = NULL;
+
+
+// Allocates a buffer with room for sz bytes of data, exits when out of memory.
+static netbuf netbuffer_alloc( sysint sz ){
+	// struct netbuf already contains 32 bytes of buffer space at its end
+	netbuf nb = (netbuf)malloc( sizeof(struct netbuf) + sz - 32 );
+
+	if(nb == NULL){
+		ShowFatalError("Netbuffer: out of memory allocating a buffer of %u bytes!\n", (uint32)sz);
+		exit(EXIT_FAILURE);
+	}
+
+	return nb;
+}//end: netbuffer_alloc()
 
 
 void netbuffer_init(){
-	char localsection[32];
-	raconf conf;
 	sysint i;
-	
+
 	// Initialize Statistic counters:
 	l_nEmergencyAllocations = 0;
-	
-	// Set localsection name according to running serverype.
-	switch(SERVER_TYPE){
-		case ATHENA_SERVER_LOGIN:	strcpy(localsection, "login-netbuffer");		break;
-		case ATHENA_SERVER_CHAR:	strcpy(localsection, "char-netbuffer");			break;
-		case ATHENA_SERVER_INTER:	strcpy(localsection, "inter-netbuffer");		break;
-		case ATHENA_SERVER_MAP:		strcpy(localsection, "map-netbuffer");			break;
-		default:					strcpy(localsection, "unsupported_type");		break;
-	}
-	
-	
-	conf = raconf_parse("conf/network.conf");
-	if(conf == NULL){
-		ShowFatalError("Failed to Parse required Configuration (conf/network.conf)");
-		exit(EXIT_FAILURE);
+
+	for(i = 0; i < NETBUFFER_NUM_POOLS; i++){
+		InitializeSpinLock(&l_pool[i].lock);
+		l_pool[i].free = NULL;
+		l_pool[i].num_free = 0;
+		l_pool[i].num_used = 0;
+		l_pool[i].peak_used = 0;
 	}
-	
-	// Get Values from config file
-	l_nPools = (sysint)raconf_getintEx(conf,  localsection,  "netbuffer", "num", 0);
-	if(l_nPools == 0){
-		ShowFatalError("Netbuffer (network.conf) failure - requires at least 1 Pool.\n");		
-		exit(EXIT_FAILURE);
-	}	
-
-	// Allocate arrays.
-	l_poolElemSize = (sysint*)aCalloc( l_nPools, sizeof(sysint) );
-	l_pool = (mempool*)aCalloc( l_nPools, sizeof(mempool) );
-	
-
-	for(i = 0; i < l_nPools; i++){
-		int64 num_prealloc, num_realloc;
-		char key[32];
-		
-		sprintf(key, "pool_%u_size", (uint32)i+1);
-		l_poolElemSize[i] = (sysint)raconf_getintEx(conf, localsection, "netbuffer", key, 4096);
-		if(l_poolElemSize[i] < 32){
-			ShowWarning("Netbuffer (network.conf) failure - minimum allowed buffer size is 32 byte) - fixed.\n");
-			l_poolElemSize[i] = 32;
-		}
-		
-		sprintf(key, "pool_%u_prealloc", (uint32)i+1);
-		num_prealloc = raconf_getintEx(conf, localsection, "netbuffer", key, 150);
-		
-		sprintf(key, "pool_%u_realloc_step", (uint32)i+1);
-		num_realloc = raconf_getintEx(conf, localsection, "netbuffer", key, 100);
-			
-		// Create Pool!
-		sprintf(key, "Netbuffer %u", (uint32)l_poolElemSize[i]); // name.
-
-		// Info
-		ShowInfo("NetBuffer: Creating Pool %u (Prealloc: %u, Realloc Step: %u) - %0.2f MiB\n", l_poolElemSize[i], num_prealloc, num_realloc, (float)((sizeof(struct netbuf) + l_poolElemSize[i] - 32)* num_prealloc)/1024.0f/1024.0f);
-		
-		//
-		// Size Calculation:
-		//  struct netbuf  +  requested buffer size - 32 (because the struct already contains 32 byte buffer space at the end of struct)
-		l_pool[i] = mempool_create(key,  (sizeof(struct netbuf) + l_poolElemSize[i] - 32),  num_prealloc,  num_realloc, NULL, NULL);
-		if(l_pool[i] == NULL){
-			ShowFatalError("Netbuffer: cannot create Pool for %u byte buffers.\n", l_poolElemSize[i]);
-			// @leak: clean everything :D
-			exit(EXIT_FAILURE);
-		}		
-				
-	}// 
-		
-	
-	raconf_destroy(conf);
 
 }//end: netbuffer_init()
 
 
 void netbuffer_final(){
 	sysint i;
-	
-	if(l_nPools > 0){
-		/// .. finalize mempools
-		for(i = 0; i < l_nPools; i++){
-			mempool_stats stats = mempool_get_stats(l_pool[i]);
-			
-			ShowInfo("Netbuffer: Freeing Pool %u (Peak Usage: %u, Realloc Events: %u)\n", l_poolElemSize[i], stats.peak_nodes_used, stats.num_realloc_events);
-						
-			mempool_destroy(l_pool[i]);
-		}	
-	
-		if(l_nEmergencyAllocations > 0){
-			ShowWarning("Netbuffer: did %u Emergency Allocations, please tune your network.conf!\n", l_nEmergencyAllocations);
-			l_nEmergencyAllocations = 0;
+
+	for(i = 0; i < NETBUFFER_NUM_POOLS; i++){
+		netbuf nb;
+
+		if(l_pool[i].num_used > 0)
+			ShowWarning("Netbuffer: Pool %u still has %d buffers in use.\n", (uint32)l_poolElemSize[i], l_pool[i].num_used);
+
+		ShowInfo("Netbuffer: Freeing Pool %u (Peak Usage: %d)\n", (uint32)l_poolElemSize[i], l_pool[i].peak_used);
+
+		while( (nb = l_pool[i].free) != NULL ){
+			l_pool[i].free = nb->next;
+			free(nb);
 		}
-	
-		aFree(l_poolElemSize);  l_poolElemSize = NULL;
-		aFree(l_pool);	l_pool = NULL;
-		l_nPools = 0;
+		l_pool[i].num_free = 0;
+
+		FinalizeSpinLock(&l_pool[i].lock);
 	}
-	
-	
+
+	if(l_nEmergencyAllocations > 0){
+		ShowWarning("Netbuffer: did %u Emergency Allocations.\n", l_nEmergencyAllocations);
+		l_nEmergencyAllocations = 0;
+	}
+
 }//end: netbuffer_final()
 
 
 netbuf netbuffer_get( sysint sz ){
 	sysint i;
 	netbuf nb = NULL;
-	
+
 	// Search an appropriate pool
-	for(i = 0; i < l_nPools; i++){
+	for(i = 0; i < NETBUFFER_NUM_POOLS; i++){
 		if(sz <= l_poolElemSize[i]){
-			// match 
-			
-			nb = (netbuf)mempool_node_get(l_pool[i]); 
+			// match
+			int32 used;
+
+			EnterSpinLock(&l_pool[i].lock);
+			if( (nb = l_pool[i].free) != NULL ){
+				l_pool[i].free = nb->next;
+				l_pool[i].num_free--;
+			}
+			LeaveSpinLock(&l_pool[i].lock);
+
+			if(nb == NULL)
+				nb = netbuffer_alloc(l_poolElemSize[i]);
+
+			used = InterlockedIncrement(&l_pool[i].num_used);
+			if(used > l_pool[i].peak_used)
+				l_pool[i].peak_used = used;
+
 			nb->pool = i;
-			
 			break;
-		}		
+		}
 	}
-	
-	// No Bufferpool found that mets there quirements?.. (thats bad..)
+
+	// No Bufferpool found that mets there quirements?..
 	if(nb == NULL){
-		ShowWarning("Netbuffer: get(%u): => no appropriate pool found - emergency allocation required.\n", sz);
-		ShowWarning("Please reconfigure your network.conf!");
-		
+		ShowWarning("Netbuffer: get(%u): => no appropriate pool found - emergency allocation required.\n", (uint32)sz);
+
 		InterlockedIncrement(&l_nEmergencyAllocations);
 
 		// .. better to check (netbuf struct provides 32 byte bufferspace itself.
 		if(sz < 32)	sz = 32;
-		
-		// allocate memory using malloc .. 
-		while(1){
-			nb = (netbuf) aMalloc(  (sizeof(struct netbuf) + sz - 32) );
-			if(nb != NULL){
-				memset(nb, 0x00, (sizeof(struct netbuf) + sz - 32) ); // zero memory! (to enforce commit @ os.)
-				nb->pool = -1; // emergency alloc.
-				break;
-			}
-			
-			rathread_yield();
-		}// spin allocation.
-		
+
+		nb = netbuffer_alloc(sz);
+
+		nb->pool = -1; // emergency alloc.
 	}
-	
-	
+
+	nb->next = NULL;
+	nb->dataPos = 0;
+	nb->dataLen = 0;
 	nb->refcnt = 1;	 // Initial refcount is 1
 
-	return nb;	
+	return nb;
 }//end: netbuffer_get()
 
 
 void netbuffer_put( netbuf nb ){
-	
+	sysint i;
+
 	// Decrement reference counter, if > 0 do nothing :)
 	if( InterlockedDecrement(&nb->refcnt) > 0 )
 		return;
-	
+
 	// Is this buffer an emergency allocated buffer?
 	if(nb->pool == -1){
-		aFree(nb); 
+		free(nb);
 		return;
 	}
-	
-	
-	// Otherwise its a normal mempool based buffer
-	// return it to the according mempool:
-	mempool_node_put( l_pool[nb->pool], nb);
-	
-	
+
+	// Otherwise its a pooled buffer
+	// return it to the according free list:
+	i = nb->pool;
+	InterlockedDecrement(&l_pool[i].num_used);
+
+	EnterSpinLock(&l_pool[i].lock);
+	if(l_pool[i].num_free < NETBUFFER_MAX_FREE){
+		nb->next = l_pool[i].free;
+		l_pool[i].free = nb;
+		l_pool[i].num_free++;
+		nb = NULL;
+	}
+	LeaveSpinLock(&l_pool[i].lock);
+
+	if(nb != NULL)
+		free(nb);
+
 }//end: netbuffer_put()
 
 
 void netbuffer_incref( netbuf nb ){
-	
+
 	InterlockedIncrement(&nb->refcnt);
-	
+
 }//end: netbuf_incref()
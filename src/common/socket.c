@@ -7,7 +7,27 @@
 #include "../common/malloc.h"
 #include "../common/showmsg.h"
 #include "../common/strlib.h"
+#include "../common/utils.h"
 #include "socket.h"
+#ifdef SOCKET_EPOLL
+#include "../common/evdp.h"
+#endif
+#ifdef SOCKET_IOTHREADS
+#include "../common/thread.h"
+#include "../common/spinlock.h"
+#include "../common/spscring.h"
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#endif
+#ifdef SOCKET_URING
+#include <linux/io_uring.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <poll.h>
+#if !defined(IORING_FEAT_EXT_ARG) || !defined(SEND_SHAREDBUF)
+#undef SOCKET_URING // kernel headers older than 5.11
+#endif
+#endif
 
 #include <stdio.h>
 #include <stdlib.h>
@@ -27,6 +47,9 @@
 	#include <sys/ioctl.h>
 	#include <netdb.h>
 	#include <arpa/inet.h>
+#ifdef SEND_SHAREDBUF
+	#include <sys/uio.h>
+#endif
 
 	#ifndef SIOCGIFCONF
 	#include <sys/sockio.h> // SIOCGIFCONF on Solaris, maybe others? [Shinomori]
@@ -208,7 +231,9 @@ char *sErr(int code)
 	#define MSG_NOSIGNAL 0
 #endif
 
+#ifndef SOCKET_EPOLL
 fd_set readfds;
+#endif
 int fd_max;
 time_t last_tick;
 time_t stall_time = 60;
@@ -224,6 +249,14 @@ static size_t socket_max_client_packet = 0x6000;
 static size_t socket_max_client_packet = USHRT_MAX;
 #endif
 
+struct socket_packet_stats socket_sent_stats[0x10000];
+
+// Flush each session once per tick, with MSG_MORE between the writes of a flush (send_coalesce in packet_athena.conf)
+static bool send_coalesce = false;
+// Send syscalls of the main thread, for the average bytes per syscall (see socket_send_report)
+static uint64 socket_send_calls = 0, socket_send_bytes = 0;
+static unsigned int socket_send_tick = 0;// start of the measurement
+
 #ifdef SHOW_SERVER_STATS
 // Data I/O statistics
 static size_t socket_data_i = 0, socket_data_ci = 0, socket_data_qi = 0;
@@ -241,12 +274,295 @@ static time_t socket_data_last_tick = 0;
 // The connection is closed if it goes over the limit.
 #define WFIFO_MAX (1*1024*1024)
 
-struct socket_data* session[FD_SETSIZE];
+// Size of the send buffer that a session returns to once everything is sent.
+// WFIFOSET keeps a reserve of WFIFO_SIZE (FIFOSIZE_SERVERLINK/4 for servers),
+// so a session that sends anything needs twice that much.
+#define WFIFO_NOMINAL(s) ( (s)->flag.server ? FIFOSIZE_SERVERLINK : 2*WFIFO_SIZE )
+
+struct socket_data* session[MAXCONN];
+
+
+/////////////////////////////////////////////////////////////////////
+// Session FIFOs
+//
+// The read and write buffers of the sessions come from size classes
+// (powers of two from 2 KB to 1 MB), each with a free list, so that the
+// buffers of sessions that come and go or grow for a burst are reused.
+// The buffers have to be contiguous (RFIFOP/WFIFOP), so a fifo that
+// grows or shrinks moves to a buffer of another size class.
+// Bigger buffers are allocated directly.
+#define SOCKET_FIFO_MINSHIFT 11 // 2 KB
+#define SOCKET_FIFO_CLASSES 10 // 2 KB - 1 MB
+#define SOCKET_FIFO_MAXFREE (4*1024*1024) // max. bytes kept in the free list of a size class
+
+struct socket_fifo_class {
+	void* free; // unused buffers, linked through their first bytes
+	int num_free;
+	int num_used;
+	int peak_used;
+};
+static struct socket_fifo_class socket_fifo_class[SOCKET_FIFO_CLASSES];
+static size_t socket_fifo_used = 0; // bytes in the buffers of the sessions
+static size_t socket_fifo_big = 0; // bytes in buffers bigger than the biggest size class
+
+/// Returns the size class of a buffer size, or -1 if it's bigger than the biggest class.
+static int socket_fifo_classof(size_t size)
+{
+	int i;
+
+	for( i = 0; i < SOCKET_FIFO_CLASSES; ++i )
+		if( size <= ((size_t)1<<(SOCKET_FIFO_MINSHIFT+i)) )
+			return i;
+	return -1;
+}
+
+/// Returns the actual size of the buffer that holds size bytes.
+static size_t socket_fifo_size(size_t size)
+{
+	int i = socket_fifo_classof(size);
+
+	return ( i < 0 ? size : (size_t)1<<(SOCKET_FIFO_MINSHIFT+i) );
+}
+
+/// Gets a buffer, size must come from socket_fifo_size.
+static unsigned char* socket_fifo_get(size_t size)
+{
+	int i = socket_fifo_classof(size);
+	unsigned char* buf;
+
+	socket_fifo_used += size;
+	if( i < 0 ) {
+		socket_fifo_big += size;
+		return (unsigned char*)aMalloc(size);
+	}
+
+	if( socket_fifo_class[i].free ) {
+		buf = (unsigned char*)socket_fifo_class[i].free;
+		socket_fifo_class[i].free = *(void**)buf;
+		socket_fifo_class[i].num_free--;
+	} else
+		buf = (unsigned char*)aMalloc(size);
+	if( ++socket_fifo_class[i].num_used > socket_fifo_class[i].peak_used )
+		socket_fifo_class[i].peak_used = socket_fifo_class[i].num_used;
+	return buf;
+}
+
+/// Returns a buffer to its size class.
+static void socket_fifo_put(unsigned char* buf, size_t size)
+{
+	int i = socket_fifo_classof(size);
+
+	if( buf == NULL )
+		return;
+
+	socket_fifo_used -= size;
+	if( i < 0 ) {
+		socket_fifo_big -= size;
+		aFree(buf);
+		return;
+	}
+
+	socket_fifo_class[i].num_used--;
+	if( (size_t)(socket_fifo_class[i].num_free+1)*size > SOCKET_FIFO_MAXFREE ) {
+		aFree(buf);
+		return;
+	}
+	*(void**)buf = socket_fifo_class[i].free;
+	socket_fifo_class[i].free = buf;
+	socket_fifo_class[i].num_free++;
+}
+
+/// Moves the first len bytes of a buffer to a buffer of another size.
+static unsigned char* socket_fifo_resize(unsigned char* buf, size_t size, size_t newsize, size_t len)
+{
+	unsigned char* newbuf;
+
+	if( size == newsize )
+		return buf;
+	newbuf = socket_fifo_get(newsize);
+	if( len > 0 )
+		memcpy(newbuf, buf, min(len, newsize));
+	socket_fifo_put(buf, size);
+	return newbuf;
+}
+
+/// Returns a send buffer that grew for a burst to its nominal size, once everything is sent.
+static void socket_wfifo_shrink(struct socket_data* s)
+{
+	size_t nominal = WFIFO_NOMINAL(s);
+
+	if( s->wdata_size == 0 && s->max_wdata > nominal ) {
+		s->wdata = socket_fifo_resize(s->wdata, s->max_wdata, nominal, 0);
+		s->max_wdata = nominal;
+	}
+}
+
+/// Frees the unused buffers of all the size classes.
+static void socket_fifo_final(void)
+{
+	int i;
+
+	for( i = 0; i < SOCKET_FIFO_CLASSES; ++i ) {
+		void* buf;
+
+		while( (buf = socket_fifo_class[i].free) != NULL ) {
+			socket_fifo_class[i].free = *(void**)buf;
+			aFree(buf);
+		}
+		socket_fifo_class[i].num_free = 0;
+	}
+}
+
+/// Displays the memory used by the session fifos.
+void socket_fifo_report(void)
+{
+	size_t cached = 0;
+	int i, sessions = 0;
+
+	for( i = 0; i < fd_max; ++i )
+		if( session[i] )
+			sessions++;
+	for( i = 0; i < SOCKET_FIFO_CLASSES; ++i )
+		cached += (size_t)socket_fifo_class[i].num_free<<(SOCKET_FIFO_MINSHIFT+i);
+
+	ShowMessage(CL_BOLD"[Fifo report]"CL_NORMAL" %d sessions: %.1f KB in use, %.1f KB unused in the free lists\n",
+		sessions, socket_fifo_used/1024., cached/1024.);
+	ShowMessage("\t%10s %8s %8s %8s %12s\n", "size", "used", "peak", "free", "KB");
+	for( i = 0; i < SOCKET_FIFO_CLASSES; ++i ) {
+		struct socket_fifo_class* c = &socket_fifo_class[i];
+
+		if( c->num_used == 0 && c->peak_used == 0 )
+			continue;
+		ShowMessage("\t%10u %8d %8d %8d %12.1f\n", 1u<<(SOCKET_FIFO_MINSHIFT+i), c->num_used, c->peak_used, c->num_free,
+			((size_t)(c->num_used+c->num_free)<<(SOCKET_FIFO_MINSHIFT+i))/1024.);
+	}
+	if( socket_fifo_big )
+		ShowMessage("\t%10s %8s %8s %8s %12.1f\n", "bigger", "", "", "", socket_fifo_big/1024.);
+}
 
 #ifdef SEND_SHORTLIST
-int send_shortlist_array[FD_SETSIZE];// we only support FD_SETSIZE sockets, limit the array to that
+int send_shortlist_array[MAXCONN];// we only support MAXCONN sockets, limit the array to that
 int send_shortlist_count = 0;// how many fd's are in the shortlist
-uint32 send_shortlist_set[(FD_SETSIZE+31)/32];// to know if specific fd's are already in the shortlist
+uint32 send_shortlist_set[(MAXCONN+31)/32];// to know if specific fd's are already in the shortlist
+static void send_shortlist_do_sends_(bool send);
+#endif
+
+#ifdef SOCKET_EPOLL
+// Max. number of events fetched from the event dispatcher per call
+#define SOCKET_EVENTS_PER_CYCLE 1024
+// Max. number of connections accepted on a listener per tick
+#define SOCKET_ACCEPT_PER_CYCLE 64
+
+/// List of fds waiting to be handled by do_sockets.
+/// Double-buffered, fds that are added while the list is being walked
+/// end up in the other half and are handled on the next tick.
+struct socket_fdlist {
+	int array[2][MAXCONN];
+	int count[2];
+	int cur;// half that is currently being filled
+	uint32 set[(MAXCONN+31)/32];// to know if specific fd's are already in the list
+};
+
+static EVDP_DATA socket_evdp[MAXCONN];// event dispatcher data of each fd
+static EVDP_EVENT socket_events[SOCKET_EVENTS_PER_CYCLE];
+static struct socket_fdlist socket_readlist;// fds that may have data to read
+static struct socket_fdlist socket_parselist;// fds that have data to parse
+static time_t socket_stall_last_tick = 0;
+
+static void socket_fdlist_add(struct socket_fdlist* list, int fd);
+#endif
+
+#ifdef SOCKET_IOTHREADS
+#define SOCKET_IO_MAXTHREADS 16
+// Number of messages each ring can hold
+#define SOCKET_IO_RINGSIZE (64*1024)
+// Size of the data chunks passed between the threads
+#define SOCKET_IO_CHUNKSIZE (4*1024)
+// Max. number of unused chunks kept for reuse
+#define SOCKET_IO_MAXFREE 4096
+// Max. received data waiting for room in the rfifo (client connections).
+// The connection is closed if it goes over the limit.
+#define SOCKET_IO_MAXPENDING (1*1024*1024)
+
+enum socket_io_cmd {
+	SOCKET_IO_ADD,   // logic -> io : start handling the socket
+	SOCKET_IO_SEND,  // logic -> io : send data
+	SOCKET_IO_CLOSE, // logic -> io : close the socket (after sending what's queued)
+	SOCKET_IO_DATA,  // io -> logic : data received
+	SOCKET_IO_EOF,   // io -> logic : connection closed or failed
+};
+
+/// Message passed between the logic and io threads.
+struct socket_io_chunk {
+	struct socket_io_chunk* next;
+	int cmd;
+	int fd;
+	uint32 serial;// connection serial, messages of a previous connection on the same fd are dropped
+	uint32 len, pos;
+#ifdef SEND_SHAREDBUF
+	netbuf nb;// SOCKET_IO_SEND: shared buffer sent instead of data
+#endif
+	uint8 data[SOCKET_IO_CHUNKSIZE];
+};
+
+struct socket_io_thread {
+	rAthread thread;
+	int epoll_fd;
+	int wake_fd;// eventfd, wakes the thread when there are new commands
+	SPSC_RING in;// commands (logic -> io)
+	SPSC_RING out;// data and events (io -> logic)
+	struct socket_io_fd* fds;// state of the sockets by fd, only used by this thread
+	int* flush_array;// sockets that got data queued in this cycle
+	int flush_count;
+	bool dirty;// commands were pushed since the last wake up (logic side)
+	uint64 send_calls, send_bytes;// send syscalls (io thread side, stored atomically for socket_send_report)
+	uint64 send_calls_reset, send_bytes_reset;// values at the last reset of the statistics (logic side)
+};
+
+/// Socket state in the io thread owning it.
+/// Each thread has its own, a closed fd can be reused by a connection of another thread.
+struct socket_io_fd {
+	uint32 serial;
+	bool active, eof, flush;
+	struct socket_io_chunk *sendq, *sendq_last;
+};
+
+int socket_io_threads = 0;// number of io threads, 0 = disabled
+static struct socket_io_thread socket_io[SOCKET_IO_MAXTHREADS];
+static volatile int32 socket_io_terminate = 0;
+static SPIN_LOCK socket_io_freelock;
+static struct socket_io_chunk* socket_io_freelist = NULL;// unused chunks, shared by all threads
+static int socket_io_freecount = 0;
+static int socket_io_wake_fd = -1;// eventfd, wakes the logic thread when there are new messages
+// logic thread side
+static uint8 socket_io_owner[MAXCONN];// io thread handling the socket + 1, 0 = none
+static uint32 socket_io_serial[MAXCONN];
+static struct socket_io_chunk* socket_io_pending[MAXCONN];// received data waiting for room in the rfifo
+static struct socket_io_chunk* socket_io_pending_last[MAXCONN];
+static size_t socket_io_pending_size[MAXCONN];
+static int socket_io_next = 0;
+
+static void socket_io_add(int fd);
+static void socket_io_dispatch(void);
+static void socket_io_fill(int fd);
+static void socket_io_wakeall(void);
+static void socket_io_close(int fd);
+#endif
+
+#ifdef SOCKET_URING
+struct socket_uring_op;
+static bool socket_uring_active = false;// client connections use the io_uring backend
+static bool socket_uring_config = false;// io_uring setting of packet_athena.conf
+static struct socket_uring_op* socket_uring_recvop[MAXCONN];// recv request of each connection in the ring
+static struct socket_uring_op* socket_uring_sendop[MAXCONN];// send request of each connection in the ring
+
+static void socket_uring_add(int fd);
+static int socket_uring_send(int fd);
+static void socket_uring_fill(int fd);
+static bool socket_uring_wait(int next);
+static void socket_uring_close(int fd);
+#elif defined(SOCKET_EPOLL)
+#define socket_uring_active false
 #endif
 
 static int create_session(int fd, RecvFunc func_recv, SendFunc func_send, ParseFunc func_parse);
@@ -264,6 +580,18 @@ const char *error_msg(void)
 	return buf;
 }
 
+#ifdef SEND_SHAREDBUF
+// Max. number of buffers passed to the kernel in one send
+#define SOCKET_IOV_MAX 128
+/// Checks if the session has data waiting to be sent.
+#define SESSION_WPENDING(s) ((s)->wdata_size > 0 || (s)->wbuf_count > 0)
+static int socket_wbuf_iov(struct socket_data* s, struct iovec* iov, bool* partial);
+static void socket_wbuf_clear(struct socket_data* s);
+static void socket_wbuf_consume(struct socket_data* s, size_t len);
+#else
+#define SESSION_WPENDING(s) ((s)->wdata_size > 0)
+#endif
+
 /*======================================
  *	CORE : Default processing functions
  *--------------------------------------*/
@@ -345,12 +673,13 @@ void set_eof(int fd)
 
 int recv_to_fifo(int fd)
 {
-	int len;
+	int len, space;
 
 	if( !session_isActive(fd) )
 		return -1;
 
-	len = sRecv(fd, (char *) session[fd]->rdata + session[fd]->rdata_size, (int)RFIFOSPACE(fd), 0);
+	space = (int)RFIFOSPACE(fd);
+	len = sRecv(fd, (char *) session[fd]->rdata + session[fd]->rdata_size, space, 0);
 
 	if( len == SOCKET_ERROR ) { //An exception has occured
 		if( sErrno != S_EWOULDBLOCK ) {
@@ -367,6 +696,13 @@ int recv_to_fifo(int fd)
 
 	session[fd]->rdata_size += len;
 	session[fd]->rdata_tick = last_tick;
+#ifdef SOCKET_EPOLL
+	// sockets are edge triggered, if the fifo got filled up there might
+	// still be data left in the socket and no new event will tell us
+	if( len == space )
+		socket_fdlist_add(&socket_readlist, fd);
+	socket_fdlist_add(&socket_parselist, fd);
+#endif
 #ifdef SHOW_SERVER_STATS
 	socket_data_i += len;
 	socket_data_qi += len;
@@ -377,6 +713,51 @@ int recv_to_fifo(int fd)
 	return 0;
 }
 
+#ifdef SEND_SHAREDBUF
+/// Sends the wfifo data and the shared buffers in between with gathering writes.
+/// Without send_coalesce only the first SOCKET_IOV_MAX entries are sent, the rest waits for the next flush.
+static int send_from_fifo_shared(int fd)
+{
+	struct socket_data* s = session[fd];
+	struct iovec iov[SOCKET_IOV_MAX];
+	struct msghdr msg;
+	bool partial;
+	int len;
+
+	do {
+		memset(&msg, 0, sizeof(msg));
+		msg.msg_iov = iov;
+		msg.msg_iovlen = socket_wbuf_iov(s, iov, &partial);
+		// MSG_MORE: the rest of the queue follows right away, don't push a segment for the end of this part
+		len = sendmsg(fd, &msg, MSG_NOSIGNAL|(send_coalesce && partial ? MSG_MORE : 0));
+		socket_send_calls++;
+
+		if( len == SOCKET_ERROR ) { //An exception has occured
+			if( sErrno != S_EWOULDBLOCK ) {
+				//ShowDebug("send_from_fifo: %s, ending connection #%d\n", error_msg(), fd);
+				socket_wbuf_clear(s);
+				set_eof(fd);
+			}
+			return 0;
+		}
+
+		if( len > 0 ) {
+			socket_wbuf_consume(s, len);
+			socket_wfifo_shrink(s);
+			socket_send_bytes += len;
+#ifdef SHOW_SERVER_STATS
+			socket_data_o += len;
+			if( !s->flag.server ) {
+				socket_data_co += len;
+			}
+#endif
+		}
+	} while( send_coalesce && partial && len > 0 );
+
+	return 0;
+}
+#endif
+
 int send_from_fifo(int fd)
 {
 	int len;
@@ -384,10 +765,20 @@ int send_from_fifo(int fd)
 	if( !session_isValid(fd) )
 		return -1;
 
-	if( session[fd]->wdata_size == 0 )
+	if( !SESSION_WPENDING(session[fd]) )
 		return 0; // nothing to send
 
+#ifdef SOCKET_URING
+	if( socket_uring_sendop[fd] )
+		return socket_uring_send(fd);
+#endif
+#ifdef SEND_SHAREDBUF
+	if( session[fd]->wbuf_count > 0 )
+		return send_from_fifo_shared(fd);
+#endif
+
 	len = sSend(fd, (const char *) session[fd]->wdata, (int)session[fd]->wdata_size, MSG_NOSIGNAL);
+	socket_send_calls++;
 
 	if( len == SOCKET_ERROR ) { //An exception has occured
 		if( sErrno != S_EWOULDBLOCK ) {
@@ -408,6 +799,8 @@ int send_from_fifo(int fd)
 			memmove(session[fd]->wdata, session[fd]->wdata + len, session[fd]->wdata_size - len);
 
 		session[fd]->wdata_size -= len;
+		socket_wfifo_shrink(session[fd]);
+		socket_send_bytes += len;
 #ifdef SHOW_SERVER_STATS
 		socket_data_o += len;
 		socket_data_qo -= len;
@@ -437,7 +830,9 @@ void flush_fifos(void)
 /*======================================
  *	CORE : Connection functions
  *--------------------------------------*/
-int connect_client(int listen_fd)
+/// Accepts one pending connection.
+/// Returns the new fd, -1 on error or -2 if there was nothing to accept.
+static int connect_client_(int listen_fd)
 {
 	int fd;
 	struct sockaddr_in client_address;
@@ -447,6 +842,8 @@ int connect_client(int listen_fd)
 
 	fd = sAccept(listen_fd, (struct sockaddr*)&client_address, &len);
 	if ( fd == -1 ) {
+		if( sErrno == S_EWOULDBLOCK )
+			return -2;// nothing pending
 		ShowError("connect_client: accept failed (%s)!\n", error_msg());
 		return -1;
 	}
@@ -456,9 +853,9 @@ int connect_client(int listen_fd)
 		sClose(fd);
 		return -1;
 	}
-	if( fd >= FD_SETSIZE )
+	if( fd >= MAXCONN )
 	{// socket number too big
-		ShowError("connect_client: New socket #%d is greater than can we handle! Increase the value of FD_SETSIZE (currently %d) for your OS to fix this!\n", fd, FD_SETSIZE);
+		ShowError("connect_client: New socket #%d is greater than can we handle! Increase the value of MAXCONN (currently %d) to fix this!\n", fd, MAXCONN);
 		sClose(fd);
 		return -1;
 	}
@@ -474,14 +871,54 @@ int connect_client(int listen_fd)
 #endif
 
 	if( fd_max <= fd ) fd_max = fd + 1;
+#ifdef SOCKET_EPOLL
+	if( !socket_uring_active ) {
+		if( !evdp_addclient(fd, &socket_evdp[fd]) ) {
+			do_close(fd);
+			return -1;
+		}
+		// data might have arrived before the socket was added to the dispatcher
+		socket_fdlist_add(&socket_readlist, fd);
+	}
+#else
 	sFD_SET(fd,&readfds);
+#endif
 
 	create_session(fd, recv_to_fifo, send_from_fifo, default_func_parse);
 	session[fd]->client_addr = ntohl(client_address.sin_addr.s_addr);
+#ifdef SOCKET_URING
+	if( socket_uring_active )
+		socket_uring_add(fd);
+#endif
+#ifdef SOCKET_IOTHREADS
+	if( socket_io_threads > 0 )
+		socket_io_add(fd);
+#endif
 
 	return fd;
 }
 
+int connect_client(int listen_fd)
+{
+#ifdef SOCKET_EPOLL
+	// listeners are edge triggered, keep accepting until there is nothing left
+	// anything over SOCKET_ACCEPT_PER_CYCLE is accepted on the next tick
+	int i, fd = -1;
+
+	for( i = 0; i < SOCKET_ACCEPT_PER_CYCLE; ++i )
+	{
+		fd = connect_client_(listen_fd);
+		if( fd == -2 )
+			return -1;// all pending connections were accepted
+	}
+	socket_fdlist_add(&socket_readlist, listen_fd);
+	return fd;
+#else
+	int fd = connect_client_(listen_fd);
+	return ( fd == -2 ) ? -1 : fd;
+#endif
+}
+
 int make_listen_bind(uint32 ip, uint16 port)
 {
 	struct sockaddr_in server_address;
@@ -501,9 +938,9 @@ int make_listen_bind(uint32 ip, uint16 port)
 		sClose(fd);
 		return -1;
 	}
-	if( fd >= FD_SETSIZE )
+	if( fd >= MAXCONN )
 	{// socket number too big
-		ShowError("make_listen_bind: New socket #%d is greater than can we handle! Increase the value of FD_SETSIZE (currently %d) for your OS to fix this!\n", fd, FD_SETSIZE);
+		ShowError("make_listen_bind: New socket #%d is greater than can we handle! Increase the value of MAXCONN (currently %d) to fix this!\n", fd, MAXCONN);
 		sClose(fd);
 		return -1;
 	}
@@ -520,14 +957,21 @@ int make_listen_bind(uint32 ip, uint16 port)
 		ShowError("make_listen_bind: bind failed (socket #%d, %s)!\n", fd, error_msg());
 		exit(EXIT_FAILURE);
 	}
-	result = sListen(fd,5);
+	result = sListen(fd,SOMAXCONN);
 	if( result == SOCKET_ERROR ) {
 		ShowError("make_listen_bind: listen failed (socket #%d, %s)!\n", fd, error_msg());
 		exit(EXIT_FAILURE);
 	}
 
 	if(fd_max <= fd) fd_max = fd + 1;
+#ifdef SOCKET_EPOLL
+	if( !evdp_addlistener(fd, &socket_evdp[fd]) ) {
+		ShowError("make_listen_bind: unable to watch socket #%d for events!\n", fd);
+		exit(EXIT_FAILURE);
+	}
+#else
 	sFD_SET(fd, &readfds);
+#endif
 
 	create_session(fd, connect_client, null_send, null_parse);
 	session[fd]->client_addr = 0; // just listens
@@ -553,9 +997,9 @@ int make_connection(uint32 ip, uint16 port, bool silent, int timeout) {
 		sClose(fd);
 		return -1;
 	}
-	if( fd >= FD_SETSIZE )
+	if( fd >= MAXCONN )
 	{// socket number too big
-		ShowError("make_connection: New socket #%d is greater than can we handle! Increase the value of FD_SETSIZE (currently %d) for your OS to fix this!\n", fd, FD_SETSIZE);
+		ShowError("make_connection: New socket #%d is greater than can we handle! Increase the value of MAXCONN (currently %d) to fix this!\n", fd, MAXCONN);
 		sClose(fd);
 		return -1;
 	}
@@ -580,10 +1024,24 @@ int make_connection(uint32 ip, uint16 port, bool silent, int timeout) {
 	set_nonblocking(fd, 1);
 
 	if (fd_max <= fd) fd_max = fd + 1;
+#ifdef SOCKET_EPOLL
+	if( !socket_uring_active ) {
+		if( !evdp_addclient(fd, &socket_evdp[fd]) ) {
+			do_close(fd);
+			return -1;
+		}
+		socket_fdlist_add(&socket_readlist, fd);
+	}
+#else
 	sFD_SET(fd,&readfds);
+#endif
 
 	create_session(fd, recv_to_fifo, send_from_fifo, default_func_parse);
 	session[fd]->client_addr = ntohl(remote_address.sin_addr.s_addr);
+#ifdef SOCKET_URING
+	if( socket_uring_active )
+		socket_uring_add(fd);
+#endif
 
 	return fd;
 }
@@ -591,8 +1049,8 @@ int make_connection(uint32 ip, uint16 port, bool silent, int timeout) {
 static int create_session(int fd, RecvFunc func_recv, SendFunc func_send, ParseFunc func_parse)
 {
 	CREATE(session[fd], struct socket_data, 1);
-	CREATE(session[fd]->rdata, unsigned char, RFIFO_SIZE);
-	CREATE(session[fd]->wdata, unsigned char, WFIFO_SIZE);
+	session[fd]->rdata = socket_fifo_get(RFIFO_SIZE);
+	session[fd]->wdata = socket_fifo_get(WFIFO_SIZE);
 	session[fd]->max_rdata  = RFIFO_SIZE;
 	session[fd]->max_wdata  = WFIFO_SIZE;
 	session[fd]->func_recv  = func_recv;
@@ -605,12 +1063,17 @@ static int create_session(int fd, RecvFunc func_recv, SendFunc func_send, ParseF
 static void delete_session(int fd)
 {
 	if( session_isValid(fd) ) {
+#ifdef SEND_SHAREDBUF
+		socket_wbuf_clear(session[fd]);
+		if( session[fd]->wbuf )
+			aFree(session[fd]->wbuf);
+#endif
 #ifdef SHOW_SERVER_STATS
 		socket_data_qi -= session[fd]->rdata_size - session[fd]->rdata_pos;
 		socket_data_qo -= session[fd]->wdata_size;
 #endif
-		aFree(session[fd]->rdata);
-		aFree(session[fd]->wdata);
+		socket_fifo_put(session[fd]->rdata, session[fd]->max_rdata);
+		socket_fifo_put(session[fd]->wdata, session[fd]->max_wdata);
 		aFree(session[fd]->session_data);
 		aFree(session[fd]);
 		session[fd] = NULL;
@@ -622,13 +1085,16 @@ int realloc_fifo(int fd, unsigned int rfifo_size, unsigned int wfifo_size)
 	if( !session_isValid(fd) )
 		return 0;
 
+	rfifo_size = (unsigned int)socket_fifo_size(rfifo_size);
+	wfifo_size = (unsigned int)socket_fifo_size(wfifo_size);
+
 	if( session[fd]->max_rdata != rfifo_size && session[fd]->rdata_size < rfifo_size) {
-		RECREATE(session[fd]->rdata, unsigned char, rfifo_size);
+		session[fd]->rdata = socket_fifo_resize(session[fd]->rdata, session[fd]->max_rdata, rfifo_size, session[fd]->rdata_size);
 		session[fd]->max_rdata  = rfifo_size;
 	}
 
 	if( session[fd]->max_wdata != wfifo_size && session[fd]->wdata_size < wfifo_size) {
-		RECREATE(session[fd]->wdata, unsigned char, wfifo_size);
+		session[fd]->wdata = socket_fifo_resize(session[fd]->wdata, session[fd]->max_wdata, wfifo_size, session[fd]->wdata_size);
 		session[fd]->max_wdata  = wfifo_size;
 	}
 	return 0;
@@ -642,20 +1108,19 @@ int realloc_writefifo(int fd, size_t addition)
 		return 0;
 
 	if( session[fd]->wdata_size + addition  > session[fd]->max_wdata )
-	{	// grow rule; grow in multiples of WFIFO_SIZE
-		newsize = WFIFO_SIZE;
-		while( session[fd]->wdata_size + addition > newsize ) newsize += WFIFO_SIZE;
+	{	// grow rule; grow to the size class that fits
+		newsize = socket_fifo_size(session[fd]->wdata_size + addition);
 	}
 	else
 	if( session[fd]->max_wdata >= (size_t)2*(session[fd]->flag.server?FIFOSIZE_SERVERLINK:WFIFO_SIZE)
 		&& (session[fd]->wdata_size+addition)*4 < session[fd]->max_wdata )
 	{	// shrink rule, shrink by 2 when only a quarter of the fifo is used, don't shrink below nominal size.
-		newsize = session[fd]->max_wdata / 2;
+		newsize = socket_fifo_size(session[fd]->max_wdata / 2);
 	}
 	else // no change
 		return 0;
 
-	RECREATE(session[fd]->wdata, unsigned char, newsize);
+	session[fd]->wdata = socket_fifo_resize(session[fd]->wdata, session[fd]->max_wdata, newsize, session[fd]->wdata_size);
 	session[fd]->max_wdata  = newsize;
 
 	return 0;
@@ -718,44 +1183,826 @@ int WFIFOSET(int fd, size_t len)
 		return 0;
 	}
 
-	if( !s->flag.server ) {
+	if( !s->flag.server ) {
+
+		if( len > socket_max_client_packet ) {// see declaration of socket_max_client_packet for details
+			ShowError("WFIFOSET: Dropped too large client packet 0x%04x (length=%u, max=%u).\n", WFIFOW(fd,0), len, socket_max_client_packet);
+			return 0;
+		}
+
+		socket_sent_stats[WFIFOW(fd,0)].count++;
+		socket_sent_stats[WFIFOW(fd,0)].bytes += len;
+	}
+	s->wdata_size += len;
+#ifdef SHOW_SERVER_STATS
+	socket_data_qo += len;
+#endif
+	//If the interserver has 200% of its normal size full, flush the data.
+	if( s->flag.server && s->wdata_size >= 2*FIFOSIZE_SERVERLINK )
+		flush_fifo(fd);
+
+	// always keep a WFIFO_SIZE reserve in the buffer
+	// For inter-server connections, let the reserve be 1/4th of the link size.
+	newreserve = s->flag.server ? FIFOSIZE_SERVERLINK / 4 : WFIFO_SIZE;
+
+	// readjust the buffer to include the chosen reserve
+	realloc_writefifo(fd, newreserve);
+
+#ifdef SEND_SHORTLIST
+	send_shortlist_add_fd(fd);
+#endif
+
+	return 0;
+}
+
+/// Queues a shared buffer for sending (nb->dataLen bytes), after everything written to the wfifo so far.
+/// The session keeps a reference to the buffer until it's sent, so the same buffer
+/// can be queued in any number of sessions without copying the data.
+void WFIFOSHARE(int fd, netbuf nb)
+{
+	struct socket_data* s = session[fd];
+	size_t len = (size_t)nb->dataLen;
+
+	if( fd <= 0 || !session_isValid(fd) || s->wdata == NULL )
+		return;// session[0] is never flushed
+
+	if( len == 0 )
+		return;
+
+	if( !s->flag.server && len > socket_max_client_packet ) {// see declaration of socket_max_client_packet for details
+		ShowError("WFIFOSHARE: Dropped too large client packet 0x%04x (length=%u, max=%u).\n", NBUFW(nb,0), len, socket_max_client_packet);
+		return;
+	}
+
+#ifdef SEND_SHAREDBUF
+	if( !s->flag.server ) {
+		socket_sent_stats[NBUFW(nb,0)].count++;
+		socket_sent_stats[NBUFW(nb,0)].bytes += len;
+	}
+	if( s->wbuf_count == s->max_wbuf ) {
+		s->max_wbuf = ( s->max_wbuf ? s->max_wbuf*2 : 16 );
+		RECREATE(s->wbuf, struct socket_wbuf, s->max_wbuf);
+	}
+	netbuffer_incref(nb);
+	s->wbuf[s->wbuf_count].nb = nb;
+	s->wbuf[s->wbuf_count].mark = s->wdata_size;
+	s->wbuf_count++;
+#ifdef SHOW_SERVER_STATS
+	socket_data_qo += len;
+#endif
+
+#ifdef SEND_SHORTLIST
+	send_shortlist_add_fd(fd);
+#endif
+#else
+	// no gathering writes, copy it to the wfifo
+	WFIFOHEAD(fd, len);
+	memcpy(WFIFOP(fd,0), nb->buf, len);
+	WFIFOSET(fd, len);
+#endif
+}
+
+#ifdef SEND_SHAREDBUF
+/// Fills iov with the send queue (wfifo data and shared buffers, in sending order).
+/// @param partial set to true if the queue didn't fit in SOCKET_IOV_MAX entries
+/// @return number of entries used, at most SOCKET_IOV_MAX
+static int socket_wbuf_iov(struct socket_data* s, struct iovec* iov, bool* partial)
+{
+	size_t pos = 0, first = s->wbuf_pos;
+	int i, n = 0;
+
+	for( i = 0; i < s->wbuf_count && n < SOCKET_IOV_MAX - 1; ++i )
+	{
+		struct socket_wbuf* b = &s->wbuf[i];
+
+		if( b->mark > pos ) {// wfifo data in front of the buffer
+			iov[n].iov_base = s->wdata + pos;
+			iov[n].iov_len = b->mark - pos;
+			n++;
+			pos = b->mark;
+		}
+		iov[n].iov_base = b->nb->buf + first;
+		iov[n].iov_len = b->nb->dataLen - first;
+		n++;
+		first = 0;
+	}
+	if( i == s->wbuf_count && s->wdata_size > pos ) {// wfifo data behind the last buffer
+		iov[n].iov_base = s->wdata + pos;
+		iov[n].iov_len = s->wdata_size - pos;
+		n++;
+	}
+	*partial = ( i < s->wbuf_count );
+	return n;
+}
+
+/// Drops everything queued for sending.
+static void socket_wbuf_clear(struct socket_data* s)
+{
+	int i;
+
+#ifdef SHOW_SERVER_STATS
+	socket_data_qo -= s->wdata_size;
+#endif
+	s->wdata_size = 0;
+	for( i = 0; i < s->wbuf_count; ++i ) {
+#ifdef SHOW_SERVER_STATS
+		socket_data_qo -= s->wbuf[i].nb->dataLen - (i == 0 ? s->wbuf_pos : 0);
+#endif
+		netbuffer_put(s->wbuf[i].nb);
+	}
+	s->wbuf_count = 0;
+	s->wbuf_pos = 0;
+}
+
+/// Removes the first len bytes of the send queue (wfifo data and shared buffers, in sending order).
+static void socket_wbuf_consume(struct socket_data* s, size_t len)
+{
+	size_t wpos = 0;// wfifo bytes sent
+	int i = 0;
+
+#ifdef SHOW_SERVER_STATS
+	socket_data_qo -= len;
+#endif
+	while( len > 0 && i < s->wbuf_count )
+	{
+		struct socket_wbuf* b = &s->wbuf[i];
+		size_t n;
+
+		if( wpos < b->mark ) {// wfifo data in front of the buffer
+			n = min(b->mark - wpos, len);
+			wpos += n;
+			len -= n;
+			continue;
+		}
+
+		n = min((size_t)b->nb->dataLen - s->wbuf_pos, len);
+		s->wbuf_pos += n;
+		len -= n;
+		if( s->wbuf_pos < (size_t)b->nb->dataLen )
+			break;// partially sent
+
+		netbuffer_put(b->nb);
+		s->wbuf_pos = 0;
+		++i;
+	}
+	wpos += len;// wfifo data behind the last buffer
+
+	if( i > 0 ) {
+		s->wbuf_count -= i;
+		memmove(s->wbuf, s->wbuf + i, s->wbuf_count*sizeof(struct socket_wbuf));
+	}
+
+	if( wpos > 0 ) {
+		if( wpos < s->wdata_size )
+			memmove(s->wdata, s->wdata + wpos, s->wdata_size - wpos);
+		s->wdata_size -= wpos;
+		for( i = 0; i < s->wbuf_count; ++i )
+			s->wbuf[i].mark -= wpos;
+	}
+}
+#endif
+
+#ifdef SOCKET_EPOLL
+/// Adds a fd to the list, if it isn't there already.
+static void socket_fdlist_add(struct socket_fdlist* list, int fd)
+{
+	int i = fd/32;
+	int bit = fd%32;
+
+	if( fd <= 0 || fd >= MAXCONN )
+		return;// out of range
+	if( (list->set[i]>>bit)&1 )
+		return;// already in the list
+
+	list->set[i] |= 1<<bit;
+	list->array[list->cur][list->count[list->cur]++] = fd;
+}
+
+/// Takes all fds currently in the list for processing.
+/// Fds added afterwards are kept for the next call.
+/// @return number of fds in *fds
+static int socket_fdlist_take(struct socket_fdlist* list, int** fds)
+{
+	int i, n = list->count[list->cur];
+
+	*fds = list->array[list->cur];
+	for( i = 0; i < n; ++i )
+		list->set[(*fds)[i]/32] &= ~(1<<((*fds)[i]%32));
+
+	list->cur ^= 1;
+	list->count[list->cur] = 0;
+	return n;
+}
+
+/// Timeout checks, done once per second since rdata_tick has a resolution of seconds.
+/// Stalled server links are queued for parsing so they get to send their ping.
+static void socket_stall_check(void)
+{
+	int i;
+
+	for( i = 1; i < fd_max; i++ )
+	{
+		if( !session[i] || !session[i]->rdata_tick || DIFF_TICK(last_tick, session[i]->rdata_tick) <= stall_time )
+			continue;
+
+		if( session[i]->flag.server ) {/* server is special */
+			if( session[i]->flag.ping != 2 )/* only update if necessary otherwise it'd resend the ping unnecessarily */
+				session[i]->flag.ping = 1;
+			socket_fdlist_add(&socket_parselist, i);
+		} else {
+			ShowInfo("Session #%d timed out\n", i);
+			set_eof(i);
+		}
+	}
+}
+#endif
+
+#ifdef SOCKET_IOTHREADS
+/*======================================
+ *	CORE : Network I/O threads
+ *--------------------------------------
+ * Accepted connections are spread over the io threads, each with its own epoll instance.
+ * The io threads recv into chunks and pass them to the logic thread, which copies them
+ * into the rfifo before parsing. Data in the wfifo is copied into chunks and sent by the io thread.
+ * Chunks travel through a pair of SPSC rings per io thread, so the only lock is the
+ * one of the free list the chunks are recycled through.
+ * Chunks are allocated with the system allocator, the memory manager is not thread-safe.
+ */
+
+static struct socket_io_chunk* socket_io_chunk_get(int cmd, int fd, uint32 serial)
+{
+	struct socket_io_chunk* c;
+
+	EnterSpinLock(&socket_io_freelock);
+	if( (c = socket_io_freelist) != NULL ) {
+		socket_io_freelist = c->next;
+		socket_io_freecount--;
+	}
+	LeaveSpinLock(&socket_io_freelock);
+
+	if( c == NULL && (c = (struct socket_io_chunk*)malloc(sizeof(struct socket_io_chunk))) == NULL ) {
+		ShowFatalError("socket_io_chunk_get: out of memory!\n");
+		exit(EXIT_FAILURE);
+	}
+
+	c->next = NULL;
+	c->cmd = cmd;
+	c->fd = fd;
+	c->serial = serial;
+	c->len = c->pos = 0;
+#ifdef SEND_SHAREDBUF
+	c->nb = NULL;
+#endif
+	return c;
+}
+
+static void socket_io_chunk_put(struct socket_io_chunk* c)
+{
+#ifdef SEND_SHAREDBUF
+	if( c->nb ) {
+		netbuffer_put(c->nb);
+		c->nb = NULL;
+	}
+#endif
+	EnterSpinLock(&socket_io_freelock);
+	if( socket_io_freecount < SOCKET_IO_MAXFREE ) {
+		c->next = socket_io_freelist;
+		socket_io_freelist = c;
+		socket_io_freecount++;
+		c = NULL;
+	}
+	LeaveSpinLock(&socket_io_freelock);
+
+	if( c != NULL )
+		free(c);
+}
+
+static void socket_io_wakeup(int wake_fd)
+{
+	uint64 one = 1;
+
+	if( write(wake_fd, &one, sizeof(one)) != sizeof(one) && errno != EAGAIN )
+		ShowError("socket_io_wakeup: unable to signal the event notifier (%s)!\n", error_msg());
+	// EAGAIN: counter overflow, the other side is awake anyway
+}
+
+/// Passes a message to the logic thread (io thread side).
+static void socket_io_post(struct socket_io_thread* t, struct socket_io_chunk* c)
+{
+	while( !SPSCRingPush(&t->out, c) )
+	{// ring is full, wait for the logic thread to catch up
+		socket_io_wakeup(socket_io_wake_fd);
+		rathread_yield();
+	}
+}
+
+/// Reports a closed/failed connection to the logic thread (io thread side).
+static void socket_io_seteof(struct socket_io_thread* t, int fd)
+{
+	struct socket_io_fd* s = &t->fds[fd];
+	struct socket_io_chunk* c;
+
+	if( s->eof )
+		return;
+	s->eof = true;
+
+	// nothing more can be sent
+	while( (c = s->sendq) != NULL ) {
+		s->sendq = c->next;
+		socket_io_chunk_put(c);
+	}
+	s->sendq_last = NULL;
+
+	socket_io_post(t, socket_io_chunk_get(SOCKET_IO_EOF, fd, s->serial));
+}
+
+/// Reads everything the socket has (io thread side).
+/// @return true if something was passed to the logic thread
+static bool socket_io_recv(struct socket_io_thread* t, int fd)
+{
+	struct socket_io_fd* s = &t->fds[fd];
+	bool posted = false;
+
+	while( s->active && !s->eof )
+	{
+		struct socket_io_chunk* c = socket_io_chunk_get(SOCKET_IO_DATA, fd, s->serial);
+		int len = sRecv(fd, (char*)c->data, SOCKET_IO_CHUNKSIZE, 0);
+
+		if( len > 0 ) {
+			c->len = len;
+			socket_io_post(t, c);
+			posted = true;
+			if( len < SOCKET_IO_CHUNKSIZE )
+				break;// drained, edge triggered so we'll be told when there's more
+			continue;
+		}
+		socket_io_chunk_put(c);
+		if( len == 0 || sErrno != S_EWOULDBLOCK ) {
+			socket_io_seteof(t, fd);
+			posted = true;
+		}
+		break;
+	}
+	return posted;
+}
+
+/// Sends queued chunks until the socket would block (io thread side).
+/// @return true if something was passed to the logic thread
+static bool socket_io_flush(struct socket_io_thread* t, int fd)
+{
+	struct socket_io_fd* s = &t->fds[fd];
+	struct socket_io_chunk* c;
+
+	while( (c = s->sendq) != NULL )
+	{
+		const uint8* data = c->data;
+		int len;
+
+#ifdef SEND_SHAREDBUF
+		if( c->nb )
+			data = (const uint8*)c->nb->buf;
+#endif
+		len = sSend(fd, (const char*)data + c->pos, c->len - c->pos, MSG_NOSIGNAL|(send_coalesce && c->next ? MSG_MORE : 0));
+		__atomic_store_n(&t->send_calls, t->send_calls + 1, __ATOMIC_RELAXED);
+
+		if( len == SOCKET_ERROR ) {
+			if( sErrno == S_EWOULDBLOCK )
+				break;// socket buffer is full, EPOLLOUT tells us when to continue
+			socket_io_seteof(t, fd);
+			return true;
+		}
+		__atomic_store_n(&t->send_bytes, t->send_bytes + len, __ATOMIC_RELAXED);
+		c->pos += len;
+		if( c->pos < c->len )
+			break;
+
+		s->sendq = c->next;
+		if( s->sendq == NULL )
+			s->sendq_last = NULL;
+		socket_io_chunk_put(c);
+	}
+	return false;
+}
+
+/// Handles the commands of the logic thread (io thread side).
+/// @return true if something was passed to the logic thread
+static bool socket_io_commands(struct socket_io_thread* t)
+{
+	struct socket_io_chunk* c;
+	bool posted = false;
+	int i;
+
+	while( (c = (struct socket_io_chunk*)SPSCRingPop(&t->in)) != NULL )
+	{
+		struct socket_io_fd* s = &t->fds[c->fd];
+
+		switch( c->cmd ) {
+		case SOCKET_IO_ADD:
+			{
+				struct epoll_event ev;
+				bool flush = s->flush;// might still be in flush_array from the previous connection
+
+				memset(s, 0, sizeof(*s));
+				s->flush = flush;
+				s->serial = c->serial;
+				s->active = true;
+
+				ev.events = EPOLLET|EPOLLIN|EPOLLOUT|EPOLLHUP;
+				ev.data.fd = c->fd;
+				if( epoll_ctl(t->epoll_fd, EPOLL_CTL_ADD, c->fd, &ev) != 0 ) {
+					socket_io_seteof(t, c->fd);
+					posted = true;
+				}
+				socket_io_chunk_put(c);
+			}
+			break;
+		case SOCKET_IO_SEND:
+			if( !s->active || s->eof || s->serial != c->serial ) {
+				socket_io_chunk_put(c);
+				break;
+			}
+			if( s->sendq_last )
+				s->sendq_last->next = c;
+			else
+				s->sendq = c;
+			s->sendq_last = c;
+			if( !s->flush ) {// send once all commands are handled
+				s->flush = true;
+				t->flush_array[t->flush_count++] = c->fd;
+			}
+			break;
+		case SOCKET_IO_CLOSE:
+			if( s->active && s->serial == c->serial ) {
+				struct socket_io_chunk* q;
+
+				if( !s->eof )
+					socket_io_flush(t, c->fd);// best effort
+				epoll_ctl(t->epoll_fd, EPOLL_CTL_DEL, c->fd, NULL);
+
+				while( (q = s->sendq) != NULL ) {// what couldn't be sent
+					s->sendq = q->next;
+					socket_io_chunk_put(q);
+				}
+				s->sendq_last = NULL;
+				s->active = false;
+
+				// last, the fd can be handed out again as soon as it's closed
+				sShutdown(c->fd, SHUT_RDWR);
+				sClose(c->fd);
+			}
+			socket_io_chunk_put(c);
+			break;
+		default:
+			socket_io_chunk_put(c);
+			break;
+		}
+	}
+
+	for( i = 0; i < t->flush_count; ++i ) {
+		int fd = t->flush_array[i];
+
+		t->fds[fd].flush = false;
+		if( t->fds[fd].active && socket_io_flush(t, fd) )
+			posted = true;
+	}
+	t->flush_count = 0;
+
+	return posted;
+}
+
+static void* socket_io_main(void* param)
+{
+	struct socket_io_thread* t = (struct socket_io_thread*)param;
+	struct epoll_event events[256];
+
+	while( !socket_io_terminate )
+	{
+		bool posted = false;
+		int i, n;
+
+		n = epoll_wait(t->epoll_fd, events, ARRAYLENGTH(events), -1);
+		for( i = 0; i < n; ++i )
+		{
+			int fd = events[i].data.fd;
+
+			if( fd == t->wake_fd ) {
+				uint64 count;
+				while( read(t->wake_fd, &count, sizeof(count)) > 0 );// reset
+				continue;
+			}
+			if( events[i].events&(EPOLLIN|EPOLLHUP|EPOLLERR) )
+				posted |= socket_io_recv(t, fd);
+			if( (events[i].events&EPOLLOUT) && t->fds[fd].active && !t->fds[fd].eof )
+				posted |= socket_io_flush(t, fd);
+		}
+
+		posted |= socket_io_commands(t);
+
+		if( posted )
+			socket_io_wakeup(socket_io_wake_fd);
+	}
+
+	socket_io_commands(t);// close what's left
+	return NULL;
+}
+
+/// Passes a command to the io thread owning the socket (logic thread side).
+static void socket_io_command(int fd, struct socket_io_chunk* c)
+{
+	struct socket_io_thread* t = &socket_io[socket_io_owner[fd]-1];
+
+	while( !SPSCRingPush(&t->in, c) )
+	{// ring is full, let the io thread catch up
+		socket_io_wakeup(t->wake_fd);
+		socket_io_dispatch();// it might be waiting for room in its own ring
+		rathread_yield();
+	}
+	t->dirty = true;
+}
+
+/// Wakes up the io threads that got new commands (logic thread side).
+static void socket_io_wakeall(void)
+{
+	int i;
+
+	for( i = 0; i < socket_io_threads; ++i )
+	{
+		if( socket_io[i].dirty ) {
+			socket_io[i].dirty = false;
+			socket_io_wakeup(socket_io[i].wake_fd);
+		}
+	}
+}
+
+/// Passes wfifo data to the io thread (logic thread side).
+static void socket_io_sendcopy(int fd, const uint8* data, size_t size)
+{
+	size_t pos, len;
+
+	for( pos = 0; pos < size; pos += len )
+	{
+		struct socket_io_chunk* c = socket_io_chunk_get(SOCKET_IO_SEND, fd, socket_io_serial[fd]);
+
+		len = min(size - pos, SOCKET_IO_CHUNKSIZE);
+		memcpy(c->data, data + pos, len);
+		c->len = (uint32)len;
+		socket_io_command(fd, c);
+	}
+}
+
+/// Send function of sessions that are handled by an io thread.
+static int socket_io_send(int fd)
+{
+	struct socket_data* s;
+	size_t total;
+
+	if( !session_isValid(fd) || !socket_io_owner[fd] )
+		return -1;
+
+	s = session[fd];
+	total = s->wdata_size;
+#ifdef SEND_SHAREDBUF
+	if( s->wbuf_count > 0 )
+	{// the references of the session are handed over to the io thread
+		size_t pos = 0;
+		int i;
+
+		for( i = 0; i < s->wbuf_count; ++i )
+		{
+			struct socket_io_chunk* c;
+
+			socket_io_sendcopy(fd, s->wdata + pos, s->wbuf[i].mark - pos);
+			pos = s->wbuf[i].mark;
+
+			c = socket_io_chunk_get(SOCKET_IO_SEND, fd, socket_io_serial[fd]);
+			c->nb = s->wbuf[i].nb;
+			c->len = (uint32)c->nb->dataLen;
+			c->pos = (uint32)( i == 0 ? s->wbuf_pos : 0 );
+			total += c->len - c->pos;
+			socket_io_command(fd, c);
+		}
+		socket_io_sendcopy(fd, s->wdata + pos, s->wdata_size - pos);
+		s->wbuf_count = 0;
+		s->wbuf_pos = 0;
+	}
+	else
+#endif
+	socket_io_sendcopy(fd, s->wdata, s->wdata_size);
+#ifdef SHOW_SERVER_STATS
+	socket_data_o += total;
+	socket_data_qo -= total;
+	if( !s->flag.server ) {
+		socket_data_co += total;
+	}
+#endif
+	s->wdata_size = 0;
+	socket_wfifo_shrink(s);
+	return 0;
+}
+
+/// Hands an accepted socket over to an io thread (logic thread side).
+static void socket_io_add(int fd)
+{
+	int owner = socket_io_next;
+
+	socket_io_next = (socket_io_next + 1)%socket_io_threads;
+
+	evdp_remove(fd, &socket_evdp[fd]);
+	session[fd]->func_recv = null_recv;
+	session[fd]->func_send = socket_io_send;
+
+	socket_io_owner[fd] = owner + 1;
+	socket_io_serial[fd]++;
+	socket_io_command(fd, socket_io_chunk_get(SOCKET_IO_ADD, fd, socket_io_serial[fd]));
+}
+
+/// Tells the io thread to close the socket and forgets about it (logic thread side).
+static void socket_io_close(int fd)
+{
+	struct socket_io_chunk* c;
+
+	socket_io_command(fd, socket_io_chunk_get(SOCKET_IO_CLOSE, fd, socket_io_serial[fd]));
+	socket_io_owner[fd] = 0;
+
+	while( (c = socket_io_pending[fd]) != NULL ) {
+		socket_io_pending[fd] = c->next;
+		socket_io_chunk_put(c);
+	}
+	socket_io_pending_last[fd] = NULL;
+	socket_io_pending_size[fd] = 0;
+}
+
+/// Moves received data into the rfifo, as much as there is room for (logic thread side).
+static void socket_io_fill(int fd)
+{
+	struct socket_data* s = session[fd];
+	struct socket_io_chunk* c;
+
+	while( (c = socket_io_pending[fd]) != NULL )
+	{
+		size_t len = min(c->len - c->pos, RFIFOSPACE(fd));
+
+		if( len == 0 )
+			break;// rfifo is full
+		memcpy(s->rdata + s->rdata_size, c->data + c->pos, len);
+		s->rdata_size += len;
+		c->pos += (uint32)len;
+		socket_io_pending_size[fd] -= len;
+		if( c->pos < c->len )
+			break;// rfifo is full
+
+		socket_io_pending[fd] = c->next;
+		if( socket_io_pending[fd] == NULL )
+			socket_io_pending_last[fd] = NULL;
+		socket_io_chunk_put(c);
+	}
+
+	if( !s->flag.server && socket_io_pending_size[fd] > SOCKET_IO_MAXPENDING ) {
+		ShowWarning("socket_io_fill: Session #%d is sending more data than it can process, closing connection.\n", fd);
+		set_eof(fd);
+	}
+}
+
+/// Handles the messages of the io threads (logic thread side).
+static void socket_io_dispatch(void)
+{
+	struct socket_io_chunk* c;
+	int i;
+
+	for( i = 0; i < socket_io_threads; ++i )
+	{
+		while( (c = (struct socket_io_chunk*)SPSCRingPop(&socket_io[i].out)) != NULL )
+		{
+			int fd = c->fd;
+
+			if( socket_io_owner[fd] != i + 1 || socket_io_serial[fd] != c->serial || !session_isActive(fd) ) {
+				socket_io_chunk_put(c);// message of a closed connection
+				continue;
+			}
+
+			if( c->cmd == SOCKET_IO_EOF ) {
+				set_eof(fd);
+				socket_io_chunk_put(c);
+				continue;
+			}
+
+			session[fd]->rdata_tick = last_tick;
+#ifdef SHOW_SERVER_STATS
+			socket_data_i += c->len;
+			socket_data_qi += c->len;
+			if( !session[fd]->flag.server ) {
+				socket_data_ci += c->len;
+			}
+#endif
+			if( socket_io_pending_last[fd] )
+				socket_io_pending_last[fd]->next = c;
+			else
+				socket_io_pending[fd] = c;
+			socket_io_pending_last[fd] = c;
+			socket_io_pending_size[fd] += c->len;
+
+			socket_io_fill(fd);
+			socket_fdlist_add(&socket_parselist, fd);
+		}
+	}
+}
+
+static void socket_io_init(void)
+{
+	int i;
 
-		if( len > socket_max_client_packet ) {// see declaration of socket_max_client_packet for details
-			ShowError("WFIFOSET: Dropped too large client packet 0x%04x (length=%u, max=%u).\n", WFIFOW(fd,0), len, socket_max_client_packet);
-			return 0;
+	InitializeSpinLock(&socket_io_freelock);
+	socket_io_terminate = 0;
+
+	socket_io_wake_fd = eventfd(0, EFD_NONBLOCK);
+	if( socket_io_wake_fd == -1 || socket_io_wake_fd >= MAXCONN || !evdp_addclient(socket_io_wake_fd, &socket_evdp[socket_io_wake_fd]) ) {
+		ShowFatalError("socket_io_init: unable to create the event notifier (%s)!\n", error_msg());
+		exit(EXIT_FAILURE);
+	}
+
+	for( i = 0; i < socket_io_threads; ++i )
+	{
+		struct socket_io_thread* t = &socket_io[i];
+		struct epoll_event ev;
+
+		InitializeSPSCRing(&t->in, SOCKET_IO_RINGSIZE);
+		InitializeSPSCRing(&t->out, SOCKET_IO_RINGSIZE);
+		CREATE(t->fds, struct socket_io_fd, MAXCONN);
+		CREATE(t->flush_array, int, MAXCONN);
+		t->flush_count = 0;
+		t->dirty = false;
+
+		t->epoll_fd = epoll_create(1024);
+		t->wake_fd = eventfd(0, EFD_NONBLOCK);
+		ev.events = EPOLLET|EPOLLIN;
+		ev.data.fd = t->wake_fd;
+		if( t->epoll_fd == -1 || t->wake_fd == -1 || epoll_ctl(t->epoll_fd, EPOLL_CTL_ADD, t->wake_fd, &ev) != 0 ) {
+			ShowFatalError("socket_io_init: unable to set up io thread #%d (%s)!\n", i, error_msg());
+			exit(EXIT_FAILURE);
 		}
 
+		t->thread = rathread_createEx(socket_io_main, t, 1024*1024, RAT_PRIO_HIGH);
+		if( t->thread == NULL ) {
+			ShowFatalError("socket_io_init: unable to start io thread #%d!\n", i);
+			exit(EXIT_FAILURE);
+		}
 	}
-	s->wdata_size += len;
-#ifdef SHOW_SERVER_STATS
-	socket_data_qo += len;
-#endif
-	//If the interserver has 200% of its normal size full, flush the data.
-	if( s->flag.server && s->wdata_size >= 2*FIFOSIZE_SERVERLINK )
-		flush_fifo(fd);
 
-	// always keep a WFIFO_SIZE reserve in the buffer
-	// For inter-server connections, let the reserve be 1/4th of the link size.
-	newreserve = s->flag.server ? FIFOSIZE_SERVERLINK / 4 : WFIFO_SIZE;
+	ShowInfo("Using '"CL_WHITE"%d"CL_RESET"' network I/O threads.\n", socket_io_threads);
+}
 
-	// readjust the buffer to include the chosen reserve
-	realloc_writefifo(fd, newreserve);
+static void socket_io_final(void)
+{
+	struct socket_io_chunk* c;
+	int i;
 
-#ifdef SEND_SHORTLIST
-	send_shortlist_add_fd(fd);
-#endif
+	InterlockedExchange(&socket_io_terminate, 1);
+	for( i = 0; i < socket_io_threads; ++i )
+		socket_io_wakeup(socket_io[i].wake_fd);
 
-	return 0;
+	for( i = 0; i < socket_io_threads; ++i )
+	{
+		struct socket_io_thread* t = &socket_io[i];
+
+		rathread_wait(t->thread, NULL);
+		while( (c = (struct socket_io_chunk*)SPSCRingPop(&t->out)) != NULL )
+			socket_io_chunk_put(c);
+		FinalizeSPSCRing(&t->in);
+		FinalizeSPSCRing(&t->out);
+		aFree(t->fds);
+		aFree(t->flush_array);
+		close(t->epoll_fd);
+		close(t->wake_fd);
+	}
+
+	evdp_remove(socket_io_wake_fd, &socket_evdp[socket_io_wake_fd]);
+	close(socket_io_wake_fd);
+	socket_io_wake_fd = -1;
+
+	while( (c = socket_io_freelist) != NULL ) {
+		socket_io_freelist = c->next;
+		free(c);
+	}
+	socket_io_freecount = 0;
+	FinalizeSpinLock(&socket_io_freelock);
 }
+#endif
 
 int do_sockets(int next)
 {
+#ifdef SOCKET_EPOLL
+	int* fds;
+	int n;
+	bool evdp_ready = true;
+#else
 	fd_set rfd;
 	struct timeval timeout;
+#endif
 	int ret,i;
 
 	// PRESEND Timers are executed before do_sendrecv and can send packets and/or set sessions to eof.
 	// Send remaining data and process client-side disconnects here.
+	tick_phase(TICK_PHASE_SEND);
 #ifdef SEND_SHORTLIST
 	send_shortlist_do_sends();
 #else
@@ -764,16 +2011,64 @@ int do_sockets(int next)
 		if(!session[i])
 			continue;
 
-		if(session[i]->wdata_size)
+		if(SESSION_WPENDING(session[i]))
 			session[i]->func_send(i);
 	}
 #endif
+#ifdef SOCKET_IOTHREADS
+	socket_io_wakeall();// let the io threads send while we wait
+#endif
+
+#ifdef SOCKET_EPOLL
+	// can timeout until the next tick, unless there is still input waiting to be handled
+	if( socket_readlist.count[socket_readlist.cur] || socket_parselist.count[socket_parselist.cur] )
+		next = 0;
+
+	tick_phase(TICK_PHASE_POLL);
+
+#ifdef SOCKET_URING
+	if( socket_uring_active ) {// the ring waits for the client connections and for the event dispatcher
+		evdp_ready = socket_uring_wait(next);
+		next = 0;
+	}
+#endif
+	while( evdp_ready ) {
+		ret = evdp_wait(socket_events, SOCKET_EVENTS_PER_CYCLE, next);
+		for( i = 0; i < ret; ++i )
+		{
+#ifdef SOCKET_IOTHREADS
+			if( socket_events[i].fd == socket_io_wake_fd ) {
+				uint64 count;
+				while( read(socket_io_wake_fd, &count, sizeof(count)) > 0 );// reset
+				continue;
+			}
+#endif
+			socket_fdlist_add(&socket_readlist, socket_events[i].fd);
+		}
+		next = 0;
+		evdp_ready = ( ret == SOCKET_EVENTS_PER_CYCLE );
+	}
+
+	last_tick = time(NULL);
+	tick_phase(TICK_PHASE_RECV);
 
+	n = socket_fdlist_take(&socket_readlist, &fds);
+	for( i = 0; i < n; ++i )
+	{
+		if( session[fds[i]] )
+			session[fds[i]]->func_recv(fds[i]);
+	}
+#ifdef SOCKET_IOTHREADS
+	if( socket_io_threads > 0 )
+		socket_io_dispatch();
+#endif
+#else
 	// can timeout until the next tick
 	timeout.tv_sec  = next/1000;
 	timeout.tv_usec = next%1000*1000;
 
 	memcpy(&rfd, &readfds, sizeof(rfd));
+	tick_phase(TICK_PHASE_POLL);
 	ret = sSelect(fd_max, &rfd, NULL, NULL, &timeout);
 
 	if( ret == SOCKET_ERROR )
@@ -787,6 +2082,7 @@ int do_sockets(int next)
 	}
 
 	last_tick = time(NULL);
+	tick_phase(TICK_PHASE_RECV);
 
 #if defined(WIN32)
 	// on windows, enumerating all members of the fd_set is way faster if we access the internals
@@ -807,17 +2103,20 @@ int do_sockets(int next)
 		}
 	}
 #endif
+#endif // SOCKET_EPOLL
 
 	// POSTSEND Send remaining data and handle eof sessions.
+	// With send_coalesce the sessions are only flushed in PRESEND, once per tick.
+	tick_phase(TICK_PHASE_SEND);
 #ifdef SEND_SHORTLIST
-	send_shortlist_do_sends();
+	send_shortlist_do_sends_(!send_coalesce);
 #else
 	for (i = 1; i < fd_max; i++)
 	{
 		if(!session[i])
 			continue;
 
-		if(session[i]->wdata_size)
+		if(!send_coalesce && SESSION_WPENDING(session[i]))
 			session[i]->func_send(i);
 
 		if(session[i]->flag.eof) //func_send can't free a session, this is safe.
@@ -827,7 +2126,60 @@ int do_sockets(int next)
 	}
 #endif
 
+#ifdef SOCKET_EPOLL
+	if( last_tick != socket_stall_last_tick ) {
+		socket_stall_check();
+		socket_stall_last_tick = last_tick;
+	}
+
+	// parse input data on sockets that received something
+	tick_phase(TICK_PHASE_PARSE);
+	n = socket_fdlist_take(&socket_parselist, &fds);
+	for( i = 0; i < n; ++i )
+	{
+		int fd = fds[i];
+		size_t rest;
+		bool parsed;
+
+		if( !session[fd] )
+			continue;
+
+		rest = RFIFOREST(fd);
+		if( slow_tick_budget ) {
+			uint64 start = gettick_us();
+			session[fd]->func_parse(fd);
+			tick_parse(fd, gettick_us() - start);
+		} else
+			session[fd]->func_parse(fd);
+
+		if( !session[fd] )
+			continue;
+
+		// after parse, check client's RFIFO size to know if there is an invalid packet (too big and not parsed)
+		if( session[fd]->rdata_size == RFIFO_SIZE && session[fd]->max_rdata == RFIFO_SIZE ) {
+			set_eof(fd);
+			continue;
+		}
+		parsed = ( RFIFOREST(fd) != rest );
+		RFIFOFLUSH(fd);
+		rest = RFIFOREST(fd);
+#ifdef SOCKET_IOTHREADS
+		if( socket_io_pending[fd] )
+			socket_io_fill(fd);
+#endif
+#ifdef SOCKET_URING
+		if( socket_uring_recvop[fd] )
+			socket_uring_fill(fd);
+#endif
+
+		// parsers may leave complete packets for the next tick (e.g. the packet limit of clif_parse),
+		// an incomplete one waits for more data
+		if( RFIFOREST(fd) > 0 && (parsed || RFIFOREST(fd) > rest) )
+			socket_fdlist_add(&socket_parselist, fd);
+	}
+#else
 	// parse input data on each socket
+	tick_phase(TICK_PHASE_PARSE);
 	for(i = 1; i < fd_max; i++)
 	{
 		if(!session[i])
@@ -843,7 +2195,12 @@ int do_sockets(int next)
 			}
 		}
 
-		session[i]->func_parse(i);
+		if( slow_tick_budget ) {
+			uint64 start = gettick_us();
+			session[i]->func_parse(i);
+			tick_parse(i, gettick_us() - start);
+		} else
+			session[i]->func_parse(i);
 
 		if(!session[i])
 			continue;
@@ -855,12 +2212,17 @@ int do_sockets(int next)
 		}
 		RFIFOFLUSH(i);
 	}
+#endif
+#ifdef SOCKET_IOTHREADS
+	socket_io_wakeall();
+#endif
 
 #ifdef SHOW_SERVER_STATS
 	if (last_tick != socket_data_last_tick) {
 		char buf[1024];
 
 		sprintf(buf, "In: %.03f kB/s (%.03f kB/s, Q: %.03f kB) | Out: %.03f kB/s (%.03f kB/s, Q: %.03f kB) | RAM: %.03f MB", socket_data_i/1024., socket_data_ci/1024., socket_data_qi/1024., socket_data_o/1024., socket_data_co/1024., socket_data_qo/1024., malloc_usage()/1024.);
+		sprintf(buf + strlen(buf), " | FIFO: %.03f MB", socket_fifo_used/1024./1024.);
 #ifdef _WIN32
 		SetConsoleTitle(buf);
 #else
@@ -1113,6 +2475,517 @@ int access_ipmask(const char *str, AccessControl* acc)
 #endif
 //////////////////////////////
 
+#ifdef SOCKET_URING
+/*======================================
+ *	CORE : io_uring backend
+ *--------------------------------------
+ * Client connections aren't watched by epoll, each one has a recv request and
+ * at most one send request in an io_uring instead. Requests are queued while
+ * the tick runs and submitted together with the wait for completions, so a tick
+ * costs a single syscall however many sessions receive or send.
+ * The listeners stay in the event dispatcher, whose descriptor is polled by the ring.
+ * The ring is set up with the raw syscalls (liburing isn't required), kernel 5.11 or newer.
+ */
+#define SOCKET_URING_ENTRIES 4096 // size of the submission queue
+#define SOCKET_URING_RECVMAX (64*1024) // max. size of the recv buffer of a connection
+
+enum socket_uring_optype {
+	SOCKET_URING_RECV,
+	SOCKET_URING_SEND,
+	SOCKET_URING_POLL,
+};
+
+/// Request in the ring, its address is the user_data of the completion.
+/// Requests of closed connections are freed when they complete.
+struct socket_uring_op {
+	enum socket_uring_optype type;
+	int fd;// -1 once the connection is closed
+	bool busy;// submitted (or queued), waiting for the completion
+	// recv: buf[pos,len) was received but didn't fit in the rfifo yet
+	uint8* buf;
+	size_t size, pos, len;
+	// send: send queue taken from the session while the kernel sends it
+	struct socket_data q;
+	struct iovec* iov;
+	struct msghdr msg;
+};
+
+static struct {
+	int fd;
+	unsigned *sq_head, *sq_tail, *sq_mask, *sq_array;
+	unsigned *cq_head, *cq_tail, *cq_mask;
+	struct io_uring_sqe* sqes;
+	struct io_uring_cqe* cqes;
+	unsigned sq_entries;
+	unsigned sq_local_tail;// requests are queued up to here
+	unsigned to_submit;// queued requests the kernel doesn't know about yet
+	void* ring;
+	size_t ring_size, sqes_size;
+	int ops;// requests allocated
+} socket_uring = { -1 };
+static struct socket_uring_op socket_uring_poll;// poll of the event dispatcher
+static bool socket_uring_evdp = false;// the event dispatcher has events
+
+/// Sets up the ring.
+static bool socket_uring_init(void)
+{
+	struct io_uring_params p;
+	void *ring, *sqes;
+	int fd;
+
+	memset(&p, 0, sizeof(p));
+	p.flags = IORING_SETUP_CQSIZE;
+	p.cq_entries = 2*MAXCONN;// a recv and a send per connection
+#ifdef IORING_SETUP_DEFER_TASKRUN
+	// only this thread uses the ring, completion work can wait until it asks for completions (6.1+)
+	p.flags |= IORING_SETUP_SINGLE_ISSUER|IORING_SETUP_DEFER_TASKRUN;
+	fd = (int)syscall(__NR_io_uring_setup, SOCKET_URING_ENTRIES, &p);
+	if( fd < 0 && errno == EINVAL ) {
+		memset(&p, 0, sizeof(p));
+		p.flags = IORING_SETUP_CQSIZE;
+		p.cq_entries = 2*MAXCONN;
+		fd = (int)syscall(__NR_io_uring_setup, SOCKET_URING_ENTRIES, &p);
+	}
+#else
+	fd = (int)syscall(__NR_io_uring_setup, SOCKET_URING_ENTRIES, &p);
+#endif
+	if( fd < 0 ) {
+		ShowWarning("socket_uring_init: io_uring is not available (%s), using epoll.\n", error_msg());
+		return false;
+	}
+	if( !(p.features&IORING_FEAT_SINGLE_MMAP) || !(p.features&IORING_FEAT_NODROP) || !(p.features&IORING_FEAT_EXT_ARG) ) {
+		ShowWarning("socket_uring_init: io_uring of this kernel is too old (5.11 or newer is required), using epoll.\n");
+		close(fd);
+		return false;
+	}
+
+	socket_uring.ring_size = max(p.sq_off.array + p.sq_entries*sizeof(unsigned), p.cq_off.cqes + p.cq_entries*sizeof(struct io_uring_cqe));
+	socket_uring.sqes_size = p.sq_entries*sizeof(struct io_uring_sqe);
+	ring = mmap(NULL, socket_uring.ring_size, PROT_READ|PROT_WRITE, MAP_SHARED|MAP_POPULATE, fd, IORING_OFF_SQ_RING);
+	sqes = mmap(NULL, socket_uring.sqes_size, PROT_READ|PROT_WRITE, MAP_SHARED|MAP_POPULATE, fd, IORING_OFF_SQES);
+	if( ring == MAP_FAILED || sqes == MAP_FAILED ) {
+		ShowWarning("socket_uring_init: unable to map the ring (%s), using epoll.\n", error_msg());
+		if( ring != MAP_FAILED )
+			munmap(ring, socket_uring.ring_size);
+		if( sqes != MAP_FAILED )
+			munmap(sqes, socket_uring.sqes_size);
+		close(fd);
+		return false;
+	}
+
+	socket_uring.fd = fd;
+	socket_uring.ring = ring;
+	socket_uring.sq_head = (unsigned*)((uint8*)ring + p.sq_off.head);
+	socket_uring.sq_tail = (unsigned*)((uint8*)ring + p.sq_off.tail);
+	socket_uring.sq_mask = (unsigned*)((uint8*)ring + p.sq_off.ring_mask);
+	socket_uring.sq_array = (unsigned*)((uint8*)ring + p.sq_off.array);
+	socket_uring.cq_head = (unsigned*)((uint8*)ring + p.cq_off.head);
+	socket_uring.cq_tail = (unsigned*)((uint8*)ring + p.cq_off.tail);
+	socket_uring.cq_mask = (unsigned*)((uint8*)ring + p.cq_off.ring_mask);
+	socket_uring.cqes = (struct io_uring_cqe*)((uint8*)ring + p.cq_off.cqes);
+	socket_uring.sqes = (struct io_uring_sqe*)sqes;
+	socket_uring.sq_entries = p.sq_entries;
+	socket_uring.sq_local_tail = *socket_uring.sq_tail;
+	socket_uring.to_submit = 0;
+	socket_uring.ops = 0;
+
+	memset(&socket_uring_poll, 0, sizeof(socket_uring_poll));
+	socket_uring_poll.type = SOCKET_URING_POLL;
+	socket_uring_poll.fd = evdp_getfd();
+	socket_uring_evdp = false;
+	return true;
+}
+
+static void socket_uring_final(void)
+{
+	if( socket_uring.ops > 0 )
+		ShowWarning("socket_uring_final: %d requests didn't complete.\n", socket_uring.ops);
+	munmap(socket_uring.sqes, socket_uring.sqes_size);
+	munmap(socket_uring.ring, socket_uring.ring_size);
+	close(socket_uring.fd);
+	socket_uring.fd = -1;
+}
+
+/// Submits the queued requests and waits up to timeout milliseconds for a completion (0 = don't wait).
+static void socket_uring_enter(int timeout)
+{
+	struct io_uring_getevents_arg arg;
+	struct __kernel_timespec ts;
+	int ret;
+
+	memset(&arg, 0, sizeof(arg));
+	if( timeout > 0 ) {
+		ts.tv_sec = timeout/1000;
+		ts.tv_nsec = timeout%1000*1000000;
+		arg.ts = (uint64)(uintptr_t)&ts;
+	}
+
+	__atomic_store_n(socket_uring.sq_tail, socket_uring.sq_local_tail, __ATOMIC_RELEASE);
+	ret = (int)syscall(__NR_io_uring_enter, socket_uring.fd, socket_uring.to_submit, (timeout > 0 ? 1 : 0), IORING_ENTER_GETEVENTS|IORING_ENTER_EXT_ARG, &arg, sizeof(arg));
+	if( ret >= 0 )
+		socket_uring.to_submit -= min((unsigned)ret, socket_uring.to_submit);
+	else if( errno != EINTR && errno != ETIME && errno != EAGAIN && errno != EBUSY ) {
+		ShowFatalError("socket_uring_enter: io_uring_enter failed (%s)!\n", error_msg());
+		exit(EXIT_FAILURE);
+	}
+}
+
+/// Queues a request.
+static struct io_uring_sqe* socket_uring_sqe(struct socket_uring_op* op, int opcode, int fd)
+{
+	struct io_uring_sqe* sqe;
+	unsigned idx;
+
+	if( socket_uring.sq_local_tail - __atomic_load_n(socket_uring.sq_head, __ATOMIC_ACQUIRE) >= socket_uring.sq_entries ) {
+		socket_uring_enter(0);// full, submit what is there
+		if( socket_uring.sq_local_tail - __atomic_load_n(socket_uring.sq_head, __ATOMIC_ACQUIRE) >= socket_uring.sq_entries ) {
+			ShowFatalError("socket_uring_sqe: the submission queue is full!\n");
+			exit(EXIT_FAILURE);
+		}
+	}
+
+	idx = socket_uring.sq_local_tail & *socket_uring.sq_mask;
+	sqe = &socket_uring.sqes[idx];
+	memset(sqe, 0, sizeof(*sqe));
+	sqe->opcode = opcode;
+	sqe->fd = fd;
+	sqe->user_data = (uint64)(uintptr_t)op;
+	socket_uring.sq_array[idx] = idx;
+	socket_uring.sq_local_tail++;
+	socket_uring.to_submit++;
+	op->busy = true;
+	return sqe;
+}
+
+/// Queues the next recv of a connection, once the data of the previous one is in the rfifo.
+static void socket_uring_recv_post(struct socket_uring_op* op)
+{
+	struct io_uring_sqe* sqe;
+	size_t size = socket_fifo_size(min(session[op->fd]->max_rdata, SOCKET_URING_RECVMAX));
+
+	if( op->busy || op->pos < op->len )
+		return;
+
+	if( op->size != size ) {// the rfifo was resized
+		socket_fifo_put(op->buf, op->size);
+		op->buf = socket_fifo_get(size);
+		op->size = size;
+	}
+	op->pos = op->len = 0;
+	sqe = socket_uring_sqe(op, IORING_OP_RECV, op->fd);
+	sqe->addr = (uint64)(uintptr_t)op->buf;
+	sqe->len = (uint32)op->size;
+}
+
+/// Queues a send of what is left in the send queue of the request.
+static void socket_uring_send_post(struct socket_uring_op* op)
+{
+	struct io_uring_sqe* sqe;
+	bool partial;
+
+	memset(&op->msg, 0, sizeof(op->msg));
+	op->msg.msg_iov = op->iov;
+	op->msg.msg_iovlen = socket_wbuf_iov(&op->q, op->iov, &partial);
+	sqe = socket_uring_sqe(op, IORING_OP_SENDMSG, op->fd);
+	sqe->addr = (uint64)(uintptr_t)&op->msg;
+	sqe->len = 1;
+	sqe->msg_flags = MSG_NOSIGNAL|(send_coalesce && partial ? MSG_MORE : 0);
+}
+
+static void socket_uring_free(struct socket_uring_op* op)
+{
+	if( op->type == SOCKET_URING_RECV )
+		socket_fifo_put(op->buf, op->size);
+	else {
+		socket_wbuf_clear(&op->q);
+		if( op->q.wbuf )
+			aFree(op->q.wbuf);
+		socket_fifo_put(op->q.wdata, op->q.max_wdata);
+		aFree(op->iov);
+	}
+	aFree(op);
+	socket_uring.ops--;
+}
+
+/// Moves a new connection to the ring.
+static void socket_uring_add(int fd)
+{
+	struct socket_uring_op* op;
+
+	CREATE(op, struct socket_uring_op, 1);
+	op->type = SOCKET_URING_SEND;
+	op->fd = fd;
+	op->q.wdata = socket_fifo_get(WFIFO_SIZE);
+	op->q.max_wdata = WFIFO_SIZE;
+	CREATE(op->iov, struct iovec, SOCKET_IOV_MAX);
+	socket_uring_sendop[fd] = op;
+
+	CREATE(op, struct socket_uring_op, 1);
+	op->type = SOCKET_URING_RECV;
+	op->fd = fd;
+	socket_uring_recvop[fd] = op;
+	socket_uring.ops += 2;
+
+	socket_uring_recv_post(op);
+}
+
+/// Hands the send queue of the session to the kernel (func_send of the connections in the ring).
+/// While a send is pending, new data stays in the session and is sent once it completes.
+static int socket_uring_send(int fd)
+{
+	struct socket_data* s = session[fd];
+	struct socket_uring_op* op = socket_uring_sendop[fd];
+	struct socket_data* q = &op->q;
+	uint8* wdata = q->wdata;
+	size_t max_wdata = q->max_wdata;
+	struct socket_wbuf* wbuf = q->wbuf;
+	int max_wbuf = q->max_wbuf;
+
+	if( op->busy )
+		return 0;
+
+	// the request takes the queue, the session gets the empty buffers of the previous send
+	q->flag.server = s->flag.server;
+	q->wdata = s->wdata;
+	q->max_wdata = s->max_wdata;
+	q->wdata_size = s->wdata_size;
+	q->wbuf = s->wbuf;
+	q->max_wbuf = s->max_wbuf;
+	q->wbuf_count = s->wbuf_count;
+	q->wbuf_pos = s->wbuf_pos;
+	s->wdata = wdata;
+	s->max_wdata = max_wdata;
+	s->wdata_size = 0;
+	s->wbuf = wbuf;
+	s->max_wbuf = max_wbuf;
+	s->wbuf_count = 0;
+	s->wbuf_pos = 0;
+
+	socket_uring_send_post(op);
+	return 0;
+}
+
+/// Moves received data into the rfifo, as much as there is room for.
+/// The next recv is queued once everything was moved.
+static void socket_uring_fill(int fd)
+{
+	struct socket_data* s = session[fd];
+	struct socket_uring_op* op = socket_uring_recvop[fd];
+	size_t len = min(op->len - op->pos, RFIFOSPACE(fd));
+
+	if( len > 0 ) {
+		memcpy(s->rdata + s->rdata_size, op->buf + op->pos, len);
+		s->rdata_size += len;
+		op->pos += len;
+	}
+	if( !s->flag.eof )
+		socket_uring_recv_post(op);
+}
+
+static void socket_uring_complete(struct socket_uring_op* op, int res)
+{
+	int fd = op->fd;
+
+	op->busy = false;
+	if( op->type == SOCKET_URING_POLL ) {
+		socket_uring_evdp = true;
+		return;
+	}
+	if( fd == -1 ) {// connection was closed
+		socket_uring_free(op);
+		return;
+	}
+	if( res == -EAGAIN || res == -EINTR ) {// try again
+		if( op->type == SOCKET_URING_RECV )
+			socket_uring_recv_post(op);
+		else
+			socket_uring_send_post(op);
+		return;
+	}
+
+	if( op->type == SOCKET_URING_RECV )
+	{
+		if( res <= 0 ) {// connection end or error
+			set_eof(fd);
+			return;
+		}
+		op->pos = 0;
+		op->len = (size_t)res;
+		session[fd]->rdata_tick = last_tick;
+#ifdef SHOW_SERVER_STATS
+		socket_data_i += res;
+		socket_data_qi += res;
+		if( !session[fd]->flag.server ) {
+			socket_data_ci += res;
+		}
+#endif
+		socket_uring_fill(fd);
+		socket_fdlist_add(&socket_parselist, fd);
+	}
+	else
+	{
+		if( res < 0 ) {
+			socket_wbuf_clear(&op->q);
+			set_eof(fd);
+			return;
+		}
+		socket_wbuf_consume(&op->q, res);
+		socket_send_calls++;
+		socket_send_bytes += res;
+#ifdef SHOW_SERVER_STATS
+		socket_data_o += res;
+		if( !op->q.flag.server ) {
+			socket_data_co += res;
+		}
+#endif
+		if( SESSION_WPENDING(&op->q) )
+			socket_uring_send_post(op);// partially sent
+		else {
+			socket_wfifo_shrink(&op->q);
+			if( SESSION_WPENDING(session[fd]) )
+				send_shortlist_add_fd(fd);
+		}
+	}
+}
+
+/// Handles the completions that arrived.
+static void socket_uring_reap(void)
+{
+	unsigned head = *socket_uring.cq_head;
+	unsigned tail = __atomic_load_n(socket_uring.cq_tail, __ATOMIC_ACQUIRE);
+
+	while( head != tail )
+	{
+		struct io_uring_cqe* cqe = &socket_uring.cqes[head & *socket_uring.cq_mask];
+
+		++head;
+		socket_uring_complete((struct socket_uring_op*)(uintptr_t)cqe->user_data, cqe->res);
+	}
+	__atomic_store_n(socket_uring.cq_head, head, __ATOMIC_RELEASE);
+}
+
+/// Submits the requests of this tick and waits up to next milliseconds for completions.
+/// @return true if the event dispatcher (listeners) has events
+static bool socket_uring_wait(int next)
+{
+	bool evdp_ready;
+
+	if( !socket_uring_poll.busy ) {
+		struct io_uring_sqe* sqe = socket_uring_sqe(&socket_uring_poll, IORING_OP_POLL_ADD, socket_uring_poll.fd);
+		sqe->poll32_events = POLLIN;
+	}
+	if( *socket_uring.cq_head != __atomic_load_n(socket_uring.cq_tail, __ATOMIC_ACQUIRE) )
+		next = 0;// completions are waiting already
+
+	socket_uring_enter(next);
+	last_tick = time(NULL);
+	socket_uring_reap();
+
+	evdp_ready = socket_uring_evdp;
+	socket_uring_evdp = false;
+	return evdp_ready;
+}
+
+/// Detaches a connection from its requests, before the socket is closed.
+/// Pending requests are freed when they complete, the shutdown of the socket
+/// makes a pending recv complete right away.
+static void socket_uring_close(int fd)
+{
+	struct socket_uring_op* ops[2];
+	bool busy = false;
+	int i;
+
+	ops[0] = socket_uring_recvop[fd];
+	ops[1] = socket_uring_sendop[fd];
+	socket_uring_recvop[fd] = NULL;
+	socket_uring_sendop[fd] = NULL;
+	for( i = 0; i < 2; ++i )
+	{
+		ops[i]->fd = -1;
+		if( ops[i]->busy )
+			busy = true;
+		else
+			socket_uring_free(ops[i]);
+	}
+
+	// queued requests must reach the kernel while the descriptor still refers to this socket,
+	// this also tries to send what is left
+	if( busy && socket_uring.to_submit > 0 )
+		socket_uring_enter(0);
+}
+#endif
+
+/// Switches the client connections opened from now on to the io_uring backend, or back to epoll.
+/// The ring is only released once no connection uses it anymore.
+/// @return true if the backend is in the requested state
+bool socket_uring_enable(bool enable)
+{
+#ifdef SOCKET_URING
+	int i;
+
+	if( enable == socket_uring_active )
+		return true;
+
+	if( enable ) {
+		if( !socket_uring_init() )
+			return false;
+		socket_uring_active = true;
+		ShowInfo("Using io_uring for the client connections.\n");
+		return true;
+	}
+
+	for( i = 1; i < fd_max; ++i ) {
+		if( socket_uring_recvop[i] ) {
+			ShowError("socket_uring_enable: connection #%d still uses io_uring.\n", i);
+			return false;
+		}
+	}
+	// give the requests of closed connections some time to complete
+	for( i = 0; i < 100 && socket_uring.ops > 0; ++i ) {
+		socket_uring_enter(10);
+		socket_uring_reap();
+	}
+	socket_uring_final();
+	socket_uring_active = false;
+	return true;
+#else
+	return !enable;
+#endif
+}
+
+/// Shows the average number of bytes per send syscall (or io_uring send) since the last reset.
+void socket_send_report(bool reset)
+{
+	uint64 calls = socket_send_calls, bytes = socket_send_bytes;
+	unsigned int tick = gettick();
+	double seconds = max(DIFF_TICK(tick, socket_send_tick), 1)/1000.;
+#ifdef SOCKET_IOTHREADS
+	uint64 io_calls[SOCKET_IO_MAXTHREADS], io_bytes[SOCKET_IO_MAXTHREADS];
+	int i;
+
+	for( i = 0; i < socket_io_threads; ++i ) {// the io threads keep counting while we read
+		io_calls[i] = __atomic_load_n(&socket_io[i].send_calls, __ATOMIC_RELAXED);
+		io_bytes[i] = __atomic_load_n(&socket_io[i].send_bytes, __ATOMIC_RELAXED);
+		calls += io_calls[i] - socket_io[i].send_calls_reset;
+		bytes += io_bytes[i] - socket_io[i].send_bytes_reset;
+	}
+#endif
+
+	ShowMessage(CL_BOLD"[Send report]"CL_NORMAL" last %.1f s, send_coalesce %s: %.0f sends (%.1f/s), %.1f KB, %.1f bytes per send\n",
+		seconds, (send_coalesce ? "on" : "off"), (double)calls, calls/seconds, bytes/1024., (calls ? (double)bytes/calls : 0.));
+
+	if( reset ) {
+		socket_send_calls = socket_send_bytes = 0;
+		socket_send_tick = tick;
+#ifdef SOCKET_IOTHREADS
+		for( i = 0; i < socket_io_threads; ++i ) {
+			socket_io[i].send_calls_reset = io_calls[i];
+			socket_io[i].send_bytes_reset = io_bytes[i];
+		}
+#endif
+	}
+}
+
 int socket_config_read(const char *cfgName)
 {
 	char line[1024],w1[1024],w2[1024];
@@ -1168,6 +3041,20 @@ int socket_config_read(const char *cfgName)
 		else if (!strcmpi(w1,"debug"))
 			access_debug = config_switch(w2);
 #endif
+		else if (!strcmpi(w1, "io_threads")) {
+#ifdef SOCKET_IOTHREADS
+			socket_io_threads = cap_value(atoi(w2), 0, SOCKET_IO_MAXTHREADS);
+#endif
+		}
+		else if (!strcmpi(w1, "io_uring")) {
+#ifdef SOCKET_URING
+			socket_uring_config = (config_switch(w2) != 0);
+#endif
+		}
+		else if (!strcmpi(w1, "send_coalesce"))
+			send_coalesce = (config_switch(w2) != 0);
+		else if (!strcmpi(w1, "slow_tick"))
+			slow_tick_budget = (unsigned int)max(0, atoi(w2));
 		else if (!strcmpi(w1, "import"))
 			socket_config_read(w2);
 		else
@@ -1203,23 +3090,51 @@ void socket_final(void)
 	for( i = 1; i < fd_max; i++ )
 		if(session[i])
 			do_close(i);
+#ifdef SOCKET_IOTHREADS
+	if( socket_io_threads > 0 )
+		socket_io_final();
+#endif
+#ifdef SOCKET_URING
+	socket_uring_enable(false);
+#endif
 
 	// session[0]
-	aFree(session[0]->rdata);
-	aFree(session[0]->wdata);
+	socket_fifo_put(session[0]->rdata, session[0]->max_rdata);
+	socket_fifo_put(session[0]->wdata, session[0]->max_wdata);
 	aFree(session[0]->session_data);
 	aFree(session[0]);
 	session[0] = NULL;
+	socket_fifo_final();
+
+#ifdef SOCKET_EPOLL
+	evdp_final();
+#endif
+	netbuffer_final();
 }
 
 /// Closes a socket.
 void do_close(int fd)
 {
-	if( fd <= 0 ||fd >= FD_SETSIZE )
+	if( fd <= 0 ||fd >= MAXCONN )
 		return;// invalid
 
 	flush_fifo(fd); // Try to send what's left (although it might not succeed since it's a nonblocking socket)
+#ifdef SOCKET_URING
+	if( socket_uring_recvop[fd] )
+		socket_uring_close(fd);
+#endif
+#ifdef SOCKET_IOTHREADS
+	if( socket_io_owner[fd] ) {// the io thread closes the socket after sending what's left
+		socket_io_close(fd);
+		if (session[fd]) delete_session(fd);
+		return;
+	}
+#endif
+#ifdef SOCKET_EPOLL
+	evdp_remove(fd, &socket_evdp[fd]);// this needs to be done before closing the socket
+#else
 	sFD_CLR(fd, &readfds);// this needs to be done before closing the socket
+#endif
 	sShutdown(fd, SHUT_RDWR); // Disallow further reads/writes
 	sClose(fd); // We don't really care if these closing functions return an error, we are just shutting down and not reusing this socket.
 	if (session[fd]) delete_session(fd);
@@ -1310,7 +3225,7 @@ int socket_getips(uint32* ips, int max)
 void socket_init(void)
 {
 	char *SOCKET_CONF_FILENAME = "conf/packet_athena.conf";
-	unsigned int rlim_cur = FD_SETSIZE;
+	unsigned int rlim_cur = MAXCONN;
 
 #ifdef WIN32
 	{// Start up windows networking
@@ -1330,14 +3245,14 @@ void socket_init(void)
 #elif defined(HAVE_SETRLIMIT) && !defined(CYGWIN)
 	// NOTE: getrlimit and setrlimit have bogus behaviour in cygwin.
 	//       "Number of fds is virtually unlimited in cygwin" (sys/param.h)
-	{// set socket limit to FD_SETSIZE
+	{// set socket limit to MAXCONN
 		struct rlimit rlp;
 		if( 0 == getrlimit(RLIMIT_NOFILE, &rlp) )
 		{
-			rlp.rlim_cur = FD_SETSIZE;
+			rlp.rlim_cur = MAXCONN;
 			if( 0 != setrlimit(RLIMIT_NOFILE, &rlp) )
 			{// failed, try setting the maximum too (permission to change system limits is required)
-				rlp.rlim_max = FD_SETSIZE;
+				rlp.rlim_max = MAXCONN;
 				if( 0 != setrlimit(RLIMIT_NOFILE, &rlp) )
 				{// failed
 					const char *errmsg = error_msg();
@@ -1350,7 +3265,7 @@ void socket_init(void)
 					// report limit
 					getrlimit(RLIMIT_NOFILE, &rlp);
 					rlim_cur = rlp.rlim_cur;
-					ShowWarning("socket_init: failed to set socket limit to %d, setting to maximum allowed (original limit=%d, current limit=%d, maximum allowed=%d, %s).\n", FD_SETSIZE, rlim_ori, (int)rlp.rlim_cur, (int)rlp.rlim_max, errmsg);
+					ShowWarning("socket_init: failed to set socket limit to %d, setting to maximum allowed (original limit=%d, current limit=%d, maximum allowed=%d, %s).\n", MAXCONN, rlim_ori, (int)rlp.rlim_cur, (int)rlp.rlim_max, errmsg);
 				}
 			}
 		}
@@ -1360,15 +3275,34 @@ void socket_init(void)
 	// Get initial local ips
 	naddr_ = socket_getips(addr_,16);
 
+	netbuffer_init();
+
+#ifdef SOCKET_EPOLL
+	evdp_init();
+	memset(&socket_readlist, 0, sizeof(socket_readlist));
+	memset(&socket_parselist, 0, sizeof(socket_parselist));
+#else
 	sFD_ZERO(&readfds);
+#endif
 #if defined(SEND_SHORTLIST)
 	memset(send_shortlist_set, 0, sizeof(send_shortlist_set));
 #endif
 
 	socket_config_read(SOCKET_CONF_FILENAME);
+#ifdef SOCKET_URING
+	if( socket_uring_config && socket_uring_enable(true) && socket_io_threads > 0 ) {
+		ShowWarning("socket_init: io_threads is ignored when io_uring is used.\n");
+		socket_io_threads = 0;
+	}
+#endif
+#ifdef SOCKET_IOTHREADS
+	if( socket_io_threads > 0 )
+		socket_io_init();
+#endif
 
 	// Initialise last send-receive tick
 	last_tick = time(NULL);
+	socket_send_tick = gettick();
 
 	// session[0] is now currently used for disconnected sessions of the map server, and as such,
 	// Should hold enough buffer (it is a vacuum so to speak) as it is never flushed. [Skotlex]
@@ -1386,7 +3320,7 @@ void socket_init(void)
 
 bool session_isValid(int fd)
 {
-	return ( fd > 0 && fd < FD_SETSIZE && session[fd] != NULL );
+	return ( fd > 0 && fd < MAXCONN && session[fd] != NULL );
 }
 
 bool session_isActive(int fd)
@@ -1520,6 +3454,13 @@ void send_shortlist_add_fd(int fd)
 
 // Do pending network sends and eof handling from the shortlist.
 void send_shortlist_do_sends()
+{
+	send_shortlist_do_sends_(true);
+}
+
+// Do the eof handling from the shortlist, and the pending network sends if send is true.
+// Sessions that still have something to send stay in the shortlist.
+static void send_shortlist_do_sends_(bool send)
 {
 	int i;
 
@@ -1534,7 +3475,7 @@ void send_shortlist_do_sends()
 		send_shortlist_array[i] = send_shortlist_array[send_shortlist_count];
 		send_shortlist_array[send_shortlist_count] = 0;
 
-		if( fd <= 0 || fd >= FD_SETSIZE )
+		if( fd <= 0 || fd >= MAXCONN )
 		{
 			ShowDebug("send_shortlist_do_sends: fd is out of range, corrupted memory? (fd=%d)\n", fd);
 			continue;
@@ -1550,7 +3491,7 @@ void send_shortlist_do_sends()
 		if( session[fd] )
 		{
 			// Send data
-			if( session[fd]->wdata_size )
+			if( send && SESSION_WPENDING(session[fd]) )
 				session[fd]->func_send(fd);
 
 			// If it's been marked as eof, call the parse func on it so that
@@ -1560,7 +3501,7 @@ void send_shortlist_do_sends()
 
 			// If the session still exists, is not eof and has things left to
 			// be sent from it we'll re-add it to the shortlist.
-			if( session[fd] && !session[fd]->flag.eof && session[fd]->wdata_size )
+			if( session[fd] && !session[fd]->flag.eof && SESSION_WPENDING(session[fd]) )
 				send_shortlist_add_fd(fd);
 		}
 	}
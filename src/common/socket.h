@@ -5,6 +5,7 @@
 #define _SOCKET_H_
 
 #include "../common/cbasetypes.h"
+#include "../common/netbuffer.h"
 
 #ifdef WIN32
 	#include "../common/winapi.h"
@@ -19,6 +20,43 @@
 
 #define FIFOSIZE_SERVERLINK 256*1024
 
+/// Use the epoll event dispatcher (evdp) instead of select() to wait for socket events.
+/// Sockets are edge triggered, so each tick only touches the sessions that actually
+/// have something to do, and the number of connections isn't bound to FD_SETSIZE.
+#if defined(__linux__)
+#define SOCKET_EPOLL
+#endif
+
+/// Allow accepted connections to be handed to network I/O threads (see io_threads in packet_athena.conf).
+/// The I/O threads do the recv/send syscalls, the logic thread only parses and fills the fifos.
+#ifdef SOCKET_EPOLL
+#define SOCKET_IOTHREADS
+#endif
+
+/// Allow the io_uring backend for client connections (see io_uring in packet_athena.conf).
+/// Receives and sends are queued in a ring and submitted once per tick, together with the wait.
+#if defined(SOCKET_EPOLL) && defined(__has_include)
+	#if __has_include(<linux/io_uring.h>)
+		#define SOCKET_URING
+	#endif
+#endif
+
+/// Allow shared buffers (netbuf) in the send queue of a session, see WFIFOSHARE.
+/// A broadcast packet is then encoded once and every recipient only keeps a reference,
+/// the data is sent with scatter-gather writes.
+#if !defined(WIN32)
+#define SEND_SHAREDBUF
+#endif
+
+/// Maximum number of sockets (and sessions) the server can handle.
+#ifndef MAXCONN
+	#ifdef SOCKET_EPOLL
+		#define MAXCONN 16384
+	#else
+		#define MAXCONN FD_SETSIZE
+	#endif
+#endif
+
 // socket I/O macros
 #define RFIFOHEAD(fd)
 #define WFIFOHEAD(fd,size) do{ if((fd) && session[fd]->wdata_size + (size) > session[fd]->max_wdata ) realloc_writefifo(fd, size); }while(0)
@@ -71,6 +109,15 @@ typedef int (*RecvFunc)(int fd);
 typedef int (*SendFunc)(int fd);
 typedef int (*ParseFunc)(int fd);
 
+#ifdef SEND_SHAREDBUF
+/// Shared buffer queued for sending.
+/// It is sent after the first 'mark' bytes of the wfifo and before the rest.
+struct socket_wbuf {
+	netbuf nb;
+	size_t mark;
+};
+#endif
+
 struct socket_data
 {
 	struct {
@@ -86,6 +133,11 @@ struct socket_data
 	size_t rdata_size, wdata_size;
 	size_t rdata_pos;
 	time_t rdata_tick; // time of last recv (for detecting timeouts); zero when timeout is disabled
+#ifdef SEND_SHAREDBUF
+	struct socket_wbuf* wbuf; // shared buffers queued for sending, in order
+	int wbuf_count, max_wbuf;
+	size_t wbuf_pos; // bytes of the first shared buffer that were sent already
+#endif
 
 	RecvFunc func_recv;
 	SendFunc func_send;
@@ -97,19 +149,30 @@ struct socket_data
 
 // Data prototype declaration
 
-extern struct socket_data* session[FD_SETSIZE];
+extern struct socket_data* session[MAXCONN];
 
 extern int fd_max;
 
 extern time_t last_tick;
 extern time_t stall_time;
 
+#ifndef MINICORE
+extern int ip_rules;// enable_ip_rules: access lists and DDoS protection of connect_client
+#endif
+
 //////////////////////////////////
 // some checking on sockets
 extern bool session_isValid(int fd);
 extern bool session_isActive(int fd);
 //////////////////////////////////
 
+/// Number and size of the packets queued for the clients, by packet id.
+struct socket_packet_stats {
+	uint32 count;
+	uint64 bytes;
+};
+extern struct socket_packet_stats socket_sent_stats[0x10000];
+
 // Function prototype declaration
 
 int make_listen_bind(uint32 ip, uint16 port);
@@ -117,9 +180,13 @@ int make_connection(uint32 ip, uint16 port, bool silent, int timeout);
 int realloc_fifo(int fd, unsigned int rfifo_size, unsigned int wfifo_size);
 int realloc_writefifo(int fd, size_t addition);
 int WFIFOSET(int fd, size_t len);
+void WFIFOSHARE(int fd, netbuf nb);
 int RFIFOSKIP(int fd, size_t len);
 
 int do_sockets(int next);
+void socket_fifo_report(void);
+void socket_send_report(bool reset);
+bool socket_uring_enable(bool enable);
 void do_close(int fd);
 void socket_init(void);
 void socket_final(void);
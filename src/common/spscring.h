@@ -0,0 +1,113 @@
+// Copyright (c) rAthena Project (www.rathena.org) - Licensed under GNU GPL
+// For more information, see LICENCE in the main folder
+
+#pragma once
+#ifndef _rA_SPSCRING_H_
+#define _rA_SPSCRING_H_
+
+//
+// Lock-free Single Producer / Single Consumer Ring of pointers
+//
+// Exactly one thread may push and exactly one (other) thread may pop,
+// no locks are taken on either side.
+// The producer owns 'head', the consumer owns 'tail', both are kept
+// on their own cacheline so the threads don't fight over it.
+// The owner publishes its index with a release store, the other side
+// reads it with an acquire load, this orders the slot accesses.
+// The indexes are unsigned and wrap around, only their difference matters.
+//
+
+#include "../common/cbasetypes.h"
+#include "../common/atomic.h"
+#include "../common/malloc.h"
+
+#if defined(_MSC_VER)
+// volatile accesses are acquire/release with /volatile:ms, the barriers make sure of it
+static forceinline uint32 SPSCRingLoad(uint32 *p){ uint32 v = *(volatile uint32*)p; MemoryBarrier(); return v; }
+static forceinline void SPSCRingStore(uint32 *p, uint32 v){ MemoryBarrier(); *(volatile uint32*)p = v; }
+#define SPSCRingLoadOwn(p) (*(volatile uint32*)(p))
+#else
+#define SPSCRingLoad(p) __atomic_load_n((p), __ATOMIC_ACQUIRE)
+#define SPSCRingStore(p,v) __atomic_store_n((p), (v), __ATOMIC_RELEASE)
+#define SPSCRingLoadOwn(p) __atomic_load_n((p), __ATOMIC_RELAXED)
+#endif
+
+#ifdef WIN32
+typedef struct __declspec( align(64) ) SPSC_RING{
+#else
+typedef struct SPSC_RING{
+#endif
+	uint32 head;	// next slot to write (producer)
+	char pad1[64 - sizeof(uint32)];
+	uint32 tail;	// next slot to read (consumer)
+	char pad2[64 - sizeof(uint32)];
+
+	uint32 mask;	// capacity - 1, capacity is a power of two
+	void **slots;
+#ifdef WIN32
+} SPSC_RING, *PSPSC_RING;
+#else
+} __attribute__((aligned(64))) SPSC_RING, *PSPSC_RING;
+#endif
+
+
+/**
+ * Initializes the ring
+ *
+ * @param capacity - number of slots, rounded up to the next power of two
+ */
+static forceinline void InitializeSPSCRing(PSPSC_RING r, uint32 capacity){
+	uint32 n = 2;
+
+	while( n < capacity )
+		n <<= 1;
+
+	r->head = 0;
+	r->tail = 0;
+	r->mask = n - 1;
+	r->slots = (void **)aCalloc(n, sizeof(void*));
+}
+
+static forceinline void FinalizeSPSCRing(PSPSC_RING r){
+	aFree((void*)r->slots);
+	r->slots = NULL;
+}
+
+
+/**
+ * Appends an element (producer side)
+ *
+ * @return false if the ring is full
+ */
+static forceinline bool SPSCRingPush(PSPSC_RING r, void *elem){
+	uint32 head = SPSCRingLoadOwn(&r->head);
+
+	if( head - SPSCRingLoad(&r->tail) > r->mask )
+		return false; // full (the consumer might still be reading the slot)
+
+	r->slots[head & r->mask] = elem;
+	SPSCRingStore(&r->head, head + 1); // slot is visible before the new head
+
+	return true;
+}
+
+
+/**
+ * Takes the oldest element (consumer side)
+ *
+ * @return NULL if the ring is empty
+ */
+static forceinline void *SPSCRingPop(PSPSC_RING r){
+	uint32 tail = SPSCRingLoadOwn(&r->tail);
+	void *elem;
+
+	if( tail == SPSCRingLoad(&r->head) )
+		return NULL; // empty, otherwise the slot is visible now
+
+	elem = r->slots[tail & r->mask];
+	SPSCRingStore(&r->tail, tail + 1); // slot is read before it's handed back to the producer
+
+	return elem;
+}
+
+#endif
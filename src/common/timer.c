@@ -5,6 +5,7 @@
 #include "../common/db.h"
 #include "../common/malloc.h"
 #include "../common/showmsg.h"
+#include "../common/strlib.h"
 #include "../common/utils.h"
 #include "../common/nullpo.h"
 #include "timer.h"
@@ -39,22 +40,142 @@ static int free_timer_list_max = 0;
 static int free_timer_list_pos = 0;
 
 
-/// Comparator for the timer heap. (minimum tick at top)
-/// Returns negative if tid1's tick is smaller, positive if tid2's tick is smaller, 0 if equal.
-///
-/// @param tid1 First timer
-/// @param tid2 Second timer
-/// @return negative if tid1 is top, positive if tid2 is top, 0 if equal
-#define DIFFTICK_MINTOPCMP(tid1,tid2) DIFF_TICK(timer_data[tid1].tick,timer_data[tid2].tick)
-
-// timer heap (binary heap of tid's)
-static BHEAP_VAR(int, timer_heap);
+/// Hierarchical timing wheel.
+/// Level 0 has a slot for each of the next 256 ticks, each following level
+/// covers 64 slots of the previous one, so 5 levels cover the whole tick range.
+/// When level 0 wraps around, the next slot of level 1 is moved down (cascaded)
+/// into level 0, and so on. Adding and removing a timer is O(1), a timer is
+/// cascaded at most 4 times before it expires.
+#define TIMER_WHEEL_ROOT_BITS 8
+#define TIMER_WHEEL_BITS 6
+#define TIMER_WHEEL_LEVELS 5
+#define TIMER_WHEEL_ROOT_SIZE (1<<TIMER_WHEEL_ROOT_BITS)
+#define TIMER_WHEEL_SIZE (1<<TIMER_WHEEL_BITS)
+#define TIMER_WHEEL_SLOTS (TIMER_WHEEL_ROOT_SIZE + (TIMER_WHEEL_LEVELS-1)*TIMER_WHEEL_SIZE)
+/// Extra slot for timers that were added with a tick that was processed already (sorted by tick).
+#define TIMER_WHEEL_DUE TIMER_WHEEL_SLOTS
+
+/// First bit of the tick that selects the slot in a level.
+#define TIMER_WHEEL_SHIFT(level) ( (level) == 0 ? 0 : TIMER_WHEEL_ROOT_BITS + ((level)-1)*TIMER_WHEEL_BITS )
+/// Index of the first slot of a level in timer_wheel.
+#define TIMER_WHEEL_OFFSET(level) ( (level) == 0 ? 0 : TIMER_WHEEL_ROOT_SIZE + ((level)-1)*TIMER_WHEEL_SIZE )
+/// Slot of a level that covers the tick.
+#define TIMER_WHEEL_INDEX(level,tick) ( TIMER_WHEEL_OFFSET(level) + (((tick)>>TIMER_WHEEL_SHIFT(level)) & ((level) == 0 ? TIMER_WHEEL_ROOT_SIZE-1 : TIMER_WHEEL_SIZE-1)) )
+
+/// Links of a timer in its wheel slot (parallel to timer_data).
+struct timer_link {
+	int prev, next;
+	int slot; // -1 if not in the wheel
+	int stats; // index in timer_stats, -1 if unused
+};
+
+static struct timer_link* timer_link = NULL;
+static int timer_wheel[TIMER_WHEEL_SLOTS+1]; // first timer of each slot, -1 if empty
+static unsigned int timer_wheel_tick = 0; // next tick to be processed
+static int timer_wheel_count = 0; // timers in the wheel
 
 
 // server startup time
 time_t start_time;
 
 
+/*----------------------------
+ * 	Timer profiling
+ *----------------------------*/
+/// Execution statistics of a timer function.
+struct timer_func_stats {
+	TimerFunc func;
+	uint64 calls;
+	uint64 total; // microseconds
+	uint32 max; // microseconds
+	int live; // timers using the function
+};
+
+static struct timer_func_stats* timer_stats = NULL;
+static int timer_stats_num = 0;
+static int timer_stats_max = 0;
+static int* timer_stats_hash = NULL; // index in timer_stats by function, -1 if empty (open addressing)
+static int timer_stats_hash_size = 0; // power of two
+static uint64 timer_stats_since = 0; // gettick_us() of the last reset
+
+/*----------------------------
+ * 	Tick profiling
+ *----------------------------*/
+#define TICK_HIST_BUCKETS 24 // bucket b counts the durations in [2^(b-1),2^b) us, the last one everything above
+
+/// Latency histogram of a tick phase.
+struct tick_phase_stats {
+	uint32 hist[TICK_HIST_BUCKETS];
+	uint64 total; // microseconds
+	uint64 max; // microseconds
+};
+
+static const char* tick_phase_name[TICK_PHASE_MAX+1] = { "timers", "poll", "recv", "parse", "send", "busy" };
+static struct tick_phase_stats tick_stats[TICK_PHASE_MAX+1]; // per phase, plus the whole tick without the poll
+static uint32 tick_slow_count = 0;
+static uint64 tick_stats_since = 0; // gettick_us() of the last reset
+
+// current tick
+static int tick_cur = -1; // current phase, -1 before the first tick
+static uint64 tick_phase_start = 0;
+static uint64 tick_phase_us[TICK_PHASE_MAX];
+static TimerFunc tick_slow_func; // slowest timer function
+static uint64 tick_slow_func_us;
+static int tick_slow_fd; // slowest session parse
+static uint64 tick_slow_fd_us;
+static int tick_slow_cmd; // slowest packet handler
+static uint64 tick_slow_cmd_us;
+
+static uint64 tick_slow_last = 0; // gettick_us() of the last slow tick report
+static uint32 tick_slow_skipped = 0; // slow ticks not reported since then
+
+/// Ticks that take longer than this (in milliseconds, without the poll) are reported, 0 to disable.
+unsigned int slow_tick_budget = 0;
+
+#define TIMER_STATS_HASH(func) ( (int)((((uintptr_t)(func)>>4)*2654435761u) & (uintptr_t)(timer_stats_hash_size-1)) )
+
+/// Returns the statistics of a timer function, creating them if needed.
+static int timer_stats_get(TimerFunc func)
+{
+	int i;
+
+	if( timer_stats_num*2 >= timer_stats_hash_size )
+	{// grow the hash table
+		timer_stats_hash_size = max(256, timer_stats_hash_size*2);
+		if( timer_stats_hash )
+			RECREATE(timer_stats_hash, int, timer_stats_hash_size);
+		else
+			CREATE(timer_stats_hash, int, timer_stats_hash_size);
+		memset(timer_stats_hash, -1, timer_stats_hash_size*sizeof(int));
+		for( i = 0; i < timer_stats_num; ++i )
+		{
+			int j = TIMER_STATS_HASH(timer_stats[i].func);
+
+			while( timer_stats_hash[j] != -1 )
+				j = (j+1)&(timer_stats_hash_size-1);
+			timer_stats_hash[j] = i;
+		}
+	}
+
+	for( i = TIMER_STATS_HASH(func); timer_stats_hash[i] != -1; i = (i+1)&(timer_stats_hash_size-1) )
+		if( timer_stats[timer_stats_hash[i]].func == func )
+			return timer_stats_hash[i];
+
+	if( timer_stats_num == timer_stats_max )
+	{
+		timer_stats_max += 64;
+		if( timer_stats )
+			RECREATE(timer_stats, struct timer_func_stats, timer_stats_max);
+		else
+			CREATE(timer_stats, struct timer_func_stats, timer_stats_max);
+	}
+	memset(&timer_stats[timer_stats_num], 0, sizeof(struct timer_func_stats));
+	timer_stats[timer_stats_num].func = func;
+	timer_stats_hash[i] = timer_stats_num;
+	return timer_stats_num++;
+}
+
+
 /*----------------------------
  * 	Timer debugging
  *----------------------------*/
@@ -159,6 +280,31 @@ static unsigned int tick(void)
 #endif
 }
 
+/// Returns a monotonic time in microseconds, used to measure execution times.
+uint64 gettick_us(void)
+{
+#if defined(WIN32)
+	static LARGE_INTEGER freq;
+	LARGE_INTEGER count;
+
+	if( freq.QuadPart == 0 )
+		QueryPerformanceFrequency(&freq);
+	QueryPerformanceCounter(&count);
+	return (uint64)(count.QuadPart / freq.QuadPart) * 1000000 + (uint64)(count.QuadPart % freq.QuadPart) * 1000000 / freq.QuadPart;
+#elif defined(ENABLE_RDTSC)
+	uint64 d = _rdtsc() - RDTSC_BEGINTICK;// RDTSC_CLOCK is per ms, d*1000 would overflow after a few weeks
+	return d / RDTSC_CLOCK * 1000 + d % RDTSC_CLOCK * 1000 / RDTSC_CLOCK;
+#elif defined(HAVE_MONOTONIC_CLOCK)
+	struct timespec tval;
+	clock_gettime(CLOCK_MONOTONIC, &tval);
+	return (uint64)tval.tv_sec * 1000000 + tval.tv_nsec / 1000;
+#else
+	struct timeval tval;
+	gettimeofday(&tval, NULL);
+	return (uint64)tval.tv_sec * 1000000 + tval.tv_usec;
+#endif
+}
+
 //////////////////////////////////////////////////////////////////////////
 #if defined(TICK_CACHE) && TICK_CACHE > 1
 //////////////////////////////////////////////////////////////////////////
@@ -195,14 +341,103 @@ unsigned int gettick(void)
 //////////////////////////////////////////////////////////////////////////
 
 /*======================================
- * 	CORE : Timer Heap
+ * 	CORE : Timer Wheel
  *--------------------------------------*/
 
-/// Adds a timer to the timer_heap
-static void push_timer_heap(int tid)
+/// Adds a timer to the slot that covers its tick.
+/// Expired timers go to the due list, ordered by tick.
+static void push_timer_wheel(int tid)
+{
+	unsigned int tick = timer_data[tid].tick;
+	unsigned int delta = tick - timer_wheel_tick;
+	int level, slot, prev = -1;
+
+	if( DIFF_TICK(tick, timer_wheel_tick) < 0 ) {
+		int next;
+
+		slot = TIMER_WHEEL_DUE;
+		for( next = timer_wheel[slot]; next != -1 && DIFF_TICK(timer_data[next].tick, tick) <= 0; next = timer_link[next].next )
+			prev = next;
+	} else {
+		for( level = 0; level < TIMER_WHEEL_LEVELS-1; ++level )
+			if( delta < (1u<<TIMER_WHEEL_SHIFT(level+1)) )
+				break;
+		slot = TIMER_WHEEL_INDEX(level, tick);
+	}
+
+	timer_link[tid].slot = slot;
+	timer_link[tid].prev = prev;
+	if( prev == -1 ) {
+		timer_link[tid].next = timer_wheel[slot];
+		timer_wheel[slot] = tid;
+	} else {
+		timer_link[tid].next = timer_link[prev].next;
+		timer_link[prev].next = tid;
+	}
+	if( timer_link[tid].next != -1 )
+		timer_link[timer_link[tid].next].prev = tid;
+	timer_wheel_count++;
+}
+
+/// Removes a timer from its slot.
+static void pop_timer_wheel(int tid)
 {
-	BHEAP_ENSURE(timer_heap, 1, 256);
-	BHEAP_PUSH(timer_heap, tid, DIFFTICK_MINTOPCMP, swap);
+	struct timer_link* link = &timer_link[tid];
+
+	if( link->prev != -1 )
+		timer_link[link->prev].next = link->next;
+	else
+		timer_wheel[link->slot] = link->next;
+	if( link->next != -1 )
+		timer_link[link->next].prev = link->prev;
+
+	link->slot = -1;
+	link->prev = link->next = -1;
+	timer_wheel_count--;
+}
+
+/// Moves the timers of a slot to the lower levels.
+static void cascade_timer_wheel(int slot)
+{
+	int tid = timer_wheel[slot];
+
+	timer_wheel[slot] = -1;
+	while( tid != -1 )
+	{
+		int next = timer_link[tid].next;
+
+		timer_wheel_count--;
+		push_timer_wheel(tid);
+		tid = next;
+	}
+}
+
+/// Returns the number of ticks until the first timer might expire, up to 'limit'.
+/// Only level 0 is exact, for timers in other levels the start of their slot is used.
+static int next_timer_wheel(int limit)
+{
+	int diff, level;
+
+	if( timer_wheel_count == 0 )
+		return limit;
+	if( timer_wheel[TIMER_WHEEL_DUE] != -1 )
+		return 0;
+
+	for( diff = 0; diff < TIMER_WHEEL_ROOT_SIZE && diff < limit; ++diff )
+		if( timer_wheel[TIMER_WHEEL_INDEX(0, timer_wheel_tick + diff)] != -1 )
+			return diff;
+
+	for( level = 1; level < TIMER_WHEEL_LEVELS; ++level )
+	{
+		unsigned int size = 1u<<TIMER_WHEEL_SHIFT(level);// ticks covered by a slot
+		unsigned int start = (timer_wheel_tick & ~(size-1)) + size;// start of the next slot
+
+		for( diff = DIFF_TICK(start, timer_wheel_tick); diff < limit; diff += size )
+			if( timer_wheel[TIMER_WHEEL_INDEX(level, timer_wheel_tick + diff)] != -1 )
+				return diff;
+	}
+
+	return limit;
 }
 
 /*==========================
@@ -226,13 +461,19 @@ static int acquire_timer(void)
 	if( tid >= timer_data_num )
 		for (tid = timer_data_num; tid < timer_data_max && timer_data[tid].type; tid++);
 	if (tid >= timer_data_num && tid >= timer_data_max)
-	{// expand timer array
-		timer_data_max += 256;
-		if( timer_data )
+	{// expand timer array (by half its size, so it doesn't get copied over and over with lots of timers)
+		int step = max(256, timer_data_max/2);
+
+		timer_data_max += step;
+		if( timer_data ) {
 			RECREATE(timer_data, struct TimerData, timer_data_max);
-		else
+			RECREATE(timer_link, struct timer_link, timer_data_max);
+		} else {
 			CREATE(timer_data, struct TimerData, timer_data_max);
-		memset(timer_data + (timer_data_max - 256), 0, sizeof(struct TimerData)*256);
+			CREATE(timer_link, struct timer_link, timer_data_max);
+		}
+		memset(timer_data + (timer_data_max - step), 0, sizeof(struct TimerData)*step);
+		memset(timer_link + (timer_data_max - step), -1, sizeof(struct timer_link)*step);
 	}
 
 	if( tid >= timer_data_num )
@@ -241,6 +482,25 @@ static int acquire_timer(void)
 	return tid;
 }
 
+/// Returns a timer id to the free list.
+static void release_timer(int tid)
+{
+	if( timer_link[tid].stats != -1 ) {
+		timer_stats[timer_link[tid].stats].live--;
+		timer_link[tid].stats = -1;
+	}
+	timer_data[tid].type = 0;
+	timer_data[tid].func = NULL;
+	if (free_timer_list_pos >= free_timer_list_max) {
+		int step = max(256, free_timer_list_max/2);
+
+		free_timer_list_max += step;
+		RECREATE(free_timer_list,int,free_timer_list_max);
+		memset(free_timer_list + (free_timer_list_max - step), 0, step * sizeof(int));
+	}
+	free_timer_list[free_timer_list_pos++] = tid;
+}
+
 /// Starts a new timer that is deleted once it expires (single-use).
 /// Returns the timer's id.
 int add_timer(unsigned int tick, TimerFunc func, int id, intptr_t data)
@@ -254,7 +514,9 @@ int add_timer(unsigned int tick, TimerFunc func, int id, intptr_t data)
 	timer_data[tid].data     = data;
 	timer_data[tid].type     = TIMER_ONCE_AUTODEL;
 	timer_data[tid].interval = 1000;
-	push_timer_heap(tid);
+	timer_link[tid].stats    = timer_stats_get(func);
+	timer_stats[timer_link[tid].stats].live++;
+	push_timer_wheel(tid);
 
 	return tid;
 }
@@ -277,7 +539,9 @@ int add_timer_interval(unsigned int tick, TimerFunc func, int id, intptr_t data,
 	timer_data[tid].data     = data;
 	timer_data[tid].type     = TIMER_INTERVAL;
 	timer_data[tid].interval = interval;
-	push_timer_heap(tid);
+	timer_link[tid].stats    = timer_stats_get(func);
+	timer_stats[timer_link[tid].stats].live++;
+	push_timer_wheel(tid);
 
 	return tid;
 }
@@ -288,7 +552,10 @@ const struct TimerData* get_timer(int tid)
 	return (tid >= 0 && tid < timer_data_num) ? &timer_data[tid] : NULL;
 }
 
-/// Marks a timer specified by 'id' for immediate deletion once it expires.
+/// Deletes a timer specified by 'id'.
+/// The timer stays in the wheel without a function and its id is only released
+/// once its tick has passed, so a stale second delete_timer fails the function
+/// check instead of hitting a new timer that reused the id.
 /// Param 'func' is used for debug/verification purposes.
 /// Returns 0 on success, < 0 on failure.
 int delete_timer(int tid, TimerFunc func)
@@ -319,11 +586,7 @@ int addtick_timer(int tid, unsigned int tick)
 /// Returns the new tick value, or -1 if it fails.
 int settick_timer(int tid, unsigned int tick)
 {
-	size_t i;
-
-	// search timer position
-	ARR_FIND(0, BHEAP_LENGTH(timer_heap), i, BHEAP_DATA(timer_heap)[i] == tid);
-	if( i == BHEAP_LENGTH(timer_heap) )
+	if( tid < 0 || tid >= timer_data_num || timer_link[tid].slot == -1 )
 	{
 		ShowError("settick_timer: no such timer %d (%p(%s))\n", tid, timer_data[tid].func, search_timer_func_list(timer_data[tid].func));
 		return -1;
@@ -336,69 +599,325 @@ int settick_timer(int tid, unsigned int tick)
 		return (int)tick;// nothing to do, already in propper position
 
 	// pop and push adjusted timer
-	BHEAP_POPINDEX(timer_heap, i, DIFFTICK_MINTOPCMP, swap);
+	pop_timer_wheel(tid);
 	timer_data[tid].tick = tick;
-	BHEAP_PUSH(timer_heap, tid, DIFFTICK_MINTOPCMP, swap);
+	push_timer_wheel(tid);
 	return (int)tick;
 }
 
+/// Executes a timer that was taken out of the wheel.
+static void run_timer(int tid, unsigned int tick)
+{
+	int diff = DIFF_TICK(timer_data[tid].tick, tick);
+
+	timer_data[tid].type |= TIMER_REMOVE_HEAP;
+
+	if( timer_data[tid].func )
+	{
+		int stats = timer_link[tid].stats;
+		uint64 start = gettick_us();
+		uint32 elapsed;
+
+		if( diff < -1000 )
+			// timer was delayed for more than 1 second, use current tick instead
+			timer_data[tid].func(tid, tick, timer_data[tid].id, timer_data[tid].data);
+		else
+			timer_data[tid].func(tid, timer_data[tid].tick, timer_data[tid].id, timer_data[tid].data);
+
+		elapsed = (uint32)(gettick_us() - start);
+		timer_stats[stats].calls++;
+		timer_stats[stats].total += elapsed;
+		if( elapsed > timer_stats[stats].max )
+			timer_stats[stats].max = elapsed;
+		if( elapsed > tick_slow_func_us ) {
+			tick_slow_func = timer_stats[stats].func;
+			tick_slow_func_us = elapsed;
+		}
+	}
+
+	// in the case the function didn't change anything...
+	if( timer_data[tid].type & TIMER_REMOVE_HEAP )
+	{
+		timer_data[tid].type &= ~TIMER_REMOVE_HEAP;
+
+		switch( timer_data[tid].type )
+		{
+		default:
+		case TIMER_ONCE_AUTODEL:
+			release_timer(tid);
+		break;
+		case TIMER_INTERVAL:
+			if( DIFF_TICK(timer_data[tid].tick, tick) < -1000 )
+				timer_data[tid].tick = tick + timer_data[tid].interval;
+			else
+				timer_data[tid].tick += timer_data[tid].interval;
+			push_timer_wheel(tid);
+		break;
+		}
+	}
+}
+
 /// Executes all expired timers.
 /// Returns the value of the smallest non-expired timer (or 1 second if there aren't any).
 int do_timer(unsigned int tick)
 {
-	int diff = TIMER_MAX_INTERVAL; // return value
-
-	// process all timers one by one
-	while( BHEAP_LENGTH(timer_heap) )
+	// process the wheel tick by tick
+	for(;;)
 	{
-		int tid = BHEAP_PEEK(timer_heap);// top element in heap (smallest tick)
+		int slot = TIMER_WHEEL_INDEX(0, timer_wheel_tick);
+		int level, tid;
 
-		diff = DIFF_TICK(timer_data[tid].tick, tick);
-		if( diff > 0 )
-			break; // no more expired timers to process
+		// timers of past ticks first
+		while( (tid = timer_wheel[TIMER_WHEEL_DUE]) != -1 )
+		{
+			pop_timer_wheel(tid);
+			run_timer(tid, tick);
+		}
 
-		// remove timer
-		BHEAP_POP(timer_heap, DIFFTICK_MINTOPCMP, swap);
-		timer_data[tid].type |= TIMER_REMOVE_HEAP;
+		if( DIFF_TICK(timer_wheel_tick, tick) > 0 )
+			break; // no more expired timers to process
 
-		if( timer_data[tid].func )
+		// level 0 wrapped around, move the timers of the next slots down
+		for( level = 1; level < TIMER_WHEEL_LEVELS; ++level )
 		{
-			if( diff < -1000 )
-				// timer was delayed for more than 1 second, use current tick instead
-				timer_data[tid].func(tid, tick, timer_data[tid].id, timer_data[tid].data);
-			else
-				timer_data[tid].func(tid, timer_data[tid].tick, timer_data[tid].id, timer_data[tid].data);
+			if( (timer_wheel_tick & ((1u<<TIMER_WHEEL_SHIFT(level))-1)) != 0 )
+				break;
+			cascade_timer_wheel(TIMER_WHEEL_INDEX(level, timer_wheel_tick));
 		}
 
-		// in the case the function didn't change anything...
-		if( timer_data[tid].type & TIMER_REMOVE_HEAP )
+		// timers added to this slot (or the due list) by the timer functions are executed as well
+		while( (tid = timer_wheel[TIMER_WHEEL_DUE]) != -1 || (tid = timer_wheel[slot]) != -1 )
 		{
-			timer_data[tid].type &= ~TIMER_REMOVE_HEAP;
-
-			switch( timer_data[tid].type )
-			{
-			default:
-			case TIMER_ONCE_AUTODEL:
-				timer_data[tid].type = 0;
-				if (free_timer_list_pos >= free_timer_list_max) {
-					free_timer_list_max += 256;
-					RECREATE(free_timer_list,int,free_timer_list_max);
-					memset(free_timer_list + (free_timer_list_max - 256), 0, 256 * sizeof(int));
-				}
-				free_timer_list[free_timer_list_pos++] = tid;
-			break;
-			case TIMER_INTERVAL:
-				if( DIFF_TICK(timer_data[tid].tick, tick) < -1000 )
-					timer_data[tid].tick = tick + timer_data[tid].interval;
-				else
-					timer_data[tid].tick += timer_data[tid].interval;
-				push_timer_heap(tid);
-			break;
-			}
+			pop_timer_wheel(tid);
+			run_timer(tid, tick);
+		}
+
+		timer_wheel_tick++;
+	}
+
+	return cap_value(next_timer_wheel(TIMER_MAX_INTERVAL), TIMER_MIN_INTERVAL, TIMER_MAX_INTERVAL);
+}
+
+/// Comparator for timer_report, most expensive first.
+static int timer_report_cmp(const void* a, const void* b)
+{
+	uint64 total_a = timer_stats[*(const int*)a].total;
+	uint64 total_b = timer_stats[*(const int*)b].total;
+
+	uint64 calls_a = timer_stats[*(const int*)a].calls;
+	uint64 calls_b = timer_stats[*(const int*)b].calls;
+
+	if( total_a != total_b )
+		return ( total_a > total_b ) ? -1 : 1;
+	if( calls_a != calls_b )
+		return ( calls_a > calls_b ) ? -1 : 1;
+	return 0;
+}
+
+/// Displays the execution statistics of the timer functions, sorted by the total execution time.
+/// @param reset Clears the statistics afterwards
+void timer_report(bool reset)
+{
+	uint64 elapsed = gettick_us() - timer_stats_since;
+	uint64 calls = 0, total = 0;
+	int* order;
+	int i, live = 0;
+
+	if( timer_stats_num == 0 ) {
+		ShowInfo("No timers were used yet.\n");
+		return;
+	}
+
+	CREATE(order, int, timer_stats_num);
+	for( i = 0; i < timer_stats_num; ++i ) {
+		order[i] = i;
+		calls += timer_stats[i].calls;
+		total += timer_stats[i].total;
+		live += timer_stats[i].live;
+	}
+	qsort(order, timer_stats_num, sizeof(int), timer_report_cmp);
+
+	ShowMessage(CL_BOLD"[Timer report]"CL_NORMAL" last %.1f s: %.0f calls, %.1f ms in timer functions (%.1f%%), %d timers\n",
+		elapsed/1000000., (double)calls, total/1000., elapsed ? total*100./elapsed : 0., live);
+	ShowMessage("\t%-40s %10s %10s %8s %8s %8s\n", "function", "calls", "total ms", "avg us", "max us", "timers");
+	for( i = 0; i < timer_stats_num; ++i )
+	{
+		struct timer_func_stats* stats = &timer_stats[order[i]];
+
+		if( stats->calls == 0 && stats->live == 0 )
+			continue;
+		ShowMessage("\t%-40.40s %10.0f %10.1f %8u %8u %8d\n", search_timer_func_list(stats->func),
+			(double)stats->calls, stats->total/1000., (uint32)(stats->calls ? stats->total/stats->calls : 0), stats->max, stats->live);
+	}
+	aFree(order);
+
+	if( reset ) {
+		for( i = 0; i < timer_stats_num; ++i ) {
+			timer_stats[i].calls = 0;
+			timer_stats[i].total = 0;
+			timer_stats[i].max = 0;
+		}
+		timer_stats_since = gettick_us();
+	}
+}
+
+/// Returns the histogram bucket of a duration.
+static int tick_hist_bucket(uint64 us)
+{
+	int b = 0;
+
+	while( us && b < TICK_HIST_BUCKETS-1 ) {
+		us >>= 1;
+		++b;
+	}
+	return b;
+}
+
+/// Adds a duration to the statistics of a phase.
+static void tick_stats_add(struct tick_phase_stats* stats, uint64 us)
+{
+	stats->hist[tick_hist_bucket(us)]++;
+	stats->total += us;
+	if( us > stats->max )
+		stats->max = us;
+}
+
+/// Reports a tick that exceeded slow_tick_budget, with what took most of the time.
+static void tick_slow_report(uint64 busy)
+{
+	char culprit[128];
+	int i, phase = TICK_PHASE_TIMER;
+
+	tick_slow_count++;
+	if( tick_phase_start - tick_slow_last < 1000000 ) {// not more than one report per second
+		tick_slow_skipped++;
+		return;
+	}
+	tick_slow_last = tick_phase_start;
+
+	for( i = 0; i < TICK_PHASE_MAX; ++i )
+		if( i != TICK_PHASE_POLL && tick_phase_us[i] > tick_phase_us[phase] )
+			phase = i;
+
+	if( phase == TICK_PHASE_TIMER && tick_slow_func_us )
+		safesnprintf(culprit, sizeof(culprit), ", slowest timer '%s' %u us", search_timer_func_list(tick_slow_func), (uint32)tick_slow_func_us);
+	else if( phase == TICK_PHASE_PARSE && tick_slow_cmd_us )
+		safesnprintf(culprit, sizeof(culprit), ", slowest packet 0x%04x %u us (session #%d %u us)", tick_slow_cmd, (uint32)tick_slow_cmd_us, tick_slow_fd, (uint32)tick_slow_fd_us);
+	else if( phase == TICK_PHASE_PARSE && tick_slow_fd_us )
+		safesnprintf(culprit, sizeof(culprit), ", slowest session #%d %u us", tick_slow_fd, (uint32)tick_slow_fd_us);
+	else
+		culprit[0] = '\0';
+
+	ShowWarning("Slow tick: %u ms, mostly %s (timers %u, recv %u, parse %u, send %u us)%s.",
+		(uint32)(busy/1000), tick_phase_name[phase], (uint32)tick_phase_us[TICK_PHASE_TIMER], (uint32)tick_phase_us[TICK_PHASE_RECV],
+		(uint32)tick_phase_us[TICK_PHASE_PARSE], (uint32)tick_phase_us[TICK_PHASE_SEND], culprit);
+	if( tick_slow_skipped ) {
+		ShowMessage(" %u slow ticks not shown.", tick_slow_skipped);
+		tick_slow_skipped = 0;
+	}
+	ShowMessage("\n");
+}
+
+/// Ends the current tick of the main loop and starts the next one with the timer phase.
+void tick_begin(void)
+{
+	uint64 busy = 0;
+	bool first = ( tick_cur < 0 );
+	int i;
+
+	tick_phase(TICK_PHASE_TIMER);
+	if( !first ) {
+		for( i = 0; i < TICK_PHASE_MAX; ++i ) {
+			tick_stats_add(&tick_stats[i], tick_phase_us[i]);
+			if( i != TICK_PHASE_POLL )
+				busy += tick_phase_us[i];
 		}
+		tick_stats_add(&tick_stats[TICK_PHASE_MAX], busy);
+		if( slow_tick_budget && busy > (uint64)slow_tick_budget*1000 )
+			tick_slow_report(busy);
 	}
 
-	return cap_value(diff, TIMER_MIN_INTERVAL, TIMER_MAX_INTERVAL);
+	memset(tick_phase_us, 0, sizeof(tick_phase_us));
+	tick_slow_func_us = tick_slow_fd_us = tick_slow_cmd_us = 0;
+}
+
+/// Ends the current phase of the tick and starts another one.
+/// The time of a phase is added up when it occurs several times in a tick.
+void tick_phase(enum e_tick_phase phase)
+{
+	uint64 now = gettick_us();
+
+	if( tick_cur >= 0 )
+		tick_phase_us[tick_cur] += now - tick_phase_start;
+	tick_cur = phase;
+	tick_phase_start = now;
+}
+
+/// Records the time spent parsing the data of a session.
+void tick_parse(int fd, uint64 elapsed)
+{
+	if( elapsed > tick_slow_fd_us ) {
+		tick_slow_fd = fd;
+		tick_slow_fd_us = elapsed;
+	}
+}
+
+/// Records the time spent in a packet handler.
+void tick_packet(int cmd, uint64 elapsed)
+{
+	if( elapsed > tick_slow_cmd_us ) {
+		tick_slow_cmd = cmd;
+		tick_slow_cmd_us = elapsed;
+	}
+}
+
+/// Returns the upper bound (in us) of the bucket that contains the given fraction of the samples.
+static uint64 tick_percentile(const struct tick_phase_stats* stats, double p)
+{
+	uint32 count = 0, total = 0;
+	int b;
+
+	for( b = 0; b < TICK_HIST_BUCKETS; ++b )
+		total += stats->hist[b];
+	for( b = 0; b < TICK_HIST_BUCKETS-1; ++b ) {
+		count += stats->hist[b];
+		if( count >= total*p )
+			break;
+	}
+	return min(stats->max, (uint64)1<<b);
+}
+
+/// Displays the latency of each phase of the main loop ticks.
+/// @param reset Clears the statistics afterwards
+void tick_report(bool reset)
+{
+	uint64 elapsed = gettick_us() - tick_stats_since;
+	uint32 ticks = tick_stats[TICK_PHASE_MAX].hist[0];
+	int i, b;
+
+	for( b = 1; b < TICK_HIST_BUCKETS; ++b )
+		ticks += tick_stats[TICK_PHASE_MAX].hist[b];
+	if( ticks == 0 ) {
+		ShowInfo("No ticks were measured yet.\n");
+		return;
+	}
+
+	ShowMessage(CL_BOLD"[Tick report]"CL_NORMAL" last %.1f s: %u ticks (%.1f/s), %u slow ticks (budget %u ms)\n",
+		elapsed/1000000., ticks, elapsed ? ticks*1000000./elapsed : 0., tick_slow_count, slow_tick_budget);
+	ShowMessage("\t%-8s %10s %8s %8s %8s %8s %8s\n", "phase", "total ms", "avg us", "p50 us", "p90 us", "p99 us", "max us");
+	for( i = 0; i <= TICK_PHASE_MAX; ++i )
+	{
+		struct tick_phase_stats* stats = &tick_stats[i];
+
+		ShowMessage("\t%-8s %10.1f %8u %8u %8u %8u %8u\n", tick_phase_name[i], stats->total/1000., (uint32)(stats->total/ticks),
+			(uint32)tick_percentile(stats, 0.5), (uint32)tick_percentile(stats, 0.9), (uint32)tick_percentile(stats, 0.99), (uint32)stats->max);
+	}
+
+	if( reset ) {
+		memset(tick_stats, 0, sizeof(tick_stats));
+		tick_slow_count = 0;
+		tick_stats_since = gettick_us();
+	}
 }
 
 unsigned long get_uptime(void)
@@ -515,6 +1034,13 @@ void timer_init(void)
 #endif
 
 	time(&start_time);
+
+	memset(timer_wheel, -1, sizeof(timer_wheel));
+	timer_wheel_tick = gettick_nocache();
+	timer_wheel_count = 0;
+
+	timer_stats_since = gettick_us();
+	tick_stats_since = timer_stats_since;
 }
 
 void timer_final(void)
@@ -529,6 +1055,8 @@ void timer_final(void)
 	}
 
 	if (timer_data) aFree(timer_data);
-	BHEAP_CLEAR(timer_heap);
+	if (timer_link) aFree(timer_link);
+	if (timer_stats) aFree(timer_stats);
+	if (timer_stats_hash) aFree(timer_stats_hash);
 	if (free_timer_list) aFree(free_timer_list);
 }
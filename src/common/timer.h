@@ -19,6 +19,16 @@ enum {
 	TIMER_REMOVE_HEAP = 0x10,
 };
 
+/// Phases of a main loop tick, see tick_phase.
+enum e_tick_phase {
+	TICK_PHASE_TIMER = 0, // do_timer
+	TICK_PHASE_POLL,      // waiting for socket events (idle time)
+	TICK_PHASE_RECV,      // reading from the sockets
+	TICK_PHASE_PARSE,     // handling the received packets
+	TICK_PHASE_SEND,      // flushing the send buffers
+	TICK_PHASE_MAX
+};
+
 // Struct declaration
 
 typedef int (*TimerFunc)(int tid, unsigned int tick, int id, intptr_t data);
@@ -38,6 +48,7 @@ struct TimerData {
 
 unsigned int gettick(void);
 unsigned int gettick_nocache(void);
+uint64 gettick_us(void);
 
 int add_timer(unsigned int tick, TimerFunc func, int id, intptr_t data);
 int add_timer_interval(unsigned int tick, TimerFunc func, int id, intptr_t data, int interval);
@@ -48,6 +59,15 @@ int addtick_timer(int tid, unsigned int tick);
 int settick_timer(int tid, unsigned int tick);
 
 int add_timer_func_list(TimerFunc func, char* name);
+void timer_report(bool reset);
+
+extern unsigned int slow_tick_budget;
+
+void tick_begin(void);
+void tick_phase(enum e_tick_phase phase);
+void tick_parse(int fd, uint64 elapsed);
+void tick_packet(int cmd, uint64 elapsed);
+void tick_report(bool reset);
 
 unsigned long get_uptime(void);
 
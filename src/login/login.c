@@ -403,13 +403,36 @@ int parse_console(const char *buf) {
 			}
 			ShowStatus("Console: Account '%s' created successfully.\n", username);
 		}
+		if( strcmpi("timers", type) == 0 )
+			timer_report(strcmpi("reset", command) == 0);
+		if( strcmpi("ticks", type) == 0 )
+			tick_report(strcmpi("reset", command) == 0);
+		if( strcmpi("sends", type) == 0 )
+			socket_send_report(strcmpi("reset", command) == 0);
+		if( strcmpi("memory", type) == 0 )
+			malloc_report(strcmpi("reset", command) == 0);
 	} else if( strcmpi("ers_report", type) == 0 ) {
 		ers_report();
+	} else if( strcmpi("memory", type) == 0 ) {
+		malloc_report(false);
+	} else if( strcmpi("timers", type) == 0 ) {
+		timer_report(false);
+	} else if( strcmpi("ticks", type) == 0 ) {
+		tick_report(false);
+	} else if( strcmpi("fifos", type) == 0 ) {
+		socket_fifo_report();
+	} else if( strcmpi("sends", type) == 0 ) {
+		socket_send_report(false);
 	} else if( strcmpi("help", type) == 0 ) {
 		ShowInfo("Available commands:\n");
 		ShowInfo("\t server:shutdown => Stops the server.\n");
 		ShowInfo("\t server:alive => Checks if the server is running.\n");
 		ShowInfo("\t ers_report => Displays database usage.\n");
+		ShowInfo("\t memory[:reset] => Displays the memory in use by each source file (and resets the peaks).\n");
+		ShowInfo("\t timers[:reset] => Displays the execution time of each timer function (and resets it).\n");
+		ShowInfo("\t ticks[:reset] => Displays the latency of each phase of the main loop (and resets it).\n");
+		ShowInfo("\t fifos => Displays the memory used by the session buffers.\n");
+		ShowInfo("\t sends[:reset] => Displays the average number of bytes per send syscall (and resets it).\n");
 		ShowInfo("\t create:<username> <password> <sex:M|F> => Creates a new account.\n");
 	} else { // commands with parameters
 
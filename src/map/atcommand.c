@@ -9881,6 +9881,24 @@ ACMD_FUNC(adopt)
 	return -1;
 }
 
+/*==========================================
+ * @packetstats [reset]
+ * Shows the received packets that took the most handler time and the biggest sent packets.
+ *------------------------------------------*/
+ACMD_FUNC(packetstats)
+{
+	nullpo_retr(-1, sd);
+
+	if (message && strcmpi(message, "reset") == 0) {
+		clif_packet_stats_reset();
+		clif_displaymessage(fd, msg_txt(1515)); // Packet statistics have been reset.
+		return 0;
+	}
+
+	clif_packet_stats_show(fd, 10);
+	return 0;
+}
+
 #include "../custom/atcommand.inc"
 
 /**
@@ -10178,6 +10196,7 @@ void atcommand_basecommands(void) {
 		ACMD_DEF(adopt),
 		ACMD_DEF(agitstart3),
 		ACMD_DEF(agitend3),
+		ACMD_DEF(packetstats),
 	};
 	AtCommandInfo *atcommand;
 	int i;
@@ -8616,6 +8616,8 @@ static const struct _battle_data {
 	{ "allow_bound_sell",                   &battle_config.allow_bound_sell,                0,      0,      1|2,            },
 	{ "autoloot_adjust",                    &battle_config.autoloot_adjust,                 0,      0,      1,              },
 	{ "show_skill_scale",                   &battle_config.show_skill_scale,                1,      0,      1,              },
+	{ "path_search_jps",                    &battle_config.path_search_jps,                 0,      0,      1,              },
+	{ "path_flow_field",                    &battle_config.path_flow_field,                 0,      0,      1000,           },
 
 #include "../custom/battle_config_init.inc"
 };
@@ -647,6 +647,8 @@ extern struct Battle_Config
 	int allow_bound_sell;
 	int autoloot_adjust;
 	int show_skill_scale;
+	int path_search_jps;
+	int path_flow_field;
 
 #include "../custom/battle_config_struct.inc"
 } battle_config;
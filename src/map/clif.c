@@ -58,6 +58,18 @@ static struct eri *delay_clearunit_ers;
 
 struct s_packet_db packet_db[MAX_PACKET_DB + 1];
 int packet_db_ack[MAX_ACK_FUNC + 1];
+
+/// Statistics of the received packets, by packet id.
+struct s_packet_stats {
+	uint32 count;
+	uint64 bytes;
+	uint64 total; // handler time in microseconds
+	uint32 max; // microseconds
+};
+static struct s_packet_stats packet_stats[MAX_PACKET_DB + 1];
+static unsigned int packet_stats_since; // gettick() of the last reset
+int packet_stats_interval = 0; // seconds between two dumps to packet_stats_file, 0 to disable
+char packet_stats_file[256] = "./log/packet_stats.log";
 unsigned long color_table[COLOR_MAX];
 
 #include "clif_obfuscation.h"
@@ -279,9 +291,34 @@ static bool clif_session_isValid(struct map_session_data *sd) {
 	return (sd && session_isActive(sd->fd));
 }
 
+/// Broadcast packets of at least this size are encoded once into a shared buffer,
+/// smaller ones are cheaper to copy into each wfifo.
+#define CLIF_SEND_SHARE_MIN 32
+
+/*==========================================
+ * Queues a broadcast packet for one recipient of clif_send.
+ * The packet is copied to a shared buffer (*nb) for the first recipient,
+ * the others only get a reference to it. Release it with netbuffer_put when done.
+ *------------------------------------------*/
+static void clif_send_fd(int fd, const uint8 *buf, int len, netbuf *nb) {
+	if (len >= CLIF_SEND_SHARE_MIN) {
+		if (*nb == NULL) {
+			*nb = netbuffer_get(len);
+			memcpy((*nb)->buf, buf, len);
+			(*nb)->dataLen = len;
+		}
+		WFIFOSHARE(fd, *nb);
+		return;
+	}
+
+	WFIFOHEAD(fd,len);
+	memcpy(WFIFOP(fd,0), buf, len);
+	WFIFOSET(fd,len);
+}
+
 /*==========================================
  * sub process of clif_send
- * Called from a map_foreachinallarea (grabs all players in specific area and subjects them to this function)
+ * Called for each player found by clif_send_area or clif_send_view
  * In order to send area-wise packets, such as:
  * - AREA : everyone nearby your area
  * - AREA_WOSC (AREA WITHOUT SAME CHAT) : Not run for people in the same chat as yours
@@ -289,23 +326,13 @@ static bool clif_session_isValid(struct map_session_data *sd) {
  * - AREA_WOS (AREA WITHOUT SELF) : Not run for self
  * - AREA_CHAT_WOC : Everyone in the area of your chat without a chat
  *------------------------------------------*/
-static int clif_send_sub(struct block_list *bl, va_list ap) {
-	struct block_list *src_bl;
-	struct map_session_data *sd;
-	unsigned char *buf;
-	int len, type, fd;
-
-	nullpo_ret(bl);
-	nullpo_ret(sd = (struct map_session_data *)bl);
+static int clif_send_sub(struct map_session_data *sd, const uint8 *buf, int len, netbuf *nb, struct block_list *src_bl, enum send_target type) {
+	struct block_list *bl = &sd->bl;
+	int fd;
 
 	if (!(fd = sd->fd) || !session[fd]) //Don't send to disconnected clients
 		return 0;
 
-	buf = va_arg(ap,unsigned char *);
-	len = va_arg(ap,int);
-	nullpo_ret(src_bl = va_arg(ap,struct block_list *));
-	type = va_arg(ap,int);
-
 	switch (type) {
 		case AREA_WOS:
 			if (bl->id == src_bl->id)
@@ -329,14 +356,15 @@ static int clif_send_sub(struct block_list *bl, va_list ap) {
 				}
 			}
 			break;
+		default:
+			break;
 	}
 
 	if (!battle_config.update_enemy_position && ally_only && !sd->special_state.intravision &&
 		!sd->sc.data[SC_INTRAVISION] && battle_check_target(src_bl, &sd->bl, BCT_ENEMY) > 0)
 		return 0; //Unless visible, hold it here
 
-	WFIFOHEAD(fd,len);
-	if (WFIFOP(fd,0) == buf) {
+	if (*nb == NULL && WFIFOP(fd,0) == buf) {
 		ShowError("WARNING: Invalid use of clif_send function\n");
 		ShowError("         Packet x%4x use a WFIFO of a player instead of to use a buffer.\n", WBUFW(buf,0));
 		ShowError("         Please correct your code.\n");
@@ -346,12 +374,43 @@ static int clif_send_sub(struct block_list *bl, va_list ap) {
 		return 0;
 	}
 
-	memcpy(WFIFOP(fd,0), buf, len);
-	WFIFOSET(fd,len);
+	clif_send_fd(fd, buf, len, nb);
 
 	return 0;
 }
 
+/*==========================================
+ * Sends an area-wise packet to every player in the area (x0,y0)-(x1,y1) of src_bl's map, see clif_send_sub.
+ *------------------------------------------*/
+static void clif_send_area(const uint8 *buf, int len, netbuf *nb, struct block_list *src_bl, int16 x0, int16 y0, int16 x1, int16 y1, enum send_target type) {
+	struct map_query q;
+	struct block_list *bl;
+
+	map_query_area(&q, src_bl->m, x0, y0, x1, y1, BL_PC, MQ_ALL);
+	while ((bl = map_query_next(&q)))
+		clif_send_sub((struct map_session_data *)bl, buf, len, nb, src_bl, type);
+	map_query_end(&q);
+}
+
+/*==========================================
+ * Sends an area-wise packet to src_bl and the players that have it in view (map_view_watchers),
+ * falls back to the map query when src_bl has no view set.
+ *------------------------------------------*/
+static void clif_send_view(const uint8 *buf, int len, netbuf *nb, struct block_list *src_bl, enum send_target type) {
+	struct map_view_list *watchers = map_view_watchers(src_bl);
+	int i;
+
+	if (watchers == NULL) {
+		clif_send_area(buf, len, nb, src_bl, src_bl->x - AREA_SIZE, src_bl->y - AREA_SIZE, src_bl->x + AREA_SIZE, src_bl->y + AREA_SIZE, type);
+		return;
+	}
+
+	if (src_bl->type == BL_PC)
+		clif_send_sub((struct map_session_data *)src_bl, buf, len, nb, src_bl, type);
+	for (i = 0; i < watchers->count; i++)
+		clif_send_sub((struct map_session_data *)watchers->bl[i], buf, len, nb, src_bl, type);
+}
+
 /*==========================================
  * Packet Delegation (called on all packets that require data to be sent to more than one client)
  * functions that are sent solely to one use whose ID it posses use WFIFOSET
@@ -364,6 +423,7 @@ int clif_send(const uint8 *buf, int len, struct block_list *bl, enum send_target
 	struct battleground_data *bg = NULL;
 	int x0 = 0, x1 = 0, y0 = 0, y1 = 0, fd;
 	struct s_mapiterator *iter;
+	netbuf nb = NULL;
 
 	if (type != ALL_CLIENT)
 		nullpo_ret(bl);
@@ -374,9 +434,7 @@ int clif_send(const uint8 *buf, int len, struct block_list *bl, enum send_target
 		case ALL_CLIENT: //All player clients
 			iter = mapit_getallusers();
 			while ((tsd = (TBL_PC *)mapit_next(iter))) {
-				WFIFOHEAD(tsd->fd,len);
-				memcpy(WFIFOP(tsd->fd,0), buf, len);
-				WFIFOSET(tsd->fd,len);
+				clif_send_fd(tsd->fd, buf, len, &nb);
 			}
 			mapit_free(iter);
 			break;
@@ -385,9 +443,7 @@ int clif_send(const uint8 *buf, int len, struct block_list *bl, enum send_target
 			iter = mapit_getallusers();
 			while ((tsd = (TBL_PC *)mapit_next(iter))) {
 				if (bl->m == tsd->bl.m) {
-					WFIFOHEAD(tsd->fd,len);
-					memcpy(WFIFOP(tsd->fd,0), buf, len);
-					WFIFOSET(tsd->fd,len);
+					clif_send_fd(tsd->fd, buf, len, &nb);
 				}
 			}
 			mapit_free(iter);
@@ -400,15 +456,14 @@ int clif_send(const uint8 *buf, int len, struct block_list *bl, enum send_target
 		//Fall through
 		case AREA_WOC:
 		case AREA_WOS:
-			map_foreachinallarea(clif_send_sub, bl->m, bl->x - AREA_SIZE, bl->y - AREA_SIZE, bl->x + AREA_SIZE, bl->y + AREA_SIZE,
-				BL_PC, buf, len, bl, type);
+			clif_send_view(buf, len, &nb, bl, type);
 			break;
 		case AREA_CHAT_WOC: {
 				uint8 size = CHAT_AREA_SIZE;
 
 				if (bl->type == BL_NPC)
 					size <<= 1; //In official, NPC has chat area size two times wider than player [exneval]
-				map_foreachinallarea(clif_send_sub, bl->m, bl->x - size, bl->y - size, bl->x + size, bl->y + size, BL_PC, buf, len, bl, AREA_WOC);
+				clif_send_area(buf, len, &nb, bl, bl->x - size, bl->y - size, bl->x + size, bl->y + size, AREA_WOC);
 			}
 			break;
 
@@ -429,9 +484,7 @@ int clif_send(const uint8 *buf, int len, struct block_list *bl, enum send_target
 					if (type == CHAT_WOS && cd->usersd[i] == sd)
 						continue;
 					if ((fd = cd->usersd[i]->fd) && session[fd]) { //Added check to see if session exists [PoW]
-						WFIFOHEAD(fd,len);
-						memcpy(WFIFOP(fd,0), buf, len);
-						WFIFOSET(fd,len);
+						clif_send_fd(fd, buf, len, &nb);
 					}
 				}
 			}
@@ -462,18 +515,14 @@ int clif_send(const uint8 *buf, int len, struct block_list *bl, enum send_target
 						continue;
 					if ((type == PARTY_AREA || type == PARTY_AREA_WOS) && (sd->bl.x < x0 || sd->bl.y < y0 || sd->bl.x > x1 || sd->bl.y > y1))
 						continue;
-					WFIFOHEAD(fd,len);
-					memcpy(WFIFOP(fd,0), buf, len);
-					WFIFOSET(fd,len);
+					clif_send_fd(fd, buf, len, &nb);
 				}
 				if (!enable_spy) //Skip unnecessary parsing [Skotlex]
 					break;
 				iter = mapit_getallusers();
 				while ((tsd = (TBL_PC *)mapit_next(iter))) {
 					if (tsd->partyspy == p->party.party_id) {
-						WFIFOHEAD(tsd->fd,len);
-						memcpy(WFIFOP(tsd->fd,0), buf, len);
-						WFIFOSET(tsd->fd,len);
+						clif_send_fd(tsd->fd, buf, len, &nb);
 					}
 				}
 				mapit_free(iter);
@@ -489,9 +538,7 @@ int clif_send(const uint8 *buf, int len, struct block_list *bl, enum send_target
 				if (type == DUEL_WOS && bl->id == tsd->bl.id)
 					continue;
 				if (sd->duel_group == tsd->duel_group) {
-					WFIFOHEAD(tsd->fd,len);
-					memcpy(WFIFOP(tsd->fd,0), buf, len);
-					WFIFOSET(tsd->fd,len);
+					clif_send_fd(tsd->fd, buf, len, &nb);
 				}
 			}
 			mapit_free(iter);
@@ -534,9 +581,7 @@ int clif_send(const uint8 *buf, int len, struct block_list *bl, enum send_target
 						if ((type == GUILD_AREA || type == GUILD_AREA_WOS) && (sd->bl.x < x0 || sd->bl.y < y0 ||
 							sd->bl.x > x1 || sd->bl.y > y1))
 							continue;
-						WFIFOHEAD(fd,len);
-						memcpy(WFIFOP(fd,0), buf, len);
-						WFIFOSET(fd,len);
+						clif_send_fd(fd, buf, len, &nb);
 					}
 				}
 				if (!enable_spy) //Skip unnecessary parsing [Skotlex]
@@ -544,9 +589,7 @@ int clif_send(const uint8 *buf, int len, struct block_list *bl, enum send_target
 				iter = mapit_getallusers();
 				while ((tsd = (TBL_PC *)mapit_next(iter))) {
 					if (tsd->guildspy == g->guild_id) {
-						WFIFOHEAD(tsd->fd,len);
-						memcpy(WFIFOP(tsd->fd,0), buf, len);
-						WFIFOSET(tsd->fd,len);
+						clif_send_fd(tsd->fd, buf, len, &nb);
 					}
 				}
 				mapit_free(iter);
@@ -574,9 +617,7 @@ int clif_send(const uint8 *buf, int len, struct block_list *bl, enum send_target
 						continue;
 					if ((type == BG_AREA || type == BG_AREA_WOS) && (sd->bl.x < x0 || sd->bl.y < y0 || sd->bl.x > x1 || sd->bl.y > y1))
 						continue;
-					WFIFOHEAD(fd,len);
-					memcpy(WFIFOP(fd,0), buf, len);
-					WFIFOSET(fd,len);
+					clif_send_fd(fd, buf, len, &nb);
 				}
 			}
 			break;
@@ -588,18 +629,14 @@ int clif_send(const uint8 *buf, int len, struct block_list *bl, enum send_target
 				for (i = 0; i < clan->max_member; i++) {
 					if (!(sd = clan->members[i]) || !(fd = sd->fd))
 						continue;
-					WFIFOHEAD(fd,len);
-					memcpy(WFIFOP(fd,0), buf, len);
-					WFIFOSET(fd,len);
+					clif_send_fd(fd, buf, len, &nb);
 				}
 				if (!enable_spy) //Skip unnecessary parsing [Skotlex]
 					break;
 				iter = mapit_getallusers();
 				while ((tsd = (TBL_PC *)mapit_next(iter))) { //Packet must exist for the client version
 					if (tsd->clanspy == clan->id) {
-						WFIFOHEAD(tsd->fd,len);
-						memcpy(WFIFOP(tsd->fd,0), buf, len);
-						WFIFOSET(tsd->fd,len);
+						clif_send_fd(tsd->fd, buf, len, &nb);
 					}
 				}
 				mapit_free(iter);
@@ -611,6 +648,9 @@ int clif_send(const uint8 *buf, int len, struct block_list *bl, enum send_target
 			return -1;
 	}
 
+	if (nb)
+		netbuffer_put(nb);
+
 	return 0;
 }
 
@@ -10368,6 +10408,7 @@ void clif_parse_LoadEndAck(int fd,struct map_session_data *sd) {
 		return;
 
 	clif_spawn(&sd->bl);
+	mob_ai_wake_near(&sd->bl);
 
 	//Party
 	//(Needs to go after clif_spawn() to show hp bars correctly)
@@ -14234,6 +14275,7 @@ void clif_parse_GMChangeMapType(int fd, struct map_session_data *sd)
 	type = RFIFOW(fd,info->pos[2]);
 
 	map_setgatcell(sd->bl.m,x,y,type);
+	map[sd->bl.m].cells_pinned = true;
 	clif_changemapcell(0,sd->bl.m,x,y,type,ALL_SAMEMAP);
 	//FIXME: once players leave the map, the client 'forgets' this information.
 }
@@ -20364,6 +20406,9 @@ static int clif_parse(int fd)
 			sd->cryptKey = ((sd->cryptKey * clif_cryptKey[1]) + clif_cryptKey[2])&0xFFFFFFFF; //Update key for the next packet
 #endif
 
+		packet_stats[cmd].count++;
+		packet_stats[cmd].bytes += packet_len;
+
 		if( packet_db[cmd].func == clif_parse_debug )
 			packet_db[cmd].func(fd, sd);
 		else if( packet_db[cmd].func ) {
@@ -20371,8 +20416,19 @@ static int clif_parse(int fd)
 				; //Only valid packet when there is no session
 			else if( sd && !sd->bl.prev && packet_db[cmd].func != clif_parse_LoadEndAck )
 				; //Only valid packet when player is not on a map
-			else
-				packet_db[cmd].func(fd, sd); 
+			else {
+				uint64 start = gettick_us();
+				uint32 elapsed;
+
+				packet_db[cmd].func(fd, sd);
+
+				elapsed = (uint32)(gettick_us() - start);
+				packet_stats[cmd].total += elapsed;
+				if( elapsed > packet_stats[cmd].max )
+					packet_stats[cmd].max = elapsed;
+				if( slow_tick_budget )
+					tick_packet(cmd, elapsed);
+			}
 		}
 #ifdef DUMP_UNKNOWN_PACKET
 		else DumpUnknow(fd, sd, cmd, packet_len);
@@ -20383,7 +20439,7 @@ static int clif_parse(int fd)
 	return 0;
 }
 
-void packetdb_addpacket(uint16 cmd, uint16 length, void (*func)(int, struct map_session_data *), ...)
+void packetdb_addpacket(uint16 cmd, uint16 length, void (*func)(int, struct map_session_data *), const char* name, ...)
 {
 	va_list argp;
 	int i;
@@ -20393,8 +20449,9 @@ void packetdb_addpacket(uint16 cmd, uint16 length, void (*func)(int, struct map_
 
 	packet_db[cmd].len = length;
 	packet_db[cmd].func = func;
+	packet_db[cmd].name = name;
 
-	va_start(argp, func);
+	va_start(argp, name);
 
 	for( i = 0; i < MAX_PACKET_POS; i++ ) {
 		int offset = va_arg(argp, int);
@@ -20429,6 +20486,129 @@ void packetdb_readdb()
 #endif
 }
 
+/*==========================================
+ * Packet statistics
+ *------------------------------------------*/
+/// Sorts packet ids by handler time, most expensive first.
+static int clif_packet_stats_cmp_recv(const void* a, const void* b)
+{
+	uint64 total_a = packet_stats[*(const int*)a].total;
+	uint64 total_b = packet_stats[*(const int*)b].total;
+
+	if( total_a != total_b )
+		return ( total_a > total_b ) ? -1 : 1;
+	return (int)(packet_stats[*(const int*)b].count - packet_stats[*(const int*)a].count);
+}
+
+/// Sorts packet ids by sent bytes, biggest first.
+static int clif_packet_stats_cmp_send(const void* a, const void* b)
+{
+	uint64 bytes_a = socket_sent_stats[*(const int*)a].bytes;
+	uint64 bytes_b = socket_sent_stats[*(const int*)b].bytes;
+
+	if( bytes_a != bytes_b )
+		return ( bytes_a > bytes_b ) ? -1 : 1;
+	return *(const int*)a - *(const int*)b;
+}
+
+/// Collects the ids of the received and sent packets, sorted by handler time and by size.
+static void clif_packet_stats_sort(int** recv, int* recv_num, int** send, int* send_num)
+{
+	int i;
+
+	CREATE(*recv, int, MAX_PACKET_DB + 1);
+	CREATE(*send, int, ARRAYLENGTH(socket_sent_stats));
+	*recv_num = *send_num = 0;
+	for( i = 0; i <= MAX_PACKET_DB; ++i )
+		if( packet_stats[i].count )
+			(*recv)[(*recv_num)++] = i;
+	for( i = 0; i < ARRAYLENGTH(socket_sent_stats); ++i )
+		if( socket_sent_stats[i].count )
+			(*send)[(*send_num)++] = i;
+	qsort(*recv, *recv_num, sizeof(int), clif_packet_stats_cmp_recv);
+	qsort(*send, *send_num, sizeof(int), clif_packet_stats_cmp_send);
+}
+
+/// Shows the most expensive received packets and the biggest sent packets to a player (@packetstats).
+void clif_packet_stats_show(int fd, int limit)
+{
+	char output[CHAT_SIZE_MAX];
+	unsigned int elapsed = max(1, DIFF_TICK(gettick(), packet_stats_since)/1000);
+	int *recv, *send, recv_num, send_num, i;
+
+	clif_packet_stats_sort(&recv, &recv_num, &send, &send_num);
+
+	safesnprintf(output, sizeof(output), msg_txt(1513), elapsed); // Received packets in the last %u seconds, by handler time:
+	clif_displaymessage(fd, output);
+	for( i = 0; i < recv_num && i < limit; ++i ) {
+		struct s_packet_stats* stats = &packet_stats[recv[i]];
+
+		safesnprintf(output, sizeof(output), "0x%04x %s: %u (%.1f/s), %u KB, %.1f ms (avg %u us, max %u us)",
+			recv[i], packet_db[recv[i]].name ? packet_db[recv[i]].name : "-", stats->count, stats->count/(double)elapsed,
+			(uint32)(stats->bytes/1024), stats->total/1000., (uint32)(stats->total/stats->count), stats->max);
+		clif_displaymessage(fd, output);
+	}
+
+	safesnprintf(output, sizeof(output), msg_txt(1514), elapsed); // Sent packets in the last %u seconds, by size:
+	clif_displaymessage(fd, output);
+	for( i = 0; i < send_num && i < limit; ++i ) {
+		struct socket_packet_stats* stats = &socket_sent_stats[send[i]];
+
+		safesnprintf(output, sizeof(output), "0x%04x: %u (%.1f/s), %u KB (%.1f KB/s)",
+			send[i], stats->count, stats->count/(double)elapsed, (uint32)(stats->bytes/1024), stats->bytes/1024./elapsed);
+		clif_displaymessage(fd, output);
+	}
+
+	aFree(recv);
+	aFree(send);
+}
+
+/// Clears the packet statistics.
+void clif_packet_stats_reset(void)
+{
+	memset(packet_stats, 0, sizeof(packet_stats));
+	memset(socket_sent_stats, 0, sizeof(socket_sent_stats));
+	packet_stats_since = gettick();
+}
+
+/// Appends the statistics of every packet to packet_stats_file (every packet_stats_interval seconds).
+static int clif_packet_stats_dump(int tid, unsigned int tick, int id, intptr_t data)
+{
+	char timestring[32];
+	unsigned int elapsed = max(1, DIFF_TICK(tick, packet_stats_since)/1000);
+	int *recv, *send, recv_num, send_num, i;
+	FILE* fp;
+
+	if( (fp = fopen(packet_stats_file, "a")) == NULL ) {
+		ShowError("clif_packet_stats_dump: Can't write to '%s'.\n", packet_stats_file);
+		return 0;
+	}
+
+	clif_packet_stats_sort(&recv, &recv_num, &send, &send_num);
+
+	fprintf(fp, "[%s] last %u s\n", timestamp2string(timestring, sizeof(timestring), time(NULL), "%Y-%m-%d %H:%M:%S"), elapsed);
+	fprintf(fp, "recv %-6s %-36s %10s %8s %12s %10s %8s %8s\n", "id", "handler", "count", "per s", "bytes", "total ms", "avg us", "max us");
+	for( i = 0; i < recv_num; ++i ) {
+		struct s_packet_stats* stats = &packet_stats[recv[i]];
+
+		fprintf(fp, "recv 0x%04x %-36s %10u %8.1f %12.0f %10.1f %8u %8u\n", recv[i], packet_db[recv[i]].name ? packet_db[recv[i]].name : "-",
+			stats->count, stats->count/(double)elapsed, (double)stats->bytes, stats->total/1000., (uint32)(stats->total/stats->count), stats->max);
+	}
+	fprintf(fp, "send %-6s %-36s %10s %8s %12s %10s\n", "id", "", "count", "per s", "bytes", "KB/s");
+	for( i = 0; i < send_num; ++i ) {
+		struct socket_packet_stats* stats = &socket_sent_stats[send[i]];
+
+		fprintf(fp, "send 0x%04x %-36s %10u %8.1f %12.0f %10.1f\n", send[i], "",
+			stats->count, stats->count/(double)elapsed, (double)stats->bytes, stats->bytes/1024./elapsed);
+	}
+	fprintf(fp, "\n");
+	fclose(fp);
+
+	aFree(recv);
+	aFree(send);
+	return 0;
+}
+
 /*==========================================
  *
  *------------------------------------------*/
@@ -20451,6 +20631,11 @@ void do_init_clif(void) {
 
 	add_timer_func_list(clif_clearunit_delayed_sub, "clif_clearunit_delayed_sub");
 	add_timer_func_list(clif_delayquit, "clif_delayquit");
+	add_timer_func_list(clif_packet_stats_dump, "clif_packet_stats_dump");
+
+	packet_stats_since = gettick();
+	if( packet_stats_interval > 0 )
+		add_timer_interval(gettick() + packet_stats_interval*1000, clif_packet_stats_dump, 0, 0, packet_stats_interval*1000);
 
 	delay_clearunit_ers = ers_new(sizeof(struct block_list), "clif.c::delay_clearunit_ers", ERS_OPT_CLEAR);
 }
@@ -69,6 +69,7 @@ struct s_packet_db {
 	short len;
 	void (*func)(int, struct map_session_data *);
 	short pos[MAX_PACKET_POS];
+	const char* name; // name of the handler, for the statistics
 };
 
 #ifdef PACKET_OBFUSCATION
@@ -119,6 +120,8 @@ enum e_bossmap_info {
 #define packet_len(cmd) packet_db[cmd].len
 extern struct s_packet_db packet_db[MAX_PACKET_DB + 1];
 extern int packet_db_ack[MAX_ACK_FUNC + 1];
+extern int packet_stats_interval;
+extern char packet_stats_file[256];
 
 // Local define
 typedef enum send_target {
@@ -893,6 +896,9 @@ int clif_send(const uint8 *buf, int len, struct block_list *bl, enum send_target
 void do_init_clif(void);
 void do_final_clif(void);
 
+void clif_packet_stats_show(int fd, int limit);
+void clif_packet_stats_reset(void);
+
 // MAIL SYSTEM
 enum mail_send_result {
 	WRITE_MAIL_SUCCESS = 0x0,
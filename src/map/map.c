@@ -61,6 +61,7 @@
 #include <math.h>
 #ifndef _WIN32
 #include <unistd.h>
+#include <sys/mman.h>
 #endif
 
 char default_codepage[32] = "";
@@ -108,18 +109,59 @@ static DBMap *bossid_db = NULL; // int id -> struct mob_data* (MVP db)
 static DBMap *map_db = NULL; // unsigned int mapindex -> struct map_data*
 static DBMap *nick_db = NULL; // int char_id -> struct charid2nick* (requested names of offline characters)
 static DBMap *charid_db = NULL; // int char_id -> struct map_session_data*
-static DBMap *regen_db = NULL; // int id -> struct block_list* (status_natural_heal processing)
+
+/// Dense list of the block_lists of one type, walked by map_foreach* and mapit.
+/// Entries are swap-removed, except while the list is locked by a walk:
+/// then they are left as NULL holes and compacted when the last lock is released.
+struct map_bllist {
+	struct block_list **list;
+	int count; // used entries, including holes
+	int max;
+	int holes;
+	int lock;
+};
+static struct map_bllist map_bllists[BL_TYPE_NUM];
 
 static int map_users = 0;
 
-#define BLOCK_SIZE 8
 #define block_free_max 1048576
 struct block_list *block_free[block_free_max];
 static int block_free_count = 0, block_free_lock = 0;
 
-#define BL_LIST_MAX 1048576
-static struct block_list *bl_list[BL_LIST_MAX];
-static int bl_list_count = 0;
+// Blocks found by the map_foreach* functions and map queries, each call uses the entries
+// from bl_list_count on and gives them back when done, so the calls can be nested.
+static struct block_list **bl_list = NULL;
+static int bl_list_count = 0, bl_list_max = 0;
+
+static void map_bl_list_grow(void)
+{
+	bl_list_max = ( bl_list_max ? bl_list_max * 2 : 4096 );
+	RECREATE(bl_list, struct block_list *, bl_list_max);
+}
+
+#define BL_LIST_PUSH(bl) do { if( bl_list_count == bl_list_max ) map_bl_list_grow(); bl_list[bl_list_count++] = (bl); } while(0)
+
+/// Types of bl kept in each block chain of the maps
+static const int map_chain_types[BLC_MAX] = { BL_PC, BL_MOB, BL_NPC, BL_ITEM, BL_SKILL, BL_PET|BL_HOM|BL_MER|BL_CHAT|BL_ELEM };
+
+static enum map_block_chain map_block_chain(enum bl_type type)
+{
+	switch( type ) {
+		case BL_PC:    return BLC_PC;
+		case BL_MOB:   return BLC_MOB;
+		case BL_NPC:   return BLC_NPC;
+		case BL_ITEM:  return BLC_ITEM;
+		case BL_SKILL: return BLC_SKILL;
+		default:       return BLC_OTHER;
+	}
+}
+
+/// Walks the blocks at block position pos of map m, in the chains holding any of the given types.
+/// BLC_OTHER holds several types, the caller still has to check bl->type.
+#define map_foreachblock(m, pos, type, c, bl) \
+	for( (c) = 0; (c) < BLC_MAX; (c)++ ) \
+		if( ((type)&map_chain_types[c]) && map[m].block[c] != NULL ) \
+			for( (bl) = map[m].block[c][pos]; (bl) != NULL; (bl) = (bl)->next )
 
 #define MAP_MAX_MSG 1550
 static char *msg_table[MAP_MAX_MSG]; // map Server messages
@@ -163,6 +205,30 @@ struct map_cache_map_info {
 	int32 len;
 };
 
+// Map cache v2 (mapcache -v2): the header, the index of the maps, then the uncompressed
+// cells of each map on page boundaries. A cell is cell_size bytes, the first one holds
+// the MAP_CACHE_V2_* flags and the rest is zero, so the cells can be used in place.
+// They aren't bit-packed for that reason, see doc/map_cache.txt.
+#define MAP_CACHE_V2_MAGIC "MCV2"
+#define MAP_CACHE_V2_WALKABLE  0x01
+#define MAP_CACHE_V2_SHOOTABLE 0x02
+#define MAP_CACHE_V2_WATER     0x04
+
+struct map_cache_v2_header {
+	char magic[4];
+	uint32 file_size;
+	uint32 map_count;
+	uint32 page_size; // Alignment of the cells of each map
+	uint32 cell_size;
+};
+
+struct map_cache_v2_index {
+	char name[MAP_NAME_LENGTH];
+	int16 xs;
+	int16 ys;
+	uint32 offset; // Position of the cells in the file
+};
+
 char db_path[256] = "db";
 char motd_txt[256] = "conf/motd.txt";
 char help_txt[256] = "conf/help.txt";
@@ -178,6 +244,24 @@ int console = 0;
 int enable_spy = 0; //To enable/disable @spy commands, which consume too much cpu time when sending packets. [Skotlex]
 int enable_grf = 0;	//To enable/disable reading maps from GRF files, bypassing mapcache [blackhole89]
 
+static int mem_stats_interval = 0; // seconds between two dumps to mem_stats_file, 0 to disable
+static char mem_stats_file[256] = "./log/mem_stats.log";
+
+static bool lazy_map_load = false; // only register the maps of the map cache at startup, see map_loadcells
+static int map_unload_time = 0; // seconds of inactivity before the cells of a map are released again, 0 to keep them
+static char *map_cache_buffer = NULL; // the map cache, kept while maps are loaded on demand or use its cells
+static size_t map_cache_size = 0;
+static bool map_cache_v2 = false;
+static bool map_cache_mapped = false; // map_cache_buffer is a private mapping of the file
+static bool map_cache_direct = false; // the cells of the v2 map cache are used in place
+static struct mapcell map_cell_unloaded; // cells of the maps that aren't loaded yet
+#define MAP_UNLOAD_INTERVAL 60 // seconds between two runs of map_unload_timer
+
+static void map_loadcells(struct map_data *m);
+static void map_collect_area(int16 m, int16 x0, int16 y0, int16 x1, int16 y1, int type, bool wall_check);
+static void map_collect_movearea(int16 m, int16 cx, int16 cy, int16 range, int16 dx, int16 dy, int type);
+static void map_freecells(struct map_data *m);
+
 /*==========================================
  * server player count (of all mapservers)
  *------------------------------------------*/
@@ -261,9 +345,120 @@ int map_freeblock_timer(int tid, unsigned int tick, int id, intptr_t data)
 	return 0;
 }
 
+/// Appends the memory in use by each source file to mem_stats_file (every mem_stats_interval seconds).
+static int map_mem_stats_timer(int tid, unsigned int tick, int id, intptr_t data)
+{
+	if( !malloc_report_file(mem_stats_file) )
+		ShowError("map_mem_stats_timer: Can't write to '%s'.\n", mem_stats_file);
+	return 0;
+}
+
 //
 // blocklist
 //
+/*==========================================
+ * Cells of instance maps
+ * Instance maps share the cells of their source map (cell_base),
+ * a page of cells is copied the first time one of them is changed.
+ *------------------------------------------*/
+/// Returns the cell at xy.
+static inline struct mapcell *map_cellat(struct map_data *m, int xy)
+{
+	if( m->cell_page != NULL && m->cell_page[xy >> MAP_CELL_PAGE_BITS] != NULL )
+		return &m->cell_page[xy >> MAP_CELL_PAGE_BITS][xy & (MAP_CELL_PAGE_SIZE - 1)];
+	return &m->cell[xy];
+}
+
+/// Returns the cell at xy for a change, copying its page if it's still shared.
+static struct mapcell *map_cell_write(struct map_data *m, int xy)
+{
+	int page = xy >> MAP_CELL_PAGE_BITS;
+
+	if( m->cell_page != NULL && m->cell_page[page] == NULL ) {
+		int num = min(MAP_CELL_PAGE_SIZE, m->xs * m->ys - (page << MAP_CELL_PAGE_BITS));
+
+		CREATE(m->cell_page[page], struct mapcell, MAP_CELL_PAGE_SIZE);
+		memcpy(m->cell_page[page], &m->cell[page << MAP_CELL_PAGE_BITS], num * sizeof(struct mapcell));
+	}
+	return map_cellat(m, xy);
+}
+
+/// Returns the part of a cell that is shared with new instance maps, without the flags of the skills cast on it.
+static struct mapcell map_cell_shared(struct mapcell cell)
+{
+	cell.basilica = cell.landprotector = cell.icewall = cell.maelstrom = 0;
+#ifdef CELL_NOSTACK
+	cell.cell_bl = 0;
+#endif
+	return cell;
+}
+
+/// Releases a reference to the shared cells, they're freed once neither the instance maps nor the source map use them.
+static void map_cell_share_release(struct map_cell_share *share)
+{
+	if( --share->refs <= 0 ) {
+		aFree(share->cell);
+		aFree(share);
+	}
+}
+
+/// Forgets the shared cells of a map after a change, the instances created so far keep them.
+static void map_cell_share_drop(struct map_data *m)
+{
+	if( m->cell_base != NULL ) {
+		map_cell_share_release(m->cell_base);
+		m->cell_base = NULL;
+	}
+}
+
+/// Changes the cell at xy if it's different.
+static void map_putcell(struct map_data *m, int xy, struct mapcell cell)
+{
+	struct mapcell old = *map_cellat(m, xy);
+
+	if( memcmp(&old, &cell, sizeof(struct mapcell)) != 0 ) {
+		if( m->cell_base != NULL ) {
+			struct mapcell a = map_cell_shared(old), b = map_cell_shared(cell);
+
+			if( memcmp(&a, &b, sizeof(struct mapcell)) != 0 )
+				map_cell_share_drop(m); // the next instance takes the new cells
+		}
+		*map_cell_write(m, xy) = cell;
+		if( old.walkable != cell.walkable || old.shootable != cell.shootable ) {
+			m->changes++;
+			path_jump_update(m, xy % m->xs, xy / m->xs);
+			path_flow_update(m, xy % m->xs, xy / m->xs);
+		}
+	}
+}
+
+/// Returns the number of cell pages of a map.
+static int map_cell_pages(struct map_data *m)
+{
+	return (m->xs * m->ys + MAP_CELL_PAGE_SIZE - 1) >> MAP_CELL_PAGE_BITS;
+}
+
+/// Shares the cells of a map with a new instance map, without the flags of the skills cast on it.
+/// The copy is made again after the cells of the source map changed (see map_putcell).
+static void map_sharecells(struct map_data *src, struct map_data *dst)
+{
+	if( src->cell_base == NULL ) {
+		int xy, num_cell = src->xs * src->ys;
+
+		CREATE(src->cell_base, struct map_cell_share, 1);
+		CREATE(src->cell_base->cell, struct mapcell, num_cell);
+		for( xy = 0; xy < num_cell; xy++ )
+			src->cell_base->cell[xy] = map_cell_shared(*map_cellat(src, xy));
+		src->cell_base->refs = 1; // the source map
+	}
+	src->cell_base->refs++;
+
+	dst->cell = src->cell_base->cell;
+	dst->cell_page = (struct mapcell **)aCalloc(map_cell_pages(dst), sizeof(struct mapcell *));
+	dst->cell_base = NULL;
+	dst->cell_shared = src->cell_base;
+}
+
 /*==========================================
  * Handling of map_bl[]
  * The address of bl_heal is set in bl->prev
@@ -279,7 +474,9 @@ static void map_addblcell(struct block_list *bl)
 {
 	if( bl->m < 0 || bl->x < 0 || bl->x >= map[bl->m].xs || bl->y < 0 || bl->y >= map[bl->m].ys || !(bl->type&BL_CHAR) )
 		return;
-	map[bl->m].cell[bl->x + bl->y * map[bl->m].xs].cell_bl++;
+	if( map[bl->m].cell == &map_cell_unloaded )
+		return; // counted by map_loadcells
+	map_cell_write(&map[bl->m], bl->x + bl->y * map[bl->m].xs)->cell_bl++;
 	return;
 }
 
@@ -287,20 +484,157 @@ static void map_delblcell(struct block_list *bl)
 {
 	if( bl->m < 0 || bl->x < 0 || bl->x >= map[bl->m].xs || bl->y < 0 || bl->y >= map[bl->m].ys || !(bl->type&BL_CHAR) )
 		return;
-	map[bl->m].cell[bl->x + bl->y * map[bl->m].xs].cell_bl--;
+	if( map[bl->m].cell == &map_cell_unloaded )
+		return;
+	map_cell_write(&map[bl->m], bl->x + bl->y * map[bl->m].xs)->cell_bl--;
 }
 #endif
 
 /*==========================================
- * Adds a block to the map.
- * Returns 0 on success, 1 on failure (illegal coordinates).
+ * View sets (struct map_view)
+ * A player has every block within map_view_range in its seen list, and each of these
+ * blocks has the player in its watchers list. Only the blocks that come or go out of
+ * range are looked up when a block is added, removed or moved.
  *------------------------------------------*/
-int map_addblock(struct block_list *bl)
+static int map_view_range = -1; // area_size the view sets are kept for, set once the maps are loaded
+static struct map_view_list map_view_nobody; // watchers of the blocks without a view set
+
+static void map_view_list_add(struct map_view_list *list, struct block_list *bl)
+{
+	if( list->count == list->max ) {
+		list->max = ( list->max ? list->max * 2 : 8 );
+		RECREATE(list->bl, struct block_list *, list->max);
+	}
+	list->bl[list->count++] = bl;
+}
+
+static void map_view_list_remove(struct map_view_list *list, struct block_list *bl)
+{
+	int i;
+
+	ARR_FIND(0, list->count, i, list->bl[i] == bl);
+	if( i < list->count )
+		list->bl[i] = list->bl[--list->count];
+}
+
+static struct map_view *map_view_get(struct block_list *bl)
+{
+	if( bl->view == NULL )
+		CREATE(bl->view, struct map_view, 1);
+	return bl->view;
+}
+
+/// Puts a and b in view of each other, as far as they are players.
+static void map_view_link(struct block_list *a, struct block_list *b)
+{
+	if( a->type == BL_PC ) {
+		map_view_list_add(&map_view_get(a)->seen, b);
+		map_view_list_add(&map_view_get(b)->watchers, a);
+	}
+	if( b->type == BL_PC ) {
+		map_view_list_add(&map_view_get(b)->seen, a);
+		map_view_list_add(&map_view_get(a)->watchers, b);
+	}
+}
+
+static void map_view_unlink(struct block_list *a, struct block_list *b)
+{
+	if( a->view == NULL || b->view == NULL )
+		return;
+	if( a->type == BL_PC ) {
+		map_view_list_remove(&a->view->seen, b);
+		map_view_list_remove(&b->view->watchers, a);
+	}
+	if( b->type == BL_PC ) {
+		map_view_list_remove(&b->view->seen, a);
+		map_view_list_remove(&a->view->watchers, b);
+	}
+}
+
+/// Links bl with the blocks in range after it was put on its map.
+static void map_view_enter(struct block_list *bl)
+{
+	int blockcount = bl_list_count, i;
+
+	if( map_view_range < 0 )
+		return;
+
+	map_collect_area(bl->m, bl->x - map_view_range, bl->y - map_view_range, bl->x + map_view_range, bl->y + map_view_range, ( bl->type == BL_PC ? BL_ALL : BL_PC ), false);
+	for( i = blockcount; i < bl_list_count; i++ )
+		if( bl_list[i] != bl )
+			map_view_link(bl, bl_list[i]);
+	bl_list_count = blockcount;
+}
+
+/// Unlinks bl from all the blocks and releases its view set.
+static void map_view_leave(struct block_list *bl)
+{
+	struct map_view *view = bl->view;
+	struct block_list *other;
+
+	if( view == NULL )
+		return;
+
+	while( view->seen.count ) {
+		other = view->seen.bl[--view->seen.count];
+		if( other->view )
+			map_view_list_remove(&other->view->watchers, bl);
+	}
+	while( view->watchers.count ) {
+		other = view->watchers.bl[--view->watchers.count];
+		if( other->view )
+			map_view_list_remove(&other->view->seen, bl);
+	}
+	aFree(view->seen.bl);
+	aFree(view->watchers.bl);
+	aFree(view);
+	bl->view = NULL;
+}
+
+/// Updates the links of bl after it moved by dx,dy: only the strips that left or entered
+/// the range are scanned, like for map_foreachinmovearea.
+static void map_view_move(struct block_list *bl, int16 dx, int16 dy)
+{
+	int blockcount = bl_list_count, i;
+	int type = ( bl->type == BL_PC ? BL_ALL : BL_PC );
+
+	if( map_view_range < 0 || (!dx && !dy) )
+		return;
+
+	map_collect_movearea(bl->m, bl->x - dx, bl->y - dy, map_view_range, dx, dy, type);
+	for( i = blockcount; i < bl_list_count; i++ )
+		if( bl_list[i] != bl )
+			map_view_unlink(bl, bl_list[i]);
+	bl_list_count = blockcount;
+
+	map_collect_movearea(bl->m, bl->x, bl->y, map_view_range, -dx, -dy, type);
+	for( i = blockcount; i < bl_list_count; i++ )
+		if( bl_list[i] != bl )
+			map_view_link(bl, bl_list[i]);
+	bl_list_count = blockcount;
+}
+
+/**
+ * Players that have bl in view, to send area packets without a map query.
+ * @return NULL if bl has no view set to rely on (not on a map, not a real block or area_size was changed)
+ */
+struct map_view_list *map_view_watchers(struct block_list *bl)
+{
+	nullpo_retr(NULL, bl);
+
+	// Temporary blocks (e.g. the dummies of clif.c) aren't in the id db and may not be initialized
+	if( map_view_range != AREA_SIZE || bl->type == BL_NUL || map_id2bl(bl->id) != bl || bl->prev == NULL )
+		return NULL;
+
+	return ( bl->view ? &bl->view->watchers : &map_view_nobody );
+}
+
+/// Puts bl in the block chain of its position.
+static int map_block_insert(struct block_list *bl)
 {
 	int16 m, x, y;
 	int pos;
-
-	nullpo_ret(bl);
+	enum map_block_chain c;
 
 	if( bl->prev != NULL ) {
 		ShowError("map_addblock: bl->prev != NULL\n");
@@ -320,20 +654,16 @@ int map_addblock(struct block_list *bl)
 	}
 
 	pos = x / BLOCK_SIZE + (y / BLOCK_SIZE) * map[m].bxs;
+	c = map_block_chain(bl->type);
+	if( map[m].block[c] == NULL )
+		map[m].block[c] = (struct block_list **)aCalloc(map[m].bxs * map[m].bys, sizeof(struct block_list *));
 
-	if( bl->type == BL_MOB ) {
-		bl->next = map[m].block_mob[pos];
-		bl->prev = &bl_head;
-		if( bl->next )
-			bl->next->prev = bl;
-		map[m].block_mob[pos] = bl;
-	} else {
-		bl->next = map[m].block[pos];
-		bl->prev = &bl_head;
-		if( bl->next )
-			bl->next->prev = bl;
-		map[m].block[pos] = bl;
-	}
+	bl->next = map[m].block[c][pos];
+	bl->prev = &bl_head;
+	if( bl->next )
+		bl->next->prev = bl;
+	map[m].block[c][pos] = bl;
+	map[m].changes++;
 
 #ifdef CELL_NOSTACK
 	map_addblcell(bl);
@@ -342,20 +672,10 @@ int map_addblock(struct block_list *bl)
 	return 0;
 }
 
-/*==========================================
- * Removes a block from the map.
- *------------------------------------------*/
-int map_delblock(struct block_list *bl)
+/// Takes bl out of its block chain.
+static void map_block_remove(struct block_list *bl)
 {
 	int pos;
-	nullpo_ret(bl);
-
-	//Blocklist (2ways chainlist)
-	if (bl->prev == NULL) {
-		if (bl->next != NULL) //Can't delete block (already at the beginning of the chain)
-			ShowError("map_delblock error : bl->next!=NULL\n");
-		return 0;
-	}
 
 #ifdef CELL_NOSTACK
 	map_delblcell(bl);
@@ -367,14 +687,47 @@ int map_delblock(struct block_list *bl)
 		bl->next->prev = bl->prev;
 	if (bl->prev == &bl_head) {
 		//Since the head of the list, update the block_list map of []
-		if (bl->type == BL_MOB)
-			map[bl->m].block_mob[pos] = bl->next;
-		else
-			map[bl->m].block[pos] = bl->next;
+		map[bl->m].block[map_block_chain(bl->type)][pos] = bl->next;
 	} else
 		bl->prev->next = bl->next;
 	bl->next = NULL;
 	bl->prev = NULL;
+	map[bl->m].changes++;
+}
+
+/*==========================================
+ * Adds a block to the map.
+ * Returns 0 on success, 1 on failure (illegal coordinates).
+ *------------------------------------------*/
+int map_addblock(struct block_list *bl)
+{
+	nullpo_ret(bl);
+
+	if( bl->prev == NULL )
+		bl->view = NULL; // Not on a map, the block may come from aMalloc (chat_createchat)
+	if( map_block_insert(bl) )
+		return 1;
+	map_view_enter(bl);
+
+	return 0;
+}
+
+/*==========================================
+ * Removes a block from the map.
+ *------------------------------------------*/
+int map_delblock(struct block_list *bl)
+{
+	nullpo_ret(bl);
+
+	//Blocklist (2ways chainlist)
+	if (bl->prev == NULL) {
+		if (bl->next != NULL) //Can't delete block (already at the beginning of the chain)
+			ShowError("map_delblock error : bl->next!=NULL\n");
+		return 0;
+	}
+
+	map_view_leave(bl);
+	map_block_remove(bl);
 
 	return 0;
 }
@@ -428,7 +781,7 @@ int map_moveblock(struct block_list *bl, int x1, int y1, unsigned int tick)
 		npc_unsetcells((TBL_NPC *)bl);
 
 	if (moveblock)
-		map_delblock(bl);
+		map_block_remove(bl);
 #ifdef CELL_NOSTACK
 	else
 		map_delblcell(bl);
@@ -436,15 +789,19 @@ int map_moveblock(struct block_list *bl, int x1, int y1, unsigned int tick)
 
 	bl->x = x1;
 	bl->y = y1;
+	map[bl->m].changes++;
 
 	if (moveblock) {
-		if (map_addblock(bl))
+		if (map_block_insert(bl)) {
+			map_view_leave(bl);
 			return 1;
+		}
 	}
 #ifdef CELL_NOSTACK
 	else
 		map_addblcell(bl);
 #endif
+	map_view_move(bl, x1 - x0, y1 - y0);
 
 	if (bl->type&BL_CHAR) {
 		skill_unit_move(bl, tick, 3);
@@ -511,7 +868,7 @@ int map_moveblock(struct block_list *bl, int x1, int y1, unsigned int tick)
  *------------------------------------------*/
 int map_count_oncell(int16 m, int16 x, int16 y, int type, int flag)
 {
-	int bx,by;
+	int bx,by,c;
 	struct block_list *bl;
 	int count = 0;
 
@@ -521,46 +878,24 @@ int map_count_oncell(int16 m, int16 x, int16 y, int type, int flag)
 	bx = x / BLOCK_SIZE;
 	by = y / BLOCK_SIZE;
 
-	if (type&~BL_MOB) {
-		for (bl = map[m].block[bx + by * map[m].bxs]; bl != NULL; bl = bl->next) {
-			if (bl->x == x && bl->y == y && bl->type&type) {
-				if (flag&0x2) {
-					struct map_session_data *sd = map_id2sd(bl->id);
-					struct npc_data *nd = map_id2nd(bl->id);
+	map_foreachblock(m, bx + by * map[m].bxs, type, c, bl) {
+		if (bl->x == x && bl->y == y && bl->type&type) {
+			if (flag&0x2) {
+				struct map_session_data *sd = map_id2sd(bl->id);
+				struct npc_data *nd = map_id2nd(bl->id);
 
-					if (sd && pc_isinvisible(sd))
-						continue;
-					if (nd && (nd->class_ == JT_FAKENPC || nd->class_ == JT_HIDDEN_WARP_NPC))
-						continue;
-				}
-				if (flag&0x1) {
-					struct unit_data *ud = unit_bl2ud(bl);
-
-					if (ud && ud->walktimer != INVALID_TIMER)
-						continue;
-				}
-				count++;
+				if (sd && pc_isinvisible(sd))
+					continue;
+				if (nd && (nd->class_ == JT_FAKENPC || nd->class_ == JT_HIDDEN_WARP_NPC))
+					continue;
 			}
-		}
-	}
-
-	if (type&BL_MOB) {
-		for (bl = map[m].block_mob[bx + by * map[m].bxs]; bl != NULL; bl = bl->next) {
-			if (bl->x == x && bl->y == y) {
-				if (flag&0x2) {
-					struct map_session_data *sd = map_id2sd(bl->id);
-
-					if (sd && pc_isinvisible(sd))
-						continue;
-				}
-				if (flag&0x1) {
-					struct unit_data *ud = unit_bl2ud(bl);
+			if (flag&0x1) {
+				struct unit_data *ud = unit_bl2ud(bl);
 
-					if (ud && ud->walktimer != INVALID_TIMER)
-						continue;
-				}
-				count++;
+				if (ud && ud->walktimer != INVALID_TIMER)
+					continue;
 			}
+			count++;
 		}
 	}
 
@@ -580,11 +915,14 @@ struct skill_unit *map_find_skill_unit_oncell(struct block_list *target, int16 x
 	if( x < 0 || y < 0 || (x >= map[m].xs) || (y >= map[m].ys) )
 		return NULL;
 
+	if( map[m].block[BLC_SKILL] == NULL )
+		return NULL;
+
 	bx = x / BLOCK_SIZE;
 	by = y / BLOCK_SIZE;
 
-	for( bl = map[m].block[bx + by * map[m].bxs]; bl != NULL; bl = bl->next ) {
-		if( bl->x != x || bl->y != y || bl->type != BL_SKILL )
+	for( bl = map[m].block[BLC_SKILL][bx + by * map[m].bxs]; bl != NULL; bl = bl->next ) {
+		if( bl->x != x || bl->y != y )
 			continue;
 		unit = (struct skill_unit *) bl;
 		if( unit == out_unit || !unit->alive || !unit->group || unit->group->skill_id != skill_id )
@@ -596,61 +934,189 @@ struct skill_unit *map_find_skill_unit_oncell(struct block_list *target, int16 x
 }
 
 /*==========================================
- * Adapted from foreachinarea for an easier invocation. [Skotlex]
+ * Adds the blocks of the given types within range of center to bl_list.
  *------------------------------------------*/
-int map_foreachinrangeV(int (*func)(struct block_list *, va_list), struct block_list *center, int16 range, int type, va_list ap, bool wall_check)
+static void map_collect_range(struct block_list *center, int16 range, int type, bool wall_check)
 {
-	int bx, by, m;
-	int returnCount = 0; //Total sum of returned values of func() [Skotlex]
+	int bx, by, c, m;
 	struct block_list *bl;
-	int blockcount = bl_list_count, i;
 	int x0, x1, y0, y1;
-	va_list ap_copy;
 
 	m = center->m;
 	if( m < 0 )
-		return 0;
+		return;
 
 	x0 = i16max(center->x - range, 0);
 	y0 = i16max(center->y - range, 0);
 	x1 = i16min(center->x + range, map[m].xs - 1);
 	y1 = i16min(center->y + range, map[m].ys - 1);
 
-	if( type&~BL_MOB ) {
-		for( by = y0 / BLOCK_SIZE; by <= y1 / BLOCK_SIZE; by++ ) {
-			for( bx = x0 / BLOCK_SIZE; bx <= x1 / BLOCK_SIZE; bx++ ) {
-				for( bl = map[m].block[bx + by * map[m].bxs]; bl != NULL; bl = bl->next ) {
-					if( bl->type&type
-						&& bl->x >= x0 && bl->x <= x1 && bl->y >= y0 && bl->y <= y1
+	for( by = y0 / BLOCK_SIZE; by <= y1 / BLOCK_SIZE; by++ ) {
+		for( bx = x0 / BLOCK_SIZE; bx <= x1 / BLOCK_SIZE; bx++ ) {
+			map_foreachblock(m, bx + by * map[m].bxs, type, c, bl) {
+				if( bl->type&type
+					&& bl->x >= x0 && bl->x <= x1 && bl->y >= y0 && bl->y <= y1
 #ifdef CIRCULAR_AREA
-						&& check_distance_bl(center, bl, range)
+					&& check_distance_bl(center, bl, range)
 #endif
-						&& (!wall_check || path_search_long(NULL, center->m, center->x, center->y, bl->x, bl->y, CELL_CHKWALL))
-					  	&& bl_list_count < BL_LIST_MAX )
-						bl_list[bl_list_count++] = bl;
-				}
+					&& (!wall_check || path_search_long(NULL, center->m, center->x, center->y, bl->x, bl->y, CELL_CHKWALL)) )
+					BL_LIST_PUSH(bl);
+			}
+		}
+	}
+}
+
+/*==========================================
+ * Adds the blocks of the given types in the area (x0,y0)-(x1,y1) to bl_list.
+ * The wall check is done from the center of the area.
+ *------------------------------------------*/
+static void map_collect_area(int16 m, int16 x0, int16 y0, int16 x1, int16 y1, int type, bool wall_check)
+{
+	int bx, by, c, cx = 0, cy = 0;
+	struct block_list *bl;
+
+	if( m < 0 || m >= map_num )
+		return;
+
+	if( x1 < x0 )
+		swap(x0, x1);
+
+	if( y1 < y0 )
+		swap(y0, y1);
+
+	x0 = i16max(x0, 0);
+	y0 = i16max(y0, 0);
+	x1 = i16min(x1, map[m].xs - 1);
+	y1 = i16min(y1, map[m].ys - 1);
+
+	if( wall_check ) {
+		cx = x0 + (x1 - x0) / 2;
+		cy = y0 + (y1 - y0) / 2;
+	}
+
+	for( by = y0 / BLOCK_SIZE; by <= y1 / BLOCK_SIZE; by++ ) {
+		for( bx = x0 / BLOCK_SIZE; bx <= x1 / BLOCK_SIZE; bx++ ) {
+			map_foreachblock(m, bx + by * map[m].bxs, type, c, bl) {
+				if( bl->type&type
+					&& bl->x >= x0 && bl->x <= x1 && bl->y >= y0 && bl->y <= y1
+					&& (!wall_check || path_search_long(NULL, m, cx, cy, bl->x, bl->y, CELL_CHKWALL)) )
+					BL_LIST_PUSH(bl);
 			}
 		}
 	}
+}
+
+static bool map_query_wallcheck(enum map_query_mode mode)
+{
+	return ( mode == MQ_SHOOT || (mode == MQ_SKILL && battle_config.skill_wall_check > 0) );
+}
 
-	if( type&BL_MOB ) {
-		for( by = y0 / BLOCK_SIZE; by <= y1 / BLOCK_SIZE; by++ ) {
-			for( bx = x0 / BLOCK_SIZE; bx <= x1 / BLOCK_SIZE; bx++ ) {
-				for( bl = map[m].block_mob[bx + by * map[m].bxs]; bl != NULL; bl = bl->next ) {
-					if( bl->x >= x0 && bl->x <= x1 && bl->y >= y0 && bl->y <= y1
+/**
+ * Finds the blocks of the given types within range of center.
+ * Walk the result with map_query_next and release it with map_query_end, in the reverse order
+ * of the queries when they are nested. The blocks are not freed until then (map_freeblock_lock).
+ * @param q: Query to fill
+ * @param center: Center of the search
+ * @param range: Range around center
+ * @param type: Types of bl to search for
+ * @param mode: Wall check, see map_query_mode
+ * @return Number of blocks found
+ */
+int map_query_range(struct map_query *q, struct block_list *center, int16 range, int type, enum map_query_mode mode)
+{
+	q->base = bl_list_count;
+	map_collect_range(center, range, type, map_query_wallcheck(mode));
+	q->count = bl_list_count - q->base;
+	q->pos = 0;
+	map_freeblock_lock();
+	return q->count;
+}
+
+/**
+ * Finds the blocks of the given types in the area (x0,y0)-(x1,y1), see map_query_range.
+ * @return Number of blocks found
+ */
+int map_query_area(struct map_query *q, int16 m, int16 x0, int16 y0, int16 x1, int16 y1, int type, enum map_query_mode mode)
+{
+	q->base = bl_list_count;
+	map_collect_area(m, x0, y0, x1, y1, type, map_query_wallcheck(mode));
+	q->count = bl_list_count - q->base;
+	q->pos = 0;
+	map_freeblock_lock();
+	return q->count;
+}
+
+/**
+ * Next block of a query result, skipping those removed from the map since the query.
+ * @return NULL at the end of the result
+ */
+struct block_list *map_query_next(struct map_query *q)
+{
+	while( q->pos < q->count ) {
+		struct block_list *bl = bl_list[q->base + q->pos++];
+
+		if( bl->prev ) //Blocks queued for deletion are taken off the map
+			return bl;
+	}
+	return NULL;
+}
+
+/// Releases a query result.
+void map_query_end(struct map_query *q)
+{
+	map_freeblock_unlock();
+	bl_list_count = q->base;
+	q->count = q->pos = 0;
+}
+
+/**
+ * Finds the blocks of the given types within range of center, like map_query_range without wall check.
+ * Only reads the block lists, so the mob AI threads can call it while the main thread waits (see mob_ai_decide).
+ * @param list: Blocks found, in the same order as map_query_range
+ * @param max: Size of list
+ * @return Number of blocks found, more than max if they didn't all fit
+ */
+int map_collect_blocks(struct block_list *center, int16 range, int type, struct block_list **list, int max)
+{
+	int bx, by, c, m, count = 0;
+	struct block_list *bl;
+	int x0, x1, y0, y1;
+
+	m = center->m;
+	if( m < 0 )
+		return 0;
+
+	x0 = i16max(center->x - range, 0);
+	y0 = i16max(center->y - range, 0);
+	x1 = i16min(center->x + range, map[m].xs - 1);
+	y1 = i16min(center->y + range, map[m].ys - 1);
+
+	for( by = y0 / BLOCK_SIZE; by <= y1 / BLOCK_SIZE; by++ ) {
+		for( bx = x0 / BLOCK_SIZE; bx <= x1 / BLOCK_SIZE; bx++ ) {
+			map_foreachblock(m, bx + by * map[m].bxs, type, c, bl) {
+				if( bl->type&type
+					&& bl->x >= x0 && bl->x <= x1 && bl->y >= y0 && bl->y <= y1
 #ifdef CIRCULAR_AREA
-						&& check_distance_bl(center, bl, range)
+					&& check_distance_bl(center, bl, range)
 #endif
-						&& (!wall_check || path_search_long(NULL, center->m, center->x, center->y, bl->x, bl->y, CELL_CHKWALL))
-					  	&& bl_list_count < BL_LIST_MAX )
-						bl_list[bl_list_count++] = bl;
+					) {
+					if( count < max )
+						list[count] = bl;
+					count++;
 				}
 			}
 		}
 	}
+	return count;
+}
 
-	if( bl_list_count >= BL_LIST_MAX )
-		ShowWarning("map_foreachinrange: block count too many!\n");
+/// Calls func for each block found from position blockcount of bl_list on and releases them.
+/// @param count Stops once the sum of the returned values reaches count (0 = no limit)
+static int map_foreach_collected(int (*func)(struct block_list *, va_list), int blockcount, int count, va_list ap)
+{
+	int returnCount = 0; //Total sum of returned values of func() [Skotlex]
+	int i;
+	va_list ap_copy;
 
 	map_freeblock_lock();
 
@@ -659,13 +1125,26 @@ int map_foreachinrangeV(int (*func)(struct block_list *, va_list), struct block_
 			va_copy(ap_copy, ap);
 			returnCount += func(bl_list[i], ap_copy);
 			va_end(ap_copy);
+			if( count && returnCount >= count )
+				break;
 		}
 	}
 
 	map_freeblock_unlock();
 
-	bl_list_count = blockcount;
-	return returnCount;	//[Skotlex]
+	bl_list_count = blockcount;
+	return returnCount;
+}
+
+/*==========================================
+ * Adapted from foreachinarea for an easier invocation. [Skotlex]
+ *------------------------------------------*/
+int map_foreachinrangeV(int (*func)(struct block_list *, va_list), struct block_list *center, int16 range, int type, va_list ap, bool wall_check)
+{
+	int blockcount = bl_list_count;
+
+	map_collect_range(center, range, type, wall_check);
+	return map_foreach_collected(func, blockcount, 0, ap);
 }
 
 int map_foreachinrange(int (*func)(struct block_list *, va_list), struct block_list *center, int16 range, int type, ...)
@@ -717,75 +1196,10 @@ int map_foreachinshootrange(int (*func)(struct block_list *, va_list), struct bl
  */
 int map_foreachinareaV(int (*func)(struct block_list *, va_list), int16 m, int16 x0, int16 y0, int16 x1, int16 y1, int type, va_list ap, bool wall_check)
 {
-	int bx, by, cx = 0, cy = 0;
-	int returnCount = 0; //Total sum of returned values of func()
-	struct block_list *bl;
-	int blockcount = bl_list_count, i;
-	va_list ap_copy;
-
-	if( m < 0 || m >= map_num )
-		return 0;
-
-	if( x1 < x0 )
-		swap(x0, x1);
-
-	if( y1 < y0 )
-		swap(y0, y1);
-
-	x0 = i16max(x0, 0);
-	y0 = i16max(y0, 0);
-	x1 = i16min(x1, map[m].xs - 1);
-	y1 = i16min(y1, map[m].ys - 1);
-
-	if( wall_check ) {
-		cx = x0 + (x1 - x0) / 2;
-		cy = y0 + (y1 - y0) / 2;
-	}
-
-	if( type&~BL_MOB ) {
-		for( by = y0 / BLOCK_SIZE; by <= y1 / BLOCK_SIZE; by++ ) {
-			for( bx = x0 / BLOCK_SIZE; bx <= x1 / BLOCK_SIZE; bx++ ) {
-				for( bl = map[m].block[bx + by * map[m].bxs]; bl != NULL; bl = bl->next ) {
-					if( bl->type&type
-						&& bl->x >= x0 && bl->x <= x1 && bl->y >= y0 && bl->y <= y1
-						&& (!wall_check || path_search_long(NULL, m, cx, cy, bl->x, bl->y, CELL_CHKWALL))
-						&& bl_list_count < BL_LIST_MAX )
-						bl_list[bl_list_count++] = bl;
-				}
-			}
-		}
-	}
-
-	if( type&BL_MOB ) {
-		for( by = y0 / BLOCK_SIZE; by <= y1 / BLOCK_SIZE; by++ ) {
-			for( bx = x0 / BLOCK_SIZE; bx <= x1 / BLOCK_SIZE; bx++ ) {
-				for( bl = map[m].block_mob[bx + by * map[m].bxs]; bl != NULL; bl = bl->next ) {
-					if( bl->x >= x0 && bl->x <= x1 && bl->y >= y0 && bl->y <= y1
-						&& (!wall_check || path_search_long(NULL, m, cx, cy, bl->x, bl->y, CELL_CHKWALL))
-						&& bl_list_count < BL_LIST_MAX )
-						bl_list[bl_list_count++] = bl;
-				}
-			}
-		}
-	}
-
-	if( bl_list_count >= BL_LIST_MAX )
-		ShowWarning("map_foreachinarea: block count too many!\n");
-
-	map_freeblock_lock();
-
-	for( i = blockcount; i < bl_list_count; i++ ) {
-		if( bl_list[i]->prev ) { //func() may delete this bl_list[] slot, checking for prev ensures it wasn't queued for deletion
-			va_copy(ap_copy, ap);
-			returnCount += func(bl_list[i], ap_copy);
-			va_end(ap_copy);
-		}
-	}
-
-	map_freeblock_unlock();
+	int blockcount = bl_list_count;
 
-	bl_list_count = blockcount;
-	return returnCount;
+	map_collect_area(m, x0, y0, x1, y1, type, wall_check);
+	return map_foreach_collected(func, blockcount, 0, ap);
 }
 
 int map_foreachinallarea(int (*func)(struct block_list *, va_list), int16 m, int16 x0, int16 y0, int16 x1, int16 y1, int type, ...)
@@ -826,140 +1240,41 @@ int map_foreachinarea(int (*func)(struct block_list *, va_list), int16 m, int16
  *------------------------------------------*/
 int map_forcountinrange(int (*func)(struct block_list *, va_list), struct block_list *center, int16 range, int count, int type, ...)
 {
-	int bx, by, m;
-	int returnCount = 0; //Total sum of returned values of func() [Skotlex]
-	struct block_list *bl;
-	int blockcount = bl_list_count, i;
-	int x0, x1, y0, y1;
+	int returnCount = 0;
+	int blockcount = bl_list_count;
 	va_list ap;
 
-	m = center->m;
-	x0 = i16max(center->x - range, 0);
-	y0 = i16max(center->y - range, 0);
-	x1 = i16min(center->x + range, map[m].xs - 1);
-	y1 = i16min(center->y + range, map[m].ys - 1);
-
-	if( type&~BL_MOB ) {
-		for( by = y0 / BLOCK_SIZE; by <= y1 / BLOCK_SIZE; by++ ) {
-			for( bx = x0 / BLOCK_SIZE; bx <= x1 / BLOCK_SIZE; bx++ ) {
-				for( bl = map[m].block[bx + by * map[m].bxs]; bl != NULL; bl = bl->next ) {
-					if( bl->type&type
-						&& bl->x >= x0 && bl->x <= x1 && bl->y >= y0 && bl->y <= y1
-#ifdef CIRCULAR_AREA
-						&& check_distance_bl(center, bl, range)
-#endif
-					  	&& bl_list_count < BL_LIST_MAX )
-						bl_list[bl_list_count++] = bl;
-				}
-			}
-		}
-	}
-
-	if( type&BL_MOB ) {
-		for( by = y0 / BLOCK_SIZE; by <= y1 / BLOCK_SIZE; by++ ) {
-			for( bx = x0 / BLOCK_SIZE; bx <= x1 / BLOCK_SIZE; bx++ ){
-				for( bl = map[m].block_mob[bx + by * map[m].bxs]; bl != NULL; bl = bl->next ) {
-					if( bl->x >= x0 && bl->x <= x1 && bl->y >= y0 && bl->y <= y1
-#ifdef CIRCULAR_AREA
-						&& check_distance_bl(center, bl, range)
-#endif
-						&& bl_list_count < BL_LIST_MAX )
-						bl_list[bl_list_count++] = bl;
-				}
-			}
-		}
-	}
-
-	if( bl_list_count >= BL_LIST_MAX )
-		ShowWarning("map_forcountinrange: block count too many!\n");
-
-	map_freeblock_lock();
-
-	for( i = blockcount; i < bl_list_count; i++ ) {
-		if( bl_list[i]->prev ) { //func() may delete this bl_list[] slot, checking for prev ensures it wasn't queued for deletion
-			va_start(ap, type);
-			returnCount += func(bl_list[i], ap);
-			va_end(ap);
-			if( count && returnCount >= count )
-				break;
-		}
-	}
-
-	map_freeblock_unlock();
-
-	bl_list_count = blockcount;
-	return returnCount;	//[Skotlex]
+	map_collect_range(center, range, type, false);
+	va_start(ap, type);
+	returnCount = map_foreach_collected(func, blockcount, count, ap);
+	va_end(ap);
+	return returnCount;
 }
 
 int map_forcountinarea(int (*func)(struct block_list *, va_list), int16 m, int16 x0, int16 y0, int16 x1, int16 y1, int count, int type, ...)
 {
-	int bx, by;
-	int returnCount = 0; //Total sum of returned values of func() [Skotlex]
-	struct block_list *bl;
-	int blockcount = bl_list_count, i;
+	int returnCount = 0;
+	int blockcount = bl_list_count;
 	va_list ap;
 
-	if( m < 0 )
-		return 0;
-
-	if( x1 < x0 )
-		swap(x0, x1);
-
-	if( y1 < y0 )
-		swap(y0, y1);
-
-	x0 = i16max(x0, 0);
-	y0 = i16max(y0, 0);
-	x1 = i16min(x1, map[m].xs - 1);
-	y1 = i16min(y1, map[m].ys - 1);
-
-	if( type&~BL_MOB )
-		for( by = y0 / BLOCK_SIZE; by <= y1 / BLOCK_SIZE; by++ )
-			for( bx = x0 / BLOCK_SIZE; bx <= x1 / BLOCK_SIZE; bx++ )
-				for( bl = map[m].block[bx + by * map[m].bxs]; bl != NULL; bl = bl->next )
-					if( bl->type&type && bl->x >= x0 && bl->x <= x1 && bl->y >= y0 && bl->y <= y1 && bl_list_count < BL_LIST_MAX )
-						bl_list[bl_list_count++] = bl;
-
-	if( type&BL_MOB )
-		for( by = y0 / BLOCK_SIZE; by <= y1 / BLOCK_SIZE; by++ )
-			for( bx = x0 / BLOCK_SIZE; bx <= x1 / BLOCK_SIZE; bx++ )
-				for( bl = map[m].block_mob[bx + by * map[m].bxs]; bl != NULL; bl = bl->next )
-					if( bl->x >= x0 && bl->x <= x1 && bl->y >= y0 && bl->y <= y1 && bl_list_count < BL_LIST_MAX )
-						bl_list[bl_list_count++] = bl;
-
-	if( bl_list_count >= BL_LIST_MAX )
-		ShowWarning("map_forcountinarea: block count too many!\n");
-
-	map_freeblock_lock();
-
-	for( i = blockcount; i < bl_list_count; i++ ) {
-		if( bl_list[i]->prev ) { //func() may delete this bl_list[] slot, checking for prev ensures it wasn't queued for deletion
-			va_start(ap, type);
-			returnCount += func(bl_list[i], ap);
-			va_end(ap);
-			if( count && returnCount >= count )
-				break;
-		}
-	}
-
-	map_freeblock_unlock();
-
-	bl_list_count = blockcount;
-	return returnCount;	//[Skotlex]
+	map_collect_area(m, x0, y0, x1, y1, type, false);
+	va_start(ap, type);
+	returnCount = map_foreach_collected(func, blockcount, count, ap);
+	va_end(ap);
+	return returnCount;
 }
 
 /*==========================================
  * For what I get
  * Move bl and do func* with va_list while moving.
  * Movement is set by dx dy which are distance in x and y
+ * Only the cells left behind by the movement are scanned: a strip |dx| cells
+ * wide and a strip |dy| cells high in the remaining columns.
  *------------------------------------------*/
 int map_foreachinmovearea(int (*func)(struct block_list *, va_list), struct block_list *center, int16 range, int16 dx, int16 dy, int type, ...)
 {
-	int bx, by, m;
 	int returnCount = 0; //Total sum of returned values of func() [Skotlex]
-	struct block_list *bl;
-	int blockcount = bl_list_count, i;
-	int16 x0, x1, y0, y1;
+	int blockcount = bl_list_count;
 	va_list ap;
 
 	if( !range )
@@ -968,11 +1283,23 @@ int map_foreachinmovearea(int (*func)(struct block_list *, va_list), struct bloc
 	if( !dx && !dy )
 		return 0; //No movement
 
-	m = center->m;
-	x0 = center->x - range;
-	x1 = center->x + range;
-	y0 = center->y - range;
-	y1 = center->y + range;
+	map_collect_movearea(center->m, center->x, center->y, range, dx, dy, type);
+
+	va_start(ap, type);
+	returnCount = map_foreach_collected(func, blockcount, 0, ap);
+	va_end(ap);
+	return returnCount;
+}
+
+/// Collects the blocks in the strips of the area around cx,cy that are left behind by a move of dx,dy.
+static void map_collect_movearea(int16 m, int16 cx, int16 cy, int16 range, int16 dx, int16 dy, int type)
+{
+	int16 x0, x1, y0, y1;
+
+	x0 = cx - range;
+	x1 = cx + range;
+	y0 = cy - range;
+	y1 = cy + range;
 
 	if( x1 < x0 )
 		swap(x0, x1);
@@ -980,100 +1307,20 @@ int map_foreachinmovearea(int (*func)(struct block_list *, va_list), struct bloc
 	if( y1 < y0 )
 		swap(y0, y1);
 
-	if( dx == 0 || dy == 0 ) {
-		//Movement along one axis only
-		if( dx == 0 ) {
-			if( dy < 0 ) //Moving south
-				y0 = y1 + dy + 1;
-			else //North
-				y1 = y0 + dy - 1;
-		} else { //dy == 0
-			if( dx < 0 ) //West
-				x0 = x1 + dx + 1;
-			else //East
-				x1 = x0 + dx - 1;
-		}
-
-		x0 = i16max(x0, 0);
-		y0 = i16max(y0, 0);
-		x1 = i16min(x1, map[m].xs - 1);
-		y1 = i16min(y1, map[m].ys - 1);
-
-		for( by = y0 / BLOCK_SIZE; by <= y1 / BLOCK_SIZE; by++ ) {
-			for( bx = x0 / BLOCK_SIZE; bx <= x1 / BLOCK_SIZE; bx++ ) {
-				if( type&~BL_MOB ) {
-					for( bl = map[m].block[bx + by * map[m].bxs]; bl != NULL; bl = bl->next ) {
-						if( bl->type&type &&
-							bl->x >= x0 && bl->x <= x1 &&
-							bl->y >= y0 && bl->y <= y1 &&
-							bl_list_count < BL_LIST_MAX )
-							bl_list[bl_list_count++] = bl;
-					}
-				}
-				if( type&BL_MOB ) {
-					for( bl = map[m].block_mob[bx + by * map[m].bxs]; bl != NULL; bl = bl->next ) {
-						if( bl->x >= x0 && bl->x <= x1 &&
-							bl->y >= y0 && bl->y <= y1 &&
-							bl_list_count < BL_LIST_MAX )
-							bl_list[bl_list_count++] = bl;
-					}
-				}
-			}
-		}
-	} else { // Diagonal movement
-		x0 = i16max(x0, 0);
-		y0 = i16max(y0, 0);
-		x1 = i16min(x1, map[m].xs - 1);
-		y1 = i16min(y1, map[m].ys - 1);
-
-		for( by = y0 / BLOCK_SIZE; by <= y1 / BLOCK_SIZE; by++ ) {
-			for( bx = x0 / BLOCK_SIZE; bx <= x1 / BLOCK_SIZE; bx++ ) {
-				if( type & ~BL_MOB ) {
-					for( bl = map[m].block[bx + by * map[m].bxs]; bl != NULL; bl = bl->next ) {
-						if( bl->type&type &&
-							bl->x >= x0 && bl->x <= x1 &&
-							bl->y >= y0 && bl->y <= y1 &&
-							bl_list_count < BL_LIST_MAX )
-						if( (dx > 0 && bl->x < x0 + dx) ||
-							(dx < 0 && bl->x > x1 + dx) ||
-							(dy > 0 && bl->y < y0 + dy) ||
-							(dy < 0 && bl->y > y1 + dy) )
-							bl_list[bl_list_count++] = bl;
-					}
-				}
-				if( type&BL_MOB ) {
-					for( bl = map[m].block_mob[bx + by * map[m].bxs]; bl != NULL; bl = bl->next ) {
-						if( bl->x >= x0 && bl->x <= x1 &&
-							bl->y >= y0 && bl->y <= y1 &&
-							bl_list_count < BL_LIST_MAX)
-						if( (dx > 0 && bl->x < x0 + dx) ||
-							(dx < 0 && bl->x > x1 + dx) ||
-							(dy > 0 && bl->y < y0 + dy) ||
-							(dy < 0 && bl->y > y1 + dy) )
-							bl_list[bl_list_count++] = bl;
-					}
-				}
-			}
-		}
+	if( dx > 0 ) { //East
+		map_collect_area(m, x0, y0, i16min(x0 + dx - 1, x1), y1, type, false);
+		x0 += dx;
+	} else if( dx < 0 ) { //West
+		map_collect_area(m, i16max(x1 + dx + 1, x0), y0, x1, y1, type, false);
+		x1 += dx;
 	}
 
-	if( bl_list_count >= BL_LIST_MAX )
-		ShowWarning("map_foreachinmovearea: block count too many!\n");
-
-	map_freeblock_lock(); // Prohibit the release from memory
-
-	for( i = blockcount; i < bl_list_count; i++ ) {
-		if( bl_list[i]->prev ) { //func() may delete this bl_list[] slot, checking for prev ensures it wasn't queued for deletion
-			va_start(ap, type);
-			returnCount += func(bl_list[i], ap);
-			va_end(ap);
-		}
+	if( x0 <= x1 ) {
+		if( dy > 0 ) //North
+			map_collect_area(m, x0, y0, x1, i16min(y0 + dy - 1, y1), type, false);
+		else if( dy < 0 ) //South
+			map_collect_area(m, x0, i16max(y1 + dy + 1, y0), x1, y1, type, false);
 	}
-
-	map_freeblock_unlock();	// Allow Free
-
-	bl_list_count = blockcount;
-	return returnCount;
 }
 
 // -- moonsoul	(added map_foreachincell which is a rework of map_foreachinallarea but
@@ -1082,7 +1329,7 @@ int map_foreachinmovearea(int (*func)(struct block_list *, va_list), struct bloc
 //
 int map_foreachincell(int (*func)(struct block_list *, va_list), int16 m, int16 x, int16 y, int type, ...)
 {
-	int bx, by;
+	int bx, by, c;
 	int returnCount = 0; //Total sum of returned values of func() [Skotlex]
 	struct block_list *bl;
 	int blockcount = bl_list_count, i;
@@ -1094,18 +1341,9 @@ int map_foreachincell(int (*func)(struct block_list *, va_list), int16 m, int16
 	by = y / BLOCK_SIZE;
 	bx = x / BLOCK_SIZE;
 
-	if( type&~BL_MOB )
-		for( bl = map[m].block[bx + by * map[m].bxs]; bl != NULL; bl = bl->next )
-			if( bl->type&type && bl->x == x && bl->y == y && bl_list_count < BL_LIST_MAX )
-				bl_list[bl_list_count++] = bl;
-
-	if( type&BL_MOB )
-		for( bl = map[m].block_mob[bx + by * map[m].bxs]; bl != NULL; bl = bl->next )
-			if( bl->x == x && bl->y == y && bl_list_count < BL_LIST_MAX)
-				bl_list[bl_list_count++] = bl;
-
-	if( bl_list_count >= BL_LIST_MAX )
-		ShowWarning("map_foreachincell: block count too many!\n");
+	map_foreachblock(m, bx + by * map[m].bxs, type, c, bl)
+		if( bl->type&type && bl->x == x && bl->y == y )
+			BL_LIST_PUSH(bl);
 
 	map_freeblock_lock();
 
@@ -1165,7 +1403,7 @@ int map_foreachinpath(int (*func)(struct block_list *, va_list), int16 m, int16
 	//Generic map_foreach* variables
 	int i, blockcount = bl_list_count;
 	struct block_list *bl;
-	int bx, by;
+	int bx, by, c;
 	//method specific variables
 	int magnitude2, len_limit; //The square of the magnitude
 	int k, xi, yi, xu, yu;
@@ -1221,77 +1459,39 @@ int map_foreachinpath(int (*func)(struct block_list *, va_list), int16 m, int16
 
 	range *= (range<<8); //Values are shifted later on for higher precision using int math.
 
-	if( type&~BL_MOB ) {
-		for( by = my0 / BLOCK_SIZE; by <= my1 / BLOCK_SIZE; by++ ) {
-			for( bx = mx0 / BLOCK_SIZE; bx <= mx1 / BLOCK_SIZE; bx++ ) {
-				for( bl = map[m].block[bx + by * map[m].bxs]; bl != NULL; bl = bl->next ) {
-					if( bl->prev && bl->type&type && bl_list_count < BL_LIST_MAX ) {
-						xi = bl->x;
-						yi = bl->y;
+	for( by = my0 / BLOCK_SIZE; by <= my1 / BLOCK_SIZE; by++ ) {
+		for( bx = mx0 / BLOCK_SIZE; bx <= mx1 / BLOCK_SIZE; bx++ ) {
+			map_foreachblock(m, bx + by * map[m].bxs, type, c, bl) {
+				if( bl->prev && bl->type&type ) {
+					xi = bl->x;
+					yi = bl->y;
 
-						k = (xi - x0) * (x1 - x0) + (yi - y0) * (y1 - y0);
+					k = (xi - x0) * (x1 - x0) + (yi - y0) * (y1 - y0);
 
-						if( k < 0 || k > len_limit ) //Since more skills use this, check for ending point as well
-							continue;
-
-						if( k > magnitude2 && !path_search_long(NULL, m, x0, y0, xi, yi, CELL_CHKWALL) )
-							continue; //Targets beyond the initial ending point need the wall check
-
-						//All these shifts are to increase the precision of the intersection point and distance considering how it's int math
-						k  = (k<<4) / magnitude2; //k will be between 1~16 instead of 0~1
-						xi <<= 4;
-						yi <<= 4;
-						xu = (x0<<4) + k * (x1 - x0);
-						yu = (y0<<4) + k * (y1 - y0);
-						k  = MAGNITUDE2(xi, yi, xu, yu);
-
-						//If all dot coordinates were <<4 the square of the magnitude is <<8
-						if( k > range )
-							continue;
-
-						bl_list[bl_list_count++] = bl;
-					}
-				}
-			}
-		}
-	}
-
-	 if( type&BL_MOB ) {
-		for( by = my0 / BLOCK_SIZE; by <= my1 / BLOCK_SIZE; by++ ) {
-			for( bx = mx0 / BLOCK_SIZE; bx <= mx1 / BLOCK_SIZE; bx++ ) {
-				for( bl = map[m].block_mob[bx + by * map[m].bxs]; bl != NULL; bl = bl->next ) {
-					if( bl->prev && bl_list_count < BL_LIST_MAX ) {
-						xi = bl->x;
-						yi = bl->y;
-						k = (xi - x0) * (x1 - x0) + (yi - y0) * (y1 - y0);
-
-						if( k < 0 || k > len_limit )
-							continue;
+					if( k < 0 || k > len_limit ) //Since more skills use this, check for ending point as well
+						continue;
 
-						if( k > magnitude2 && !path_search_long(NULL, m, x0, y0, xi, yi, CELL_CHKWALL) )
-							continue; //Targets beyond the initial ending point need the wall check
+					if( k > magnitude2 && !path_search_long(NULL, m, x0, y0, xi, yi, CELL_CHKWALL) )
+						continue; //Targets beyond the initial ending point need the wall check
 
-						k  = (k<<4) / magnitude2; //k will be between 1~16 instead of 0~1
-						xi <<= 4;
-						yi <<= 4;
-						xu = (x0<<4) + k * (x1 - x0);
-						yu = (y0<<4) + k * (y1 - y0);
-						k  = MAGNITUDE2(xi, yi, xu, yu);
+					//All these shifts are to increase the precision of the intersection point and distance considering how it's int math
+					k  = (k<<4) / magnitude2; //k will be between 1~16 instead of 0~1
+					xi <<= 4;
+					yi <<= 4;
+					xu = (x0<<4) + k * (x1 - x0);
+					yu = (y0<<4) + k * (y1 - y0);
+					k  = MAGNITUDE2(xi, yi, xu, yu);
 
-						//If all dot coordinates were <<4 the square of the magnitude is <<8
-						if( k > range )
-							continue;
+					//If all dot coordinates were <<4 the square of the magnitude is <<8
+					if( k > range )
+						continue;
 
-						bl_list[bl_list_count++] = bl;
-					}
+					BL_LIST_PUSH(bl);
 				}
 			}
 		}
 	}
 
-	if( bl_list_count >= BL_LIST_MAX )
-		ShowWarning("map_foreachinpath: block count too many!\n");
-
 	map_freeblock_lock();
 
 	for( i = blockcount; i < bl_list_count; i++ ) {
@@ -1330,7 +1530,7 @@ int map_foreachindir(int(*func)(struct block_list *, va_list), int16 m, int16 x0
 	int returnCount = 0; //Total sum of returned values of func()
 	int i, blockcount = bl_list_count;
 	struct block_list *bl;
-	int bx, by, rx, ry;
+	int bx, by, c, rx, ry;
 	int16 mx0, mx1, my0, my1;
 	uint8 dir = map_calc_dir_xy(x0, y0, x1, y1, 6);
 	short dx = dirx[dir];
@@ -1378,69 +1578,34 @@ int map_foreachindir(int(*func)(struct block_list *, va_list), int16 m, int16 x0
 	mx1 = i16min(mx1, map[m].xs - 1);
 	my1 = i16min(my1, map[m].ys - 1);
 
-	if( type&~BL_MOB ) {
-		for( by = my0 / BLOCK_SIZE; by <= my1 / BLOCK_SIZE; by++ ) {
-			for( bx = mx0 / BLOCK_SIZE; bx <= mx1 / BLOCK_SIZE; bx++ ) {
-				for( bl = map[m].block[bx + by * map[m].bxs]; bl != NULL; bl = bl->next ) {
-					if( bl->prev && bl->type&type && bl_list_count < BL_LIST_MAX ) {
-						if( bl->x < mx0 || bl->x > mx1 || bl->y < my0 || bl->y > my1 )
-							continue; //Check if inside search area
-						//What matters now is the relative x and y from the start point
-						rx = (bl->x - x0);
-						ry = (bl->y - y0);
-						if( rx == 0 && ry == 0 )
-							continue; //Do not hit source cell
-						//This turns it so that the area that is hit is always with positive rx and ry
-						rx *= dx;
-						ry *= dy;
-						if( dir%2 ) { //These checks only need to be done for diagonal paths
-							if( (rx + ry < offset) || (rx + ry > 2 * (length + (offset / 2) - 1)) )
-								continue; //Check for length
-							if( abs(rx - ry) > 2 * range )
-								continue; //Check for width
-						}
-						if( !path_search_long(NULL, m, x0, y0, bl->x, bl->y, CELL_CHKWALL) )
-							continue; //Everything else ok, check for line of sight from source
-						bl_list[bl_list_count++] = bl; //All checks passed, add to list
-					}
-				}
-			}
-		}
-	}
-
-	if( type&BL_MOB ) {
-		for( by = my0 / BLOCK_SIZE; by <= my1 / BLOCK_SIZE; by++ ) {
-			for( bx = mx0 / BLOCK_SIZE; bx <= mx1 / BLOCK_SIZE; bx++ ) {
-				for( bl = map[m].block_mob[bx + by * map[m].bxs]; bl != NULL; bl = bl->next ) {
-					if( bl->prev && bl_list_count < BL_LIST_MAX ) {
-						if( bl->x < mx0 || bl->x > mx1 || bl->y < my0 || bl->y > my1 )
-							continue; //Check if inside search area
-						//What matters now is the relative x and y from the start point
-						rx = (bl->x - x0);
-						ry = (bl->y - y0);
-						if( rx == 0 && ry == 0 )
-							continue; //Do not hit source cell
-						//This turns it so that the area that is hit is always with positive rx and ry
-						rx *= dx;
-						ry *= dy;
-						if( dir%2 ) { //These checks only need to be done for diagonal paths
-							if( (rx + ry < offset) || (rx + ry > 2 * (length + (offset / 2) - 1)) )
-								continue; //Check for length
-							if( abs(rx - ry) > 2 * range )
-								continue; //Check for width
-						}
-						if( !path_search_long(NULL, m, x0, y0, bl->x, bl->y, CELL_CHKWALL) )
-							continue; //Everything else ok, check for line of sight from source
-						bl_list[bl_list_count++] = bl; //All checks passed, add to list
+	for( by = my0 / BLOCK_SIZE; by <= my1 / BLOCK_SIZE; by++ ) {
+		for( bx = mx0 / BLOCK_SIZE; bx <= mx1 / BLOCK_SIZE; bx++ ) {
+			map_foreachblock(m, bx + by * map[m].bxs, type, c, bl) {
+				if( bl->prev && bl->type&type ) {
+					if( bl->x < mx0 || bl->x > mx1 || bl->y < my0 || bl->y > my1 )
+						continue; //Check if inside search area
+					//What matters now is the relative x and y from the start point
+					rx = (bl->x - x0);
+					ry = (bl->y - y0);
+					if( rx == 0 && ry == 0 )
+						continue; //Do not hit source cell
+					//This turns it so that the area that is hit is always with positive rx and ry
+					rx *= dx;
+					ry *= dy;
+					if( dir%2 ) { //These checks only need to be done for diagonal paths
+						if( (rx + ry < offset) || (rx + ry > 2 * (length + (offset / 2) - 1)) )
+							continue; //Check for length
+						if( abs(rx - ry) > 2 * range )
+							continue; //Check for width
 					}
+					if( !path_search_long(NULL, m, x0, y0, bl->x, bl->y, CELL_CHKWALL) )
+						continue; //Everything else ok, check for line of sight from source
+					BL_LIST_PUSH(bl); //All checks passed, add to list
 				}
 			}
 		}
 	}
 
-	if( bl_list_count >= BL_LIST_MAX )
-		ShowWarning("map_foreachindir: block count too many!\n");
-
 	map_freeblock_lock();
 
 	for( i = blockcount; i < bl_list_count; i++ ) {
@@ -1460,7 +1625,7 @@ int map_foreachindir(int(*func)(struct block_list *, va_list), int16 m, int16 x0
 // Copy of map_foreachincell, but applied to the whole map. [Skotlex]
 int map_foreachinmap(int (*func)(struct block_list*, va_list), int16 m, int type,...)
 {
-	int b, bsize;
+	int b, bsize, c;
 	int returnCount = 0; //Total sum of returned values of func() [Skotlex]
 	struct block_list *bl;
 	int blockcount = bl_list_count, i;
@@ -1468,20 +1633,10 @@ int map_foreachinmap(int (*func)(struct block_list*, va_list), int16 m, int type
 
 	bsize = map[m].bxs * map[m].bys;
 
-	if( type&~BL_MOB )
-		for( b = 0; b < bsize; b++ )
-			for( bl = map[m].block[b]; bl != NULL; bl = bl->next )
-				if( bl->type&type && bl_list_count < BL_LIST_MAX )
-					bl_list[bl_list_count++] = bl;
-
-	if( type&BL_MOB )
-		for( b = 0; b < bsize; b++ )
-			for( bl = map[m].block_mob[b]; bl != NULL; bl = bl->next )
-				if( bl_list_count < BL_LIST_MAX )
-					bl_list[bl_list_count++] = bl;
-
-	if( bl_list_count >= BL_LIST_MAX )
-		ShowWarning("map_foreachinmap: block count too many!\n");
+	for( b = 0; b < bsize; b++ )
+		map_foreachblock(m, b, type, c, bl)
+			if( bl->type&type )
+				BL_LIST_PUSH(bl);
 
 	map_freeblock_lock();
 
@@ -1883,28 +2038,136 @@ void map_delnickdb(int charid, const char *name)
 /// Uses the name in nick_db if offline.
 void map_reqnickdb(struct map_session_data *sd, int charid)
 {
-	struct charid2nick *p;
-	struct charid_request* req;
-	struct map_session_data *tsd;
+	struct charid2nick *p;
+	struct charid_request* req;
+	struct map_session_data *tsd;
+
+	nullpo_retv(sd);
+
+	tsd = map_charid2sd(charid);
+	if( tsd ) {
+		clif_solved_charname(sd->fd, charid, tsd->status.name);
+		return;
+	}
+
+	p = idb_ensure(nick_db, charid, create_charid2nick);
+	if( *p->nick ) {
+		clif_solved_charname(sd->fd, charid, p->nick);
+		return;
+	}
+	//Not in cache, request it
+	CREATE(req, struct charid_request, 1);
+	req->next = p->requests;
+	p->requests = req;
+	chrif_searchcharid(charid);
+}
+
+/// Returns the list of a single bl type, or NULL if the type has no list (BL_NUL, several types).
+static struct map_bllist* map_bllist_get(enum bl_type type)
+{
+	int i;
+
+	for( i = 0; i < BL_TYPE_NUM; i++ )
+		if( type == (1<<i) )
+			return &map_bllists[i];
+	return NULL;
+}
+
+/// Adds bl to the list of its type.
+static void map_bllist_add(struct block_list *bl)
+{
+	struct map_bllist* l = map_bllist_get(bl->type);
+
+	if( l == NULL )
+		return;// not a listed type
+	if( bl->idx >= 0 && bl->idx < l->count && l->list[bl->idx] == bl )
+		return;// already in the list
+	if( l->count == l->max ) {
+		l->max = ( l->max ? l->max*2 : 256 );
+		RECREATE(l->list, struct block_list*, l->max);
+	}
+	bl->idx = l->count;
+	l->list[l->count++] = bl;
+}
+
+/// Removes bl from the list of its type.
+static void map_bllist_remove(struct block_list *bl)
+{
+	struct map_bllist* l = map_bllist_get(bl->type);
+
+	if( l == NULL || bl->idx < 0 || bl->idx >= l->count || l->list[bl->idx] != bl )
+		return;// not in the list
+	if( l->lock ) {// being walked, leave a hole
+		l->list[bl->idx] = NULL;
+		l->holes++;
+	} else {// swap-remove
+		struct block_list* last = l->list[--l->count];
+
+		l->list[bl->idx] = last;
+		last->idx = bl->idx;
+	}
+	bl->idx = -1;
+}
+
+/// Locks the lists of the given types, so entries don't move while they are walked.
+static void map_bllist_lock(enum bl_type types)
+{
+	int i;
+
+	for( i = 0; i < BL_TYPE_NUM; i++ )
+		if( types&(1<<i) )
+			map_bllists[i].lock++;
+}
+
+/// Unlocks the lists of the given types, compacting the ones that are no longer walked.
+static void map_bllist_unlock(enum bl_type types)
+{
+	int i, j, n;
+
+	for( i = 0; i < BL_TYPE_NUM; i++ ) {
+		struct map_bllist* l = &map_bllists[i];
+
+		if( !(types&(1<<i)) || --l->lock > 0 || l->holes == 0 )
+			continue;
+		for( j = n = 0; j < l->count; j++ ) {
+			if( l->list[j] == NULL )
+				continue;
+			l->list[j]->idx = n;
+			l->list[n++] = l->list[j];
+		}
+		l->count = n;
+		l->holes = 0;
+	}
+}
+
+/// Applies func to every block_list of the given types, walking their lists.
+/// Stops iterating if func returns -1.
+static void map_bllist_foreach(enum bl_type types, int (*func)(struct block_list *bl, va_list args), va_list ap)
+{
+	int i, j;
 
-	nullpo_retv(sd);
+	map_bllist_lock(types);
+	for( i = 0; i < BL_TYPE_NUM; i++ ) {
+		struct map_bllist* l = &map_bllists[i];
 
-	tsd = map_charid2sd(charid);
-	if( tsd ) {
-		clif_solved_charname(sd->fd, charid, tsd->status.name);
-		return;
-	}
+		if( !(types&(1<<i)) )
+			continue;
+		for( j = 0; j < l->count; j++ ) {// entries added meanwhile are walked too
+			va_list args;
+			int ret;
 
-	p = idb_ensure(nick_db, charid, create_charid2nick);
-	if( *p->nick ) {
-		clif_solved_charname(sd->fd, charid, p->nick);
-		return;
+			if( l->list[j] == NULL )
+				continue;
+			va_copy(args, ap);
+			ret = func(l->list[j], args);
+			va_end(args);
+			if( ret == -1 )
+				break;// stop iterating
+		}
+		if( j < l->count )
+			break;
 	}
-	//Not in cache, request it
-	CREATE(req, struct charid_request, 1);
-	req->next = p->requests;
-	p->requests = req;
-	chrif_searchcharid(charid);
+	map_bllist_unlock(types);
 }
 
 /*==========================================
@@ -1927,9 +2190,7 @@ void map_addiddb(struct block_list *bl)
 			idb_put(bossid_db, bl->id, bl);
 	}
 
-	if( bl->type&BL_REGEN )
-		idb_put(regen_db, bl->id, bl);
-
+	map_bllist_add(bl);
 	idb_put(id_db, bl->id, bl);
 }
 
@@ -1950,9 +2211,7 @@ void map_deliddb(struct block_list *bl)
 		idb_remove(bossid_db, bl->id);
 	}
 
-	if( bl->type&BL_REGEN )
-		idb_remove(regen_db, bl->id);
-
+	map_bllist_remove(bl);
 	idb_remove(id_db, bl->id);
 }
 
@@ -2243,138 +2502,113 @@ struct mob_data *map_id2boss(int id)
 /// Stops iterating if func returns -1.
 void map_foreachpc(int (*func)(struct map_session_data *sd, va_list args), ...)
 {
-	DBIterator *iter;
-	struct map_session_data *sd;
+	struct map_bllist* l = map_bllist_get(BL_PC);
+	int i;
 
-	iter = db_iterator(pc_db);
-	for( sd = dbi_first(iter); dbi_exists(iter); sd = dbi_next(iter) )
+	map_bllist_lock(BL_PC);
+	for( i = 0; i < l->count; i++ )
 	{
 		va_list args;
 		int ret;
 
+		if( l->list[i] == NULL )
+			continue;// removed
 		va_start(args, func);
-		ret = func(sd, args);
+		ret = func((struct map_session_data *)l->list[i], args);
 		va_end(args);
 		if( ret == -1 )
 			break;// stop iterating
 	}
-	dbi_destroy(iter);
+	map_bllist_unlock(BL_PC);
 }
 
 /// Applies func to all the mobs in the db.
 /// Stops iterating if func returns -1.
 void map_foreachmob(int (*func)(struct mob_data *md, va_list args), ...)
 {
-	DBIterator *iter;
-	struct mob_data *md;
+	struct map_bllist* l = map_bllist_get(BL_MOB);
+	int i;
 
-	iter = db_iterator(mobid_db);
-	for( md = (struct mob_data *)dbi_first(iter); dbi_exists(iter); md = (struct mob_data *)dbi_next(iter) )
+	map_bllist_lock(BL_MOB);
+	for( i = 0; i < l->count; i++ )
 	{
 		va_list args;
 		int ret;
 
+		if( l->list[i] == NULL )
+			continue;// removed
 		va_start(args, func);
-		ret = func(md, args);
+		ret = func((struct mob_data *)l->list[i], args);
 		va_end(args);
 		if( ret == -1 )
 			break;// stop iterating
 	}
-	dbi_destroy(iter);
+	map_bllist_unlock(BL_MOB);
 }
 
 /// Applies func to all the npcs in the db.
 /// Stops iterating if func returns -1.
 void map_foreachnpc(int (*func)(struct npc_data *nd, va_list args), ...)
 {
-	DBIterator *iter;
-	struct block_list *bl;
-
-	iter = db_iterator(id_db);
-	for( bl = (struct block_list *)dbi_first(iter); dbi_exists(iter); bl = (struct block_list *)dbi_next(iter) )
-	{
-		if( bl->type == BL_NPC )
-		{
-			struct npc_data *nd = (struct npc_data *)bl;
-			va_list args;
-			int ret;
-
-			va_start(args, func);
-			ret = func(nd, args);
-			va_end(args);
-			if( ret == -1 )
-				break;// stop iterating
-		}
-	}
-	dbi_destroy(iter);
-}
-
-/// Applies func to everything in the db.
-/// Stops iterating if func returns -1.
-void map_foreachregen(int (*func)(struct block_list *bl, va_list args), ...)
-{
-	DBIterator *iter;
-	struct block_list *bl;
+	struct map_bllist* l = map_bllist_get(BL_NPC);
+	int i;
 
-	iter = db_iterator(regen_db);
-	for( bl = (struct block_list *)dbi_first(iter); dbi_exists(iter); bl = (struct block_list *)dbi_next(iter) )
+	map_bllist_lock(BL_NPC);
+	for( i = 0; i < l->count; i++ )
 	{
 		va_list args;
 		int ret;
 
+		if( l->list[i] == NULL )
+			continue;// removed
 		va_start(args, func);
-		ret = func(bl, args);
+		ret = func((struct npc_data *)l->list[i], args);
 		va_end(args);
 		if( ret == -1 )
 			break;// stop iterating
 	}
-	dbi_destroy(iter);
+	map_bllist_unlock(BL_NPC);
+}
+
+/// Applies func to everything that regenerates (BL_REGEN).
+/// Stops iterating if func returns -1.
+void map_foreachregen(int (*func)(struct block_list *bl, va_list args), ...)
+{
+	va_list ap;
+
+	va_start(ap, func);
+	map_bllist_foreach(BL_REGEN, func, ap);
+	va_end(ap);
 }
 
 /// Applies func to everything in the db.
+/// The blocks are visited grouped by type (BL_PC first, then BL_MOB, ...), not in id order,
+/// and in no particular order within a type.
 /// Stops iterating if func returns -1.
 void map_foreachiddb(int (*func)(struct block_list *bl, va_list args), ...)
 {
-	DBIterator *iter;
-	struct block_list *bl;
-
-	iter = db_iterator(id_db);
-	for( bl = (struct block_list *)dbi_first(iter); dbi_exists(iter); bl = (struct block_list *)dbi_next(iter) )
-	{
-		va_list args;
-		int ret;
+	va_list ap;
 
-		va_start(args, func);
-		ret = func(bl, args);
-		va_end(args);
-		if( ret == -1 )
-			break;// stop iterating
-	}
-	dbi_destroy(iter);
+	va_start(ap, func);
+	map_bllist_foreach(BL_ALL, func, ap);
+	va_end(ap);
 }
 
 /// Iterator.
 /// Can filter by bl type.
+/// Walks the lists of the types in order, the position is the list and the index in it.
 struct s_mapiterator
 {
 	enum e_mapitflags flags;// flags for special behaviour
 	enum bl_type types;// what bl types to return
-	DBIterator *dbi;// database iterator
+	int type;// current list, -1 before the first and BL_TYPE_NUM after the last
+	int pos;// current index in the list
 };
 
-/// Returns true if the block_list matches the description in the iterator.
-///
-/// @param _mapit_ Iterator
-/// @param _bl_ block_list
-/// @return true if it matches
-#define MAPIT_MATCHES(_mapit_,_bl_) \
-	( \
-		( (_bl_)->type & (_mapit_)->types /* type matches */ ) \
-	)
-
 /// Allocates a new iterator.
 /// Returns the new iterator.
 /// types can represent several BL's as a bit field.
+/// The lists of these types are locked until the iterator is freed.
 /// @TODO: Should this be expanded to allow filtering of map/guild/party/chat/cell/area/...?
 ///
 /// @param flags Flags of the iterator
@@ -2387,9 +2621,9 @@ struct s_mapiterator *mapit_alloc(enum e_mapitflags flags, enum bl_type types)
 	CREATE(mapit, struct s_mapiterator, 1);
 	mapit->flags = flags;
 	mapit->types = types;
-	if( types == BL_PC )       mapit->dbi = db_iterator(pc_db);
-	else if( types == BL_MOB ) mapit->dbi = db_iterator(mobid_db);
-	else                       mapit->dbi = db_iterator(id_db);
+	mapit->type = -1;
+	mapit->pos = 0;
+	map_bllist_lock(types);
 	return mapit;
 }
 
@@ -2400,7 +2634,7 @@ void mapit_free(struct s_mapiterator *mapit)
 {
 	nullpo_retv(mapit);
 
-	dbi_destroy(mapit->dbi);
+	map_bllist_unlock(mapit->types);
 	aFree(mapit);
 }
 
@@ -2411,15 +2645,10 @@ void mapit_free(struct s_mapiterator *mapit)
 /// @return first block_list or NULL
 struct block_list *mapit_first(struct s_mapiterator *mapit)
 {
-	struct block_list *bl;
-
 	nullpo_retr(NULL,mapit);
 
-	for( bl = (struct block_list *)dbi_first(mapit->dbi); bl != NULL; bl = (struct block_list *)dbi_next(mapit->dbi) )
-		if( MAPIT_MATCHES(mapit,bl) )
-			break; // Found match
-
-	return bl;
+	mapit->type = -1;
+	return mapit_next(mapit);
 }
 
 /// Returns the last block_list that matches the description.
@@ -2429,15 +2658,10 @@ struct block_list *mapit_first(struct s_mapiterator *mapit)
 /// @return last block_list or NULL
 struct block_list *mapit_last(struct s_mapiterator *mapit)
 {
-	struct block_list *bl;
-
 	nullpo_retr(NULL,mapit);
 
-	for( bl = (struct block_list *)dbi_last(mapit->dbi); bl != NULL; bl = (struct block_list *)dbi_prev(mapit->dbi) )
-		if( MAPIT_MATCHES(mapit,bl) )
-			break; // Found match
-
-	return bl;
+	mapit->type = BL_TYPE_NUM;
+	return mapit_prev(mapit);
 }
 
 /// Returns the next block_list that matches the description.
@@ -2447,20 +2671,25 @@ struct block_list *mapit_last(struct s_mapiterator *mapit)
 /// @return next block_list or NULL
 struct block_list *mapit_next(struct s_mapiterator *mapit)
 {
-	struct block_list *bl;
-
 	nullpo_retr(NULL,mapit);
 
-	for( ; ; )
+	if( mapit->type < 0 )
+	{// before the first
+		mapit->type = 0;
+		mapit->pos = -1;
+	}
+	for( ; mapit->type < BL_TYPE_NUM; mapit->type++, mapit->pos = -1 )
 	{
-		bl = (struct block_list *)dbi_next(mapit->dbi);
-		if( bl == NULL )
-			break;// end
-		if( MAPIT_MATCHES(mapit,bl) )
-			break;// found a match
-		// try next
+		struct map_bllist* l = &map_bllists[mapit->type];
+
+		if( !(mapit->types&(1<<mapit->type)) )
+			continue;// not a target type
+		while( ++mapit->pos < l->count )
+			if( l->list[mapit->pos] != NULL )
+				return l->list[mapit->pos];// found a match
 	}
-	return bl;
+	mapit->pos = 0;
+	return NULL;// end
 }
 
 /// Returns the previous block_list that matches the description.
@@ -2470,20 +2699,30 @@ struct block_list *mapit_next(struct s_mapiterator *mapit)
 /// @return previous block_list or NULL
 struct block_list *mapit_prev(struct s_mapiterator *mapit)
 {
-	struct block_list *bl;
-
 	nullpo_retr(NULL,mapit);
 
-	for( ; ; )
+	if( mapit->type >= BL_TYPE_NUM )
+	{// after the last
+		mapit->type = BL_TYPE_NUM-1;
+		mapit->pos = map_bllists[mapit->type].count;
+	}
+	while( mapit->type >= 0 )
 	{
-		bl = (struct block_list *)dbi_prev(mapit->dbi);
-		if( bl == NULL )
-			break;// end
-		if( MAPIT_MATCHES(mapit,bl) )
-			break;// found a match
-		// try prev
+		struct map_bllist* l = &map_bllists[mapit->type];
+
+		if( mapit->types&(1<<mapit->type) )
+		{// target type
+			if( mapit->pos > l->count )
+				mapit->pos = l->count;
+			while( --mapit->pos >= 0 )
+				if( l->list[mapit->pos] != NULL )
+					return l->list[mapit->pos];// found a match
+		}
+		if( --mapit->type >= 0 )
+			mapit->pos = map_bllists[mapit->type].count;
 	}
-	return bl;
+	mapit->pos = 0;
+	return NULL;// end
 }
 
 /// Returns true if the current block_list exists in the database.
@@ -2494,7 +2733,7 @@ bool mapit_exists(struct s_mapiterator *mapit)
 {
 	nullpo_retr(false,mapit);
 
-	return dbi_exists(mapit->dbi);
+	return ( mapit->type >= 0 && mapit->type < BL_TYPE_NUM && mapit->pos >= 0 && mapit->pos < map_bllists[mapit->type].count && map_bllists[mapit->type].list[mapit->pos] != NULL );
 }
 
 /*==========================================
@@ -2514,6 +2753,7 @@ bool map_addnpc(int16 m,struct npc_data *nd)
 
 	map[m].npc[map[m].npc_num] = nd;
 	map[m].npc_num++;
+	map_bllist_add(&nd->bl);
 	idb_put(id_db,nd->bl.id,nd);
 	return true;
 }
@@ -2526,7 +2766,6 @@ int map_addinstancemap(const char *name, int id)
 	int src_m = map_mapname2mapid(name);
 	int dst_m = -1, i;
 	char iname[MAP_NAME_LENGTH];
-	size_t num_cell, size;
 
 	if(src_m < 0)
 		return -1;
@@ -2552,6 +2791,8 @@ int map_addinstancemap(const char *name, int id)
 	}
 
 	// Copy the map
+	if( map[src_m].cell == &map_cell_unloaded )
+		map_loadcells(&map[src_m]);
 	memcpy(&map[dst_m], &map[src_m], sizeof(struct map_data));
 
 	strcpy(iname,name);
@@ -2574,14 +2815,17 @@ int map_addinstancemap(const char *name, int id)
 	memset(map[dst_m].npc, 0, sizeof(map[dst_m].npc));
 	map[dst_m].npc_num = 0;
 
-	// Reallocate cells
-	num_cell = map[dst_m].xs * map[dst_m].ys;
-	CREATE(map[dst_m].cell, struct mapcell, num_cell);
-	memcpy(map[dst_m].cell, map[src_m].cell, num_cell * sizeof(struct mapcell));
+	// Share the cells
+	map_sharecells(&map[src_m], &map[dst_m]);
 
-	size = map[dst_m].bxs * map[dst_m].bys * sizeof(struct block_list *);
-	map[dst_m].block = (struct block_list **)aCalloc(1,size);
-	map[dst_m].block_mob = (struct block_list **)aCalloc(1,size);
+	memset(map[dst_m].block, 0, sizeof(map[dst_m].block));
+	map[dst_m].ai_block = NULL; // Allocated when a player enters the instance
+	// The other caches of the source map are built for the instance when needed
+	memset(map[dst_m].path_jump, 0, sizeof(map[dst_m].path_jump));
+	path_flow_free(&map[dst_m]); // Fields left by a deleted map with the same id
+	map[dst_m].cache_data = NULL; // Never unloaded, its cells can't be decoded again
+	map[dst_m].idle_time = 0;
+	map[dst_m].cells_pinned = false;
 
 	map[dst_m].index = mapindex_addmap(-1, map[dst_m].name);
 	map[dst_m].channel = NULL;
@@ -2639,6 +2883,8 @@ static void map_free_questinfo(int m);
  *------------------------------------------*/
 int map_delinstancemap(int m)
 {
+	int i;
+
 	if(m < 0 || !map[m].instance_id)
 		return 0;
 
@@ -2652,9 +2898,13 @@ int map_delinstancemap(int m)
 		delete_timer(map[m].mob_delete_timer, map_removemobs_timer);
 
 	// Free memory
-	aFree(map[m].cell);
-	aFree(map[m].block);
-	aFree(map[m].block_mob);
+	map_freecells(&map[m]);
+	for( i = 0; i < BLC_MAX; i++ ) {
+		if( map[m].block[i] )
+			aFree(map[m].block[i]);
+	}
+	if( map[m].ai_block )
+		aFree(map[m].ai_block);
 	map_free_questinfo(m);
 
 	mapindex_removemap(map[m].index);
@@ -3000,7 +3250,10 @@ int map_getcellp(struct map_data *m,int16 x,int16 y,cell_chk cellchk)
 	if(x < 0 || x >= m->xs - 1 || y < 0 || y >= m->ys - 1)
 		return(cellchk == CELL_CHKNOPASS);
 
-	cell = m->cell[x + y * m->xs];
+	if(m->cell == &map_cell_unloaded)
+		map_loadcells(m);
+
+	cell = *map_cellat(m, x + y * m->xs);
 
 	switch(cellchk) {
 		//Gat type retrieval
@@ -3072,46 +3325,61 @@ int map_getcellp(struct map_data *m,int16 x,int16 y,cell_chk cellchk)
 void map_setcell(int16 m, int16 x, int16 y, cell_t cell, bool flag)
 {
 	int j;
+	struct mapcell c;
 
 	if( m < 0 || m >= map_num || x < 0 || x >= map[m].xs || y < 0 || y >= map[m].ys )
 		return;
 
+	if( map[m].cell == &map_cell_unloaded ) {
+		if( cell == CELL_NPC )
+			return; // Deployed by map_loadcells
+		map_loadcells(&map[m]);
+	}
+
 	j = x + y*map[m].xs;
+	c = *map_cellat(&map[m], j);
 
 	switch( cell ) {
-		case CELL_WALKABLE:      map[m].cell[j].walkable = flag;      break;
-		case CELL_SHOOTABLE:     map[m].cell[j].shootable = flag;     break;
-		case CELL_WATER:         map[m].cell[j].water = flag;         break;
-
-		case CELL_NPC:           map[m].cell[j].npc = flag;           break;
-		case CELL_BASILICA:      map[m].cell[j].basilica = flag;      break;
-		case CELL_LANDPROTECTOR: map[m].cell[j].landprotector = flag; break;
-		case CELL_NOVENDING:     map[m].cell[j].novending = flag;     break;
-		case CELL_NOCHAT:        map[m].cell[j].nochat = flag;        break;
-		case CELL_MAELSTROM:     map[m].cell[j].maelstrom = flag;     break;
-		case CELL_ICEWALL:       map[m].cell[j].icewall = flag;       break;
-		case CELL_NOICEWALL:     map[m].cell[j].noicewall = flag;     break;
+		case CELL_WALKABLE:      c.walkable = flag;      break;
+		case CELL_SHOOTABLE:     c.shootable = flag;     break;
+		case CELL_WATER:         c.water = flag;         break;
+
+		case CELL_NPC:           c.npc = flag;           break;
+		case CELL_BASILICA:      c.basilica = flag;      break;
+		case CELL_LANDPROTECTOR: c.landprotector = flag; break;
+		case CELL_NOVENDING:     c.novending = flag;     break;
+		case CELL_NOCHAT:        c.nochat = flag;        break;
+		case CELL_MAELSTROM:     c.maelstrom = flag;     break;
+		case CELL_ICEWALL:       c.icewall = flag;       break;
+		case CELL_NOICEWALL:     c.noicewall = flag;     break;
 
 		default:
 			ShowWarning("map_setcell: invalid cell type '%d'\n", (int)cell);
 			break;
 	}
+
+	map_putcell(&map[m], j, c);
 }
 
 void map_setgatcell(int16 m, int16 x, int16 y, int gat)
 {
 	int j;
-	struct mapcell cell;
+	struct mapcell cell, c;
 
 	if( m < 0 || m >= map_num || x < 0 || x >= map[m].xs || y < 0 || y >= map[m].ys )
 		return;
 
+	if( map[m].cell == &map_cell_unloaded )
+		map_loadcells(&map[m]);
+
 	j = x + y*map[m].xs;
 
 	cell = map_gat2cell(gat);
-	map[m].cell[j].walkable = cell.walkable;
-	map[m].cell[j].shootable = cell.shootable;
-	map[m].cell[j].water = cell.water;
+	c = *map_cellat(&map[m], j);
+	c.walkable = cell.walkable;
+	c.shootable = cell.shootable;
+	c.water = cell.water;
+	map_putcell(&map[m], j, c);
 }
 
 /*==========================================
@@ -3297,6 +3565,103 @@ int map_eraseipport(unsigned short mapindex, uint32 ip, uint16 port)
 	return 0;
 }
 
+/// Releases the map cache.
+static void map_free_mapcache(void)
+{
+	if( map_cache_buffer == NULL )
+		return;
+#ifndef _WIN32
+	if( map_cache_mapped )
+		munmap(map_cache_buffer, map_cache_size);
+	else
+#endif
+		aFree(map_cache_buffer);
+	map_cache_buffer = NULL;
+	map_cache_size = 0;
+	map_cache_mapped = false;
+}
+
+/// Returns true if the map uses the cells of the map cache in place.
+static bool map_cells_inplace(struct map_data *m)
+{
+	return (map_cache_buffer != NULL && (char *)m->cell >= map_cache_buffer && (char *)m->cell < map_cache_buffer + map_cache_size);
+}
+
+/// Frees the cells of a map.
+static void map_freecells(struct map_data *m)
+{
+	if( m->cell_page != NULL ) { // Instance map, the cells are shared with the source map
+		int i;
+
+		for( i = 0; i < map_cell_pages(m); i++ ) {
+			if( m->cell_page[i] )
+				aFree(m->cell_page[i]);
+		}
+		aFree(m->cell_page);
+		m->cell_page = NULL;
+		map_cell_share_release(m->cell_shared);
+		m->cell_shared = NULL;
+		if( map[m->instance_src_map].cell_base != NULL && map[m->instance_src_map].cell_base->refs == 1 )
+			map_cell_share_drop(&map[m->instance_src_map]); // last instance, don't keep the copy
+	} else if( m->cell != NULL && m->cell != &map_cell_unloaded && !map_cells_inplace(m) )
+		aFree(m->cell);
+	map_cell_share_drop(m); // the instances keep their cells
+	m->cell = NULL;
+	path_jump_free(m);
+	path_flow_free(m);
+}
+
+/*==========================================
+ * Init the v2 mapcache
+ * The file is mapped copy-on-write, so the pages of the cells are shared
+ * with the page cache (and the other map-servers of the host) until changed.
+ *------------------------------------------*/
+static char *map_init_mapcache_v2(FILE *fp, size_t size)
+{
+	struct map_cache_v2_header *header;
+	struct mapcell cell;
+	char *buffer;
+
+#ifndef _WIN32
+	buffer = (char *)mmap(NULL, size, PROT_READ|PROT_WRITE, MAP_PRIVATE, fileno(fp), 0);
+	if( buffer == MAP_FAILED ) {
+		ShowError("map_init_mapcache: Could not map the mapcache file\n");
+		return NULL;
+	}
+	map_cache_mapped = true;
+#else
+	CREATE(buffer, char, size);
+	fseek(fp, 0, SEEK_SET);
+	if( fread(buffer, 1, size, fp) != size ) {
+		ShowError("map_init_mapcache: Could not read entire mapcache file\n");
+		aFree(buffer);
+		return NULL;
+	}
+#endif
+
+	header = (struct map_cache_v2_header *)buffer;
+	if( GetULong((unsigned char *)&header->file_size) != size || header->cell_size == 0 ||
+		sizeof(struct map_cache_v2_header) + header->map_count * sizeof(struct map_cache_v2_index) > size ) {
+		ShowError("map_init_mapcache: Map cache is corrupted!\n");
+		map_cache_buffer = buffer;
+		map_free_mapcache();
+		return NULL;
+	}
+	map_cache_v2 = true;
+
+	// The cells can be used in place if struct mapcell has the same layout
+	memset(&cell, 0, sizeof(cell));
+	cell.walkable = 1;
+	cell.water = 1;
+	map_cache_direct = ( header->cell_size == sizeof(struct mapcell) && *(unsigned char *)&cell == (MAP_CACHE_V2_WALKABLE|MAP_CACHE_V2_WATER) );
+#ifndef _WIN32
+	if( header->page_size % sysconf(_SC_PAGESIZE) != 0 )
+		map_cache_direct = false; // The changes of a map can't be dropped without touching the next one
+#endif
+
+	return buffer;
+}
+
 /*==========================================
  * [Shinryo]: Init the mapcache
  *------------------------------------------*/
@@ -3305,6 +3670,7 @@ static char *map_init_mapcache(FILE *fp)
 	struct map_cache_main_header header;
 	size_t size = 0;
 	char *buffer;
+	char magic[4];
 
 	// No file open? Return..
 	nullpo_ret(fp);
@@ -3313,6 +3679,11 @@ static char *map_init_mapcache(FILE *fp)
 	fseek(fp, 0, SEEK_END);
 	size = ftell(fp);
 	fseek(fp, 0, SEEK_SET);
+	map_cache_size = size;
+
+	if( size >= sizeof(struct map_cache_v2_header) && fread(magic, 1, 4, fp) == 4 && memcmp(magic, MAP_CACHE_V2_MAGIC, 4) == 0 )
+		return map_init_mapcache_v2(fp, size);
+	fseek(fp, 0, SEEK_SET);
 
 	// Allocate enough space
 	CREATE(buffer, char, size);
@@ -3350,6 +3721,73 @@ static char *map_init_mapcache(FILE *fp)
  * Map cache reading
  * [Shinryo]: Optimized some behaviour to speed this up
  *==========================================*/
+/// Sets the cells of a map from its map cache entry ('decode_buffer' is only used by v1).
+static void map_setcells(struct map_data *m, char *entry, char *decode_buffer)
+{
+	unsigned long size = (unsigned long)m->xs * (unsigned long)m->ys, xy;
+
+	if( map_cache_v2 ) {
+		struct map_cache_v2_header *header = (struct map_cache_v2_header *)map_cache_buffer;
+		unsigned char *p = (unsigned char *)map_cache_buffer + ((struct map_cache_v2_index *)entry)->offset;
+
+		if( map_cache_direct ) {
+			m->cell = (struct mapcell *)p; // Pages are copied when changed
+			return;
+		}
+
+		CREATE(m->cell, struct mapcell, size);
+		for( xy = 0; xy < size; ++xy, p += header->cell_size ) {
+			m->cell[xy].walkable = ((*p)&MAP_CACHE_V2_WALKABLE) != 0;
+			m->cell[xy].shootable = ((*p)&MAP_CACHE_V2_SHOOTABLE) != 0;
+			m->cell[xy].water = ((*p)&MAP_CACHE_V2_WATER) != 0;
+		}
+		return;
+	}
+
+	// TO-DO: Maybe handle the scenario, if the decoded buffer isn't the same size as expected? [Shinryo]
+	decode_zip(decode_buffer, &size, entry + sizeof(struct map_cache_map_info), ((struct map_cache_map_info *)entry)->len);
+
+	CREATE(m->cell, struct mapcell, (unsigned long)m->xs * (unsigned long)m->ys);
+
+
+	for( xy = 0; xy < size; ++xy )
+		m->cell[xy] = map_gat2cell(decode_buffer[xy]);
+}
+
+/// Looks up a map in the v2 map cache.
+static int map_readfromcache_v2(struct map_data *m, char *buffer, char *decode_buffer)
+{
+	struct map_cache_v2_header *header = (struct map_cache_v2_header *)buffer;
+	struct map_cache_v2_index *idx = (struct map_cache_v2_index *)(buffer + sizeof(struct map_cache_v2_header));
+	unsigned long size;
+	uint32 i;
+
+	ARR_FIND(0, header->map_count, i, strcmp(m->name, idx[i].name) == 0);
+	if( i == header->map_count || idx[i].xs <= 0 || idx[i].ys <= 0 )
+		return 0; // Not found or invalid
+
+	m->xs = idx[i].xs;
+	m->ys = idx[i].ys;
+	size = (unsigned long)idx[i].xs * (unsigned long)idx[i].ys;
+
+	if( size > MAX_MAP_SIZE ) {
+		ShowWarning("map_readfromcache: %s exceeded MAX_MAP_SIZE of %d\n", idx[i].name, MAX_MAP_SIZE);
+		return 0;
+	}
+	if( idx[i].offset + size * header->cell_size > map_cache_size ) {
+		ShowWarning("map_readfromcache: %s is out of the map cache\n", idx[i].name);
+		return 0;
+	}
+
+	m->cache_data = (char *)&idx[i];
+	if( lazy_map_load && !map_cache_direct )
+		m->cell = &map_cell_unloaded; // Converted by map_loadcells when needed
+	else
+		map_setcells(m, m->cache_data, decode_buffer);
+
+	return 1;
+}
+
 int map_readfromcache(struct map_data *m, char *buffer, char *decode_buffer)
 {
 	int i;
@@ -3357,6 +3795,9 @@ int map_readfromcache(struct map_data *m, char *buffer, char *decode_buffer)
 	struct map_cache_map_info *info = NULL;
 	char *p = buffer + sizeof(struct map_cache_main_header);
 
+	if( map_cache_v2 )
+		return map_readfromcache_v2(m, buffer, decode_buffer);
+
 	for(i = 0; i < header->map_count; i++) {
 		info = (struct map_cache_map_info *)p;
 
@@ -3368,7 +3809,7 @@ int map_readfromcache(struct map_data *m, char *buffer, char *decode_buffer)
 	}
 
 	if( info && i < header->map_count ) {
-		unsigned long size, xy;
+		unsigned long size;
 
 		if( info->xs <= 0 || info->ys <= 0 )
 			return 0;// Invalid
@@ -3382,19 +3823,139 @@ int map_readfromcache(struct map_data *m, char *buffer, char *decode_buffer)
 			return 0; // Say not found to remove it from list.. [Shinryo]
 		}
 
-		// TO-DO: Maybe handle the scenario, if the decoded buffer isn't the same size as expected? [Shinryo]
-		decode_zip(decode_buffer, &size, p + sizeof(struct map_cache_map_info), info->len);
+		if( lazy_map_load ) {
+			m->cache_data = p;
+			m->cell = &map_cell_unloaded; // Decoded by map_loadcells when needed
+			return 1;
+		}
 
-		CREATE(m->cell, struct mapcell, size);
+		map_setcells(m, p, decode_buffer);
+		return 1;
+	}
+
+	return 0; // Not found
+}
 
+/*==========================================
+ * Lazy map loading (lazy_map_load)
+ * The maps are registered with their map cache entry at startup,
+ * the cells are decoded the first time they are needed.
+ *------------------------------------------*/
+static void map_loadcells(struct map_data *m)
+{
+	static char decode_buffer[MAX_MAP_SIZE];
+	struct block_list *bl;
+	int pos;
 
-		for( xy = 0; xy < size; ++xy )
-			m->cell[xy] = map_gat2cell(decode_buffer[xy]);
+	map_setcells(m, m->cache_data, decode_buffer);
+	m->idle_time = 0;
 
-		return 1;
+	// Redeploy what was placed while the map wasn't loaded
+	for( pos = 0; pos < m->bxs * m->bys; pos++ ) {
+		if( m->block[BLC_NPC] ) {
+			for( bl = m->block[BLC_NPC][pos]; bl != NULL; bl = bl->next )
+				npc_setcells((TBL_NPC *)bl);
+		}
+#ifdef CELL_NOSTACK
+		{
+			int c;
+
+			for( c = 0; c < BLC_MAX; c++ ) {
+				if( m->block[c] == NULL )
+					continue;
+				for( bl = m->block[c][pos]; bl != NULL; bl = bl->next )
+					map_addblcell(bl);
+			}
+		}
+#endif
 	}
+}
 
-	return 0; // Not found
+/// Returns true if the cells of the map are in memory.
+bool map_hascells(int16 m)
+{
+	return (m >= 0 && m < map_num && map[m].cell != NULL && map[m].cell != &map_cell_unloaded);
+}
+
+/// Returns true if nothing but npcs without a running timer is on the map.
+static bool map_isidle(struct map_data *m)
+{
+	int i, c, pos;
+
+	if( m->users || m->iwall_num || m->cells_pinned || m->mob_delete_timer != INVALID_TIMER )
+		return false;
+
+	for( i = 0; i < m->npc_num; i++ ) {
+		if( m->npc[i]->subtype == NPCTYPE_SCRIPT && m->npc[i]->u.scr.timerid != INVALID_TIMER )
+			return false;
+	}
+
+	for( c = 0; c < BLC_MAX; c++ ) {
+		if( c == BLC_NPC || m->block[c] == NULL )
+			continue;
+		for( pos = 0; pos < m->bxs * m->bys; pos++ ) {
+			if( m->block[c][pos] )
+				return false;
+		}
+	}
+
+	return true;
+}
+
+/// Releases the cells and the empty block chains of the maps that were idle for map_unload_time seconds.
+/// They are read again from the map cache by map_loadcells.
+static int map_unload_timer(int tid, unsigned int tick, int id, intptr_t data)
+{
+	int i, c;
+
+	for( i = 0; i < instance_start; i++ ) {
+		struct map_data *m = &map[i];
+
+		if( m->cell == &map_cell_unloaded || m->cache_data == NULL )
+			continue;
+		if( !map_isidle(m) ) {
+			m->idle_time = 0;
+			continue;
+		}
+		m->idle_time += MAP_UNLOAD_INTERVAL;
+		if( m->idle_time < map_unload_time )
+			continue;
+
+		if( map_cells_inplace(m) ) {
+			// Drop the changed pages, the npc touch areas are deployed again by map_loadcells
+			unsigned long xy, size = (unsigned long)m->xs * (unsigned long)m->ys;
+#ifndef _WIN32
+			if( map_cache_mapped ) {
+				struct map_cache_v2_header *header = (struct map_cache_v2_header *)map_cache_buffer;
+
+				madvise(m->cell, (size * sizeof(struct mapcell) + header->page_size - 1) / header->page_size * header->page_size, MADV_DONTNEED);
+			} else
+#endif
+			for( xy = 0; xy < size; xy++ ) {
+				struct mapcell cell = m->cell[xy];
+
+				memset(&m->cell[xy], 0, sizeof(struct mapcell));
+				m->cell[xy].walkable = cell.walkable;
+				m->cell[xy].shootable = cell.shootable;
+				m->cell[xy].water = cell.water;
+			}
+		}
+		map_freecells(m);
+		m->cell = &map_cell_unloaded;
+		for( c = 0; c < BLC_MAX; c++ ) {
+			if( c != BLC_NPC && m->block[c] ) {
+				aFree(m->block[c]);
+				m->block[c] = NULL;
+			}
+		}
+		if( m->ai_block ) {
+			aFree(m->ai_block);
+			m->ai_block = NULL;
+		}
+		m->idle_time = 0;
+	}
+
+	return 0;
 }
 
 int map_addmap(char *mapname)
@@ -3443,17 +4004,17 @@ int map_delmap(char *mapname)
 }
 
 void do_final_maps(void) {
-	int i, v = 0;
+	int i, c, v = 0;
 
 	for( i = 0; i < map_num; i++ ) {
-		if( map[i].cell )
-			aFree(map[i].cell);
-
-		if( map[i].block )
-			aFree(map[i].block);
+		map_freecells(&map[i]);
 
-		if( map[i].block_mob )
-			aFree(map[i].block_mob);
+		for( c = 0; c < BLC_MAX; c++ ) {
+			if( map[i].block[c] )
+				aFree(map[i].block[c]);
+		}
+		if( map[i].ai_block )
+			aFree(map[i].ai_block);
 
 		if( battle_config.dynamic_mobs ) { //Dynamic mobs flag by [random]
 			int j;
@@ -3492,6 +4053,8 @@ void do_final_maps(void) {
 
 		map_free_questinfo(i);
 	}
+
+	map_free_mapcache();
 }
 
 /// Initializes map flags and adjusts them depending on configuration.
@@ -3636,11 +4199,12 @@ int map_readallmaps (void)
 	int i;
 	FILE *fp = NULL;
 	int maps_removed = 0;
-	char *map_cache_buffer = NULL; //Has the uncompressed gat data of all maps, so just one allocation has to be made
 	char map_cache_decode_buffer[MAX_MAP_SIZE];
 
-	if( enable_grf )
+	if( enable_grf ) {
 		ShowStatus("Loading maps (using GRF files)...\n");
+		lazy_map_load = false; // Needs the map cache
+	}
 	else {
 		char mapcachefilepath[254];
 		sprintf(mapcachefilepath,"%s/%s%s",db_path,DBPATH,"map_cache.dat");
@@ -3659,7 +4223,6 @@ int map_readallmaps (void)
 	}
 
 	for( i = 0; i < map_num; i++ ) {
-		size_t size;
 		unsigned short idx = 0;
 
 		//Show progress
@@ -3679,10 +4242,7 @@ int map_readallmaps (void)
 
 		if( uidb_get(map_db,(unsigned int)map_id2index(i)) != NULL ) {
 			ShowWarning("Map %s already loaded!"CL_CLL"\n", map[i].name);
-			if( map[i].cell ) {
-				aFree(map[i].cell);
-				map[i].cell = NULL;
-			}
+			map_freecells(&map[i]);
 			map_delmapid(i);
 			maps_removed++;
 			i--;
@@ -3698,9 +4258,7 @@ int map_readallmaps (void)
 		map[i].bxs = (map[i].xs + BLOCK_SIZE - 1) / BLOCK_SIZE;
 		map[i].bys = (map[i].ys + BLOCK_SIZE - 1) / BLOCK_SIZE;
 
-		size = map[i].bxs * map[i].bys * sizeof(struct block_list *);
-		map[i].block = (struct block_list**)aCalloc(size, 1);
-		map[i].block_mob = (struct block_list**)aCalloc(size, 1);
+		memset(map[i].block, 0, sizeof(map[i].block)); //Allocated by map_addblock
 	}
 
 	//Intialization and configuration-dependent adjustments of mapflags
@@ -3710,11 +4268,18 @@ int map_readallmaps (void)
 		fclose(fp);
 
 		//The cache isn't needed anymore, so free it. [Shinryo]
-		aFree(map_cache_buffer);
+		if( !lazy_map_load && !map_cache_v2 ) {
+			map_free_mapcache();
+			for( i = 0; i < map_num; i++ )
+				map[i].cache_data = NULL;
+		}
 	}
 
 	//Finished map loading
-	ShowInfo("Successfully loaded '"CL_WHITE"%d"CL_RESET"' maps."CL_CLL"\n",map_num);
+	if( lazy_map_load )
+		ShowInfo("Successfully registered '"CL_WHITE"%d"CL_RESET"' maps (loaded when needed)."CL_CLL"\n",map_num);
+	else
+		ShowInfo("Successfully loaded '"CL_WHITE"%d"CL_RESET"' maps."CL_CLL"\n",map_num);
 	instance_start = map_num; //Next Map Index will be instances
 
 	if( maps_removed )
@@ -3783,12 +4348,34 @@ int parse_console(const char *buf) {
 		}
 	} else if( strcmpi("ers_report", type) == 0 ) {
 		ers_report();
+	} else if( strcmpi("memory", type) == 0 ) {
+		malloc_report(n == 2 && strcmpi("reset", command) == 0);
+	} else if( strcmpi("timers", type) == 0 ) {
+		timer_report(n == 2 && strcmpi("reset", command) == 0);
+	} else if( strcmpi("ticks", type) == 0 ) {
+		tick_report(n == 2 && strcmpi("reset", command) == 0);
+	} else if( strcmpi("fifos", type) == 0 ) {
+		socket_fifo_report();
+	} else if( strcmpi("sends", type) == 0 ) {
+		socket_send_report(n == 2 && strcmpi("reset", command) == 0);
+	} else if( strcmpi("paths", type) == 0 ) {
+		m = ( n == 2 ? map_mapname2mapid(command) : -1 );
+		if( n == 2 && m < 0 )
+			ShowWarning("Console: Unknown map.\n");
+		else
+			path_benchmark(m);
 	} else if( strcmpi("help", type) == 0 ) {
 		ShowInfo("Available commands:\n");
 		ShowInfo("\t admin:@<atcommand> => Uses an atcommand. Do NOT use commands requiring an attached player.\n");
 		ShowInfo("\t admin:map:<map> <x> <y> => Changes the map from which console commands are executed.\n");
 		ShowInfo("\t server:shutdown => Stops the server.\n");
 		ShowInfo("\t ers_report => Displays database usage.\n");
+		ShowInfo("\t memory[:reset] => Displays the memory in use by each source file (and resets the peaks).\n");
+		ShowInfo("\t timers[:reset] => Displays the execution time of each timer function (and resets it).\n");
+		ShowInfo("\t ticks[:reset] => Displays the latency of each phase of the main loop (and resets it).\n");
+		ShowInfo("\t fifos => Displays the memory used by the session buffers.\n");
+		ShowInfo("\t sends[:reset] => Displays the average number of bytes per send syscall (and resets it).\n");
+		ShowInfo("\t paths[:<map>] => Compares the A* and the jump point path searches on random paths of the loaded maps (or one map).\n");
 	}
 
 	return 0;
@@ -3891,6 +4478,20 @@ int map_config_read(char *cfgName)
 			console_msg_log = atoi(w2); //[Ind]
 		else if (strcmpi(w1, "console_log_filepath") == 0)
 			safestrncpy(console_log_filepath, w2, sizeof(console_log_filepath));
+		else if (strcmpi(w1, "packet_stats_interval") == 0)
+			packet_stats_interval = max(0, atoi(w2));
+		else if (strcmpi(w1, "packet_stats_file") == 0)
+			safestrncpy(packet_stats_file, w2, sizeof(packet_stats_file));
+		else if (strcmpi(w1, "mem_stats_interval") == 0)
+			mem_stats_interval = max(0, atoi(w2));
+		else if (strcmpi(w1, "mem_stats_file") == 0)
+			safestrncpy(mem_stats_file, w2, sizeof(mem_stats_file));
+		else if (strcmpi(w1, "lazy_map_load") == 0)
+			lazy_map_load = (config_switch(w2) != 0);
+		else if (strcmpi(w1, "map_unload_time") == 0)
+			map_unload_time = max(0, atoi(w2));
+		else if (strcmpi(w1, "mob_ai_threads") == 0)
+			mob_ai_threads = cap_value(atoi(w2), 0, MOB_AI_MAXTHREADS);
 		else if (strcmpi(w1, "import") == 0)
 			map_config_read(w2);
 		else
@@ -4407,7 +5008,13 @@ void do_final(void)
 	nick_db->destroy(nick_db, nick_db_final);
 	charid_db->destroy(charid_db, NULL);
 	iwall_db->destroy(iwall_db, NULL);
-	regen_db->destroy(regen_db, NULL);
+	for( i = 0; i < BL_TYPE_NUM; i++ ) {
+		aFree(map_bllists[i].list);
+		memset(&map_bllists[i], 0, sizeof(map_bllists[i]));
+	}
+	aFree(bl_list);
+	bl_list = NULL;
+	bl_list_count = bl_list_max = 0;
 
 #ifdef ADJUST_SKILL_DAMAGE
 	ers_destroy(map_skill_damage_ers);
@@ -4560,14 +5167,13 @@ int do_init(int argc, char *argv[])
 	inter_config_read(INTER_CONF_NAME);
 	log_config_read(LOG_CONF_NAME);
 
-	id_db = idb_alloc(DB_OPT_BASE);
-	pc_db = idb_alloc(DB_OPT_BASE);	//Added for reliable map_id2sd() use. [Skotlex]
-	mobid_db = idb_alloc(DB_OPT_BASE);	//Added to lower the load of the lazy mob ai. [Skotlex]
-	bossid_db = idb_alloc(DB_OPT_BASE); // Used for Convex Mirror quick MVP search
+	id_db = idb_alloc(DB_OPT_FLAT);
+	pc_db = idb_alloc(DB_OPT_FLAT);	//Added for reliable map_id2sd() use. [Skotlex]
+	mobid_db = idb_alloc(DB_OPT_FLAT);	//Added to lower the load of the lazy mob ai. [Skotlex]
+	bossid_db = idb_alloc(DB_OPT_FLAT); // Used for Convex Mirror quick MVP search
 	map_db = uidb_alloc(DB_OPT_BASE);
 	nick_db = idb_alloc(DB_OPT_BASE);
-	charid_db = idb_alloc(DB_OPT_BASE);
-	regen_db = idb_alloc(DB_OPT_BASE); // efficient status_natural_heal processing
+	charid_db = idb_alloc(DB_OPT_FLAT);
 
 	iwall_db = strdb_alloc(DB_OPT_RELEASE_DATA, 2 * NAME_LENGTH + 2 + 1); // [Zephyrus] Invisible Walls
 
@@ -4584,11 +5190,18 @@ int do_init(int argc, char *argv[])
 		grfio_init(GRF_PATH_FILENAME);
 
 	map_readallmaps();
+	map_view_range = AREA_SIZE;
 
 	add_timer_func_list(map_freeblock_timer, "map_freeblock_timer");
 	add_timer_func_list(map_clearflooritem_timer, "map_clearflooritem_timer");
 	add_timer_func_list(map_removemobs_timer, "map_removemobs_timer");
 	add_timer_interval(gettick() + 1000, map_freeblock_timer, 0, 0, 60 * 1000);
+	add_timer_func_list(map_mem_stats_timer, "map_mem_stats_timer");
+	if( mem_stats_interval > 0 )
+		add_timer_interval(gettick() + mem_stats_interval*1000, map_mem_stats_timer, 0, 0, mem_stats_interval*1000);
+	add_timer_func_list(map_unload_timer, "map_unload_timer");
+	if( lazy_map_load && map_unload_time > 0 )
+		add_timer_interval(gettick() + MAP_UNLOAD_INTERVAL*1000, map_unload_timer, 0, 0, MAP_UNLOAD_INTERVAL*1000);
 
 	do_init_path();
 	do_init_atcommand();
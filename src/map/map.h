@@ -32,6 +32,7 @@ const char *map_msg_txt(int msg_number);
 void map_do_final_msg(void);
 
 #define MAX_NPC_PER_MAP 512
+#define BLOCK_SIZE 8 // Cells per side of a block (see map_data.bxs)
 #define AREA_SIZE battle_config.area_size
 #define CHAT_AREA_SIZE battle_config.chat_area_size
 #define DAMAGELOG_SIZE 30
@@ -253,6 +254,18 @@ enum bl_type {
 
 	BL_ALL   = 0xFFF,
 };
+#define BL_TYPE_NUM 10 // number of single bl types above
+
+//Block chains of a map, queries only walk the chains of the types they look for
+enum map_block_chain {
+	BLC_PC = 0,
+	BLC_MOB,
+	BLC_NPC,
+	BLC_ITEM,
+	BLC_SKILL,
+	BLC_OTHER, // BL_PET, BL_HOM, BL_MER, BL_CHAT and BL_ELEM
+	BLC_MAX
+};
 
 //For common mapforeach calls. Since pets cannot be affected, they aren't included here yet.
 #define BL_CHAR (BL_PC|BL_MOB|BL_HOM|BL_MER|BL_ELEM)
@@ -374,12 +387,27 @@ enum auto_trigger_flag {
 	ATF_SKILL  = ATF_MAGIC|ATF_MISC,
 };
 
+/// Blocks of a view set, see struct map_view.
+struct map_view_list {
+	struct block_list **bl;
+	int count, max;
+};
+
+/// Players within area_size of a block on a map, kept up to date by map_addblock,
+/// map_delblock and map_moveblock so area packets don't need a map query.
+struct map_view {
+	struct map_view_list watchers; // players that have the block in view
+	struct map_view_list seen;     // players only: blocks they have in view
+};
+
 struct block_list {
 	struct block_list *next, *prev;
 	int id;
 	int16 m, x, y;
 	enum bl_type type;
 	int val1;
+	int idx; // position in the list of its type (map_addiddb)
+	struct map_view *view; // NULL while not on a map or not in view of any player
 };
 
 // Mob List Held in memory for Dynamic Mobs [Wizputer]
@@ -552,6 +580,9 @@ typedef enum {
 	CELL_CHKNOICEWALL      // Whether the cell isn't allowed to cast Ice Wall
 } cell_chk;
 
+#define MAP_CELL_PAGE_BITS 10
+#define MAP_CELL_PAGE_SIZE (1 << MAP_CELL_PAGE_BITS)
+
 struct mapcell
 {
 	// Terrain flags
@@ -576,6 +607,12 @@ struct mapcell
 #endif
 };
 
+/// Cells of a map as they were when instances of it were created, shared by these instance maps (see map_sharecells).
+struct map_cell_share {
+	struct mapcell *cell;
+	int refs; // Instance maps using the cells
+};
+
 struct iwall_data {
 	char wall_name[50];
 	short m, x, y, size;
@@ -621,12 +658,18 @@ struct questinfo {
 	unsigned short *jobid;
 };
 
+/// Players in active AI range of a block, refreshed on each AI tick (see mob_ai_timer).
+struct map_ai_block {
+	unsigned int touch; // AI tick on which a player was in range of some cells of the block
+	unsigned int cover; // AI tick on which a player was in range of all the cells of the block
+	uint32 char_id; // Player that covers the block
+};
+
 struct map_data {
 	char name[MAP_NAME_LENGTH];
 	uint16 index; // The map index used by the mapindex* functions.
-	struct mapcell *cell; // Holds the information of each map cell (NULL if the map is not on this map-server).
-	struct block_list **block;
-	struct block_list **block_mob;
+	struct mapcell *cell; // Holds the information of each map cell (NULL if the map is not on this map-server, see map_loadcells for maps that aren't loaded yet).
+	struct block_list **block[BLC_MAX]; // Blocks of each chain by block position, allocated with the first block of the chain
 	int16 m;
 	int16 xs, ys; // Map dimensions (in cells)
 	int16 bxs, bys; // Map dimensions (in blocks)
@@ -635,6 +678,15 @@ struct map_data {
 	int users;
 	int users_pvp;
 	int iwall_num; // Total of invisible walls in this map
+	char *cache_data; // Map cache entry the cells are decoded from (lazy_map_load)
+	int idle_time; // Seconds without anything happening on the map, see map_unload_timer
+	bool cells_pinned; // The cells were changed by a script or GM and can't be decoded again
+	struct mapcell **cell_page; // Instance maps: private copies of the changed pages of cells (MAP_CELL_PAGE_SIZE cells), NULL while shared
+	struct map_cell_share *cell_base; // Cells shared by the next instances of this map, dropped when its cells change
+	struct map_cell_share *cell_shared; // Instance maps: cells of the source map in use
+	struct map_ai_block *ai_block; // Player proximity of each block for the mob AI, allocated once a player is on the map
+	unsigned int changes; // Blocks added, removed or moved and walls changed, tells the mob AI if its decisions still hold (see mob_ai_decide)
+	uint8 *path_jump[3]; // Jump tables of the jump point search for CELL_CHKNOPASS, CELL_CHKNOREACH and CELL_CHKWALL, built on first use (see path_jump_build)
 	struct map_flag {
 		unsigned town : 1; // [Suggestion to protect Mail System]
 		unsigned autotrade : 1;
@@ -762,6 +814,7 @@ int map_getcell(int16 m,int16 x,int16 y,cell_chk cellchk);
 int map_getcellp(struct map_data *m,int16 x,int16 y,cell_chk cellchk);
 void map_setcell(int16 m, int16 x, int16 y, cell_t cell, bool flag);
 void map_setgatcell(int16 m, int16 x, int16 y, int gat);
+bool map_hascells(int16 m);
 
 extern struct map_data map[];
 extern int map_num;
@@ -835,6 +888,28 @@ int map_foreachincell(int (*func)(struct block_list *, va_list), int16 m, int16
 int map_foreachinpath(int (*func)(struct block_list *, va_list), int16 m, int16 x0, int16 y0, int16 x1, int16 y1, int16 range, int length, int type, ...);
 int map_foreachindir(int (*func)(struct block_list *, va_list), int16 m, int16 x0, int16 y0, int16 x1, int16 y1, int16 range, int length, int offset, int type, ...);
 int map_foreachinmap(int (*func)(struct block_list *, va_list), int16 m, int type, ...);
+
+/// Wall check of the map queries
+enum map_query_mode {
+	MQ_ALL = 0, // No wall check (map_foreachinall*)
+	MQ_SHOOT,   // Only blocks that can be shot from the center (map_foreachinshoot*)
+	MQ_SKILL,   // MQ_SHOOT if skill_wall_check is enabled (map_foreachin*)
+};
+
+/// Blocks found by map_query_range/map_query_area, walked with map_query_next.
+/// Queries can be nested, each one must be released with map_query_end.
+struct map_query {
+	int base;  // First entry in the shared block list
+	int count; // Number of blocks found
+	int pos;   // Next entry to return
+};
+
+int map_query_range(struct map_query *q, struct block_list *center, int16 range, int type, enum map_query_mode mode);
+int map_query_area(struct map_query *q, int16 m, int16 x0, int16 y0, int16 x1, int16 y1, int type, enum map_query_mode mode);
+struct block_list *map_query_next(struct map_query *q);
+void map_query_end(struct map_query *q);
+int map_collect_blocks(struct block_list *center, int16 range, int type, struct block_list **list, int max);
+struct map_view_list *map_view_watchers(struct block_list *bl);
 // Blocklist nb in one cell
 int map_count_oncell(int16 m, int16 x, int16 y, int type, int flag);
 struct skill_unit *map_find_skill_unit_oncell(struct block_list *, int16 x, int16 y, uint16 skill_id, struct skill_unit *, int flag);
@@ -12,6 +12,9 @@
 #include "../common/strlib.h"
 #include "../common/utils.h"
 #include "../common/socket.h"
+#include "../common/atomic.h"
+#include "../common/thread.h"
+#include "../common/mutex.h"
 
 #include "map.h"
 #include "path.h"
@@ -21,6 +24,7 @@
 #include "pet.h"
 #include "status.h"
 #include "mob.h"
+#include "mob_ai.h"
 #include "homunculus.h"
 #include "mercenary.h"
 #include "elemental.h"
@@ -119,6 +123,45 @@ struct s_randomsummon_group {
 
 static DBMap *mob_summon_db; //Random summon DB, struct s_randomsummon_group -> group_id
 
+//Think schedule (mob_ai.h)
+#define MOB_AI_LAZY_DELAY 10 //AI ticks between two thinks of a monster far from players
+static struct s_mob_ai_queue mob_ai_queue;
+#define mob_ai_slot (mob_ai_queue.slot) //Current AI tick
+
+//Target search in two phases (mob_ai_threads)
+//Decide: the worker threads share out the monsters of the AI tick that look for a target and list, for each one,
+//the blocks in view range that are in sight and can be walked to. These checks only read the map.
+//Commit: the monsters think one after the other in the main thread. A monster that looks for a target picks it
+//among its candidates with the checks that use the shared state (battle_check_target), in the same order as
+//the search would. The decision is dropped if anything moved on the map since.
+#define MOB_AI_MAXCANDIDATES 64 //Blocks in view range a decision can hold, the monster searches itself if there are more
+#define MOB_AI_BATCH 8 //Monsters a worker thread decides for at once
+struct s_mob_ai_intent {
+	struct mob_data *md;
+	int id; //Monster the decision is for
+	int16 m;
+	unsigned int changes; //map_data.changes when decided
+	int view_range;
+	enum e_mode mode;
+	bool walking;
+	bool decided; //False if there were too many blocks in view range
+	int count;
+	int candidate[MOB_AI_MAXCANDIDATES]; //Block ids, in search order
+};
+int mob_ai_threads = 0;
+static struct s_mob_ai_intent *mob_ai_intents = NULL; //Decisions of the current AI tick
+static int mob_ai_intents_count = 0, mob_ai_intents_max = 0;
+static int *mob_ai_intent_of = NULL; //Decision of each monster of the bucket, -1 if none
+static int mob_ai_intent_of_max = 0;
+static struct s_mob_ai_intent *mob_ai_intent = NULL; //Decision of the monster that thinks
+static rAthread mob_ai_worker[MOB_AI_MAXTHREADS];
+static ramutex mob_ai_mutex = NULL;
+static racond mob_ai_start = NULL, mob_ai_done = NULL;
+static int mob_ai_generation = 0; //Batch of decisions, protected by mob_ai_mutex
+static int mob_ai_idle = 0; //Workers done with the batch, protected by mob_ai_mutex
+static bool mob_ai_stop = false;
+static volatile int32 mob_ai_next_intent = 0;
+
 struct eri *mob_sc_display_ers = NULL;
 
 /*==========================================
@@ -1146,6 +1189,7 @@ int mob_spawn(struct mob_data *md)
 
 	skill_unit_move(&md->bl,tick,1);
 	mobskill_use(md,tick,MSC_SPAWN);
+	mob_ai_wake(md);
 	return 0;
 }
 
@@ -1212,72 +1256,81 @@ int mob_target(struct mob_data *md, struct block_list *bl, int dist)
 /*==========================================
  * The search routine of an active monster
  *------------------------------------------*/
-static int mob_ai_sub_hard_activesearch(struct block_list *bl,va_list ap)
+/**
+ * Checks of the target search that only read the monster, the candidate and the map
+ * The worker threads run them in the decide phase (see mob_ai_decide)
+ * @param md: Monster
+ * @param bl: Target candidate
+ * @param mode: Mode of the monster
+ * @param walking: The monster is walking
+ * @return True if the candidate is in sight and can be walked to
+ */
+static bool mob_ai_search_reach(struct mob_data *md, struct block_list *bl, enum e_mode mode, bool walking)
 {
-	struct mob_data *md;
-	struct block_list **target;
-	enum e_mode mode;
-	int dist;
+	if(md->bl.id == bl->id)
+		return false;
 
-	nullpo_ret(bl);
+	if((mode&MD_TARGETWEAK) && status_get_lv(bl) >= md->level - 5)
+		return false;
 
-	md = va_arg(ap,struct mob_data *);
-	target = va_arg(ap,struct block_list **);
-	mode = va_arg(ap,enum e_mode);
+	if(bl->type == BL_PC && ((TBL_PC *)bl)->state.gangsterparadise && !status_has_mode(&md->status,MD_STATUS_IMMUNE))
+		return false; //Gangster paradise protection
+
+	if(!battle_check_range(&md->bl,bl,md->db->range2))
+		return false;
+
+#ifdef ACTIVEPATHSEARCH
+	{
+		struct walkpath_data wpd;
+
+		if(!path_search(&wpd,md->bl.m,md->bl.x,md->bl.y,bl->x,bl->y,0,CELL_CHKWALL)) //Count walk path cells
+			return false;
+		//Standing monsters use range2, walking monsters use range3
+		if((!walking && wpd.path_len > md->db->range2) || (walking && wpd.path_len > md->db->range3))
+			return false;
+	}
+#endif
+	return true;
+}
+
+/**
+ * @param decided: The candidate passed mob_ai_search_reach in the decide phase
+ */
+static int mob_ai_sub_hard_activesearch(struct block_list *bl, struct mob_data *md, struct block_list **target, enum e_mode mode, bool decided)
+{
+	int dist;
 
 	//If can't seek yet, not an enemy, or you can't attack it, skip
 	if(md->bl.id == bl->id || (*target) == bl || battle_check_target(&md->bl,bl,BCT_ENEMY) <= 0 ||
 		!status_check_skilluse(&md->bl,bl,0,0))
 		return 0;
 
-	if((mode&MD_TARGETWEAK) && status_get_lv(bl) >= md->level - 5)
-		return 0;
+	if((battle_config.hom_setting&HOMSET_FIRST_TARGET) && (*target) && (*target)->type == BL_HOM && bl->type != BL_HOM)
+		return 0; //For some reason Homun targets are never overriden
 
-	switch(bl->type) {
-		case BL_PC:
-			if(((TBL_PC *)bl)->state.gangsterparadise && !status_has_mode(&md->status,MD_STATUS_IMMUNE))
-				return 0; //Gangster paradise protection
-		default:
-			if((battle_config.hom_setting&HOMSET_FIRST_TARGET) && (*target) && (*target)->type == BL_HOM && bl->type != BL_HOM)
-				return 0; //For some reason Homun targets are never overriden
+	dist = distance_bl(&md->bl,bl);
+	if((*target) != NULL && check_distance_bl(&md->bl,*target,dist))
+		return 0; //Pick closest target
 
-			dist = distance_bl(&md->bl,bl);
-			if(((*target) == NULL || !check_distance_bl(&md->bl,*target,dist)) &&
-				battle_check_range(&md->bl,bl,md->db->range2)) { //Pick closest target?
+	if(!decided && !mob_ai_search_reach(md, bl, mode, md->ud.walktimer != INVALID_TIMER))
+		return 0;
 #ifdef ACTIVEPATHSEARCH
-			struct walkpath_data wpd;
-
-			if(!path_search(&wpd,md->bl.m,md->bl.x,md->bl.y,bl->x,bl->y,0,CELL_CHKWALL)) //Count walk path cells
-				return 0;
-			//Standing monsters use range2, walking monsters use range3
-			if((md->ud.walktimer == INVALID_TIMER && wpd.path_len > md->db->range2) ||
-				(md->ud.walktimer != INVALID_TIMER && wpd.path_len > md->db->range3))
-				return 0;
+	path_flow_prepare(md->bl.m, bl->x, bl->y, CELL_CHKWALL); //Counts the walk path search toward the target
 #endif
-				(*target) = bl;
-				md->target_id = bl->id;
-				md->min_chase = dist + md->db->range3;
-				if(md->min_chase > MAX_MINCHASE)
-					md->min_chase = MAX_MINCHASE;
-				return 1;
-			}
-			break;
-		}
-	return 0;
+
+	(*target) = bl;
+	md->target_id = bl->id;
+	md->min_chase = dist + md->db->range3;
+	if(md->min_chase > MAX_MINCHASE)
+		md->min_chase = MAX_MINCHASE;
+	return 1;
 }
 
 /*==========================================
  * Chase target-change routine.
  *------------------------------------------*/
-static int mob_ai_sub_hard_changechase(struct block_list *bl,va_list ap)
+static int mob_ai_sub_hard_changechase(struct block_list *bl, struct mob_data *md, struct block_list **target)
 {
-	struct mob_data *md;
-	struct block_list **target;
-
-	nullpo_ret(bl);
-	md = va_arg(ap,struct mob_data *);
-	target = va_arg(ap,struct block_list **);
-
 	//If can't seek yet, not an enemy, or you can't attack it, skip
 	if(md->bl.id == bl->id || (*target) == bl || battle_check_target(&md->bl,bl,BCT_ENEMY) <= 0 ||
 		!status_check_skilluse(&md->bl,bl,0,0))
@@ -1595,6 +1648,23 @@ int mob_warpchase(struct mob_data *md, struct block_list *target)
 	return 0;
 }
 
+/**
+ * Decision of the worker threads for the target search of the monster that thinks, if it still holds
+ * @param md: Monster
+ * @param view_range: Range of the search
+ * @param mode: Mode of the monster
+ * @return NULL if there is none, or if the monster or the blocks of the map changed since
+ */
+static struct s_mob_ai_intent *mob_ai_decision(struct mob_data *md, int view_range, enum e_mode mode)
+{
+	struct s_mob_ai_intent *in = mob_ai_intent;
+
+	if(in == NULL || !in->decided || in->id != md->bl.id || in->m != md->bl.m || in->changes != map[md->bl.m].changes ||
+		in->view_range != view_range || in->mode != mode || in->walking != (md->ud.walktimer != INVALID_TIMER))
+		return NULL;
+	return in;
+}
+
 /*==========================================
  * AI of MOB whose is near a Player
  *------------------------------------------*/
@@ -1740,13 +1810,35 @@ static bool mob_ai_sub_hard(struct mob_data *md, unsigned int tick)
 		(md->lootitem_count < LOOTITEM_SIZE || battle_config.monster_loot_type != 1))
 		map_foreachinshootrange(mob_ai_sub_hard_lootsearch, &md->bl, view_range, BL_ITEM, md, &tbl);
 
-	if((!tbl && (mode&MD_AGGRESSIVE)) || md->state.skillstate == MSS_FOLLOW)
-		map_foreachinallrange(mob_ai_sub_hard_activesearch, &md->bl, view_range, DEFAULT_ENEMY_TYPE(md), md, &tbl, mode);
-	else if((mode&MD_CHANGECHASE) && (md->state.skillstate == MSS_RUSH || md->state.skillstate == MSS_FOLLOW ||
+	if((!tbl && (mode&MD_AGGRESSIVE)) || md->state.skillstate == MSS_FOLLOW) {
+		struct s_mob_ai_intent *in = mob_ai_decision(md, view_range, mode);
+		struct block_list *bl;
+
+		if(in != NULL) { //Candidates of the decide phase
+			int i;
+
+			for(i = 0; i < in->count; i++) {
+				if((bl = map_id2bl(in->candidate[i])))
+					mob_ai_sub_hard_activesearch(bl, md, &tbl, mode, true);
+			}
+		} else {
+			struct map_query q;
+
+			map_query_range(&q, &md->bl, view_range, DEFAULT_ENEMY_TYPE(md), MQ_ALL);
+			while((bl = map_query_next(&q)))
+				mob_ai_sub_hard_activesearch(bl, md, &tbl, mode, false);
+			map_query_end(&q);
+		}
+	} else if((mode&MD_CHANGECHASE) && (md->state.skillstate == MSS_RUSH || md->state.skillstate == MSS_FOLLOW ||
 		(md->sc.count && md->sc.data[SC_CONFUSION] && md->sc.data[SC_CONFUSION]->val4))) {
 		int search_size = (view_range < md->status.rhw.range ? view_range : md->status.rhw.range);
+		struct map_query q;
+		struct block_list *bl;
 
-		map_foreachinallrange(mob_ai_sub_hard_changechase, &md->bl, search_size, DEFAULT_ENEMY_TYPE(md), md, &tbl);
+		map_query_range(&q, &md->bl, search_size, DEFAULT_ENEMY_TYPE(md), MQ_ALL);
+		while((bl = map_query_next(&q)))
+			mob_ai_sub_hard_changechase(bl, md, &tbl);
+		map_query_end(&q);
 	}
 
 	if(!tbl) { //No targets available
@@ -1884,74 +1976,125 @@ static bool mob_ai_sub_hard(struct mob_data *md, unsigned int tick)
 	return true;
 }
 
-static int mob_ai_sub_hard_timer(struct block_list *bl,va_list ap)
+/**
+ * Queues a think of a monster, unless it already thinks earlier
+ * @param md: Monster
+ * @param delay: AI ticks from now (1 = next AI tick)
+ */
+static void mob_ai_schedule(struct mob_data *md, int delay)
 {
-	struct mob_data *md = (struct mob_data *)bl;
-	uint32 char_id = va_arg(ap, uint32);
-	unsigned int tick = va_arg(ap, unsigned int);
+	mob_ai_queue_push(&mob_ai_queue, md->bl.id, &md->think_slot, delay);
+}
 
-	if(mob_ai_sub_hard(md, tick)) { //Hard AI triggered
-		mob_add_spotted(md, char_id);
-		md->last_pcneartime = tick;
-	}
+/**
+ * Makes a monster think on the next AI tick
+ * @param md: Monster
+ */
+void mob_ai_wake(struct mob_data *md)
+{
+	nullpo_retv(md);
+
+	mob_ai_schedule(md, 1);
+}
+
+static int mob_ai_wake_sub(struct block_list *bl, va_list ap)
+{
+	mob_ai_schedule((struct mob_data *)bl, 1);
 	return 0;
 }
 
-/*==========================================
- * Serious processing for mob in PC field of view (foreachclient)
- *------------------------------------------*/
-static int mob_ai_sub_foreachclient(struct map_session_data *sd,va_list ap)
+/**
+ * Wakes up the monsters around a player that appeared on a map, or a monster that appeared on a map
+ * @param bl: Player or monster
+ */
+void mob_ai_wake_near(struct block_list *bl)
 {
-	unsigned int tick = va_arg(ap, unsigned int);
+	nullpo_retv(bl);
 
-	map_foreachinallrange(mob_ai_sub_hard_timer, &sd->bl, AREA_SIZE + ACTIVE_AI_RANGE, BL_MOB, sd->status.char_id, tick);
-	return 0;
+	if(bl->type == BL_MOB)
+		mob_ai_schedule((struct mob_data *)bl, 1);
+	else if(bl->type == BL_PC) {
+		if(battle_config.mob_ai&0x20 && map[bl->m].users == 1) //All monsters of the map use the active AI now
+			map_foreachinmap(mob_ai_wake_sub, bl->m, BL_MOB);
+		else
+			map_foreachinallrange(mob_ai_wake_sub, bl, AREA_SIZE + ACTIVE_AI_RANGE, BL_MOB);
+	}
 }
 
-/*==========================================
- * Negligent mode MOB AI (PC is not in near)
- *------------------------------------------*/
-static int mob_ai_sub_lazy(struct mob_data *md, va_list args)
+/**
+ * Wakes up the monsters a moving player comes next to, or a monster that moves on a map with players
+ * @param bl: Player or monster, already moved
+ * @param dx: Same as in map_foreachinmovearea
+ * @param dy: Same as in map_foreachinmovearea
+ */
+void mob_ai_wake_move(struct block_list *bl, int16 dx, int16 dy)
 {
-	unsigned int tick;
+	nullpo_retv(bl);
 
-	nullpo_ret(md);
+	if(bl->type == BL_MOB) {
+		if(map[bl->m].users > 0)
+			mob_ai_schedule((struct mob_data *)bl, 1);
+	} else if(bl->type == BL_PC)
+		map_foreachinmovearea(mob_ai_wake_sub, bl, AREA_SIZE + ACTIVE_AI_RANGE, dx, dy, BL_MOB);
+}
 
-	if(!md->bl.prev)
+/**
+ * Marks the blocks in active AI range of a player for the current AI tick
+ */
+static int mob_ai_sub_cover(struct map_session_data *sd, va_list ap)
+{
+	if(sd->bl.prev == NULL)
 		return 0;
 
-	tick = va_arg(args, unsigned int);
+	mob_ai_cover(&map[sd->bl.m], sd->bl.x, sd->bl.y, AREA_SIZE + ACTIVE_AI_RANGE, sd->status.char_id, mob_ai_slot);
+	return 0;
+}
 
-	if(battle_config.mob_ai&0x20 && map[md->bl.m].users > 0)
-		return (int)mob_ai_sub_hard(md, tick);
+/**
+ * Adds a player next to a monster to its spotted log
+ */
+static int mob_ai_sub_spotted(struct block_list *bl, va_list ap)
+{
+	struct mob_data *md = va_arg(ap, struct mob_data *);
 
-	if(!md->bl.prev || !md->status.hp)
-		return 1;
+	mob_add_spotted(md, ((TBL_PC *)bl)->status.char_id);
+	return 1;
+}
 
+/*==========================================
+ * Negligent mode MOB AI (PC is not in near)
+ * @return AI ticks until the next think, 0 if the monster has nothing to do until it gets woken up
+ *------------------------------------------*/
+static int mob_ai_sub_lazy(struct mob_data *md, unsigned int tick)
+{
 	if(battle_config.mob_active_time && md->last_pcneartime && !status_has_mode(&md->status, MD_STATUS_IMMUNE) &&
 		DIFF_TICK(tick, md->last_thinktime) > MIN_MOBTHINKTIME) {
-		if(DIFF_TICK(tick, md->last_pcneartime) < battle_config.mob_active_time)
-			return (int)mob_ai_sub_hard(md, tick);
+		if(DIFF_TICK(tick, md->last_pcneartime) < battle_config.mob_active_time) {
+			mob_ai_sub_hard(md, tick);
+			return MOB_AI_LAZY_DELAY;
+		}
 		md->last_pcneartime = 0;
 	}
 
 	if(battle_config.boss_active_time && md->last_pcneartime && status_has_mode(&md->status, MD_STATUS_IMMUNE) &&
 		DIFF_TICK(tick, md->last_thinktime) > MIN_MOBTHINKTIME) {
-		if(DIFF_TICK(tick, md->last_pcneartime) < battle_config.boss_active_time)
-			return (int)mob_ai_sub_hard(md, tick);
+		if(DIFF_TICK(tick, md->last_pcneartime) < battle_config.boss_active_time) {
+			mob_ai_sub_hard(md, tick);
+			return MOB_AI_LAZY_DELAY;
+		}
 		md->last_pcneartime = 0;
 	}
 
 	mob_clean_spotted(md); //Clean the spotted log
 
-	if(DIFF_TICK(tick, md->last_thinktime) < 10 * MIN_MOBTHINKTIME)
-		return 0;
+	if(DIFF_TICK(tick, md->last_thinktime) < MOB_AI_LAZY_DELAY * MIN_MOBTHINKTIME)
+		return MOB_AI_LAZY_DELAY;
 
 	md->last_thinktime = tick;
 
-	if(md->master_id) {
+	if(md->master_id) { //Slaves keep following their master
 		mob_ai_sub_hard_slavemob(md, tick);
-		return 0;
+		return MOB_AI_LAZY_DELAY;
 	}
 
 	if(DIFF_TICK(md->next_walktime, tick) < 0 && status_has_mode(&md->status, MD_CANMOVE) &&
@@ -1962,27 +2105,221 @@ static int mob_ai_sub_lazy(struct mob_data *md, va_list args)
 		if(rnd()%1000 < MOB_LAZYSKILLPERC(md)) //Chance to do a mob's idle skill
 			mobskill_use(md, tick, -1);
 	}
-	return 0;
+
+	if(!MOB_LAZYMOVEPERC(md) && !MOB_LAZYSKILLPERC(md))
+		return 0; //Sleeps until something wakes it up
+	return MOB_AI_LAZY_DELAY;
+}
+
+/**
+ * Checks if a player is in active AI range of a monster, using the blocks marked for this AI tick
+ * Only monsters on the border of the area covered by the players look for them
+ * @param md: Monster
+ * @return True if a player is in range
+ */
+static bool mob_ai_pcnear(struct mob_data *md)
+{
+	uint32 char_id;
+
+	switch(mob_ai_near(&map[md->bl.m], md->bl.x, md->bl.y, mob_ai_slot, &char_id)) {
+		case MOB_AI_NEAR:
+			mob_add_spotted(md, char_id);
+			return true;
+		case MOB_AI_EDGE:
+			return (map_foreachinallrange(mob_ai_sub_spotted, &md->bl, AREA_SIZE + ACTIVE_AI_RANGE, BL_PC, md) > 0);
+		default:
+			return false;
+	}
 }
 
 /*==========================================
- * Negligent processing for mob outside PC field of view   (interval timer function)
+ * One think of a mob, active AI when a PC is in near
+ * @return AI ticks until the next think, 0 if the monster has nothing to do until it gets woken up
  *------------------------------------------*/
-static int mob_ai_lazy(int tid, unsigned int tick, int id, intptr_t data)
+static int mob_ai_think(struct mob_data *md, unsigned int tick)
 {
-	map_foreachmob(mob_ai_sub_lazy,tick);
-	return 0;
+	if(!md->bl.prev || !md->status.hp)
+		return 0;
+
+	if(map[md->bl.m].users > 0) {
+		if(battle_config.mob_ai&0x20) {
+			mob_ai_sub_hard(md, tick);
+			return 1;
+		}
+		if(mob_ai_pcnear(md)) {
+			mob_ai_sub_hard(md, tick);
+			md->last_pcneartime = tick;
+			return 1;
+		}
+	}
+
+	return mob_ai_sub_lazy(md, tick);
+}
+
+/**
+ * Decide phase for one monster: lists the blocks in view range that pass mob_ai_search_reach
+ * Only reads the monster, the blocks and the map
+ */
+static void mob_ai_decide_search(struct s_mob_ai_intent *in)
+{
+	struct mob_data *md = in->md;
+	struct block_list *bl[MOB_AI_MAXCANDIDATES];
+	int i, n;
+
+	n = map_collect_blocks(&md->bl, in->view_range, DEFAULT_ENEMY_TYPE(md), bl, MOB_AI_MAXCANDIDATES);
+	if(n > MOB_AI_MAXCANDIDATES)
+		return; //The monster searches when it thinks
+
+	for(i = 0; i < n; i++) {
+		if(mob_ai_search_reach(md, bl[i], in->mode, in->walking))
+			in->candidate[in->count++] = bl[i]->id;
+	}
+	in->decided = true;
+}
+
+/**
+ * Takes batches of monsters of the decide phase until none is left
+ */
+static void mob_ai_run_decide(void)
+{
+	int32 i, j;
+
+	while((i = InterlockedExchangeAdd(&mob_ai_next_intent, MOB_AI_BATCH)) < mob_ai_intents_count) {
+		for(j = i; j < i + MOB_AI_BATCH && j < mob_ai_intents_count; j++)
+			mob_ai_decide_search(&mob_ai_intents[j]);
+	}
+}
+
+static void *mob_ai_worker_main(void *param)
+{
+	int generation = 0;
+
+	ramutex_lock(mob_ai_mutex);
+	for(;;) {
+		while(!mob_ai_stop && generation == mob_ai_generation)
+			racond_wait(mob_ai_start, mob_ai_mutex, -1);
+		if(mob_ai_stop)
+			break;
+		generation = mob_ai_generation;
+		ramutex_unlock(mob_ai_mutex);
+
+		mob_ai_run_decide();
+
+		ramutex_lock(mob_ai_mutex);
+		if(++mob_ai_idle == mob_ai_threads)
+			racond_signal(mob_ai_done);
+	}
+	ramutex_unlock(mob_ai_mutex);
+	return NULL;
+}
+
+/**
+ * Checks if a monster is about to look for a target when it thinks
+ * Only used to plan the decide phase, the think still checks everything
+ */
+static bool mob_ai_searches(struct mob_data *md, unsigned int tick)
+{
+	struct map_data *mapdata = &map[md->bl.m];
+
+	if(!md->bl.prev || !md->status.hp || md->target_id || md->ud.skilltimer != INVALID_TIMER ||
+		DIFF_TICK(tick, md->last_thinktime) < MIN_MOBTHINKTIME)
+		return false;
+	if(!(status_get_mode(&md->bl)&MD_AGGRESSIVE) && md->state.skillstate != MSS_FOLLOW)
+		return false;
+	if(mapdata->users == 0 || !map_hascells(md->bl.m))
+		return false;
+	if(battle_config.mob_ai&0x20)
+		return true;
+	return (mob_ai_near(mapdata, md->bl.x, md->bl.y, mob_ai_slot, NULL) != MOB_AI_FAR);
+}
+
+/**
+ * Decide phase of the hard AI: the worker threads list the target candidates of the monsters of the
+ * bucket that look for a target, the main thread helps them
+ */
+static void mob_ai_decide(struct s_mob_ai_bucket *b, unsigned int tick)
+{
+	int i;
+
+	if(mob_ai_intent_of_max < b->count) {
+		mob_ai_intent_of_max = b->count;
+		RECREATE(mob_ai_intent_of, int, mob_ai_intent_of_max);
+	}
+
+	mob_ai_intents_count = 0;
+	for(i = 0; i < b->count; i++) {
+		struct mob_data *md = map_id2md(b->ids[i]);
+		struct s_mob_ai_intent *in;
+
+		mob_ai_intent_of[i] = -1;
+		if(!md || md->think_slot != mob_ai_slot || !mob_ai_searches(md, tick))
+			continue;
+
+		path_jump_prepare(md->bl.m, CELL_CHKWALL); //The workers don't build the jump tables
+
+		if(mob_ai_intents_count == mob_ai_intents_max) {
+			mob_ai_intents_max = (mob_ai_intents_max ? mob_ai_intents_max * 2 : 256);
+			RECREATE(mob_ai_intents, struct s_mob_ai_intent, mob_ai_intents_max);
+		}
+		mob_ai_intent_of[i] = mob_ai_intents_count;
+		in = &mob_ai_intents[mob_ai_intents_count++];
+		in->md = md;
+		in->id = md->bl.id;
+		in->m = md->bl.m;
+		in->changes = map[md->bl.m].changes;
+		in->view_range = ((md->sc.count && md->sc.data[SC_BLIND] && md->sc.data[SC_PYREXIA]) ? 3 : md->db->range2); //Same as mob_ai_sub_hard
+		in->mode = status_get_mode(&md->bl);
+		in->walking = (md->ud.walktimer != INVALID_TIMER);
+		in->decided = false;
+		in->count = 0;
+	}
+
+	if(mob_ai_intents_count == 0)
+		return;
+
+	InterlockedExchange(&mob_ai_next_intent, 0);
+	ramutex_lock(mob_ai_mutex);
+	mob_ai_idle = 0;
+	mob_ai_generation++;
+	racond_broadcast(mob_ai_start);
+	ramutex_unlock(mob_ai_mutex);
+
+	mob_ai_run_decide(); //Help the workers
+
+	ramutex_lock(mob_ai_mutex);
+	while(mob_ai_idle < mob_ai_threads)
+		racond_wait(mob_ai_done, mob_ai_mutex, -1);
+	ramutex_unlock(mob_ai_mutex);
 }
 
 /*==========================================
- * Serious processing for mob in PC field of view (interval timer function)
+ * Runs the thinks queued for the current AI tick (interval timer function)
+ * With mob_ai_threads, the target candidates are listed first (decide), then the monsters think in order (commit)
  *------------------------------------------*/
-static int mob_ai_hard(int tid, unsigned int tick, int id, intptr_t data)
+static int mob_ai_timer(int tid, unsigned int tick, int id, intptr_t data)
 {
-	if (battle_config.mob_ai&0x20)
-		map_foreachmob(mob_ai_sub_lazy,tick);
-	else
-		map_foreachpc(mob_ai_sub_foreachclient,tick);
+	struct s_mob_ai_bucket *b = mob_ai_queue_next(&mob_ai_queue);
+	int i, delay;
+
+	if(b->count && !(battle_config.mob_ai&0x20))
+		map_foreachpc(mob_ai_sub_cover); //Union of the areas in active AI range, once for all the monsters
+
+	if(b->count && mob_ai_threads > 0)
+		mob_ai_decide(b, tick);
+
+	for(i = 0; i < b->count; i++) {
+		struct mob_data *md = map_id2md(b->ids[i]);
+
+		if(!md || md->think_slot != mob_ai_slot)
+			continue; //Deleted, or woken up earlier
+		md->think_slot = 0;
+		if(mob_ai_threads > 0)
+			mob_ai_intent = (mob_ai_intent_of[i] >= 0 ? &mob_ai_intents[mob_ai_intent_of[i]] : NULL);
+		if((delay = mob_ai_think(md, tick)) > 0)
+			mob_ai_schedule(md, delay);
+	}
+	b->count = 0;
+	mob_ai_intent = NULL;
 	return 0;
 }
 
@@ -2301,6 +2638,9 @@ void mob_damage(struct mob_data *md, struct block_list *src, int damage)
 		md->dmgtick = gettick();
 	}
 
+	if( src )
+		mob_ai_wake(md); //React on the next AI tick, even if no player is in near
+
 	if( battle_config.show_mob_info&3 )
 		clif_name_area(&md->bl);
 
@@ -2896,6 +3236,7 @@ void mob_revive(struct mob_data *md, unsigned int hp)
 	clif_spawn(&md->bl);
 	skill_unit_move(&md->bl,tick,1);
 	mobskill_use(md, tick, MSC_SPAWN);
+	mob_ai_wake(md);
 	if (battle_config.show_mob_info&3)
 		clif_name_area(&md->bl);
 }
@@ -5202,14 +5543,28 @@ void do_init_mob(void)
 
 	add_timer_func_list(mob_delayspawn, "mob_delayspawn");
 	add_timer_func_list(mob_delay_item_drop, "mob_delay_item_drop");
-	add_timer_func_list(mob_ai_hard, "mob_ai_hard");
-	add_timer_func_list(mob_ai_lazy, "mob_ai_lazy");
+	add_timer_func_list(mob_ai_timer, "mob_ai_timer");
 	add_timer_func_list(mob_timer_delete, "mob_timer_delete");
 	add_timer_func_list(mob_spawn_guardian_sub, "mob_spawn_guardian_sub");
 	add_timer_func_list(mob_respawn, "mob_respawn");
 	add_timer_func_list(mvptomb_delayspawn, "mvptomb_delayspawn");
-	add_timer_interval(gettick() + MIN_MOBTHINKTIME, mob_ai_hard, 0, 0, MIN_MOBTHINKTIME);
-	add_timer_interval(gettick() + MIN_MOBTHINKTIME * 10, mob_ai_lazy, 0, 0, MIN_MOBTHINKTIME * 10);
+	add_timer_interval(gettick() + MIN_MOBTHINKTIME, mob_ai_timer, 0, 0, MIN_MOBTHINKTIME);
+
+	if(mob_ai_threads > 0) {
+		int i;
+
+		mob_ai_mutex = ramutex_create();
+		mob_ai_start = racond_create();
+		mob_ai_done = racond_create();
+		for(i = 0; i < mob_ai_threads; i++) {
+			if((mob_ai_worker[i] = rathread_createEx(mob_ai_worker_main, NULL, 1024 * 1024, RAT_PRIO_NORMAL)) == NULL) {
+				ShowError("do_init_mob: Unable to start mob AI thread %d.\n", i + 1);
+				break;
+			}
+		}
+		mob_ai_threads = i;
+		ShowInfo("Using '"CL_WHITE"%d"CL_RESET"' mob AI threads.\n", mob_ai_threads);
+	}
 }
 
 /*==========================================
@@ -5241,4 +5596,25 @@ void do_final_mob(void)
 	ers_destroy(item_drop_ers);
 	ers_destroy(item_drop_list_ers);
 	ers_destroy(mob_sc_display_ers);
+	if (mob_ai_mutex) {
+		ramutex_lock(mob_ai_mutex);
+		mob_ai_stop = true;
+		racond_broadcast(mob_ai_start);
+		ramutex_unlock(mob_ai_mutex);
+		for (i = 0; i < mob_ai_threads; i++)
+			rathread_wait(mob_ai_worker[i], NULL);
+		racond_destroy(mob_ai_start);
+		racond_destroy(mob_ai_done);
+		ramutex_destroy(mob_ai_mutex);
+		mob_ai_mutex = NULL;
+		mob_ai_threads = 0;
+	}
+	if (mob_ai_intents)
+		aFree(mob_ai_intents);
+	if (mob_ai_intent_of)
+		aFree(mob_ai_intent_of);
+	mob_ai_intents = NULL;
+	mob_ai_intent_of = NULL;
+	mob_ai_intents_count = mob_ai_intents_max = mob_ai_intent_of_max = 0;
+	mob_ai_queue_final(&mob_ai_queue);
 }
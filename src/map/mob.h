@@ -29,6 +29,7 @@
 
 //Min time between AI executions
 #define MIN_MOBTHINKTIME 100
+#define MOB_AI_MAXTHREADS 32 //Max worker threads of the mob AI (mob_ai_threads)
 //Min time before mobs do a check to call nearby friends for help (or for slaves to support their master)
 #define MIN_MOBLINKTIME 1000
 //Min time between random walks
@@ -221,6 +222,7 @@ struct mob_data {
 	unsigned int bg_id; //BattleGround System
 
 	unsigned int next_walktime,last_thinktime,last_linktime,last_pcneartime,dmgtick;
+	unsigned int think_slot; //AI tick of the next queued think, 0 if not queued
 	short move_fail_count;
 	short lootitem_count;
 	short min_chase;
@@ -331,6 +333,10 @@ int mob_randomwalk(struct mob_data *md, unsigned int tick);
 int mob_warpchase(struct mob_data *md, struct block_list *target);
 int mob_target(struct mob_data *md, struct block_list *bl, int dist);
 int mob_unlocktarget(struct mob_data *md, unsigned int tick);
+extern int mob_ai_threads;
+void mob_ai_wake(struct mob_data *md);
+void mob_ai_wake_near(struct block_list *bl);
+void mob_ai_wake_move(struct block_list *bl, int16 dx, int16 dy);
 struct mob_data *mob_spawn_dataset(struct spawn_data *data);
 int mob_spawn(struct mob_data *md);
 int mob_delayspawn(int tid, unsigned int tick, int id, intptr_t data);
@@ -0,0 +1,118 @@
+// Copyright (c) Athena Dev Teams - Licensed under GNU GPL
+// For more information, see LICENCE in the main folder
+
+// Parts of the monster AI that only use the data passed to them (no map-server state), see mob.c
+
+#include "../common/cbasetypes.h"
+#include "../common/malloc.h"
+#include "map.h" // struct map_data, struct map_ai_block, BLOCK_SIZE
+#include "mob_ai.h"
+
+#include <stdlib.h>
+
+/**
+ * Queues a think of a monster, unless it already thinks earlier
+ * @param q: Think schedule
+ * @param id: Monster id
+ * @param think_slot: AI tick of the next queued think of the monster, 0 if not queued
+ * @param delay: AI ticks from now (1 = next AI tick), less than MOB_AI_BUCKETS
+ */
+void mob_ai_queue_push(struct s_mob_ai_queue *q, int id, unsigned int *think_slot, int delay)
+{
+	unsigned int slot = q->slot + delay;
+	struct s_mob_ai_bucket *b;
+
+	if(*think_slot && (int)(*think_slot - slot) <= 0)
+		return;
+
+	b = &q->bucket[slot%MOB_AI_BUCKETS];
+	if(b->count == b->max) {
+		b->max = (b->max ? b->max * 2 : 256);
+		RECREATE(b->ids, int, b->max);
+	}
+	b->ids[b->count++] = id;
+	*think_slot = slot;
+}
+
+/**
+ * Moves to the next AI tick
+ * The bucket may hold monsters that were queued again for an earlier tick, only the ones whose
+ * think_slot is the new current tick think. The caller empties the bucket once done.
+ * @param q: Think schedule
+ * @return Monsters queued for the new current tick
+ */
+struct s_mob_ai_bucket *mob_ai_queue_next(struct s_mob_ai_queue *q)
+{
+	return &q->bucket[++q->slot%MOB_AI_BUCKETS];
+}
+
+void mob_ai_queue_final(struct s_mob_ai_queue *q)
+{
+	int i;
+
+	for(i = 0; i < MOB_AI_BUCKETS; i++) {
+		aFree(q->bucket[i].ids);
+		q->bucket[i].ids = NULL;
+		q->bucket[i].count = q->bucket[i].max = 0;
+	}
+}
+
+/**
+ * Marks the blocks in active AI range of a player for an AI tick
+ * @param mapdata: Map of the player, its blocks are allocated on first use
+ * @param x: Position of the player
+ * @param y: Position of the player
+ * @param range: Active AI range
+ * @param char_id: Player, logged by the monsters of the blocks it covers
+ * @param slot: AI tick
+ */
+void mob_ai_cover(struct map_data *mapdata, int16 x, int16 y, int range, uint32 char_id, unsigned int slot)
+{
+	int x0, y0, x1, y1, bx, by;
+
+	if(mapdata->ai_block == NULL)
+		mapdata->ai_block = (struct map_ai_block *)aCalloc(mapdata->bxs * mapdata->bys, sizeof(struct map_ai_block));
+
+	x0 = max(x - range, 0);
+	y0 = max(y - range, 0);
+	x1 = min(x + range, mapdata->xs - 1);
+	y1 = min(y + range, mapdata->ys - 1);
+
+	for(by = y0 / BLOCK_SIZE; by <= y1 / BLOCK_SIZE; by++) {
+		for(bx = x0 / BLOCK_SIZE; bx <= x1 / BLOCK_SIZE; bx++) {
+			struct map_ai_block *ab = &mapdata->ai_block[bx + by * mapdata->bxs];
+
+			ab->touch = slot;
+			if(bx * BLOCK_SIZE >= x0 && min(bx * BLOCK_SIZE + BLOCK_SIZE - 1, mapdata->xs - 1) <= x1 &&
+				by * BLOCK_SIZE >= y0 && min(by * BLOCK_SIZE + BLOCK_SIZE - 1, mapdata->ys - 1) <= y1) {
+				ab->cover = slot;
+				ab->char_id = char_id;
+			}
+		}
+	}
+}
+
+/**
+ * Checks if a player is in active AI range of a cell, using the blocks marked for an AI tick
+ * @param mapdata: Map of the cell
+ * @param x: Cell
+ * @param y: Cell
+ * @param slot: AI tick
+ * @param char_id: Set to the player that covers the block for MOB_AI_NEAR, may be NULL
+ */
+enum e_mob_ai_near mob_ai_near(struct map_data *mapdata, int16 x, int16 y, unsigned int slot, uint32 *char_id)
+{
+	struct map_ai_block *ab;
+
+	if(mapdata->ai_block == NULL)
+		return MOB_AI_FAR;
+
+	ab = &mapdata->ai_block[x / BLOCK_SIZE + (y / BLOCK_SIZE) * mapdata->bxs];
+	if(ab->touch != slot)
+		return MOB_AI_FAR;
+	if(ab->cover != slot)
+		return MOB_AI_EDGE;
+	if(char_id)
+		*char_id = ab->char_id;
+	return MOB_AI_NEAR;
+}
@@ -0,0 +1,47 @@
+// Copyright (c) Athena Dev Teams - Licensed under GNU GPL
+// For more information, see LICENCE in the main folder
+
+#ifndef _MOB_AI_H_
+#define _MOB_AI_H_
+
+#include "../common/cbasetypes.h"
+
+struct map_data;
+
+#ifdef	__cplusplus
+extern "C" {
+#endif
+
+//Think schedule, one bucket of monster ids per AI tick (MIN_MOBTHINKTIME)
+//Monsters that have nothing to do are not queued until a player, damage or their master wakes them up
+#define MOB_AI_BUCKETS 16 //Must be larger than MOB_AI_LAZY_DELAY
+
+struct s_mob_ai_bucket {
+	int *ids;
+	int count, max;
+};
+
+struct s_mob_ai_queue {
+	struct s_mob_ai_bucket bucket[MOB_AI_BUCKETS];
+	unsigned int slot; //Current AI tick
+};
+
+void mob_ai_queue_push(struct s_mob_ai_queue *q, int id, unsigned int *think_slot, int delay);
+struct s_mob_ai_bucket *mob_ai_queue_next(struct s_mob_ai_queue *q);
+void mob_ai_queue_final(struct s_mob_ai_queue *q);
+
+//Players in active AI range of the monsters, marked on the blocks of the maps once per AI tick (map_data.ai_block)
+enum e_mob_ai_near {
+	MOB_AI_FAR = 0, //No player in range
+	MOB_AI_NEAR,    //The block is in range of a player
+	MOB_AI_EDGE,    //Some cells of the block are in range of a player, the monster has to look for them
+};
+
+void mob_ai_cover(struct map_data *mapdata, int16 x, int16 y, int range, uint32 char_id, unsigned int slot);
+enum e_mob_ai_near mob_ai_near(struct map_data *mapdata, int16 x, int16 y, unsigned int slot, uint32 *char_id);
+
+#ifdef	__cplusplus
+}
+#endif
+
+#endif /* _MOB_AI_H_ */
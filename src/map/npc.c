@@ -2433,6 +2433,7 @@ struct npc_data *npc_create_npc(int m, int x, int y)
 	CREATE(nd, struct npc_data, 1);
 	nd->bl.id = npc_get_new_npc_id();
 	nd->bl.prev = nd->bl.next = NULL;
+	nd->bl.type = BL_NPC;
 	nd->bl.m = m;
 	nd->bl.x = x;
 	nd->bl.y = y;
@@ -3489,6 +3490,8 @@ void npc_setcells(struct npc_data *nd)
 
 	if (m < 0 || xs < 0 || ys < 0) //invalid range or map
 		return;
+	if (!map_hascells(m)) //deployed when the map is loaded
+		return;
 
 	for (i = y - ys; i <= y + ys; i++) {
 		for (j = x - xs; j <= x + xs; j++) {
@@ -3523,7 +3526,7 @@ void npc_unsetcells(struct npc_data *nd)
 		ys = nd->u.scr.ys;
 	}
 
-	if (m < 0 || xs < 0 || ys < 0)
+	if (m < 0 || xs < 0 || ys < 0 || !map_hascells(m))
 		return;
 
 	//Locate max range on which we can locate npc cells
@@ -7,6 +7,7 @@
 #include "../common/nullpo.h"
 #include "../common/random.h"
 #include "../common/showmsg.h"
+#include "../common/timer.h"
 #include "map.h"
 #include "battle.h"
 #include "path.h"
@@ -38,10 +39,9 @@ struct path_node {
 };
 
 /// Binary heap of path nodes
+/// Each search keeps its heap on the stack, so path_search can run in several threads at once (see mob_ai_threads).
+/// A node is at most once in the open set, so it never holds more than MAX_WALKPATH * MAX_WALKPATH nodes.
 BHEAP_STRUCT_DECL(node_heap, struct path_node *);
-// Use static heap for all path calculations
-// It get's initialized in do_init_path, freed in do_final_path
-static BHEAP_STRUCT_VAR(node_heap, g_open_set);
 
 /// Comparator for binary heap of path nodes (minimum cost at top)
 #define NODE_MINTOPCMP(i,j) ((i)->f_cost - (j)->f_cost)
@@ -61,14 +61,43 @@ static const unsigned char walk_choices [3][3] =
 	{DIR_SOUTHWEST,DIR_SOUTH,DIR_SOUTHEAST},
 };
 
+/// @name Structures and defines for flow fields
+/// @{
+
+#define PATH_FLOW_CACHE 32 ///< Flow fields kept, the least recently used one is replaced
+#define PATH_FLOW_LIFETIME 2000 ///< Milliseconds without a search toward a goal before its searches are counted again
+
+#define FLOW_NONE 0xff ///< No path of MAX_WALKPATH steps to the goal
+#define FLOW_SIDE (2 * MAX_WALKPATH + 3) ///< Cells per side of a flow field: the cells a path of MAX_WALKPATH steps to the goal can cross, and a border
+#define FLOW_COST_UNIT 2 ///< Greatest common divisor of MOVE_COST and MOVE_DIAGONAL_COST
+#define FLOW_BUCKETS (MOVE_DIAGONAL_COST / FLOW_COST_UNIT + 1) ///< Costs in the open set of path_flow_build at once
+
+/// Index of the cell (dx,dy) away from the goal in a flow field
+#define flow_index(dx, dy) ((dx) + MAX_WALKPATH + 1 + ((dy) + MAX_WALKPATH + 1) * FLOW_SIDE)
+
+/// Flow field: the walk direction toward a goal from each cell a path of MAX_WALKPATH steps to it can cross
+struct path_flow {
+	int16 m, x, y; ///< Goal (m is -1 if the entry is free)
+	cell_chk cell; ///< Type of obstruction
+	int searches; ///< Searches toward the goal, see path_flow_prepare
+	unsigned int tick; ///< Last search toward the goal
+	bool built; ///< dir and steps are set
+	uint8 dir[FLOW_SIDE * FLOW_SIDE]; ///< Direction of the next step from each cell (see flow_index), FLOW_NONE if there is no path
+	uint8 steps[FLOW_SIDE * FLOW_SIDE]; ///< Steps to the goal from each cell
+};
+static struct path_flow path_flows[PATH_FLOW_CACHE];
+/// @}
+
 void do_init_path()
-{ // [fwi]: BHEAP_STRUCT_VAR already initialized the heap, this is rudendant & just for code-conformance/readability
-	BHEAP_INIT(g_open_set);
+{
+	int i;
+
+	for (i = 0; i < ARRAYLENGTH(path_flows); i++)
+		path_flows[i].m = -1;
 }
 
 void do_final_path()
 {
-	BHEAP_CLEAR(g_open_set);
 }
 
 /*==========================================
@@ -194,11 +223,10 @@ bool path_search_long(struct shootpath_data *spd,int16 m,int16 x0,int16 y0,int16
 /// @{
 
 /// Pushes path_node to the binary node_heap.
-/// Ensures there is enough space in array to store new element.
+/// The heap has room for all the nodes of a search.
 static void heap_push_node(struct node_heap *heap, struct path_node *node)
 {
 #ifndef __clang_analyzer__ // @TODO: Figure out why clang's static analyzer doesn't like this
-	BHEAP_ENSURE(*heap, 1, 256);
 	BHEAP_PUSH2(*heap, node, NODE_MINTOPCMP, swap_ptr);
 #endif // __clang_analyzer__
 }
@@ -254,6 +282,542 @@ static int add_path(struct node_heap *heap, struct path_node *tp, int16 x, int16
 }
 ///@}
 
+/// @name Jump point search
+/// Finds the shortest paths like a complete search, but only puts the cells where a path
+/// may turn (jump points) in the open set. The straight runs between them are read from
+/// jump tables of the map instead of checking each cell.
+/// Like in the A* search, a diagonal move needs both cells around it to be free.
+/// @{
+
+/// Planes of the jump tables (map_data.path_jump), one byte per cell each.
+/// The direction planes hold the number of steps to the next jump point from the cell,
+/// or JUMP_RUN and the number of free cells up to the next obstacle if there is no jump point before it.
+enum e_jump_plane {
+	JUMP_EAST = 0, ///< x+1
+	JUMP_WEST,     ///< x-1
+	JUMP_NORTH,    ///< y+1
+	JUMP_SOUTH,    ///< y-1
+	JUMP_WALK,     ///< 1 if the cell is free
+	JUMP_PLANES
+};
+
+#define JUMP_RUN 0x80 ///< No jump point before the next obstacle
+#define JUMP_MAX 0x7f ///< Longer runs are cut, paths are never that long
+
+/// Cells per side of the window of a jump point search, centered on the start: the cells a path of MAX_WALKPATH steps can reach
+#define JUMP_WINDOW (2 * MAX_WALKPATH + 1)
+
+/// Estimates the cost from (x0,y0) to (x1,y1) without overestimating (octile distance), so the shortest paths are found.
+#define jump_heuristic(x0, y0, x1, y1) (MOVE_COST * max(abs((x1) - (x0)), abs((y1) - (y0))) + (MOVE_DIAGONAL_COST - MOVE_COST) * min(abs((x1) - (x0)), abs((y1) - (y0))))
+
+/// Obstruction type of each jump table of map_data.path_jump
+static const cell_chk jump_cell[3] = { CELL_CHKNOPASS, CELL_CHKNOREACH, CELL_CHKWALL };
+
+// Translates enum directions into dx,dy
+static const int8 dir_dx[DIR_MAX] = { 0, -1, -1, -1,  0,  1, 1, 1 };
+static const int8 dir_dy[DIR_MAX] = { 1,  1,  0, -1, -1, -1, 0, 1 };
+
+/// State of a jump point search
+struct jump_search {
+	const uint8 *tab; ///< Jump tables of the map
+	int xs, ys, size; ///< Map dimensions, cells per plane
+	int x0, y0, x1, y1; ///< Start and goal
+	struct node_heap open_set;
+	struct path_node *open_data[JUMP_WINDOW * JUMP_WINDOW];
+	struct path_node nodes[JUMP_WINDOW * JUMP_WINDOW];
+	uint16 node_id[JUMP_WINDOW * JUMP_WINDOW]; ///< 1 + index in nodes of each cell of the window, 0 = not visited yet
+	int node_count;
+};
+
+/// Returns the jump table of map_data.path_jump for the obstruction type, or -1 if there is none.
+static int path_jump_kind(cell_chk cell)
+{
+	switch (cell) {
+#ifndef CELL_NOSTACK // The stacked units would have to be followed
+		case CELL_CHKNOPASS:  return 0;
+#endif
+		case CELL_CHKNOREACH: return 1;
+		case CELL_CHKWALL:    return 2;
+		default:              return -1;
+	}
+}
+
+/// Returns true if (x,y) is inside the map and free.
+static bool jump_walkable(const uint8 *walk, int xs, int ys, int x, int y)
+{
+	return (x >= 0 && x < xs && y >= 0 && y < ys && walk[x + y * xs]);
+}
+
+/// Returns true if a unit entering (x,y) in direction (dx,dy) has a free cell on one side
+/// with an obstacle behind it, that is a neighbor it can only reach the shortest way from (x,y).
+static bool jump_forced(const uint8 *walk, int xs, int ys, int x, int y, int dx, int dy)
+{
+	return (jump_walkable(walk, xs, ys, x + dy, y + dx) && !jump_walkable(walk, xs, ys, x + dy - dx, y + dx - dy))
+		|| (jump_walkable(walk, xs, ys, x - dy, y - dx) && !jump_walkable(walk, xs, ys, x - dy - dx, y - dx - dy));
+}
+
+/// Fills the direction plane of the jump tables for the line of cells through (x,y).
+static void path_jump_line(uint8 *tab, int xs, int ys, enum e_jump_plane plane, int x, int y)
+{
+	const uint8 *walk = tab + JUMP_WALK * xs * ys;
+	uint8 *out = tab + plane * xs * ys;
+	int dx = (plane == JUMP_EAST) - (plane == JUMP_WEST);
+	int dy = (plane == JUMP_NORTH) - (plane == JUMP_SOUTH);
+	uint8 v = JUMP_RUN; // The edge of the map is ahead of the last cell
+
+	// Start at the last cell of the line and go back
+	if (dx)
+		x = (dx > 0 ? xs - 1 : 0);
+	else
+		y = (dy > 0 ? ys - 1 : 0);
+	for (;;) {
+		out[x + y * xs] = v;
+		if (!walk[x + y * xs])
+			v = JUMP_RUN;
+		else if (jump_forced(walk, xs, ys, x, y, dx, dy))
+			v = 1;
+		else if (v&JUMP_RUN)
+			v = JUMP_RUN | min((v&JUMP_MAX) + 1, JUMP_MAX);
+		else
+			v = (v < JUMP_MAX ? v + 1 : JUMP_RUN|JUMP_MAX);
+		x -= dx;
+		y -= dy;
+		if (x < 0 || x >= xs || y < 0 || y >= ys)
+			break;
+	}
+}
+
+/// Builds the jump tables of a map for an obstruction type.
+static uint8 *path_jump_build(struct map_data *md, int kind)
+{
+	int x, y, size = md->xs * md->ys;
+	uint8 *tab = (uint8 *)aMalloc(JUMP_PLANES * size);
+
+	for (y = 0; y < md->ys; y++)
+		for (x = 0; x < md->xs; x++)
+			tab[JUMP_WALK * size + x + y * md->xs] = !map_getcellp(md, x, y, jump_cell[kind]);
+	for (y = 0; y < md->ys; y++) {
+		path_jump_line(tab, md->xs, md->ys, JUMP_EAST, 0, y);
+		path_jump_line(tab, md->xs, md->ys, JUMP_WEST, 0, y);
+	}
+	for (x = 0; x < md->xs; x++) {
+		path_jump_line(tab, md->xs, md->ys, JUMP_NORTH, x, 0);
+		path_jump_line(tab, md->xs, md->ys, JUMP_SOUTH, x, 0);
+	}
+	md->path_jump[kind] = tab;
+	return tab;
+}
+
+/// Builds the jump tables of a map for the obstruction type if the jump point search is enabled.
+/// Worker threads must find them built, path_search only builds them in the main thread (see mob_ai_decide).
+void path_jump_prepare(int16 m, cell_chk cell)
+{
+	int kind = path_jump_kind(cell);
+
+	if (battle_config.path_search_jps && kind >= 0 && map[m].cell != NULL && map[m].path_jump[kind] == NULL)
+		path_jump_build(&map[m], kind);
+}
+
+/// Updates the jump tables of a map after the walkability of (x,y) changed (ice walls, invisible walls, npc cells...).
+void path_jump_update(struct map_data *md, int16 x, int16 y)
+{
+	int kind, i;
+
+	for (kind = 0; kind < ARRAYLENGTH(md->path_jump); kind++) {
+		uint8 *tab = md->path_jump[kind];
+		uint8 walk;
+
+		if (tab == NULL)
+			continue;
+		walk = !map_getcellp(md, x, y, jump_cell[kind]);
+		if (tab[JUMP_WALK * md->xs * md->ys + x + y * md->xs] == walk)
+			continue;
+		tab[JUMP_WALK * md->xs * md->ys + x + y * md->xs] = walk;
+
+		// The cell is on the lines through it and beside the lines next to it
+		for (i = max(y - 1, 0); i <= min(y + 1, md->ys - 1); i++) {
+			path_jump_line(tab, md->xs, md->ys, JUMP_EAST, x, i);
+			path_jump_line(tab, md->xs, md->ys, JUMP_WEST, x, i);
+		}
+		for (i = max(x - 1, 0); i <= min(x + 1, md->xs - 1); i++) {
+			path_jump_line(tab, md->xs, md->ys, JUMP_NORTH, i, y);
+			path_jump_line(tab, md->xs, md->ys, JUMP_SOUTH, i, y);
+		}
+	}
+}
+
+/// Frees the jump tables of a map, they are built again when needed.
+void path_jump_free(struct map_data *md)
+{
+	int kind;
+
+	for (kind = 0; kind < ARRAYLENGTH(md->path_jump); kind++) {
+		if (md->path_jump[kind]) {
+			aFree(md->path_jump[kind]);
+			md->path_jump[kind] = NULL;
+		}
+	}
+}
+
+/// Looks for the next jump point from (x,y) in the straight direction (dx,dy).
+/// @return Number of steps to it (or to the goal), 0 if there is none in the window
+static int jump_straight(struct jump_search *js, int x, int y, int dx, int dy)
+{
+	enum e_jump_plane plane = (dx > 0 ? JUMP_EAST : dx < 0 ? JUMP_WEST : dy > 0 ? JUMP_NORTH : JUMP_SOUTH);
+	uint8 v = js->tab[plane * js->size + x + y * js->xs];
+	int n = (v&JUMP_MAX);
+	int goal = 0; // Steps to the goal if it is ahead on the line
+
+	if (dx && y == js->y1)
+		goal = (js->x1 - x) * dx;
+	else if (dy && x == js->x1)
+		goal = (js->y1 - y) * dy;
+	if (goal > 0 && goal <= n)
+		return goal;
+
+	if ((v&JUMP_RUN) || abs(x + n * dx - js->x0) > MAX_WALKPATH || abs(y + n * dy - js->y0) > MAX_WALKPATH)
+		return 0;
+	return n;
+}
+
+/// Looks for the next jump point from (x,y) in the diagonal direction (dx,dy): the goal or a cell
+/// from which a straight jump finds one.
+/// @return Number of steps to it, 0 if there is none in the window
+static int jump_diagonal(struct jump_search *js, int x, int y, int dx, int dy)
+{
+	const uint8 *walk = js->tab + JUMP_WALK * js->size;
+	int steps;
+
+	for (steps = 1; ; steps++) {
+		if (!jump_walkable(walk, js->xs, js->ys, x + dx, y) || !jump_walkable(walk, js->xs, js->ys, x, y + dy)
+		||  !jump_walkable(walk, js->xs, js->ys, x + dx, y + dy))
+			return 0;
+		x += dx;
+		y += dy;
+		if (abs(x - js->x0) > MAX_WALKPATH || abs(y - js->y0) > MAX_WALKPATH)
+			return 0;
+		if ((x == js->x1 && y == js->y1) || jump_straight(js, x, y, dx, 0) || jump_straight(js, x, y, 0, dy))
+			return steps;
+	}
+}
+
+/// Adds a jump point to the open set, or updates it if the new path to it is shorter.
+static int jump_add(struct jump_search *js, int x, int y, int g_cost, struct path_node *parent)
+{
+	int i = (x - js->x0 + MAX_WALKPATH) + (y - js->y0 + MAX_WALKPATH) * JUMP_WINDOW;
+	int h_cost = jump_heuristic(x, y, js->x1, js->y1);
+	struct path_node *node;
+
+	if (g_cost + h_cost > MAX_WALKPATH * MOVE_DIAGONAL_COST)
+		return 0; // Not on a path of MAX_WALKPATH steps
+
+	if (js->node_id[i]) { // We processed this node before
+		node = &js->nodes[js->node_id[i] - 1];
+		if (g_cost >= node->g_cost)
+			return 0;
+		node->g_cost = g_cost;
+		node->f_cost = g_cost + h_cost;
+		node->parent = parent;
+		if (node->flag == SET_CLOSED)
+			heap_push_node(&js->open_set, node); // Put it in open set again
+		else if (heap_update_node(&js->open_set, node))
+			return 1;
+		node->flag = SET_OPEN;
+		return 0;
+	}
+
+	node = &js->nodes[js->node_count++];
+	js->node_id[i] = js->node_count;
+	node->x = x;
+	node->y = y;
+	node->g_cost = g_cost;
+	node->f_cost = g_cost + h_cost;
+	node->parent = parent;
+	node->flag = SET_OPEN;
+	heap_push_node(&js->open_set, node);
+	return 0;
+}
+
+/// Jump point search (x0,y0)->(x1,y1), the goal is a free cell (see path_search).
+/// @return 1 if a path was found, 0 if there is none, -1 if the A* search has to be used
+static int path_search_jps(struct walkpath_data *wpd, struct map_data *md, int16 x0, int16 y0, int16 x1, int16 y1, cell_chk cell)
+{
+	struct jump_search js;
+	struct path_node *current, *it;
+	int kind = path_jump_kind(cell);
+	int len = 0, j;
+
+	if (kind < 0)
+		return -1;
+	if (abs(x1 - x0) > MAX_WALKPATH || abs(y1 - y0) > MAX_WALKPATH)
+		return 0;
+
+	js.tab = (md->path_jump[kind] ? md->path_jump[kind] : path_jump_build(md, kind));
+	js.xs = md->xs;
+	js.ys = md->ys;
+	js.size = md->xs * md->ys;
+	js.x0 = x0;
+	js.y0 = y0;
+	js.x1 = x1;
+	js.y1 = y1;
+	js.open_set._max_ = ARRAYLENGTH(js.open_data);
+	js.open_set._len_ = 0;
+	js.open_set._data_ = js.open_data;
+	js.node_count = 0;
+	memset(js.node_id, 0, sizeof(js.node_id));
+
+	jump_add(&js, x0, y0, 0, NULL); // Start node
+
+	for(;;) {
+		int dir, first, count, k;
+
+		if (BHEAP_LENGTH(js.open_set) == 0)
+			return 0;
+
+		current = BHEAP_PEEK(js.open_set); // Look for the lowest f_cost node in the 'open' set
+		BHEAP_POP2(js.open_set, NODE_MINTOPCMP, swap_ptr); // Remove it from 'open' set
+		current->flag = SET_CLOSED; // Add current node to 'closed' set
+
+		if (current->x == x1 && current->y == y1)
+			break;
+
+		// Neighbors worth a jump: all of them from the start, else the ones ahead of the last move
+		if (current->parent == NULL) {
+			first = 0;
+			count = DIR_MAX;
+		} else {
+			int dx = current->x - current->parent->x;
+			int dy = current->y - current->parent->y;
+
+			dir = walk_choices[-(dy > 0) + (dy < 0) + 1][(dx > 0) - (dx < 0) + 1];
+			first = (dir&1 ? dir - 1 : dir - 2); // A diagonal move goes on straight, a straight one may turn
+			count = (dir&1 ? 3 : 5);
+		}
+
+		for (k = 0; k < count; k++) {
+			int steps;
+
+			dir = (first + k + DIR_MAX)%DIR_MAX;
+			if (dir&1)
+				steps = jump_diagonal(&js, current->x, current->y, dir_dx[dir], dir_dy[dir]);
+			else
+				steps = jump_straight(&js, current->x, current->y, dir_dx[dir], dir_dy[dir]);
+			if (steps && jump_add(&js, current->x + steps * dir_dx[dir], current->y + steps * dir_dy[dir],
+					current->g_cost + steps * (dir&1 ? MOVE_DIAGONAL_COST : MOVE_COST), current))
+				return -1;
+		}
+	}
+
+	for (it = current; it->parent != NULL; it = it->parent)
+		len += max(abs(it->x - it->parent->x), abs(it->y - it->parent->y));
+	if (len > MAX_WALKPATH)
+		return -1; // The shortest path has too many steps, one with more diagonal steps may fit
+
+	// Recreate path, the jump points are in a straight or diagonal line from each other
+	wpd->path_len = len;
+	wpd->path_pos = 0;
+
+	for (it = current, j = len-1; it->parent != NULL; it = it->parent) {
+		int dx = it->x - it->parent->x;
+		int dy = it->y - it->parent->y;
+		int steps = max(abs(dx), abs(dy));
+
+		dx /= steps;
+		dy /= steps;
+		while (steps-- > 0)
+			wpd->path[j--] = walk_choices[-dy + 1][dx + 1];
+	}
+
+	return 1;
+}
+///@}
+
+/// @name Flow fields
+/// Units chasing the same target and monsters looking for it search paths toward the same cell.
+/// Once there are enough of these searches, the walk directions toward the cell are computed
+/// for all the cells around it at once, and the next searches just follow them.
+/// The paths are the shortest ones, like the ones of the jump point search.
+/// @{
+
+/// Returns the flow field entry of a goal, or NULL.
+static struct path_flow *path_flow_find(int16 m, int16 x, int16 y, cell_chk cell)
+{
+	int i;
+
+	ARR_FIND(0, ARRAYLENGTH(path_flows), i, path_flows[i].m == m && path_flows[i].x == x && path_flows[i].y == y && path_flows[i].cell == cell);
+	return (i < ARRAYLENGTH(path_flows) ? &path_flows[i] : NULL);
+}
+
+/// Returns true if (x,y) is inside the map and free.
+static bool flow_walkable(struct map_data *md, int x, int y, cell_chk cell)
+{
+	return (x >= 0 && x < md->xs && y >= 0 && y < md->ys && !map_getcellp(md, x, y, cell));
+}
+
+/// Computes a flow field with Dijkstra's algorithm, from the goal outward.
+/// The open set is a ring of buckets by cost, as the moves only cost MOVE_COST or MOVE_DIAGONAL_COST.
+/// Uses static buffers, main thread only.
+static void path_flow_build(struct path_flow *flow)
+{
+	static uint8 walk[FLOW_SIDE * FLOW_SIDE]; // Free cells of the window, the border is blocked
+	static int cost[FLOW_SIDE * FLOW_SIDE];
+	static int open_cell[FLOW_SIDE * FLOW_SIDE * DIR_MAX]; // A cell is added again each time its cost drops
+	static int open_next[FLOW_SIDE * FLOW_SIDE * DIR_MAX];
+	int open_head[FLOW_BUCKETS], open_len = 0, pending = 0;
+	struct map_data *md = &map[flow->m];
+	const uint8 *tab = md->path_jump[path_jump_kind(flow->cell)];
+	int i, c, x, y;
+
+	memset(walk, 0, sizeof(walk));
+	for (y = max(flow->y - MAX_WALKPATH, 0); y <= min(flow->y + MAX_WALKPATH, md->ys - 1); y++) {
+		for (x = max(flow->x - MAX_WALKPATH, 0); x <= min(flow->x + MAX_WALKPATH, md->xs - 1); x++) {
+			i = flow_index(x - flow->x, y - flow->y);
+			if (tab) // Same cells, cheaper to read
+				walk[i] = tab[JUMP_WALK * md->xs * md->ys + x + y * md->xs];
+			else
+				walk[i] = !map_getcellp(md, x, y, flow->cell);
+		}
+	}
+
+	memset(flow->dir, FLOW_NONE, sizeof(flow->dir));
+	for (i = 0; i < ARRAYLENGTH(cost); i++)
+		cost[i] = INT_MAX;
+	for (i = 0; i < FLOW_BUCKETS; i++)
+		open_head[i] = -1;
+
+	i = flow_index(0, 0); // Goal
+	cost[i] = 0;
+	flow->steps[i] = 0;
+	open_cell[0] = i;
+	open_next[0] = -1;
+	open_head[0] = 0;
+	open_len = pending = 1;
+
+	for (c = 0; pending > 0; c += FLOW_COST_UNIT) {
+		int *head = &open_head[c / FLOW_COST_UNIT % FLOW_BUCKETS];
+
+		while (*head >= 0) {
+			int d;
+
+			i = open_cell[*head];
+			*head = open_next[*head];
+			pending--;
+			if (cost[i] != c)
+				continue; // Reached at a lower cost since
+
+			// Cells from which a unit can step onto this one, the opposite way of d
+			for (d = 0; d < DIR_MAX; d++) {
+				int n = i + dir_dx[d] + dir_dy[d] * FLOW_SIDE;
+				int nc = c + (d&1 ? MOVE_DIAGONAL_COST : MOVE_COST);
+				int *nhead;
+
+				if (nc > MAX_WALKPATH * MOVE_DIAGONAL_COST || nc >= cost[n] || !walk[n])
+					continue; // Not on a path of MAX_WALKPATH steps, reached already or blocked
+				if ((d&1) && (!walk[i + dir_dx[d]] || !walk[i + dir_dy[d] * FLOW_SIDE]))
+					continue; // Diagonal moves need both cells around them
+				cost[n] = nc;
+				flow->dir[n] = (d + DIR_MAX / 2)%DIR_MAX;
+				flow->steps[n] = flow->steps[i] + 1;
+				nhead = &open_head[nc / FLOW_COST_UNIT % FLOW_BUCKETS];
+				open_cell[open_len] = n;
+				open_next[open_len] = *nhead;
+				*nhead = open_len++;
+				pending++;
+			}
+		}
+	}
+
+	flow->built = true;
+}
+
+/// Counts a search toward (x,y), and computes its flow field once path_flow_field searches went
+/// toward it within PATH_FLOW_LIFETIME of each other.
+/// Main thread only, path_search only reads the flow fields (see mob_ai_threads).
+void path_flow_prepare(int16 m, int16 x, int16 y, cell_chk cell)
+{
+	struct path_flow *flow;
+	unsigned int tick;
+	int i;
+
+	if (!battle_config.path_flow_field || path_jump_kind(cell) < 0 || map[m].cell == NULL || !flow_walkable(&map[m], x, y, cell))
+		return;
+
+	tick = gettick();
+	flow = path_flow_find(m, x, y, cell);
+	if (flow == NULL) { // Take a free entry or the least recently used one
+		for (i = 0; i < ARRAYLENGTH(path_flows); i++) {
+			if (path_flows[i].m < 0) {
+				flow = &path_flows[i];
+				break;
+			}
+			if (flow == NULL || DIFF_TICK(path_flows[i].tick, flow->tick) < 0)
+				flow = &path_flows[i];
+		}
+		flow->m = m;
+		flow->x = x;
+		flow->y = y;
+		flow->cell = cell;
+		flow->searches = 0;
+		flow->built = false;
+	} else if (!flow->built && DIFF_TICK(tick, flow->tick) > PATH_FLOW_LIFETIME)
+		flow->searches = 0;
+
+	flow->tick = tick;
+	if (!flow->built && ++flow->searches >= battle_config.path_flow_field)
+		path_flow_build(flow);
+}
+
+/// Drops the flow fields of a map that cross (x,y), after its walkability changed.
+void path_flow_update(struct map_data *md, int16 x, int16 y)
+{
+	int i;
+
+	for (i = 0; i < ARRAYLENGTH(path_flows); i++) {
+		if (path_flows[i].m == md->m && abs(path_flows[i].x - x) <= MAX_WALKPATH && abs(path_flows[i].y - y) <= MAX_WALKPATH)
+			path_flows[i].m = -1;
+	}
+}
+
+/// Drops the flow fields of a map, with its cells.
+void path_flow_free(struct map_data *md)
+{
+	int i;
+
+	for (i = 0; i < ARRAYLENGTH(path_flows); i++) {
+		if (path_flows[i].m == md->m)
+			path_flows[i].m = -1;
+	}
+}
+
+/// Follows the flow field toward (x1,y1) if there is one (see path_search).
+/// @return 1 if a path was found, 0 if there is none, -1 if a search has to be made
+static int path_search_flow(struct walkpath_data *wpd, struct map_data *md, int16 x0, int16 y0, int16 x1, int16 y1, cell_chk cell)
+{
+	struct path_flow *flow = path_flow_find(md->m, x1, y1, cell);
+	int i, j;
+
+	if (flow == NULL || !flow->built)
+		return -1;
+	if (abs(x0 - x1) > MAX_WALKPATH || abs(y0 - y1) > MAX_WALKPATH)
+		return 0;
+
+	i = flow_index(x0 - x1, y0 - y1);
+	if (flow->dir[i] == FLOW_NONE)
+		return (map_getcellp(md, x0, y0, cell) ? -1 : 0); // A unit can start on a cell it can't walk onto
+	if (flow->steps[i] > MAX_WALKPATH)
+		return -1; // The shortest path has too many steps, one with more diagonal steps may fit
+
+	wpd->path_len = flow->steps[i];
+	wpd->path_pos = 0;
+	for (j = 0; j < wpd->path_len; j++) {
+		wpd->path[j] = flow->dir[i];
+		i += dir_dx[flow->dir[i]] + dir_dy[flow->dir[i]] * FLOW_SIDE;
+	}
+
+	return 1;
+}
+///@}
+
 /*==========================================
  * path search (x0,y0)->(x1,y1)
  * wpd: path info will be written here
@@ -261,7 +825,10 @@ static int add_path(struct node_heap *heap, struct path_node *tp, int16 x, int16
  * flag: &2 = call path_search_long instead
  * cell: type of obstruction to check for
  *
- * Note: uses global g_open_set, therefore this method can't be called in parallel or recursivly
+ * With path_flow_field, the flow field toward (x1,y1) is followed if there is one (see path_flow_prepare).
+ * With path_search_jps, the jump point search is used instead of A* where possible.
+ * Note: only reads the map, so it can be called from several threads if the cells of the map are loaded
+ * (and its jump tables built, see path_jump_prepare)
  *------------------------------------------*/
 bool path_search(struct walkpath_data *wpd, int16 m, int16 x0, int16 y0, int16 x1, int16 y1, int flag, cell_chk cell)
 {
@@ -294,6 +861,17 @@ bool path_search(struct walkpath_data *wpd, int16 m, int16 x0, int16 y0, int16 x
 	if (x1 < 0 || x1 >= md->xs || y1 < 0 || y1 >= md->ys || map_getcellp(md,x1,y1,cell))
 		return false;
 
+	if (!(flag&1)) {
+		int found = -1;
+
+		if (battle_config.path_flow_field)
+			found = path_search_flow(wpd, md, x0, y0, x1, y1, cell);
+		if (found < 0 && battle_config.path_search_jps)
+			found = path_search_jps(wpd, md, x0, y0, x1, y1, cell);
+		if (found >= 0)
+			return (found == 1);
+	}
+
 	if (flag&1) {
 		// Try finding direct path to target
 		// Direct path goes diagonally first, then in straight line.
@@ -333,6 +911,8 @@ bool path_search(struct walkpath_data *wpd, int16 m, int16 x0, int16 y0, int16 x
 		// can be found without node collision: calc_index(node1) = calc_index(node2)
 		// Figure out more proper size or another way to keep track of known nodes
 		struct path_node tp[MAX_WALKPATH * MAX_WALKPATH];
+		struct path_node *open_data[MAX_WALKPATH * MAX_WALKPATH];
+		struct node_heap open_set;
 		struct path_node *current, *it;
 		int xs = md->xs - 1;
 		int ys = md->ys - 1;
@@ -342,7 +922,9 @@ bool path_search(struct walkpath_data *wpd, int16 m, int16 x0, int16 y0, int16 x
 		// A* (A-star) pathfinding
 		// We always use A* for finding walkpaths because it is what game client uses
 		// Easy pathfinding cuts corners of non-walkable cells, but client always walks around it
-		BHEAP_RESET(g_open_set);
+		open_set._max_ = ARRAYLENGTH(open_data);
+		open_set._len_ = 0;
+		open_set._data_ = open_data;
 
 		memset(tp, 0, sizeof(tp));
 
@@ -355,7 +937,7 @@ bool path_search(struct walkpath_data *wpd, int16 m, int16 x0, int16 y0, int16 x
 		tp[i].f_cost = heuristic(x0, y0, x1, y1);
 		tp[i].flag   = SET_OPEN;
 
-		heap_push_node(&g_open_set, &tp[i]); // Put start node to 'open' set
+		heap_push_node(&open_set, &tp[i]); // Put start node to 'open' set
 
 		for(;;) {
 			int e = 0; // error flag
@@ -370,11 +952,11 @@ bool path_search(struct walkpath_data *wpd, int16 m, int16 x0, int16 y0, int16 x
 
 			int g_cost;
 
-			if (BHEAP_LENGTH(g_open_set) == 0)
+			if (BHEAP_LENGTH(open_set) == 0)
 				return false;
 
-			current = BHEAP_PEEK(g_open_set); // Look for the lowest f_cost node in the 'open' set
-			BHEAP_POP2(g_open_set, NODE_MINTOPCMP, swap_ptr); // Remove it from 'open' set
+			current = BHEAP_PEEK(open_set); // Look for the lowest f_cost node in the 'open' set
+			BHEAP_POP2(open_set, NODE_MINTOPCMP, swap_ptr); // Remove it from 'open' set
 
 			x      = current->x;
 			y      = current->y;
@@ -393,21 +975,21 @@ bool path_search(struct walkpath_data *wpd, int16 m, int16 x0, int16 y0, int16 x
 #define chk_dir(d) ((allowed_dirs & (d)) == (d))
 			// Process neighbors of current node
 			if (chk_dir(PATH_DIR_SOUTH|PATH_DIR_EAST) && !map_getcellp(md, x+1, y-1, cell))
-				e += add_path(&g_open_set, tp, x+1, y-1, g_cost + MOVE_DIAGONAL_COST, current, heuristic(x+1, y-1, x1, y1)); // (x+1, y-1) 5
+				e += add_path(&open_set, tp, x+1, y-1, g_cost + MOVE_DIAGONAL_COST, current, heuristic(x+1, y-1, x1, y1)); // (x+1, y-1) 5
 			if (chk_dir(PATH_DIR_EAST))
-				e += add_path(&g_open_set, tp, x+1, y, g_cost + MOVE_COST, current, heuristic(x+1, y, x1, y1)); // (x+1, y) 6
+				e += add_path(&open_set, tp, x+1, y, g_cost + MOVE_COST, current, heuristic(x+1, y, x1, y1)); // (x+1, y) 6
 			if (chk_dir(PATH_DIR_NORTH|PATH_DIR_EAST) && !map_getcellp(md, x+1, y+1, cell))
-				e += add_path(&g_open_set, tp, x+1, y+1, g_cost + MOVE_DIAGONAL_COST, current, heuristic(x+1, y+1, x1, y1)); // (x+1, y+1) 7
+				e += add_path(&open_set, tp, x+1, y+1, g_cost + MOVE_DIAGONAL_COST, current, heuristic(x+1, y+1, x1, y1)); // (x+1, y+1) 7
 			if (chk_dir(PATH_DIR_NORTH))
-				e += add_path(&g_open_set, tp, x, y+1, g_cost + MOVE_COST, current, heuristic(x, y+1, x1, y1)); // (x, y+1) 0
+				e += add_path(&open_set, tp, x, y+1, g_cost + MOVE_COST, current, heuristic(x, y+1, x1, y1)); // (x, y+1) 0
 			if (chk_dir(PATH_DIR_NORTH|PATH_DIR_WEST) && !map_getcellp(md, x-1, y+1, cell))
-				e += add_path(&g_open_set, tp, x-1, y+1, g_cost + MOVE_DIAGONAL_COST, current, heuristic(x-1, y+1, x1, y1)); // (x-1, y+1) 1
+				e += add_path(&open_set, tp, x-1, y+1, g_cost + MOVE_DIAGONAL_COST, current, heuristic(x-1, y+1, x1, y1)); // (x-1, y+1) 1
 			if (chk_dir(PATH_DIR_WEST))
-				e += add_path(&g_open_set, tp, x-1, y, g_cost + MOVE_COST, current, heuristic(x-1, y, x1, y1)); // (x-1, y) 2
+				e += add_path(&open_set, tp, x-1, y, g_cost + MOVE_COST, current, heuristic(x-1, y, x1, y1)); // (x-1, y) 2
 			if (chk_dir(PATH_DIR_SOUTH|PATH_DIR_WEST) && !map_getcellp(md, x-1, y-1, cell))
-				e += add_path(&g_open_set, tp, x-1, y-1, g_cost + MOVE_DIAGONAL_COST, current, heuristic(x-1, y-1, x1, y1)); // (x-1, y-1) 3
+				e += add_path(&open_set, tp, x-1, y-1, g_cost + MOVE_DIAGONAL_COST, current, heuristic(x-1, y-1, x1, y1)); // (x-1, y-1) 3
 			if (chk_dir(PATH_DIR_SOUTH))
-				e += add_path(&g_open_set, tp, x, y-1, g_cost + MOVE_COST, current, heuristic(x, y-1, x1, y1)); // (x, y-1) 4
+				e += add_path(&open_set, tp, x, y-1, g_cost + MOVE_COST, current, heuristic(x, y-1, x1, y1)); // (x, y-1) 4
 #undef chk_dir
 			if (e)
 				return false;
@@ -433,6 +1015,128 @@ bool path_search(struct walkpath_data *wpd, int16 m, int16 x0, int16 y0, int16 x
 	return false;
 }
 
+#define PATH_BENCH_CHASERS 50 // Units chasing each target in the chase part of path_benchmark
+
+/*==========================================
+ * Compares the A* search and the jump point search on random paths,
+ * and the flow fields on chases (console command "paths")
+ * m: map to check, -1 for all the loaded maps of the server
+ *------------------------------------------*/
+void path_benchmark(int16 m)
+{
+	struct path_bench {
+		int16 x0, y0, x1, y1;
+		bool found;
+		unsigned char len;
+	} *paths;
+	struct walkpath_data wpd;
+	uint64 astar_us = 0, jps_us = 0, build_us = 0, begin;
+	uint64 chase_us[3] = { 0, 0, 0 }; // A*, jump points, flow fields
+	int chase_found[3] = { 0, 0, 0 };
+	int searches = m < 0 ? 200 : 10000; // per map
+	int jps = battle_config.path_search_jps, flow = battle_config.path_flow_field;
+	int i, j, k, n, maps = 0, total = 0, chases = 0, astar_found = 0, jps_found = 0, astar_only = 0, jps_only = 0, longer = 0;
+
+	paths = (struct path_bench *)aMalloc(searches * sizeof(struct path_bench));
+	for (i = (m < 0 ? 0 : m); i < (m < 0 ? map_num : m + 1); i++) {
+		struct map_data *md = &map[i];
+		int count = 0, tries;
+
+		if (md->cell == NULL || md->instance_id || (m < 0 && !map_hascells(i)))
+			continue; // not on this map-server, or not loaded (lazy_map_load), only a given map is loaded for the benchmark
+
+		// Free start cells with a free goal up to 20 cells away, like walk requests and chases
+		for (tries = 0; count < searches && tries < searches * 20; tries++) {
+			struct path_bench *p = &paths[count];
+
+			p->x0 = rnd()%md->xs;
+			p->y0 = rnd()%md->ys;
+			p->x1 = p->x0 + rnd()%41 - 20;
+			p->y1 = p->y0 + rnd()%41 - 20;
+			if (map_getcellp(md, p->x0, p->y0, CELL_CHKNOREACH) || p->x1 < 0 || p->x1 >= md->xs || p->y1 < 0 || p->y1 >= md->ys
+			||  map_getcellp(md, p->x1, p->y1, CELL_CHKNOREACH))
+				continue;
+			count++;
+		}
+		if (count == 0)
+			continue;
+
+		battle_config.path_flow_field = 0;
+		battle_config.path_search_jps = 1;
+		path_jump_free(md);
+		begin = gettick_us();
+		path_jump_prepare(i, CELL_CHKNOREACH);
+		build_us += gettick_us() - begin;
+
+		battle_config.path_search_jps = 0;
+		begin = gettick_us();
+		for (k = 0; k < count; k++) {
+			paths[k].found = path_search(&wpd, i, paths[k].x0, paths[k].y0, paths[k].x1, paths[k].y1, 0, CELL_CHKNOREACH);
+			paths[k].len = (paths[k].found ? wpd.path_len : 0);
+		}
+		astar_us += gettick_us() - begin;
+
+		battle_config.path_search_jps = 1;
+		begin = gettick_us();
+		for (k = 0; k < count; k++) {
+			bool found = path_search(&wpd, i, paths[k].x0, paths[k].y0, paths[k].x1, paths[k].y1, 0, CELL_CHKNOREACH);
+
+			astar_found += paths[k].found;
+			jps_found += found;
+			if (paths[k].found && !found)
+				astar_only++;
+			else if (found && !paths[k].found)
+				jps_only++;
+			else if (found && wpd.path_len > paths[k].len)
+				longer++;
+		}
+		jps_us += gettick_us() - begin;
+
+		// Chases: PATH_BENCH_CHASERS units up to 14 cells around each goal of the first part
+		for (k = 0, tries = 0; k < count && tries < searches * 20; tries++) {
+			struct path_bench *p = &paths[k];
+
+			if (k%PATH_BENCH_CHASERS) {
+				p->x1 = paths[k - 1].x1;
+				p->y1 = paths[k - 1].y1;
+			}
+			p->x0 = p->x1 + rnd()%29 - 14;
+			p->y0 = p->y1 + rnd()%29 - 14;
+			if (p->x0 < 0 || p->x0 >= md->xs || p->y0 < 0 || p->y0 >= md->ys || map_getcellp(md, p->x0, p->y0, CELL_CHKNOREACH))
+				continue;
+			k++;
+		}
+		for (n = 0; n < 3; n++) {
+			battle_config.path_search_jps = (n > 0);
+			battle_config.path_flow_field = (n == 2);
+			path_flow_free(md);
+			begin = gettick_us();
+			for (j = 0; j < k; j++) {
+				if (n == 2)
+					path_flow_prepare(i, paths[j].x1, paths[j].y1, CELL_CHKNOREACH);
+				chase_found[n] += path_search(&wpd, i, paths[j].x0, paths[j].y0, paths[j].x1, paths[j].y1, 0, CELL_CHKNOREACH);
+			}
+			chase_us[n] += gettick_us() - begin;
+		}
+		path_flow_free(md);
+
+		maps++;
+		total += count;
+		chases += k;
+	}
+	battle_config.path_search_jps = jps;
+	battle_config.path_flow_field = flow;
+	aFree(paths);
+
+	ShowInfo("Path search on %d map(s), %d searches (CELL_CHKNOREACH):\n", maps, total);
+	ShowInfo("  A*: %d found (%d not by the jump point search), %.2f us per search\n", astar_found, astar_only, total ? (double)astar_us / total : 0.);
+	ShowInfo("  jump points: %d found (%d not by A*), %.2f us per search, %d paths with more steps, tables built in %.2f ms\n",
+		jps_found, jps_only, total ? (double)jps_us / total : 0., longer, build_us / 1000.);
+	ShowInfo("Chases, %d units per goal, %d searches: %d/%d/%d found, A* %.2f us, jump points %.2f us, flow fields %.2f us per search\n",
+		PATH_BENCH_CHASERS, chases, chase_found[0], chase_found[1], chase_found[2],
+		chases ? (double)chase_us[0] / chases : 0., chases ? (double)chase_us[1] / chases : 0., chases ? (double)chase_us[2] / chases : 0.);
+}
+
 // Distance functions, taken from http://www.flipcode.com/articles/article_fastdistance.shtml
 bool check_distance(int dx, int dy, int distance)
 {
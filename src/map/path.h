@@ -60,6 +60,19 @@ bool path_search(struct walkpath_data *wpd,int16 m,int16 x0,int16 y0,int16 x1,in
 // tries to find a shootable path
 bool path_search_long(struct shootpath_data *spd,int16 m,int16 x0,int16 y0,int16 x1,int16 y1,cell_chk cell);
 
+// jump tables of the jump point search (path_search_jps)
+void path_jump_prepare(int16 m, cell_chk cell);
+void path_jump_update(struct map_data *md, int16 x, int16 y);
+void path_jump_free(struct map_data *md);
+
+// flow fields shared by the searches toward the same cell
+void path_flow_prepare(int16 m, int16 x, int16 y, cell_chk cell);
+void path_flow_update(struct map_data *md, int16 x, int16 y);
+void path_flow_free(struct map_data *md);
+
+// compares the path searches on the maps (console command)
+void path_benchmark(int16 m);
+
 // distance related functions
 bool check_distance(int dx, int dy, int distance);
 unsigned int distance(int dx, int dy);
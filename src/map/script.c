@@ -18512,6 +18512,9 @@ BUILDIN_FUNC(setcell)
 	if( x1 > x2 ) swap(x1,x2);
 	if( y1 > y2 ) swap(y1,y2);
 
+	if( m >= 0 )
+		map[m].cells_pinned = true; // Keep the changes loaded
+
 	for( y = y1; y <= y2; ++y )
 		for( x = x1; x <= x2; ++x )
 			map_setcell(m,x,y,type,flag);
@@ -3464,7 +3464,20 @@ int skill_attack(int attack_type, struct block_list *src, struct block_list *dsr
  * Checking bl battle flag and display damage
  * then call func with source,target,skill_id,skill_lv,tick,flag
  *------------------------------------------*/
-typedef int (*SkillFunc)(struct block_list *, struct block_list *, int, int, unsigned int, int);
+typedef int (*SkillFunc)(struct block_list *, struct block_list *, uint16, uint16, unsigned int, int);
+static int skill_area_target(struct block_list *bl, struct block_list *src, uint16 skill_id, uint16 skill_lv, unsigned int tick, int flag, SkillFunc func)
+{
+	//Several splash skills need this initial dummy packet to display correctly
+	if (battle_check_target(src,bl,flag) > 0) {
+		if ((flag&SD_PREAMBLE) && !skill_area_temp[2])
+			clif_skill_damage(src,bl,tick,status_get_amotion(src),0,-30000,1,skill_id,skill_lv,DMG_SKILL);
+		if (flag&(SD_SPLASH|SD_PREAMBLE))
+			skill_area_temp[2]++;
+		return func(src,bl,skill_id,skill_lv,tick,flag);
+	}
+	return 0;
+}
+
 int skill_area_sub(struct block_list *bl, va_list ap)
 {
 	struct block_list *src;
@@ -3482,15 +3495,40 @@ int skill_area_sub(struct block_list *bl, va_list ap)
 	flag = va_arg(ap,int);
 	func = va_arg(ap,SkillFunc);
 
-	//Several splash skills need this initial dummy packet to display correctly
-	if (battle_check_target(src,bl,flag) > 0) {
-		if ((flag&SD_PREAMBLE) && !skill_area_temp[2])
-			clif_skill_damage(src,bl,tick,status_get_amotion(src),0,-30000,1,skill_id,skill_lv,DMG_SKILL);
-		if (flag&(SD_SPLASH|SD_PREAMBLE))
-			skill_area_temp[2]++;
-		return func(src,bl,skill_id,skill_lv,tick,flag);
-	}
-	return 0;
+	return skill_area_target(bl,src,skill_id,skill_lv,tick,flag,func);
+}
+
+/// Calls skill_area_target for each block of the query and releases it.
+static int skill_area_query(struct map_query *q, struct block_list *src, uint16 skill_id, uint16 skill_lv, unsigned int tick, int flag, SkillFunc func)
+{
+	struct block_list *bl;
+	int count = 0;
+
+	while ((bl = map_query_next(q)))
+		count += skill_area_target(bl,src,skill_id,skill_lv,tick,flag,func);
+	map_query_end(q);
+	return count;
+}
+
+/*==========================================
+ * Typed equivalents of map_foreachin*range/area(skill_area_sub,...)
+ * mode: MQ_ALL (foreachinall*), MQ_SHOOT (foreachinshoot*) or MQ_SKILL (foreachin*)
+ * Returns the sum of the values returned by func
+ *------------------------------------------*/
+static int skill_area_range(enum map_query_mode mode, struct block_list *center, int16 range, int type, struct block_list *src, uint16 skill_id, uint16 skill_lv, unsigned int tick, int flag, SkillFunc func)
+{
+	struct map_query q;
+
+	map_query_range(&q,center,range,type,mode);
+	return skill_area_query(&q,src,skill_id,skill_lv,tick,flag,func);
+}
+
+static int skill_area_area(enum map_query_mode mode, int16 m, int16 x0, int16 y0, int16 x1, int16 y1, int type, struct block_list *src, uint16 skill_id, uint16 skill_lv, unsigned int tick, int flag, SkillFunc func)
+{
+	struct map_query q;
+
+	map_query_area(&q,m,x0,y0,x1,y1,type,mode);
+	return skill_area_query(&q,src,skill_id,skill_lv,tick,flag,func);
 }
 
 static int skill_check_unit_range_sub(struct block_list *bl, va_list ap)
@@ -3919,7 +3957,7 @@ static int skill_timerskill(int tid, unsigned int tick, int id, intptr_t data)
 				if (skl->skill_id == SR_SKYNETBLOW) {
 					clif_skill_damage(src,src,tick,status_get_amotion(src),0,-30000,1,skl->skill_id,skl->skill_lv,DMG_SKILL);
 					skill_area_temp[1] = 0;
-					map_foreachinallrange(skill_area_sub,src,skill_get_splash(skl->skill_id,skl->skill_lv),BL_CHAR|BL_SKILL,src,
+					skill_area_range(MQ_ALL,src,skill_get_splash(skl->skill_id,skl->skill_lv),BL_CHAR|BL_SKILL,src,
 						skl->skill_id,skl->skill_lv,tick,skl->flag|BCT_ENEMY|SD_SPLASH|1,skill_castend_damage_id);
 				}
 				break; //Target offline, not on map, or in different maps
@@ -4635,7 +4673,7 @@ int skill_castend_damage_id(struct block_list *src, struct block_list *bl, uint1
 
 		case MO_COMBOFINISH: //Becomes a splash attack when Soul Linked
 			if (!(flag&1) && sc && sc->data[SC_SPIRIT] && sc->data[SC_SPIRIT]->val2 == SL_MONK) {
-				map_foreachinshootrange(skill_area_sub,bl,skill_get_splash(skill_id,skill_lv),BL_CHAR|BL_SKILL,src,
+				skill_area_range(MQ_SHOOT,bl,skill_get_splash(skill_id,skill_lv),BL_CHAR|BL_SKILL,src,
 					skill_id,skill_lv,tick,flag|BCT_ENEMY|1,skill_castend_damage_id);
 			} else
 				skill_attack(BF_WEAPON,src,src,bl,skill_id,skill_lv,tick,flag);
@@ -4996,9 +5034,9 @@ int skill_castend_damage_id(struct block_list *src, struct block_list *bl, uint1
 				//SD_LEVEL -> Forced splash damage for Auto Blitz-Beat -> count targets
 				//Special case: Venom Splasher uses a different range for searching than for splashing
 				if ((flag&SD_LEVEL) || (skill_get_nk(skill_id)&NK_SPLASHSPLIT))
-					skill_area_temp[0] = map_foreachinallrange(skill_area_sub,bl,(skill_id == AS_SPLASHER || skill_id == GN_SPORE_EXPLOSION ? 1 : skill_get_splash(skill_id,skill_lv)),BL_CHAR,src,skill_id,skill_lv,tick,BCT_ENEMY,skill_area_sub_count);
+					skill_area_temp[0] = skill_area_range(MQ_ALL,bl,(skill_id == AS_SPLASHER || skill_id == GN_SPORE_EXPLOSION ? 1 : skill_get_splash(skill_id,skill_lv)),BL_CHAR,src,skill_id,skill_lv,tick,BCT_ENEMY,skill_area_sub_count);
 				//Recursive invocation of skill_castend_damage_id() with flag|1
-				map_foreachinrange(skill_area_sub,bl,skill_get_splash(skill_id,skill_lv),starget,src,skill_id,skill_lv,tick,flag|BCT_ENEMY|SD_SPLASH|1,skill_castend_damage_id);
+				skill_area_range(MQ_SKILL,bl,skill_get_splash(skill_id,skill_lv),starget,src,skill_id,skill_lv,tick,flag|BCT_ENEMY|SD_SPLASH|1,skill_castend_damage_id);
 				if (skill_id == RA_ARROWSTORM)
 					status_change_end(src,SC_CAMOUFLAGE,INVALID_TIMER);
 				if (skill_id == AS_SPLASHER) {
@@ -5078,10 +5116,10 @@ int skill_castend_damage_id(struct block_list *src, struct block_list *bl, uint1
 					//Splash around target cell, but only cells inside area; we first have to check the area is not negative
 					if ((max(min_x,tx - 1) <= min(max_x,tx + 1)) &&
 						(max(min_y,ty - 1) <= min(max_y,ty + 1)) &&
-						(map_foreachinallarea(skill_area_sub,bl->m,max(min_x,tx - 1),max(min_y,ty - 1),min(max_x,tx + 1),
+						(skill_area_area(MQ_ALL,bl->m,max(min_x,tx - 1),max(min_y,ty - 1),min(max_x,tx + 1),
 							min(max_y,ty + 1),splash_target(src),src,skill_id,skill_lv,tick,flag|BCT_ENEMY,skill_area_sub_count))) {
 						//Recursive call
-						map_foreachinallarea(skill_area_sub,bl->m,max(min_x,tx - 1),max(min_y,ty - 1),min(max_x,tx + 1),
+						skill_area_area(MQ_ALL,bl->m,max(min_x,tx - 1),max(min_y,ty - 1),min(max_x,tx + 1),
 							min(max_y,ty + 1),splash_target(src),src,skill_id,skill_lv,tick,(flag|BCT_ENEMY) + 1,skill_castend_damage_id);
 						//Self-collision
 						if (bl->x >= min_x && bl->x <= max_x && bl->y >= min_y && bl->y <= max_y)
@@ -5121,7 +5159,7 @@ int skill_castend_damage_id(struct block_list *src, struct block_list *bl, uint1
 		case MO_BALKYOUNG: //Active part of the attack (Skill-attack) [Skotlex]
 			skill_area_temp[1] = bl->id; //NOTE: This is used in skill_castend_nodamage_id to avoid affecting the target
 			if (skill_attack(BF_WEAPON,src,src,bl,skill_id,skill_lv,tick,flag))
-				map_foreachinallrange(skill_area_sub,bl,skill_get_splash(skill_id,skill_lv),BL_CHAR,src,skill_id,skill_lv,tick,flag|BCT_ENEMY|1,skill_castend_nodamage_id);
+				skill_area_range(MQ_ALL,bl,skill_get_splash(skill_id,skill_lv),BL_CHAR,src,skill_id,skill_lv,tick,flag|BCT_ENEMY|1,skill_castend_nodamage_id);
 			break;
 		case CH_PALMSTRIKE: //Palm Strike takes effect 1 sec after casting [Skotlex]
 			//clif_skill_nodamage(src,bl,skill_id,skill_lv,0); //Can't make this one display the correct attack animation delay
@@ -5567,7 +5605,7 @@ int skill_castend_damage_id(struct block_list *src, struct block_list *bl, uint1
 					skill_attack(BF_WEAPON,src,src,bl,skill_id,skill_lv,tick,flag|SD_ANIMATION|16);
 				else if (flag&4) { //Triggered by RL_FLICKER
 					flag = 0; //Reset flag
-					map_foreachinallrange(skill_area_sub,bl,skill_get_splash(skill_id,skill_lv),BL_CHAR|BL_SKILL,src,
+					skill_area_range(MQ_ALL,bl,skill_get_splash(skill_id,skill_lv),BL_CHAR|BL_SKILL,src,
 						skill_id,skill_lv,tick,flag|BCT_ENEMY|SD_SPLASH|1,skill_castend_damage_id);
 					if (tsc && tsc->data[SC_H_MINE] && tsc->data[SC_H_MINE]->val2 == src->id) {
 						tsc->data[SC_H_MINE]->val3 = 1; //Mark the SC end because not expired
@@ -5624,7 +5662,7 @@ int skill_castend_damage_id(struct block_list *src, struct block_list *bl, uint1
 			else {
 				clif_skill_damage(src,bl,tick,status_get_amotion(src),0,-30000,1,skill_id,skill_lv,DMG_SKILL);
 				if (rnd()%100 < 30)
-					map_foreachinallrange(skill_area_sub,bl,skill_get_splash(skill_id,skill_lv),BL_CHAR,src,skill_id,skill_lv,tick,flag|BCT_ENEMY|SD_SPLASH|1,skill_castend_damage_id);
+					skill_area_range(MQ_ALL,bl,skill_get_splash(skill_id,skill_lv),BL_CHAR,src,skill_id,skill_lv,tick,flag|BCT_ENEMY|SD_SPLASH|1,skill_castend_damage_id);
 				else
 					skill_attack(skill_get_type(skill_id),src,src,bl,skill_id,skill_lv,tick,flag);
 			}
@@ -5698,7 +5736,7 @@ int skill_castend_damage_id(struct block_list *src, struct block_list *bl, uint1
 						skill_attack(BF_WEAPON,src,src,bl,skill_id,skill_lv,tick,flag|SD_LEVEL|16);
 				} else {
 					skill_area_temp[1] = bl->id;
-					map_foreachinallrange(skill_area_sub,bl,sd->bonus.splash_range,BL_CHAR,src,skill_id,skill_lv,
+					skill_area_range(MQ_ALL,bl,sd->bonus.splash_range,BL_CHAR,src,skill_id,skill_lv,
 						tick,flag|BCT_ENEMY|1,skill_castend_damage_id);
 					flag |= 1; //Set flag to 1 so ammo is not double-consumed [Skotlex]
 				}
@@ -6024,7 +6062,7 @@ int skill_castend_nodamage_id(struct block_list *src, struct block_list *bl, uin
 				sc_start(src,bl,type,23 + skill_lv * 4 + status_get_lv(src) - status_get_lv(bl),skill_lv,skill_get_time(skill_id,skill_lv));
 			else {
 				clif_skill_nodamage(src,bl,skill_id,skill_lv,1);
-				map_foreachinallrange(skill_area_sub,src,skill_get_splash(skill_id,skill_lv),BL_CHAR,src,
+				skill_area_range(MQ_ALL,src,skill_get_splash(skill_id,skill_lv),BL_CHAR,src,
 					skill_id,skill_lv,tick,flag|BCT_ENEMY|1,skill_castend_nodamage_id);
 			}
 			break;
@@ -6312,7 +6350,7 @@ int skill_castend_nodamage_id(struct block_list *src, struct block_list *bl, uin
 		case MS_MAGNUM:
 			clif_skill_nodamage(src,src,skill_id,skill_lv,1);
 			skill_area_temp[1] = 0;
-			map_foreachinshootrange(skill_area_sub,src,skill_get_splash(skill_id,skill_lv),BL_SKILL|BL_CHAR,src,
+			skill_area_range(MQ_SHOOT,src,skill_get_splash(skill_id,skill_lv),BL_SKILL|BL_CHAR,src,
 				skill_id,skill_lv,tick,flag|BCT_ENEMY|1,skill_castend_damage_id);
 			//Initiate 20% of your damage becomes fire element
 			sc_start2(src,src,SC_WATK_ELEMENT,100,ELE_FIRE,20,skill_get_time2(skill_id,skill_lv));
@@ -6531,7 +6569,7 @@ int skill_castend_nodamage_id(struct block_list *src, struct block_list *bl, uin
 				sc_start(src,bl,type,100,skill_lv,skill_get_time(skill_id,skill_lv));
 			else {
 				clif_skill_nodamage(src,bl,skill_id,skill_lv,1);
-				map_foreachinallrange(skill_area_sub,bl,skill_get_splash(skill_id,skill_lv),BL_PC,src,
+				skill_area_range(MQ_ALL,bl,skill_get_splash(skill_id,skill_lv),BL_PC,src,
 					skill_id,skill_lv,tick,flag|BCT_ALL|1,skill_castend_nodamage_id);
 			}
 			break;
@@ -6766,7 +6804,7 @@ int skill_castend_nodamage_id(struct block_list *src, struct block_list *bl, uin
 			status_change_end(src,SC_HIDING,INVALID_TIMER);
 			clif_skill_nodamage(src,bl,skill_id,skill_lv,1);
 			skill_area_temp[1] = 0;
-			map_foreachinallrange(skill_area_sub,bl,skill_get_splash(skill_id,skill_lv),BL_CHAR|BL_SKILL,src,
+			skill_area_range(MQ_ALL,bl,skill_get_splash(skill_id,skill_lv),BL_CHAR|BL_SKILL,src,
 				skill_id,skill_lv,tick,flag|BCT_ENEMY|1,skill_castend_damage_id);
 			break;
 
@@ -6791,7 +6829,7 @@ int skill_castend_nodamage_id(struct block_list *src, struct block_list *bl, uin
 					starget = splash_target(src);
 				clif_skill_nodamage(src,bl,skill_id,skill_lv,1);
 				skill_area_temp[1] = 0;
-				map_foreachinrange(skill_area_sub,bl,skill_get_splash(skill_id,skill_lv),starget,src,
+				skill_area_range(MQ_SKILL,bl,skill_get_splash(skill_id,skill_lv),starget,src,
 					skill_id,skill_lv,tick,flag|BCT_ENEMY|SD_SPLASH|1,skill_castend_damage_id);
 			}
 			break;
@@ -6804,7 +6842,7 @@ int skill_castend_nodamage_id(struct block_list *src, struct block_list *bl, uin
 		case SR_EARTHSHAKER:
 			clif_skill_damage(src,bl,tick,status_get_amotion(src),0,-30000,1,skill_id,skill_lv,DMG_SKILL);
 			skill_area_temp[1] = 0;
-			map_foreachinrange(skill_area_sub,bl,skill_get_splash(skill_id,skill_lv),BL_CHAR|BL_SKILL,src,
+			skill_area_range(MQ_SKILL,bl,skill_get_splash(skill_id,skill_lv),BL_CHAR|BL_SKILL,src,
 				skill_id,skill_lv,tick,flag|BCT_ENEMY|SD_SPLASH|1,skill_castend_damage_id);
 			break;
 
@@ -6830,7 +6868,7 @@ int skill_castend_nodamage_id(struct block_list *src, struct block_list *bl, uin
 			//Passive side of the attack
 			status_change_end(src,SC_SIGHT,INVALID_TIMER);
 			clif_skill_nodamage(src,bl,skill_id,skill_lv,1);
-			map_foreachinshootrange(skill_area_sub,src,skill_get_splash(skill_id,skill_lv),BL_CHAR|BL_SKILL,src,
+			skill_area_range(MQ_SHOOT,src,skill_get_splash(skill_id,skill_lv),BL_CHAR|BL_SKILL,src,
 				skill_id,skill_lv,tick,flag|BCT_ENEMY|SD_ANIMATION|1,skill_castend_damage_id);
 			break;
 
@@ -6848,7 +6886,7 @@ int skill_castend_nodamage_id(struct block_list *src, struct block_list *bl, uin
 			i = ((!md || md->special_state.ai == AI_SPHERE) && !map_flag_vs(src->m) ? BCT_ENEMY : BCT_ALL);
 			clif_skill_nodamage(src,src,skill_id,-1,1);
 			map_delblock(src); //Required to prevent chain-self-destructions hitting back
-			map_foreachinshootrange(skill_area_sub,bl,skill_get_splash(skill_id,skill_lv),BL_CHAR|BL_SKILL,src,
+			skill_area_range(MQ_SHOOT,bl,skill_get_splash(skill_id,skill_lv),BL_CHAR|BL_SKILL,src,
 				skill_id,skill_lv,tick,flag|i|SD_ANIMATION|SD_SPLASH,skill_castend_damage_id);
 			if (map_addblock(src))
 				return 1;
@@ -7612,7 +7650,7 @@ int skill_castend_nodamage_id(struct block_list *src, struct block_list *bl, uin
 					}
 					break;
 				} //Affect all targets on splash area
-				map_foreachinallrange(skill_area_sub,bl,splash,BL_CHAR,src,skill_id,skill_lv,tick,flag|1,skill_castend_damage_id);
+				skill_area_range(MQ_ALL,bl,splash,BL_CHAR,src,skill_id,skill_lv,tick,flag|1,skill_castend_damage_id);
 			}
 			break;
 
@@ -8050,7 +8088,7 @@ int skill_castend_nodamage_id(struct block_list *src, struct block_list *bl, uin
 					if (dstsd == f_sd || dstsd == m_sd)
 						clif_skill_nodamage(src,bl,skill_id,skill_lv,sc_start(src,bl,type,100,skill_lv,skill_get_time(skill_id,skill_lv)));
 				} else
-					map_foreachinrange(skill_area_sub,bl,skill_get_splash(skill_id,skill_lv),BL_PC,src,skill_id,skill_lv,tick,flag|BCT_ALL|1,skill_castend_nodamage_id);
+					skill_area_range(MQ_SKILL,bl,skill_get_splash(skill_id,skill_lv),BL_PC,src,skill_id,skill_lv,tick,flag|BCT_ALL|1,skill_castend_nodamage_id);
 			}
 			break;
 
@@ -8405,7 +8443,7 @@ int skill_castend_nodamage_id(struct block_list *src, struct block_list *bl, uin
 					sc_start(src,bl,type,100,skill_lv,skill_get_time(skill_id,skill_lv));
 			} else if (status_get_guild_id(src)) {
 				clif_skill_nodamage(src,bl,skill_id,skill_lv,1);
-				map_foreachinallrange(skill_area_sub,src,skill_get_splash(skill_id,skill_lv),BL_PC,src,
+				skill_area_range(MQ_ALL,src,skill_get_splash(skill_id,skill_lv),BL_PC,src,
 					skill_id,skill_lv,tick,flag|BCT_GUILD|1,skill_castend_nodamage_id);
 				if (sd)
 					guild_block_skill(sd,skill_get_time2(skill_id,skill_lv));
@@ -8417,7 +8455,7 @@ int skill_castend_nodamage_id(struct block_list *src, struct block_list *bl, uin
 					sc_start(src,bl,type,100,skill_lv,skill_get_time(skill_id,skill_lv));
 			} else if (status_get_guild_id(src)) {
 				clif_skill_nodamage(src,bl,skill_id,skill_lv,1);
-				map_foreachinallrange(skill_area_sub,src,skill_get_splash(skill_id,skill_lv),BL_PC,src,
+				skill_area_range(MQ_ALL,src,skill_get_splash(skill_id,skill_lv),BL_PC,src,
 					skill_id,skill_lv,tick,flag|BCT_GUILD|1,skill_castend_nodamage_id);
 				if (sd)
 					guild_block_skill(sd,skill_get_time2(skill_id,skill_lv));
@@ -8429,7 +8467,7 @@ int skill_castend_nodamage_id(struct block_list *src, struct block_list *bl, uin
 					clif_skill_nodamage(src,bl,AL_HEAL,status_percent_heal(bl,90,90),1);
 			} else if (status_get_guild_id(src)) {
 				clif_skill_nodamage(src,bl,skill_id,skill_lv,1);
-				map_foreachinallrange(skill_area_sub,src,skill_get_splash(skill_id,skill_lv),BL_PC,src,
+				skill_area_range(MQ_ALL,src,skill_get_splash(skill_id,skill_lv),BL_PC,src,
 					skill_id,skill_lv,tick,flag|BCT_GUILD|1,skill_castend_nodamage_id);
 				if (sd)
 					guild_block_skill(sd,skill_get_time2(skill_id,skill_lv));
@@ -8611,7 +8649,7 @@ int skill_castend_nodamage_id(struct block_list *src, struct block_list *bl, uin
 			} else {
 				skill_area_temp[2] = 0; //For SD_PREAMBLE
 				clif_skill_nodamage(src,bl,skill_id,skill_lv,1);
-				map_foreachinallrange(skill_area_sub,bl,skill_get_splash(skill_id,skill_lv),BL_CHAR,src,
+				skill_area_range(MQ_ALL,bl,skill_get_splash(skill_id,skill_lv),BL_CHAR,src,
 					skill_id,skill_lv,tick,flag|BCT_ENEMY|SD_PREAMBLE|1,skill_castend_nodamage_id);
 			}
 			break;
@@ -8622,7 +8660,7 @@ int skill_castend_nodamage_id(struct block_list *src, struct block_list *bl, uin
 			else {
 				skill_area_temp[2] = 0; //For SD_PREAMBLE
 				clif_skill_nodamage(src,bl,skill_id,skill_lv,1);
-				map_foreachinallrange(skill_area_sub,bl,skill_get_splash(skill_id,skill_lv),BL_CHAR,src,
+				skill_area_range(MQ_ALL,bl,skill_get_splash(skill_id,skill_lv),BL_CHAR,src,
 					skill_id,skill_lv,tick,flag|BCT_ENEMY|SD_PREAMBLE|1,skill_castend_nodamage_id);
 			}
 			break;
@@ -8632,7 +8670,7 @@ int skill_castend_nodamage_id(struct block_list *src, struct block_list *bl, uin
 				sc_start(src,bl,type,100,skill_lv,skill_get_time(skill_id,skill_lv));
 			else {
 				clif_skill_nodamage(src,bl,skill_id,skill_lv,1);
-				map_foreachinallrange(skill_area_sub,bl,skill_get_splash(skill_id,skill_lv),BL_CHAR,src,
+				skill_area_range(MQ_ALL,bl,skill_get_splash(skill_id,skill_lv),BL_CHAR,src,
 					skill_id,skill_lv,tick,flag|BCT_ENEMY|1,skill_castend_nodamage_id);
 			}
 			break;
@@ -8643,7 +8681,7 @@ int skill_castend_nodamage_id(struct block_list *src, struct block_list *bl, uin
 				if( skill_lv > 1 )
 					sflag |= 4;
 				clif_skill_nodamage(src,bl,skill_id,skill_lv,1);
-				map_foreachinshootrange(skill_area_sub,src,skill_get_splash(skill_id,skill_lv),splash_target(src),src,
+				skill_area_range(MQ_SHOOT,src,skill_get_splash(skill_id,skill_lv),splash_target(src),src,
 					skill_id,skill_lv,tick,sflag|BCT_ENEMY|SD_ANIMATION|1,skill_castend_damage_id);
 			}
 			break;
@@ -8682,7 +8720,7 @@ int skill_castend_nodamage_id(struct block_list *src, struct block_list *bl, uin
 				sc_start(src,bl,type,50 + 6 * skill_lv,skill_lv,skill_get_time(skill_id,skill_lv));
 			else {
 				clif_skill_nodamage(src,bl,skill_id,skill_lv,1);
-				map_foreachinallrange(skill_area_sub,src,skill_get_splash(skill_id,skill_lv),BL_CHAR,src,
+				skill_area_range(MQ_ALL,src,skill_get_splash(skill_id,skill_lv),BL_CHAR,src,
 					skill_id,skill_lv,tick,flag|BCT_ENEMY|1,skill_castend_nodamage_id);
 			}
 			break;
@@ -8790,7 +8828,7 @@ int skill_castend_nodamage_id(struct block_list *src, struct block_list *bl, uin
 				sc_start(src,bl,SC_ROLLINGCUTTER,100,count,skill_get_time(skill_id,skill_lv));
 				clif_skill_nodamage(src,src,skill_id,skill_lv,1);
 				skill_area_temp[2] = 0;
-				map_foreachinallrange(skill_area_sub,src,skill_get_splash(skill_id,skill_lv),BL_CHAR,src,skill_id,skill_lv,tick,flag|BCT_ENEMY|SD_SPLASH|SD_PREAMBLE|1,skill_castend_damage_id);
+				skill_area_range(MQ_ALL,src,skill_get_splash(skill_id,skill_lv),BL_CHAR,src,skill_id,skill_lv,tick,flag|BCT_ENEMY|SD_SPLASH|SD_PREAMBLE|1,skill_castend_damage_id);
 			}
 			break;
 
@@ -8879,7 +8917,7 @@ int skill_castend_nodamage_id(struct block_list *src, struct block_list *bl, uin
 				sc_start(src,bl,type,40 + 5 * skill_lv,skill_lv,skill_get_time(skill_id,skill_lv));
 			else {
 				clif_skill_nodamage(src,bl,skill_id,skill_lv,1);
-				map_foreachinallrange(skill_area_sub,src,skill_get_splash(skill_id,skill_lv),BL_CHAR,src,skill_id,skill_lv,tick,flag|BCT_ENEMY|1,skill_castend_nodamage_id);
+				skill_area_range(MQ_ALL,src,skill_get_splash(skill_id,skill_lv),BL_CHAR,src,skill_id,skill_lv,tick,flag|BCT_ENEMY|1,skill_castend_nodamage_id);
 			}
 			break;
 
@@ -8978,7 +9016,7 @@ int skill_castend_nodamage_id(struct block_list *src, struct block_list *bl, uin
 
 		case AB_SILENTIUM:
 			clif_skill_nodamage(src,bl,skill_id,skill_lv,1);
-			map_foreachinallrange(skill_area_sub,src,skill_get_splash(skill_id,skill_lv),BL_CHAR,src,
+			skill_area_range(MQ_ALL,src,skill_get_splash(skill_id,skill_lv),BL_CHAR,src,
 				PR_LEXDIVINA,skill_lv,tick,flag|BCT_ENEMY|1,skill_castend_nodamage_id);
 			break;
 
@@ -9039,7 +9077,7 @@ int skill_castend_nodamage_id(struct block_list *src, struct block_list *bl, uin
 					if( rate ) {
 						clif_skill_nodamage(src,bl,skill_id,skill_lv,1);
 						skill_area_temp[1] = bl->id;
-						map_foreachinallrange(skill_area_sub,bl,skill_get_splash(skill_id,skill_lv),BL_CHAR,src,skill_id,skill_lv,tick,flag|BCT_ENEMY|1,skill_castend_nodamage_id);
+						skill_area_range(MQ_ALL,bl,skill_get_splash(skill_id,skill_lv),BL_CHAR,src,skill_id,skill_lv,tick,flag|BCT_ENEMY|1,skill_castend_nodamage_id);
 					}
 				} else if( sd ) { //Failure on rate
 					clif_skill_fail(sd,skill_id,USESKILL_FAIL_LEVEL,0,0);
@@ -9053,7 +9091,7 @@ int skill_castend_nodamage_id(struct block_list *src, struct block_list *bl, uin
 				sc_start(src,bl,type,100,skill_lv,skill_get_time(skill_id,skill_lv));
 			else {
 				clif_skill_nodamage(src,bl,skill_id,skill_lv,1);
-				map_foreachinrange(skill_area_sub,src,skill_get_splash(skill_id,skill_lv),BL_CHAR,src,
+				skill_area_range(MQ_SKILL,src,skill_get_splash(skill_id,skill_lv),BL_CHAR,src,
 					skill_id,skill_lv,tick,(map_flag_vs(src->m) ? BCT_ALL : BCT_ENEMY|BCT_SELF)|flag|1,skill_castend_nodamage_id);
 			}
 			break;
@@ -9132,7 +9170,7 @@ int skill_castend_nodamage_id(struct block_list *src, struct block_list *bl, uin
 		case RA_SENSITIVEKEEN:
 			clif_skill_nodamage(src,bl,skill_id,skill_lv,1);
 			clif_skill_damage(src,src,tick,status_get_amotion(src),0,-30000,1,skill_id,skill_lv,DMG_SKILL);
-			map_foreachinallrange(skill_area_sub,src,skill_get_splash(skill_id,skill_lv),BL_CHAR|BL_SKILL,src,
+			skill_area_range(MQ_ALL,src,skill_get_splash(skill_id,skill_lv),BL_CHAR|BL_SKILL,src,
 				skill_id,skill_lv,tick,flag|BCT_ENEMY,skill_castend_damage_id);
 			break;
 
@@ -9152,7 +9190,7 @@ int skill_castend_nodamage_id(struct block_list *src, struct block_list *bl, uin
 					pc_setmadogear(sd,0);
 				clif_skill_nodamage(src,bl,skill_id,skill_lv,1);
 				skill_area_temp[1] = 0;
-				map_foreachinallrange(skill_area_sub,bl,skill_get_splash(skill_id,skill_lv),BL_CHAR|BL_SKILL,src,
+				skill_area_range(MQ_ALL,bl,skill_get_splash(skill_id,skill_lv),BL_CHAR|BL_SKILL,src,
 					skill_id,skill_lv,tick,flag|BCT_ENEMY|SD_SPLASH|1,skill_castend_damage_id);
 				status_set_sp(src,0,0);
 				skill_clear_unitgroup(src);
@@ -9187,7 +9225,7 @@ int skill_castend_nodamage_id(struct block_list *src, struct block_list *bl, uin
 				sc_start(src,bl,SC_INFRAREDSCAN,100,skill_lv,skill_get_time(skill_id,skill_lv));
 			} else {
 				clif_skill_damage(src,bl,tick,status_get_amotion(src),0,-30000,1,skill_id,skill_lv,DMG_SKILL);
-				map_foreachinallrange(skill_area_sub,bl,skill_get_splash(skill_id,skill_lv),splash_target(src),src,
+				skill_area_range(MQ_ALL,bl,skill_get_splash(skill_id,skill_lv),splash_target(src),src,
 					skill_id,skill_lv,tick,flag|BCT_ENEMY|SD_SPLASH|1,skill_castend_nodamage_id);
 			}
 			break;
@@ -9204,7 +9242,7 @@ int skill_castend_nodamage_id(struct block_list *src, struct block_list *bl, uin
 				clif_skill_damage(src,bl,tick,status_get_amotion(src),0,-30000,1,skill_id,skill_lv,DMG_SKILL);
 				if( map_flag_vs(src->m) ) //Doesn't affect the caster in non-PVP maps [exneval]
 					sc_start2(src,bl,type,100,skill_lv,src->id,skill_get_time(skill_id,skill_lv));
-				map_foreachinallrange(skill_area_sub,bl,skill_get_splash(skill_id,skill_lv),splash_target(src),src,
+				skill_area_range(MQ_ALL,bl,skill_get_splash(skill_id,skill_lv),splash_target(src),src,
 					skill_id,skill_lv,tick,flag|BCT_ENEMY|SD_SPLASH|1,skill_castend_nodamage_id);
 			}
 			break;
@@ -9271,7 +9309,7 @@ int skill_castend_nodamage_id(struct block_list *src, struct block_list *bl, uin
 				sc_start(src,bl,SC_BLIND,53 + 2 * skill_lv,skill_lv,skill_get_time2(skill_id,skill_lv));
 			} else {
 				clif_skill_nodamage(src,bl,skill_id,0,1);
-				map_foreachinallrange(skill_area_sub,bl,skill_get_splash(skill_id,skill_lv),BL_CHAR,src,
+				skill_area_range(MQ_ALL,bl,skill_get_splash(skill_id,skill_lv),BL_CHAR,src,
 					skill_id,skill_lv,tick,flag|BCT_ENEMY|1,skill_castend_nodamage_id);
 			}
 			break;
@@ -9335,7 +9373,7 @@ int skill_castend_nodamage_id(struct block_list *src, struct block_list *bl, uin
 				clif_skill_damage(src,bl,tick,status_get_amotion(src),0,-30000,1,skill_id,skill_lv,DMG_SKILL);
 				if( rnd()%100 < 25 + 25 * skill_lv ) {
 					map_foreachinallrange(skill_destroy_trap,bl,skill_get_splash(skill_id,skill_lv),BL_SKILL,src,tick);
-					map_foreachinallrange(skill_area_sub,bl,skill_get_splash(skill_id,skill_lv),splash_target(src),src,
+					skill_area_range(MQ_ALL,bl,skill_get_splash(skill_id,skill_lv),splash_target(src),src,
 						skill_id,skill_lv,tick,flag|BCT_ALL|SD_SPLASH|1,skill_castend_nodamage_id);
 				}
 			}
@@ -9387,7 +9425,7 @@ int skill_castend_nodamage_id(struct block_list *src, struct block_list *bl, uin
 								case 1: //Splash AoE ATK
 									sc_start(src,bl,SC_SHIELDSPELL_DEF,100,effect_number,INVALID_TIMER);
 									clif_skill_damage(src,bl,tick,status_get_amotion(src),0,-30000,1,skill_id,skill_lv,DMG_SKILL);
-									map_foreachinallrange(skill_area_sub,src,splash_range,BL_CHAR,src,skill_id,skill_lv,tick,flag|BCT_ENEMY|1,skill_castend_damage_id);
+									skill_area_range(MQ_ALL,src,splash_range,BL_CHAR,src,skill_id,skill_lv,tick,flag|BCT_ENEMY|1,skill_castend_damage_id);
 									status_change_end(bl,SC_SHIELDSPELL_DEF,INVALID_TIMER);
 									break;
 								case 2: //% Damage Reflecting Increase
@@ -9422,13 +9460,13 @@ int skill_castend_nodamage_id(struct block_list *src, struct block_list *bl, uin
 								case 1: //Splash AoE MATK
 									sc_start(src,bl,SC_SHIELDSPELL_MDEF,100,effect_number,INVALID_TIMER);
 									clif_skill_damage(src,bl,tick,status_get_amotion(src),0,-30000,1,skill_id,skill_lv,DMG_SKILL);
-									map_foreachinallrange(skill_area_sub,src,splash_range,BL_CHAR,src,skill_id,skill_lv,tick,flag|BCT_ENEMY|1,skill_castend_damage_id);
+									skill_area_range(MQ_ALL,src,splash_range,BL_CHAR,src,skill_id,skill_lv,tick,flag|BCT_ENEMY|1,skill_castend_damage_id);
 									status_change_end(bl,SC_SHIELDSPELL_MDEF,INVALID_TIMER);
 									break;
 								case 2: //Splash AoE Lex Divina
 									shield_mdef = min(shield_mdef,10); //Level of Lex Divina to cast
 									sc_start(src,bl,SC_SHIELDSPELL_MDEF,100,effect_number,INVALID_TIMER);
-									map_foreachinallrange(skill_area_sub,src,splash_range,BL_CHAR,src,PR_LEXDIVINA,shield_mdef,tick,flag|BCT_ENEMY|1,skill_castend_nodamage_id);
+									skill_area_range(MQ_ALL,src,splash_range,BL_CHAR,src,PR_LEXDIVINA,shield_mdef,tick,flag|BCT_ENEMY|1,skill_castend_nodamage_id);
 									status_change_end(bl,SC_SHIELDSPELL_MDEF,INVALID_TIMER);
 									break;
 								case 3: //Casts Magnificat
@@ -9470,7 +9508,7 @@ int skill_castend_nodamage_id(struct block_list *src, struct block_list *bl, uin
 			else {
 				clif_skill_nodamage(src,bl,skill_id,skill_lv,1);
 				skill_area_temp[2] = 0;
-				map_foreachinallrange(skill_area_sub,bl,skill_get_splash(skill_id,skill_lv),BL_PC,src,skill_id,skill_lv,tick,flag|SD_PREAMBLE|BCT_PARTY|BCT_SELF|1,skill_castend_nodamage_id);
+				skill_area_range(MQ_ALL,bl,skill_get_splash(skill_id,skill_lv),BL_PC,src,skill_id,skill_lv,tick,flag|SD_PREAMBLE|BCT_PARTY|BCT_SELF|1,skill_castend_nodamage_id);
 			}
 			break;
 
@@ -9480,7 +9518,7 @@ int skill_castend_nodamage_id(struct block_list *src, struct block_list *bl, uin
 				clif_skill_damage(src,bl,tick,status_get_amotion(src),0,-30000,1,skill_id,skill_lv,DMG_SKILL);
 				i = skill_get_splash(skill_id,skill_lv);
 				map_foreachinallarea(skill_cell_overlap,src->m,src->x-i,src->y-i,src->x+i,src->y+i,BL_SKILL,skill_id,&dummy,src);
-				map_foreachinallrange(skill_area_sub,bl,i,BL_CHAR,src,skill_id,skill_lv,tick,flag|BCT_ENEMY|1,skill_castend_damage_id);
+				skill_area_range(MQ_ALL,bl,i,BL_CHAR,src,skill_id,skill_lv,tick,flag|BCT_ENEMY|1,skill_castend_damage_id);
 			}
 			break;
 
@@ -9499,7 +9537,7 @@ int skill_castend_nodamage_id(struct block_list *src, struct block_list *bl, uin
 				skill_area_temp[1] = 0;
 				if( sc && sc->data[SC_COMBO] && sc->data[SC_COMBO]->val1 == SR_DRAGONCOMBO )
 					flag |= 8;
-				map_foreachinallrange(skill_area_sub,bl,skill_get_splash(skill_id,skill_lv),splash_target(src),src,
+				skill_area_range(MQ_ALL,bl,skill_get_splash(skill_id,skill_lv),splash_target(src),src,
 					skill_id,skill_lv,tick,flag|BCT_ENEMY|SD_SPLASH|1,skill_castend_damage_id);
 			}
 			break;
@@ -9557,7 +9595,7 @@ int skill_castend_nodamage_id(struct block_list *src, struct block_list *bl, uin
 				}
 				clif_skill_damage(src,bl,tick,status_get_amotion(src),0,-30000,1,skill_id,skill_lv,DMG_SKILL);
 			} else
-				map_foreachinallrange(skill_area_sub,bl,skill_get_splash(skill_id,skill_lv),splash_target(src),src,skill_id,skill_lv,tick,flag|BCT_ALL|SD_SPLASH|1,skill_castend_nodamage_id);
+				skill_area_range(MQ_ALL,bl,skill_get_splash(skill_id,skill_lv),splash_target(src),src,skill_id,skill_lv,tick,flag|BCT_ALL|SD_SPLASH|1,skill_castend_nodamage_id);
 			break;
 
 		case SR_POWERVELOCITY:
@@ -9655,7 +9693,7 @@ int skill_castend_nodamage_id(struct block_list *src, struct block_list *bl, uin
 				sc_start(src,bl,type,rate,skill_lv,duration);
 			} else {
 				clif_skill_nodamage(src,bl,skill_id,skill_lv,1);
-				map_foreachinallrange(skill_area_sub,src,skill_get_splash(skill_id,skill_lv),BL_CHAR,src,skill_id,skill_lv,tick,flag|BCT_ALL|1,skill_castend_nodamage_id);
+				skill_area_range(MQ_ALL,src,skill_get_splash(skill_id,skill_lv),BL_CHAR,src,skill_id,skill_lv,tick,flag|BCT_ALL|1,skill_castend_nodamage_id);
 			}
 			break;
 
@@ -9664,7 +9702,7 @@ int skill_castend_nodamage_id(struct block_list *src, struct block_list *bl, uin
 				sc_start(src,bl,type,100,skill_lv,skill_get_time(skill_id,skill_lv));
 			else {
 				clif_skill_nodamage(src,bl,skill_id,skill_lv,1);
-				map_foreachinallrange(skill_area_sub,src,skill_get_splash(skill_id,skill_lv),BL_PC,src,skill_id,skill_lv,tick,flag|BCT_ALL|1,skill_castend_nodamage_id);
+				skill_area_range(MQ_ALL,src,skill_get_splash(skill_id,skill_lv),BL_PC,src,skill_id,skill_lv,tick,flag|BCT_ALL|1,skill_castend_nodamage_id);
 			}
 			break;
 
@@ -9679,7 +9717,7 @@ int skill_castend_nodamage_id(struct block_list *src, struct block_list *bl, uin
 				int sflag = (map_flag_vs(src->m) ? BCT_ENEMY : BCT_ALL);
 
 				clif_skill_nodamage(src,bl,skill_id,skill_lv,1);
-				map_foreachinallrange(skill_area_sub,src,skill_get_splash(skill_id,skill_lv),BL_CHAR|BL_SKILL,src,skill_id,skill_lv,tick,flag|sflag|1,skill_castend_nodamage_id);
+				skill_area_range(MQ_ALL,src,skill_get_splash(skill_id,skill_lv),BL_CHAR|BL_SKILL,src,skill_id,skill_lv,tick,flag|sflag|1,skill_castend_nodamage_id);
 			}
 			break;
 
@@ -9722,7 +9760,7 @@ int skill_castend_nodamage_id(struct block_list *src, struct block_list *bl, uin
 				sc_start2(src,bl,type,100,skill_lv,party_calc_chorusbonus(sd,0),skill_get_time(skill_id,skill_lv));
 			} else if( sd ) {
 				clif_skill_nodamage(src,bl,skill_id,skill_lv,1);
-				map_foreachinallrange(skill_area_sub,src,skill_get_splash(skill_id,skill_lv),BL_PC,src,skill_id,skill_lv,tick,flag|BCT_ALL|1,skill_castend_nodamage_id);
+				skill_area_range(MQ_ALL,src,skill_get_splash(skill_id,skill_lv),BL_PC,src,skill_id,skill_lv,tick,flag|BCT_ALL|1,skill_castend_nodamage_id);
 			}
 			break;
 
@@ -9743,8 +9781,8 @@ int skill_castend_nodamage_id(struct block_list *src, struct block_list *bl, uin
 					break;
 				}
 				clif_skill_nodamage(src,bl,skill_id,skill_lv,1);
-				skill_area_temp[5] = map_foreachinallrange(skill_area_sub,src,skill_get_splash(skill_id,skill_lv),BL_PC,src,skill_id,skill_lv,tick,BCT_ALL,skill_area_sub_count);
-				map_foreachinallrange(skill_area_sub,src,skill_get_splash(skill_id,skill_lv),BL_PC,src,skill_id,skill_lv,tick,flag|BCT_ALL|1,skill_castend_nodamage_id);
+				skill_area_temp[5] = skill_area_range(MQ_ALL,src,skill_get_splash(skill_id,skill_lv),BL_PC,src,skill_id,skill_lv,tick,BCT_ALL,skill_area_sub_count);
+				skill_area_range(MQ_ALL,src,skill_get_splash(skill_id,skill_lv),BL_PC,src,skill_id,skill_lv,tick,flag|BCT_ALL|1,skill_castend_nodamage_id);
 			}
 			break;
 
@@ -9755,7 +9793,7 @@ int skill_castend_nodamage_id(struct block_list *src, struct block_list *bl, uin
 			else if( sd ) {
 				if( rnd()%100 < 15 + 5 * skill_lv + min(5 * party_calc_chorusbonus(sd,3),65) ) {
 					clif_skill_nodamage(src,bl,skill_id,skill_lv,1);
-					map_foreachinallrange(skill_area_sub,src,skill_get_splash(skill_id,skill_lv),BL_PC,src,skill_id,skill_lv,tick,flag|BCT_ENEMY|1,skill_castend_nodamage_id);
+					skill_area_range(MQ_ALL,src,skill_get_splash(skill_id,skill_lv),BL_PC,src,skill_id,skill_lv,tick,flag|BCT_ENEMY|1,skill_castend_nodamage_id);
 				}
 			}
 			break;
@@ -9824,7 +9862,7 @@ int skill_castend_nodamage_id(struct block_list *src, struct block_list *bl, uin
 				if( map_flag_vs(bl->m) )
 					party_foreachsamemap(skill_area_sub,sd,skill_get_splash(skill_id,skill_lv),src,skill_id,skill_lv,tick,flag|BCT_PARTY|1,skill_castend_nodamage_id);
 				else
-					map_foreachinallrange(skill_area_sub,src,skill_get_splash(skill_id,skill_lv),BL_PC,src,skill_id,skill_lv,tick,flag|BCT_NOENEMY|1,skill_castend_nodamage_id);
+					skill_area_range(MQ_ALL,src,skill_get_splash(skill_id,skill_lv),BL_PC,src,skill_id,skill_lv,tick,flag|BCT_NOENEMY|1,skill_castend_nodamage_id);
 			}
 			break;
 
@@ -10072,7 +10110,7 @@ int skill_castend_nodamage_id(struct block_list *src, struct block_list *bl, uin
 					status_zap(bl,0,status_get_max_sp(bl) * (25 + 5 * skill_lv) / 100);
 				}
 			} else {
-				map_foreachinallrange(skill_area_sub,bl,skill_get_splash(skill_id,skill_lv),BL_CHAR,src,skill_id,skill_lv,tick,flag|BCT_ENEMY|1,skill_castend_nodamage_id);
+				skill_area_range(MQ_ALL,bl,skill_get_splash(skill_id,skill_lv),BL_CHAR,src,skill_id,skill_lv,tick,flag|BCT_ENEMY|1,skill_castend_nodamage_id);
 				clif_skill_nodamage(src,src,skill_id,skill_lv,1);
 			}
 			break;
@@ -10096,7 +10134,7 @@ int skill_castend_nodamage_id(struct block_list *src, struct block_list *bl, uin
 				if( itemdb_is_slingatk(ammo_id) ) { //If thrown item is a bomb or a lump, then its a attack type ammo
 					if( battle_check_target(src,bl,BCT_ENEMY) > 0 ) { //Only allow throwing attacks at enemies
 						if( ammo_id == ITEMID_PINEAPPLE_BOMB ) //Pineapple Bombs deal 5x5 splash damage on targeted enemy
-							map_foreachinallrange(skill_area_sub,bl,2,BL_CHAR,src,GN_SLINGITEM_RANGEMELEEATK,skill_lv,tick,flag|BCT_ENEMY|SD_LEVEL|SD_ANIMATION|SD_SPLASH|1,skill_castend_damage_id);
+							skill_area_range(MQ_ALL,bl,2,BL_CHAR,src,GN_SLINGITEM_RANGEMELEEATK,skill_lv,tick,flag|BCT_ENEMY|SD_LEVEL|SD_ANIMATION|SD_SPLASH|1,skill_castend_damage_id);
 						else //All other bombs and lumps hits one enemy
 							skill_castend_damage_id(src,bl,GN_SLINGITEM_RANGEMELEEATK,skill_lv,tick,flag|SD_LEVEL|SD_ANIMATION);
 					} else //Otherwise, it fails, shows animation and removes items
@@ -10285,7 +10323,7 @@ int skill_castend_nodamage_id(struct block_list *src, struct block_list *bl, uin
 		case EL_HURRICANE:
 			if( rnd()%100 < 30 ) {
 				clif_skill_damage(src,bl,tick,status_get_amotion(src),0,-30000,1,skill_id,skill_lv,DMG_SKILL);
-				map_foreachinallrange(skill_area_sub,bl,skill_get_splash(skill_id + 1,skill_lv),BL_CHAR,src,skill_id + 1,skill_lv,tick,flag|BCT_ENEMY|SD_SPLASH|1,skill_castend_damage_id);
+				skill_area_range(MQ_ALL,bl,skill_get_splash(skill_id + 1,skill_lv),BL_CHAR,src,skill_id + 1,skill_lv,tick,flag|BCT_ENEMY|SD_SPLASH|1,skill_castend_damage_id);
 			} else
 				skill_attack(skill_get_type(skill_id),src,src,bl,skill_id,skill_lv,tick,flag);
 			break;
@@ -10404,7 +10442,7 @@ int skill_castend_nodamage_id(struct block_list *src, struct block_list *bl, uin
 					sc_start(src,src,SC_STOP,100,skill_lv,skill_get_time(skill_id,skill_lv));
 			} else {
 				skill_area_temp[2] = 0;
-				map_foreachinrange(skill_area_sub,bl,skill_get_splash(skill_id,skill_lv),BL_CHAR|BL_SKILL,src,
+				skill_area_range(MQ_SKILL,bl,skill_get_splash(skill_id,skill_lv),BL_CHAR|BL_SKILL,src,
 					skill_id,skill_lv,tick,flag|BCT_ENEMY|SD_SPLASH|SD_PREAMBLE|1,skill_castend_nodamage_id);
 			}
 			break;
@@ -10492,7 +10530,7 @@ int skill_castend_nodamage_id(struct block_list *src, struct block_list *bl, uin
 			if( flag&2 ) { //Splash AoE around the homunculus should only trigger by chance when status is active
 				clif_skill_nodamage(src,bl,skill_id,skill_lv,1);
 				skill_area_temp[1] = 0;
-				map_foreachinallrange(skill_area_sub,bl,skill_get_splash(skill_id,skill_lv),splash_target(src),src,
+				skill_area_range(MQ_ALL,bl,skill_get_splash(skill_id,skill_lv),splash_target(src),src,
 					skill_id,skill_lv,tick,flag|BCT_ENEMY|SD_SPLASH|1,skill_castend_damage_id);
 			} else if( !flag ) { //Using the skill normally only starts the status, it does not trigger a splash AoE attack this way
 				clif_skill_nodamage(src,bl,skill_id,skill_lv,
@@ -10516,7 +10554,7 @@ int skill_castend_nodamage_id(struct block_list *src, struct block_list *bl, uin
 					skill_castend_damage_id(src,bl,RL_H_MINE,tsc->data[SC_H_MINE]->val1,tick,flag|4);
 				}
 			} else { //Search for active howling mines and binding traps
-				map_foreachinallrange(skill_area_sub,src,skill_get_splash(skill_id,skill_lv),BL_CHAR,src,skill_id,skill_lv,tick,flag|BCT_ENEMY|1,skill_castend_nodamage_id);
+				skill_area_range(MQ_ALL,src,skill_get_splash(skill_id,skill_lv),BL_CHAR,src,skill_id,skill_lv,tick,flag|BCT_ENEMY|1,skill_castend_nodamage_id);
 				map_foreachinallrange(skill_flicker_bind_trap,src,AREA_SIZE,BL_SKILL,src,tick);
 				clif_skill_nodamage(src,bl,skill_id,skill_lv,1);
 			}
@@ -10528,7 +10566,7 @@ int skill_castend_nodamage_id(struct block_list *src, struct block_list *bl, uin
 		//Fall through
 		case RL_D_TAIL:
 			clif_skill_nodamage(src,bl,skill_id,skill_lv,1);
-			map_foreachinrange(skill_area_sub,src,skill_get_splash(skill_id,skill_lv),BL_CHAR,src,
+			skill_area_range(MQ_SKILL,src,skill_get_splash(skill_id,skill_lv),BL_CHAR,src,
 				skill_id,skill_lv,tick,flag|BCT_ENEMY|SD_SPLASH|1,skill_castend_damage_id);
 			break;
 
@@ -10625,7 +10663,7 @@ int skill_castend_nodamage_id(struct block_list *src, struct block_list *bl, uin
 				sc_start(src,bl,SC_FREEZE,100,skill_lv,skill_get_time2(skill_id,skill_lv));
 			} else {
 				clif_skill_nodamage(src,bl,skill_id,skill_lv,1);
-				map_foreachinrange(skill_area_sub,bl,skill_get_splash(skill_id,skill_lv),BL_CHAR,src,
+				skill_area_range(MQ_SKILL,bl,skill_get_splash(skill_id,skill_lv),BL_CHAR,src,
 					skill_id,skill_lv,tick,flag|BCT_ENEMY|1,skill_castend_nodamage_id);
 			}
 			break;
@@ -11195,15 +11233,15 @@ int skill_castend_pos2(struct block_list *src, int x, int y, uint16 skill_id, ui
 		case PR_BENEDICTIO:
 			skill_area_temp[1] = src->id;
 			i = skill_get_splash(skill_id,skill_lv);
-			map_foreachinallarea(skill_area_sub,src->m,x-i,y-i,x+i,y+i,BL_PC,src,
+			skill_area_area(MQ_ALL,src->m,x-i,y-i,x+i,y+i,BL_PC,src,
 				skill_id,skill_lv,tick,flag|BCT_ALL|1,skill_castend_nodamage_id);
-			map_foreachinallarea(skill_area_sub,src->m,x-i,y-i,x+i,y+i,BL_CHAR,src,
+			skill_area_area(MQ_ALL,src->m,x-i,y-i,x+i,y+i,BL_CHAR,src,
 				skill_id,skill_lv,tick,flag|BCT_ENEMY|1,skill_castend_damage_id);
 			break;
 
 		case BS_HAMMERFALL:
 			i = skill_get_splash(skill_id,skill_lv);
-			map_foreachinallarea(skill_area_sub,src->m,x-i,y-i,x+i,y+i,BL_CHAR,src,
+			skill_area_area(MQ_ALL,src->m,x-i,y-i,x+i,y+i,BL_CHAR,src,
 				skill_id,skill_lv,tick,flag|BCT_ENEMY|2,skill_castend_nodamage_id);
 			break;
 
@@ -11215,13 +11253,13 @@ int skill_castend_pos2(struct block_list *src, int x, int y, uint16 skill_id, ui
 
 		case SR_RIDEINLIGHTNING:
 			i = skill_get_splash(skill_id,skill_lv);
-			map_foreachinallarea(skill_area_sub,src->m,x-i,y-i,x+i,y+i,BL_CHAR,src,
+			skill_area_area(MQ_ALL,src->m,x-i,y-i,x+i,y+i,BL_CHAR,src,
 				skill_id,skill_lv,tick,flag|BCT_ENEMY|1,skill_castend_damage_id);
 			break;
 
 		case NPC_LEX_AETERNA:
 			i = skill_get_splash(skill_id,skill_lv);
-			map_foreachinallarea(skill_area_sub,src->m,x-i,y-i,x+i,y+i,BL_CHAR,src,
+			skill_area_area(MQ_ALL,src->m,x-i,y-i,x+i,y+i,BL_CHAR,src,
 				PR_LEXAETERNA,1,tick,flag|BCT_ENEMY|1,skill_castend_nodamage_id);
 			break;
 
@@ -11499,7 +11537,7 @@ int skill_castend_pos2(struct block_list *src, int x, int y, uint16 skill_id, ui
 
 				if( potion_hp > 0 || potion_sp > 0 ) {
 					i = skill_get_splash(skill_id, skill_lv);
-					map_foreachinallarea(skill_area_sub,src->m,x-i,y-i,x+i,y+i,BL_CHAR,src,
+					skill_area_area(MQ_ALL,src->m,x-i,y-i,x+i,y+i,BL_CHAR,src,
 						skill_id,skill_lv,tick,flag|BCT_PARTY|BCT_GUILD|1,skill_castend_nodamage_id);
 				}
 			} else {
@@ -11517,7 +11555,7 @@ int skill_castend_pos2(struct block_list *src, int x, int y, uint16 skill_id, ui
 
 				if( potion_hp > 0 || potion_sp > 0 ) {
 					i = skill_get_splash(skill_id,skill_lv);
-					map_foreachinallarea(skill_area_sub,src->m,x-i,y-i,x+i,y+i,BL_CHAR,src,
+					skill_area_area(MQ_ALL,src->m,x-i,y-i,x+i,y+i,BL_CHAR,src,
 						skill_id,skill_lv,tick,flag|BCT_PARTY|BCT_GUILD|1,skill_castend_nodamage_id);
 				}
 			}
@@ -11626,14 +11664,14 @@ int skill_castend_pos2(struct block_list *src, int x, int y, uint16 skill_id, ui
 		case MH_XENO_SLASHER:
 			skill_area_temp[1] = 0;
 			i = skill_get_splash(skill_id,skill_lv);
-			map_foreachinarea(skill_area_sub,src->m,x-i,y-i,x+i,y+i,BL_CHAR|BL_SKILL,src,
+			skill_area_area(MQ_SKILL,src->m,x-i,y-i,x+i,y+i,BL_CHAR|BL_SKILL,src,
 				skill_id,skill_lv,tick,flag|BCT_ENEMY|1,skill_castend_damage_id);
 			break;
 
 		case WM_GREAT_ECHO:
 		case WM_SOUND_OF_DESTRUCTION:
 			i = skill_get_splash(skill_id,skill_lv);
-			map_foreachinallarea(skill_area_sub,src->m,x-i,y-i,x+i,y+i,BL_CHAR,src,
+			skill_area_area(MQ_ALL,src->m,x-i,y-i,x+i,y+i,BL_CHAR,src,
 				skill_id,skill_lv,tick,flag|BCT_ENEMY|1,skill_castend_damage_id);
 			break;
 
@@ -11645,7 +11683,7 @@ int skill_castend_pos2(struct block_list *src, int x, int y, uint16 skill_id, ui
 		case AB_EPICLESIS:
 			if( !map_flag_vs(src->m) ) {
 				i = skill_get_splash(skill_id,skill_lv);
-				map_foreachinallarea(skill_area_sub,src->m,x-i,y-i,x+i,y+i,BL_CHAR,src,
+				skill_area_area(MQ_ALL,src->m,x-i,y-i,x+i,y+i,BL_CHAR,src,
 					ALL_RESURRECTION,3,tick,flag|BCT_NOENEMY|1,skill_castend_nodamage_id);
 			}
 			skill_unitsetting(src,skill_id,skill_lv,x,y,0);
@@ -11816,7 +11854,7 @@ int skill_castend_pos2(struct block_list *src, int x, int y, uint16 skill_id, ui
 								skill_unitsetting(src,sg->skill_id,sg->skill_lv,ux,uy,1);
 								break;
 							case 2:
-								map_foreachinallarea(skill_area_sub,src->m,ux - 2,uy - 2,ux + 2,uy + 2,BL_CHAR,src,
+								skill_area_area(MQ_ALL,src->m,ux - 2,uy - 2,ux + 2,uy + 2,BL_CHAR,src,
 									GN_DEMONIC_FIRE,skill_lv + 20,tick,flag|BCT_ENEMY|SD_LEVEL|1,skill_castend_damage_id);
 								skill_delunitgroup(sg);
 								break;
@@ -11831,7 +11869,7 @@ int skill_castend_pos2(struct block_list *src, int x, int y, uint16 skill_id, ui
 							case 5: //If player knows a level of Acid Demonstration greater then 5, that level will be casted
 								if( sd && (lv = pc_checkskill(sd,CR_ACIDDEMONSTRATION)) > 0 )
 									lv = max(lv,5);
-								map_foreachinallarea(skill_area_sub,src->m,ux - 2,uy - 2,ux + 2,uy + 2,BL_CHAR,src,
+								skill_area_area(MQ_ALL,src->m,ux - 2,uy - 2,ux + 2,uy + 2,BL_CHAR,src,
 									GN_FIRE_EXPANSION_ACID,lv,tick,flag|BCT_ENEMY|SD_LEVEL|1,skill_castend_damage_id);
 								skill_delunitgroup(sg);
 								break;
@@ -11850,7 +11888,7 @@ int skill_castend_pos2(struct block_list *src, int x, int y, uint16 skill_id, ui
 
 		case SO_ARRULLO:
 			i = skill_get_splash(skill_id,skill_lv);
-			map_foreachinallarea(skill_area_sub,src->m,x-i,y-i,x+i,y+i,BL_CHAR,src,
+			skill_area_area(MQ_ALL,src->m,x-i,y-i,x+i,y+i,BL_CHAR,src,
 				skill_id,skill_lv,tick,flag|BCT_ENEMY|1,skill_castend_nodamage_id);
 			break;
 
@@ -11885,9 +11923,9 @@ int skill_castend_pos2(struct block_list *src, int x, int y, uint16 skill_id, ui
 				sstatus = status_get_status_data(src);
 				rate = max((100 - (1000 / (sstatus->dex + sstatus->luk) * 5)) * (skill_lv / 2 + 5) / 10,0);
 				i = skill_get_splash(skill_id,skill_lv);
-				skill_area_temp[0] = map_foreachinallarea(skill_area_sub,src->m,x-i,y-i,x+i,y+i,BL_CHAR,src,skill_id,skill_lv,tick,BCT_ENEMY,skill_area_sub_count);
+				skill_area_temp[0] = skill_area_area(MQ_ALL,src->m,x-i,y-i,x+i,y+i,BL_CHAR,src,skill_id,skill_lv,tick,BCT_ENEMY,skill_area_sub_count);
 				if( rnd()%100 < rate )
-					map_foreachinallarea(skill_area_sub,src->m,x-i,y-i,x+i,y+i,BL_CHAR,src,skill_id,skill_lv,tick,flag|BCT_ENEMY|1,skill_castend_damage_id);
+					skill_area_area(MQ_ALL,src->m,x-i,y-i,x+i,y+i,BL_CHAR,src,skill_id,skill_lv,tick,flag|BCT_ENEMY|1,skill_castend_damage_id);
 			}
 			break;
 
@@ -11927,7 +11965,7 @@ int skill_castend_pos2(struct block_list *src, int x, int y, uint16 skill_id, ui
 
 		case NC_MAGMA_ERUPTION:
 			i = skill_get_splash(skill_id,skill_lv);
-			map_foreachinallarea(skill_area_sub,src->m,x-i,y-i,x+i,y+i,BL_CHAR,src,
+			skill_area_area(MQ_ALL,src->m,x-i,y-i,x+i,y+i,BL_CHAR,src,
 				skill_id,skill_lv,tick,flag|BCT_ENEMY|SD_ANIMATION|1,skill_castend_damage_id);
 			skill_addtimerskill(src,tick + status_get_amotion(src) * 2,0,x,y,skill_id,skill_lv,0,flag);
 			break;
@@ -13383,7 +13421,7 @@ static int skill_unit_onplace_timer(struct skill_unit *unit, struct block_list *
 
 		case UNT_EARTHQUAKE:
 			skill_attack(BF_MAGIC,src,&unit->bl,bl,skill_id,skill_lv,tick,
-				map_foreachinallrange(skill_area_sub,&unit->bl,skill_get_splash(skill_id,skill_lv),BL_CHAR,&unit->bl,skill_id,skill_lv,tick,BCT_ENEMY,skill_area_sub_count));
+				skill_area_range(MQ_ALL,&unit->bl,skill_get_splash(skill_id,skill_lv),BL_CHAR,&unit->bl,skill_id,skill_lv,tick,BCT_ENEMY,skill_area_sub_count));
 			break;
 
 		case UNT_FIREPILLAR_WAITING:
@@ -14518,7 +14556,7 @@ bool skill_check_condition_target(struct block_list *src, struct block_list *bl,
 		case RL_D_TAIL: {
 				int count = 0;
 
-				count = map_foreachinrange(skill_area_sub,src,skill_get_splash(skill_id,skill_lv),BL_CHAR,src,
+				count = skill_area_range(MQ_SKILL,src,skill_get_splash(skill_id,skill_lv),BL_CHAR,src,
 					skill_id,skill_lv,gettick(),BCT_ENEMY,skill_area_sub_count);
 				if( !count ) {
 					if( sd )
@@ -18294,7 +18332,7 @@ static int skill_unit_timer_sub(DBKey key, DBData *data, va_list ap)
 					struct block_list *src =  map_id2bl(group->src_id);
 
 					if( src )
-						map_foreachinallrange(skill_area_sub,&unit->bl,unit->range,BL_CHAR|BL_SKILL,src,SC_FEINTBOMB,group->skill_lv,tick,BCT_ENEMY|SD_LEVEL|SD_ANIMATION|1,skill_castend_damage_id);
+						skill_area_range(MQ_ALL,&unit->bl,unit->range,BL_CHAR|BL_SKILL,src,SC_FEINTBOMB,group->skill_lv,tick,BCT_ENEMY|SD_LEVEL|SD_ANIMATION|1,skill_castend_damage_id);
 					skill_delunit(unit);
 				}
 				break;
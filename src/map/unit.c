@@ -93,6 +93,9 @@ int unit_walktoxy_sub(struct block_list *bl)
 	if( !(ud = unit_bl2ud(bl)) )
 		return 0;
 
+	if( ud->target_to && !ud->state.walk_easy )
+		path_flow_prepare(bl->m, ud->to_x, ud->to_y, CELL_CHKNOPASS); // Units chasing the same target share the search
+
 	if( !path_search(&wpd,bl->m,bl->x,bl->y,ud->to_x,ud->to_y,ud->state.walk_easy,CELL_CHKNOPASS) )
 		return 0;
 
@@ -417,6 +420,7 @@ static int unit_walktoxy_timer(int tid, unsigned int tick, int id, intptr_t data
 	ud->walktimer = CLIF_WALK_TIMER; //Arbitrary non-INVALID_TIMER value to make the clif code send walking packets
 	map_foreachinmovearea(clif_insight,bl,AREA_SIZE,-dx,-dy,(sd ? BL_ALL : BL_PC),bl);
 	ud->walktimer = INVALID_TIMER;
+	mob_ai_wake_move(bl,-dx,-dy);
 
 	if(bl->x == ud->to_x && bl->y == ud->to_y) {
 		if(ud->walk_done_event[0]) {
@@ -940,6 +944,7 @@ int unit_movepos(struct block_list *bl, short dst_x, short dst_y, int easy, bool
 	ud->walktimer = CLIF_WALK_TIMER; //Arbitrary non-INVALID_TIMER value to make the clif code send walking packets
 	map_foreachinmovearea(clif_insight, bl, AREA_SIZE, -dx, -dy, (sd ? BL_ALL : BL_PC), bl);
 	ud->walktimer = INVALID_TIMER;
+	mob_ai_wake_move(bl, -dx, -dy);
 
 	if( sd ) {
 		if( sd->touching_id )
@@ -1053,6 +1058,7 @@ int unit_blown(struct block_list *bl, int dx, int dy, int count, int flag)
 				map_moveblock(bl, nx, ny, gettick());
 
 			map_foreachinmovearea(clif_insight, bl, AREA_SIZE, -dx, -dy, bl->type == BL_PC ? BL_ALL : BL_PC, bl);
+			mob_ai_wake_move(bl, -dx, -dy);
 
 			if (!(flag&1))
 				clif_blown(bl, bl);
@@ -1200,6 +1206,7 @@ int unit_warp(struct block_list *bl,short m,short x,short y,clr_type type)
 
 	clif_spawn(bl);
 	skill_unit_move(bl,gettick(),1);
+	mob_ai_wake_near(bl);
 
 	return 0;
 }
@@ -2299,6 +2306,9 @@ bool unit_can_reach_bl(struct block_list *bl,struct block_list *tbl, int range,
 	if( y )
 		*y = tbl->y - dy;
 
+	if( !easy )
+		path_flow_prepare(bl->m, tbl->x - dx, tbl->y - dy, CELL_CHKNOREACH);
+
 	if( !path_search(&wpd,bl->m,bl->x,bl->y,tbl->x - dx,tbl->y - dy,easy,CELL_CHKNOREACH) )
 		return false;
 
@@ -0,0 +1,288 @@
+#include "../common/cbasetypes.h"
+#include "../common/core.h"
+#include "../common/db.h"
+#include "../common/malloc.h"
+#include "../common/showmsg.h"
+#include "../common/timer.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+//
+// Checks the open-addressing databases (DB_OPT_FLAT) against a reference model
+// and compares their speed with the hashtable of RED-BLACK trees
+// (insert/lookup/remove with 10k, 100k and 1M int keys).
+//
+
+
+static uint32 seed = 12345;
+static uint32 rand_next(void){
+	seed = seed*1103515245 + 12345;
+	return (seed>>8);
+}
+
+
+/*----------------------------
+ * 	Correctness
+ *----------------------------*/
+#define CHECK_KEYS 50000 // keys are 0..CHECK_KEYS-1, spread over the int range
+#define CHECK_ROUNDS 400000
+
+static int* check_value = NULL; // expected data by key index, 0 = not in the db
+static int check_errors = 0;
+
+static int check_key(int n){
+	return (int)((uint32)n*2654435761U);// spread, includes negative keys
+}
+
+static int check_index(int key){
+	return (int)((uint32)key*244002641U);// inverse of 2654435761 mod 2^32
+}
+
+static int check_count_sub(DBKey key, DBData *data, va_list ap){
+	int* count = va_arg(ap, int*);
+	int n = check_index(key.i);
+
+	if( n < 0 || n >= CHECK_KEYS || check_value[n] != db_data2i(data) ){
+		if( check_errors++ < 10 ) ShowError("foreach: unexpected entry %d\n", key.i);
+	}
+	(*count)++;
+	return 0;
+}
+
+static DBData check_create(DBKey key, va_list args){
+	return db_i2data(va_arg(args, int));
+}
+
+static bool test_correctness(void){
+	DBMap* db = idb_alloc(DB_OPT_FLAT);
+	DBIterator* iter;
+	DBData* data;
+	DBKey key;
+	int i, round, count, expected = 0;
+
+	check_value = (int*)aCalloc(CHECK_KEYS, sizeof(int));
+	check_errors = 0;
+
+	for( round = 0; round < CHECK_ROUNDS; round++ ){
+		int n = rand_next()%CHECK_KEYS;
+		int k = check_key(n);
+		int v = 1 + rand_next()%1000000;
+
+		switch( rand_next()%8 ){
+		case 0: case 1: case 2: // put
+			if( idb_iput(db, k, v) != (check_value[n] != 0) ){
+				if( check_errors++ < 10 ) ShowError("put %d: wrong return value\n", k);
+			}
+			if( check_value[n] == 0 )
+				expected++;
+			check_value[n] = v;
+			break;
+		case 3: case 4: // remove
+			if( idb_remove(db, k) != (check_value[n] != 0) ){
+				if( check_errors++ < 10 ) ShowError("remove %d: wrong return value\n", k);
+			}
+			if( check_value[n] != 0 )
+				expected--;
+			check_value[n] = 0;
+			break;
+		case 5: // ensure
+			data = db->ensure(db, db_i2key(k), check_create, v);
+			if( check_value[n] == 0 ){
+				check_value[n] = v;
+				expected++;
+			}
+			if( data == NULL || db_data2i(data) != check_value[n] ){
+				if( check_errors++ < 10 ) ShowError("ensure %d: wrong data\n", k);
+			}
+			break;
+		default: // get
+			data = db->get(db, db_i2key(k));
+			if( (data ? db_data2i(data) : 0) != check_value[n] ){
+				if( check_errors++ < 10 ) ShowError("get %d: wrong data\n", k);
+			}
+			break;
+		}
+
+		if( round%50000 == 0 ){
+			// remove every other entry while iterating, adding new ones
+			iter = db_iterator(db);
+			for( data = iter->first(iter, &key); iter->exists(iter); data = iter->next(iter, &key) ){
+				int m = check_index(key.i);
+
+				if( check_value[m] != db_data2i(data) ){
+					if( check_errors++ < 10 ) ShowError("iterator: unexpected entry %d\n", key.i);
+				}
+				if( m%2 ){
+					iter->remove(iter, NULL);
+					check_value[m] = 0;
+					expected--;
+				} else if( m + 1 < CHECK_KEYS && check_value[m+1] == 0 && m%3 == 0 ){
+					idb_iput(db, check_key(m+1), m+1);
+					check_value[m+1] = m+1;
+					expected++;
+				}
+			}
+			dbi_destroy(iter);
+		}
+	}
+
+	count = 0;
+	db->foreach(db, check_count_sub, &count);
+	if( count != expected || (int)db_size(db) != expected ){
+		if( check_errors++ < 10 ) ShowError("size: foreach %d, db %u, expected %d\n", count, db_size(db), expected);
+	}
+	for( i = 0; i < CHECK_KEYS; i++ ){
+		if( idb_iget(db, check_key(i)) != check_value[i] ){
+			if( check_errors++ < 10 ) ShowError("entry %d: wrong data\n", check_key(i));
+		}
+	}
+
+	db_clear(db);
+	if( db_size(db) != 0 || idb_exists(db, check_key(0)) ){
+		if( check_errors++ < 10 ) ShowError("clear: db not empty\n");
+	}
+	db_destroy(db);
+	aFree(check_value);
+	return (check_errors == 0);
+}
+
+
+/// Adds entries while an iterator holds the database, far more than the table has room for.
+/// The entries must not move until the iterator is destroyed.
+static bool test_locked_growth(void){
+	DBMap* db = idb_alloc(DB_OPT_FLAT);
+	DBIterator* iter;
+	DBData* data;
+	DBData* first[64];
+	DBKey key;
+	int i, n = 0, seen = 0;
+
+	check_errors = 0;
+	for( i = 0; i < 64; i++ )
+		idb_iput(db, i, i + 1);
+	for( i = 0; i < 64; i++ )
+		first[i] = db->get(db, db_i2key(i));
+
+	iter = db_iterator(db);
+	for( data = iter->first(iter, &key); iter->exists(iter); data = iter->next(iter, &key) ){
+		if( key.i < 64 ){
+			seen++;
+			if( n < 20000 ){// the first entry fills the table many times over
+				for( i = 0; i < 20000; i++ )
+					idb_iput(db, 1000 + n + i, 1001 + n + i);
+				n += 20000;
+			}
+		}
+		if( db_data2i(data) != key.i + 1 ){
+			if( check_errors++ < 10 ) ShowError("locked: iterator returned wrong data for %d\n", key.i);
+		}
+	}
+	for( i = 0; i < 64; i++ ){
+		if( db->get(db, db_i2key(i)) != first[i] ){
+			if( check_errors++ < 10 ) ShowError("locked: entry %d moved while locked\n", i);
+		}
+	}
+	dbi_destroy(iter);
+
+	if( seen != 64 || (int)db_size(db) != 64 + n ){
+		if( check_errors++ < 10 ) ShowError("locked: %d entries seen, %u in the db\n", seen, db_size(db));
+	}
+	for( i = 0; i < n; i++ ){
+		if( idb_iget(db, 1000 + i) != 1001 + i ){
+			if( check_errors++ < 10 ) ShowError("locked: entry %d lost\n", 1000 + i);
+		}
+	}
+	db_destroy(db);
+	return (check_errors == 0);
+}
+
+
+/*----------------------------
+ * 	Benchmark
+ *----------------------------*/
+#define BENCH_LOOKUPS 4 // lookups per key
+
+/// Runs the benchmark with 'num' keys, ids handed out like the map server does
+/// (mostly sequential, some random).
+/// @param options Options of the database
+/// @param ms Elapsed milliseconds of insert, lookup and remove
+static void bench(int num, DBOptions options, unsigned int ms[3]){
+	DBMap* db = idb_alloc(options);
+	int* keys = (int*)aMalloc(num*sizeof(int));
+	unsigned int begin;
+	int i, sum = 0;
+
+	seed = 4711;
+	for( i = 0; i < num; i++ )
+		keys[i] = ( i%4 ) ? 110000000 + i : (int)(rand_next()%2000000000);
+
+	begin = gettick_nocache();
+	for( i = 0; i < num; i++ )
+		idb_iput(db, keys[i], i + 1);
+	ms[0] = gettick_nocache() - begin;
+
+	begin = gettick_nocache();
+	for( i = 0; i < num*BENCH_LOOKUPS; i++ )
+		sum += idb_iget(db, keys[rand_next()%num]);
+	ms[1] = gettick_nocache() - begin;
+
+	begin = gettick_nocache();
+	for( i = 0; i < num; i++ )
+		idb_remove(db, keys[i]);
+	ms[2] = gettick_nocache() - begin;
+
+	if( db_size(db) != 0 || sum == 0 )
+		ShowWarning("benchmark: %u entries left\n", db_size(db));
+	db_destroy(db);
+	aFree(keys);
+}
+
+
+int do_init(int argc, char **argv){
+	static const int sizes[] = { 10000, 100000, 1000000 };
+	int i;
+
+	ShowStatus("==========\n");
+	ShowStatus("TEST: open-addressing database correctness\n");
+	if( !test_correctness() || !test_locked_growth() ){
+		ShowFatalError("Test failed.\n");
+		exit(1);
+	}
+	ShowStatus("OK!\n");
+
+	ShowStatus("==========\n");
+	ShowStatus("BENCHMARK: insert, %d lookups per key, remove (ms)\n", BENCH_LOOKUPS);
+	for( i = 0; i < ARRAYLENGTH(sizes); i++ ){
+		unsigned int tree[3], flat[3];
+
+		bench(sizes[i], DB_OPT_BASE, tree);
+		bench(sizes[i], DB_OPT_FLAT, flat);
+		ShowStatus("%7d keys: trees %5u/%5u/%5u, open addressing %5u/%5u/%5u\n", sizes[i],
+			tree[0], tree[1], tree[2], flat[0], flat[1], flat[2]);
+	}
+
+	ShowStatus("Test passed.\n");
+	exit(0);
+
+return 0;
+}//end: do_init()
+
+
+void do_abort(){
+}//end: do_abort()
+
+
+void set_server_type(){
+	SERVER_TYPE = ATHENA_SERVER_NONE;
+}//end: set_server_type()
+
+
+void do_final(){
+}//end: do_final()
+
+
+int parse_console(const char* command){
+	return 0;
+}//end: parse_console
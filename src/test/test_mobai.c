@@ -0,0 +1,726 @@
+#include "../common/cbasetypes.h"
+#include "../common/core.h"
+#include "../common/malloc.h"
+#include "../common/showmsg.h"
+#include "../common/timer.h"
+#include "../map/map.h" // struct map_data, BLOCK_SIZE
+#include "../map/mob_ai.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+//
+// Checks the think schedule of the monster AI (mob_ai.c) against a reference
+// model, then benchmarks it on a model of the world. The test can't link the
+// rest of the map server, so the world keeps the parts that matter for the
+// cost: the monsters in blocks of BLOCK_SIZE cells, the players walking among
+// them, the spotted log of each monster and the visits of the AI to the
+// monsters. The schedule itself is the one of the map server.
+//
+// Compares the two AI sweeps of the old code (active AI around each player
+// every tick, lazy AI over every monster every second) with the think
+// schedule (one bucket of monster ids per AI tick).
+//
+// Checks the blocks marked once per AI tick (map_data.ai_block, mob_ai.c)
+// against the positions of the players, then compares the near-player test
+// of the active monsters, a scan of the players around each monster, with
+// these blocks.
+//
+
+
+static uint32 seed = 12345;
+static uint32 rand_next(void){
+	seed = seed*1103515245 + 12345;
+	return (seed>>8);
+}
+
+
+/*----------------------------
+ * 	World
+ *----------------------------*/
+#define WORLD_MAPS 400 // maps with monsters
+#define WORLD_PC_MAPS 40 // maps with players
+#define WORLD_PCS 300
+#define MAP_SIZE 320 // cells per side of a map
+#define MAP_BLOCKS (MAP_SIZE/BLOCK_SIZE) // blocks per side of a map
+#define AI_RANGE 16 // AREA_SIZE + ACTIVE_AI_RANGE with the default area_size
+#define AI_TICK 100 // MIN_MOBTHINKTIME
+#define AI_TICKS 600 // 60 seconds
+#define AI_LAZY_DELAY 10 // MOB_AI_LAZY_DELAY
+#define SPOTTED_MAX 30 // DAMAGELOG_SIZE
+
+struct world_mob {
+	int m, x, y;
+	unsigned int last_thinktime;
+	bool spotted;
+	unsigned int think_slot;
+	uint32 spotted_log[SPOTTED_MAX];
+	char data[1536]; // struct mob_data is a few KB, the visits miss the cache
+};
+
+struct world_pc {
+	int m, x, y;
+	uint32 char_id;
+};
+
+struct world_block {
+	int* ids;
+	int count, max;
+};
+
+static struct world_mob* mobs = NULL;
+static int mob_count = 0;
+static int* mob_order = NULL; // map_foreachmob visits the monsters in id db order, not by map
+static struct world_pc* pcs = NULL;
+static int pc_count = 0;
+static struct world_block* mob_blocks = NULL;
+static struct world_block* pc_blocks = NULL;
+static int users[WORLD_MAPS];
+
+static uint64 visits = 0; // monsters the AI looked at
+static uint64 thinks = 0; // monsters that ran their AI
+static uint32 think_work = 0;
+
+static struct world_block* world_block(struct world_block* blocks, int m, int x, int y){
+	return &blocks[(m*MAP_BLOCKS + y/BLOCK_SIZE)*MAP_BLOCKS + x/BLOCK_SIZE];
+}
+
+static void block_add(struct world_block* b, int id){
+	if( b->count == b->max ){
+		b->max = ( b->max ? b->max*2 : 4 );
+		RECREATE(b->ids, int, b->max);
+	}
+	b->ids[b->count++] = id;
+}
+
+static void block_remove(struct world_block* b, int id){
+	int i;
+	for( i = 0; i < b->count; i++ ){
+		if( b->ids[i] == id ){
+			b->ids[i] = b->ids[--b->count];
+			return;
+		}
+	}
+}
+
+/// Stands in for mob_ai_sub_hard/mob_ai_sub_lazy, the same work for every monster.
+static void mob_think(struct world_mob* md){
+	uint32 h = (uint32)(md - mobs);
+	int i;
+
+	for( i = 0; i < 64; i++ )
+		h = h*2654435761U + i;
+	think_work += h&1;
+	thinks++;
+}
+
+/// Stands in for mob_clean_spotted, which the lazy AI runs on every visit.
+static void mob_clean_spotted(struct world_mob* md){
+	int i;
+
+	for( i = 0; i < SPOTTED_MAX; i++ )
+		think_work += ( md->spotted_log[i] != 0 );
+}
+
+/// Places 'num_mobs' monsters on all maps and 'num_pcs' players on a few of them.
+static void world_init(int num_mobs, int num_pcs){
+	int blocks = WORLD_MAPS*MAP_BLOCKS*MAP_BLOCKS;
+	int i;
+
+	seed = 4711;
+	mob_count = num_mobs;
+	pc_count = num_pcs;
+	CREATE(mobs, struct world_mob, mob_count);
+	CREATE(mob_order, int, mob_count);
+	CREATE(pcs, struct world_pc, pc_count);
+	CREATE(mob_blocks, struct world_block, blocks);
+	CREATE(pc_blocks, struct world_block, blocks);
+	memset(users, 0, sizeof(users));
+
+	for( i = 0; i < mob_count; i++ ){
+		mobs[i].m = rand_next()%WORLD_MAPS;
+		mobs[i].x = rand_next()%MAP_SIZE;
+		mobs[i].y = rand_next()%MAP_SIZE;
+		block_add(world_block(mob_blocks, mobs[i].m, mobs[i].x, mobs[i].y), i);
+		mob_order[i] = i;
+	}
+	for( i = mob_count - 1; i > 0; i-- ){
+		int j = rand_next()%(i + 1);
+		int tmp = mob_order[i];
+		mob_order[i] = mob_order[j];
+		mob_order[j] = tmp;
+	}
+	for( i = 0; i < pc_count; i++ ){
+		pcs[i].m = (i%WORLD_PC_MAPS)*(WORLD_MAPS/WORLD_PC_MAPS);
+		pcs[i].x = 20 + rand_next()%(MAP_SIZE - 40);
+		pcs[i].y = 20 + rand_next()%(MAP_SIZE - 40);
+		pcs[i].char_id = 150000 + i;
+		block_add(world_block(pc_blocks, pcs[i].m, pcs[i].x, pcs[i].y), i);
+		users[pcs[i].m]++;
+	}
+}
+
+static void world_final(void){
+	int blocks = WORLD_MAPS*MAP_BLOCKS*MAP_BLOCKS;
+	int i;
+
+	for( i = 0; i < blocks; i++ ){
+		aFree(mob_blocks[i].ids);
+		aFree(pc_blocks[i].ids);
+	}
+	aFree(mob_blocks);
+	aFree(pc_blocks);
+	aFree(mobs);
+	aFree(mob_order);
+	aFree(pcs);
+}
+
+/// Moves a player one cell in a random direction, two moves out of three.
+/// @return false if the player didn't move
+static bool pc_walk(struct world_pc* pc, int* dx, int* dy){
+	if( rand_next()%3 == 2 )
+		return false;
+	*dx = (int)(rand_next()%3) - 1;
+	*dy = (int)(rand_next()%3) - 1;
+	if( pc->x + *dx < 20 || pc->x + *dx >= MAP_SIZE - 20 )
+		*dx = 0;
+	if( pc->y + *dy < 20 || pc->y + *dy >= MAP_SIZE - 20 )
+		*dy = 0;
+	block_remove(world_block(pc_blocks, pc->m, pc->x, pc->y), (int)(pc - pcs));
+	pc->x += *dx;
+	pc->y += *dy;
+	block_add(world_block(pc_blocks, pc->m, pc->x, pc->y), (int)(pc - pcs));
+	return true;
+}
+
+/// Calls 'func' for the monsters in the area, like map_foreachinarea(BL_MOB).
+static void foreach_mob(int m, int x0, int y0, int x1, int y1, void (*func)(struct world_mob*)){
+	int bx, by, i;
+
+	x0 = max(x0, 0);
+	y0 = max(y0, 0);
+	x1 = min(x1, MAP_SIZE - 1);
+	y1 = min(y1, MAP_SIZE - 1);
+	for( by = y0/BLOCK_SIZE; by <= y1/BLOCK_SIZE; by++ ){
+		for( bx = x0/BLOCK_SIZE; bx <= x1/BLOCK_SIZE; bx++ ){
+			struct world_block* b = &mob_blocks[(m*MAP_BLOCKS + by)*MAP_BLOCKS + bx];
+
+			for( i = 0; i < b->count; i++ ){
+				struct world_mob* md = &mobs[b->ids[i]];
+
+				if( md->x < x0 || md->x > x1 || md->y < y0 || md->y > y1 )
+					continue;
+				visits++;
+				func(md);
+			}
+		}
+	}
+}
+
+/// Checks for a player in active AI range of a monster, like map_foreachinallrange(BL_PC).
+static bool pc_near(struct world_mob* md){
+	int x0 = max(md->x - AI_RANGE, 0), y0 = max(md->y - AI_RANGE, 0);
+	int x1 = min(md->x + AI_RANGE, MAP_SIZE - 1), y1 = min(md->y + AI_RANGE, MAP_SIZE - 1);
+	int bx, by, i;
+
+	for( by = y0/BLOCK_SIZE; by <= y1/BLOCK_SIZE; by++ ){
+		for( bx = x0/BLOCK_SIZE; bx <= x1/BLOCK_SIZE; bx++ ){
+			struct world_block* b = &pc_blocks[(md->m*MAP_BLOCKS + by)*MAP_BLOCKS + bx];
+
+			for( i = 0; i < b->count; i++ ){
+				struct world_pc* pc = &pcs[b->ids[i]];
+
+				if( abs(pc->x - md->x) <= AI_RANGE && abs(pc->y - md->y) <= AI_RANGE )
+					return true;
+			}
+		}
+	}
+	return false;
+}
+
+
+/*----------------------------
+ * 	AI sweeps (old code)
+ *----------------------------*/
+static unsigned int sweep_tick;
+
+/// mob_ai_sub_hard_timer
+static void sweep_hard_sub(struct world_mob* md){
+	if( sweep_tick - md->last_thinktime < AI_TICK )
+		return;
+	md->last_thinktime = sweep_tick;
+	md->spotted = true;
+	mob_think(md);
+}
+
+/// Runs the AI for 'AI_TICKS' ticks with the two sweeps.
+/// @return Elapsed microseconds
+static uint64 run_sweeps(void){
+	uint64 begin = gettick_us();
+	int t, i;
+
+	sweep_tick = 1000;
+	for( t = 0; t < AI_TICKS; t++ ){
+		sweep_tick += AI_TICK;
+		for( i = 0; i < pc_count; i++ ){
+			int dx, dy;
+			pc_walk(&pcs[i], &dx, &dy);
+		}
+		// mob_ai_hard: the monsters around each player
+		for( i = 0; i < pc_count; i++ ){
+			struct world_pc* pc = &pcs[i];
+			foreach_mob(pc->m, pc->x - AI_RANGE, pc->y - AI_RANGE, pc->x + AI_RANGE, pc->y + AI_RANGE, sweep_hard_sub);
+		}
+		// mob_ai_lazy: every monster, once per second
+		if( t%AI_LAZY_DELAY == AI_LAZY_DELAY - 1 ){
+			for( i = 0; i < mob_count; i++ ){
+				struct world_mob* md = &mobs[mob_order[i]];
+
+				visits++;
+				mob_clean_spotted(md);
+				if( sweep_tick - md->last_thinktime < AI_LAZY_DELAY*AI_TICK )
+					continue;
+				md->last_thinktime = sweep_tick;
+				if( md->spotted )
+					mob_think(md);
+			}
+		}
+	}
+	return gettick_us() - begin;
+}
+
+
+/*----------------------------
+ * 	Think schedule (mob_ai_timer)
+ *----------------------------*/
+static struct s_mob_ai_queue queue;
+
+/// mob_ai_schedule
+static void queue_think(struct world_mob* md, int delay){
+	mob_ai_queue_push(&queue, (int)(md - mobs), &md->think_slot, delay);
+}
+
+/// mob_ai_wake_sub
+static void queue_wake_sub(struct world_mob* md){
+	queue_think(md, 1);
+}
+
+/// mob_ai_wake_move, the monsters in the cells a player walked into range of
+static void queue_wake_move(struct world_pc* pc, int dx, int dy){
+	if( dx ){
+		int x = ( dx > 0 ? pc->x + AI_RANGE : pc->x - AI_RANGE );
+		foreach_mob(pc->m, x, pc->y - AI_RANGE, x, pc->y + AI_RANGE, queue_wake_sub);
+	}
+	if( dy ){
+		int y = ( dy > 0 ? pc->y + AI_RANGE : pc->y - AI_RANGE );
+		int x0 = pc->x - AI_RANGE + ( dx < 0 ? 1 : 0 );
+		int x1 = pc->x + AI_RANGE - ( dx > 0 ? 1 : 0 );
+		foreach_mob(pc->m, x0, y, x1, y, queue_wake_sub);
+	}
+}
+
+/// mob_ai_think
+/// @return AI ticks until the next think, 0 to sleep until woken up
+static int queue_think_sub(struct world_mob* md, unsigned int tick){
+	if( users[md->m] && pc_near(md) ){
+		if( tick - md->last_thinktime >= AI_TICK ){
+			md->last_thinktime = tick;
+			mob_think(md);
+		}
+		md->spotted = true;
+		return 1;
+	}
+	mob_clean_spotted(md);
+	if( tick - md->last_thinktime < AI_LAZY_DELAY*AI_TICK )
+		return AI_LAZY_DELAY;
+	md->last_thinktime = tick;
+	if( !md->spotted )
+		return 0;
+	mob_think(md);
+	return AI_LAZY_DELAY;
+}
+
+/// Runs the AI for 'AI_TICKS' ticks with the think schedule.
+/// @return Elapsed microseconds
+static uint64 run_schedule(void){
+	uint64 begin = gettick_us();
+	unsigned int tick = 1000;
+	int t, i;
+
+	memset(&queue, 0, sizeof(queue));
+	for( i = 0; i < mob_count; i++ )
+		queue_think(&mobs[i], 1);// spawn
+
+	for( t = 0; t < AI_TICKS; t++ ){
+		struct s_mob_ai_bucket* b;
+
+		tick += AI_TICK;
+		for( i = 0; i < pc_count; i++ ){
+			int dx, dy;
+			if( pc_walk(&pcs[i], &dx, &dy) )
+				queue_wake_move(&pcs[i], dx, dy);
+		}
+
+		b = mob_ai_queue_next(&queue);
+		for( i = 0; i < b->count; i++ ){
+			struct world_mob* md = &mobs[b->ids[i]];
+			int delay;
+
+			visits++;
+			if( md->think_slot != queue.slot )
+				continue;// queued again for an earlier tick
+			md->think_slot = 0;
+			delay = queue_think_sub(md, tick);
+			if( delay )
+				queue_think(md, delay);
+		}
+		b->count = 0;
+	}
+	mob_ai_queue_final(&queue);
+	return gettick_us() - begin;
+}
+
+/// Queues random thinks of 'CHECK_MOBS' monsters for 'CHECK_TICKS' AI ticks and checks that
+/// each one thinks exactly once on the earliest tick it was queued for.
+#define CHECK_MOBS 2000
+#define CHECK_TICKS 1000
+static bool check_schedule(void){
+	unsigned int* think_slot;
+	unsigned int* expected; // reference: earliest queued tick, 0 if not queued
+	int* thought; // thinks in the current tick
+	int i, t, errors = 0;
+
+	CREATE(think_slot, unsigned int, CHECK_MOBS);
+	CREATE(expected, unsigned int, CHECK_MOBS);
+	CREATE(thought, int, CHECK_MOBS);
+	memset(&queue, 0, sizeof(queue));
+	seed = 815;
+
+	for( t = 0; t < CHECK_TICKS; t++ ){
+		struct s_mob_ai_bucket* b;
+
+		// queue a few, some of them again for an earlier or a later tick
+		for( i = 0; i < 200; i++ ){
+			int id = rand_next()%CHECK_MOBS;
+			int delay = 1 + rand_next()%(MOB_AI_BUCKETS - 1);
+			unsigned int slot = queue.slot + delay;
+
+			mob_ai_queue_push(&queue, id, &think_slot[id], delay);
+			if( !expected[id] || (int)(expected[id] - slot) > 0 )
+				expected[id] = slot;
+			if( think_slot[id] != expected[id] && errors++ < 10 )
+				ShowError("monster %d queued for tick %u, expected %u\n", id, think_slot[id], expected[id]);
+		}
+
+		// run the next tick like mob_ai_timer
+		b = mob_ai_queue_next(&queue);
+		memset(thought, 0, CHECK_MOBS*sizeof(int));
+		for( i = 0; i < b->count; i++ ){
+			int id = b->ids[i];
+
+			if( think_slot[id] != queue.slot )
+				continue;// queued again for an earlier tick
+			think_slot[id] = 0;
+			thought[id]++;
+			if( rand_next()%2 )// thinks again later
+				mob_ai_queue_push(&queue, id, &think_slot[id], 1 + rand_next()%(MOB_AI_BUCKETS - 1));
+		}
+		b->count = 0;
+
+		for( i = 0; i < CHECK_MOBS; i++ ){
+			bool due = ( expected[i] == queue.slot );
+
+			if( thought[i] != (due ? 1 : 0) && errors++ < 10 )
+				ShowError("monster %d thought %d times on tick %u, expected %u\n", i, thought[i], queue.slot, expected[i]);
+			if( due )
+				expected[i] = think_slot[i];
+		}
+	}
+
+	mob_ai_queue_final(&queue);
+	aFree(think_slot);
+	aFree(expected);
+	aFree(thought);
+	return ( errors == 0 );
+}
+
+
+/*----------------------------
+ * 	Near-player test (mob_ai_pcnear)
+ *----------------------------*/
+#define NEAR_TICKS 2000
+
+static struct map_data near_map; // map of the crowd
+static int* near_list = NULL; // players found by the scan, like bl_list
+
+/// mob_add_spotted
+static void near_add_spotted(struct world_mob* md, uint32 char_id){
+	int i;
+
+	for( i = 0; i < SPOTTED_MAX; i++ ){
+		if( md->spotted_log[i] == char_id )
+			return;
+	}
+	for( i = 0; i < SPOTTED_MAX; i++ ){
+		if( md->spotted_log[i] == 0 ){
+			md->spotted_log[i] = char_id;
+			return;
+		}
+	}
+}
+
+/// map_foreachinallrange(mob_ai_sub_spotted, BL_PC), collects the players, then adds them to the log.
+/// @return Players in range
+static int near_scan(struct world_mob* md){
+	int x0 = max(md->x - AI_RANGE, 0), y0 = max(md->y - AI_RANGE, 0);
+	int x1 = min(md->x + AI_RANGE, MAP_SIZE - 1), y1 = min(md->y + AI_RANGE, MAP_SIZE - 1);
+	int bx, by, i, count = 0;
+
+	for( by = y0/BLOCK_SIZE; by <= y1/BLOCK_SIZE; by++ ){
+		for( bx = x0/BLOCK_SIZE; bx <= x1/BLOCK_SIZE; bx++ ){
+			struct world_block* b = world_block(pc_blocks, 0, bx*BLOCK_SIZE, by*BLOCK_SIZE);
+
+			for( i = 0; i < b->count; i++ ){
+				struct world_pc* pc = &pcs[b->ids[i]];
+
+				if( pc->x >= x0 && pc->x <= x1 && pc->y >= y0 && pc->y <= y1 )
+					near_list[count++] = b->ids[i];
+			}
+		}
+	}
+	for( i = 0; i < count; i++ )
+		near_add_spotted(md, pcs[near_list[i]].char_id);
+	return count;
+}
+
+/// mob_ai_sub_cover for every player
+static void near_cover(unsigned int slot){
+	int i;
+
+	for( i = 0; i < pc_count; i++ )
+		mob_ai_cover(&near_map, pcs[i].x, pcs[i].y, AI_RANGE, pcs[i].char_id, slot);
+}
+
+/// mob_ai_pcnear
+static bool near_marked(struct world_mob* md, unsigned int slot){
+	uint32 char_id;
+
+	switch( mob_ai_near(&near_map, md->x, md->y, slot, &char_id) ){
+		case MOB_AI_NEAR:
+			near_add_spotted(md, char_id);
+			return true;
+		case MOB_AI_EDGE:
+			return ( near_scan(md) > 0 );
+		default:
+			return false;
+	}
+}
+
+static void near_map_init(struct map_data* mapdata, int16 xs, int16 ys){
+	memset(mapdata, 0, sizeof(*mapdata));
+	mapdata->xs = xs;
+	mapdata->ys = ys;
+	mapdata->bxs = (xs + BLOCK_SIZE - 1)/BLOCK_SIZE;
+	mapdata->bys = (ys + BLOCK_SIZE - 1)/BLOCK_SIZE;
+}
+
+/// Marks the blocks around players walking on a map whose size isn't a multiple of BLOCK_SIZE
+/// and checks every cell of it: a covered block must be in range of the player that covers it,
+/// a block that isn't marked must be out of range of all the players. The cells of a second map
+/// must stay unmarked.
+#define CHECK_PCS 20
+#define CHECK_SLOTS 50
+static bool check_near(void){
+	struct map_data other;
+	int i, x, y, errors = 0;
+	unsigned int slot;
+
+	seed = 99;
+	pc_count = CHECK_PCS;
+	CREATE(pcs, struct world_pc, pc_count);
+	near_map_init(&near_map, 149, 91);
+	near_map_init(&other, 149, 91);
+	for( i = 0; i < pc_count; i++ ){
+		pcs[i].x = rand_next()%near_map.xs;
+		pcs[i].y = rand_next()%near_map.ys;
+		pcs[i].char_id = 150000 + i;
+	}
+
+	for( slot = 1; slot <= CHECK_SLOTS; slot++ ){
+		for( i = 0; i < pc_count; i++ ){// players jump around, the marks of the last tick must not count
+			pcs[i].x = (pcs[i].x + near_map.xs + (int)(rand_next()%21) - 10)%near_map.xs;
+			pcs[i].y = (pcs[i].y + near_map.ys + (int)(rand_next()%21) - 10)%near_map.ys;
+		}
+		near_cover(slot);
+
+		for( y = 0; y < near_map.ys; y++ ){
+			for( x = 0; x < near_map.xs; x++ ){
+				uint32 char_id = 0;
+				enum e_mob_ai_near r = mob_ai_near(&near_map, x, y, slot, &char_id);
+				bool in_range = false;
+
+				for( i = 0; i < pc_count && !in_range; i++ )
+					in_range = ( abs(pcs[i].x - x) <= AI_RANGE && abs(pcs[i].y - y) <= AI_RANGE );
+				if( r == MOB_AI_FAR && in_range && errors++ < 10 )
+					ShowError("cell %d,%d: not marked but a player is in range (tick %u)\n", x, y, slot);
+				if( r == MOB_AI_NEAR ){
+					struct world_pc* pc = &pcs[char_id - 150000];
+
+					if( char_id < 150000 || char_id >= 150000 + CHECK_PCS || abs(pc->x - x) > AI_RANGE || abs(pc->y - y) > AI_RANGE ){
+						if( errors++ < 10 )
+							ShowError("cell %d,%d: covered by %u, which is out of range (tick %u)\n", x, y, char_id, slot);
+					}
+				}
+				if( mob_ai_near(&other, x, y, slot, NULL) != MOB_AI_FAR && errors++ < 10 )
+					ShowError("cell %d,%d of the other map is marked (tick %u)\n", x, y, slot);
+			}
+		}
+	}
+
+	aFree(near_map.ai_block);
+	aFree(other.ai_block);
+	aFree(pcs);
+	return ( errors == 0 );
+}
+
+/// Places 'num_pcs' players in a 'field' x 'field' square of one map and
+/// 'num_mobs' monsters in active AI range of the square, then runs the
+/// near-player test of every monster for 'NEAR_TICKS' AI ticks both ways.
+/// @param us Elapsed microseconds of the scan and of the marked blocks
+/// @param found Monsters near a player per tick, both ways
+static void near_bench(int num_pcs, int num_mobs, int field, uint64 us[2], int found[2]){
+	int blocks = MAP_BLOCKS*MAP_BLOCKS;
+	int64 count[2] = { 0, 0 };
+	uint64 begin;
+	int i, t;
+
+	seed = 4711;
+	pc_count = num_pcs;
+	mob_count = num_mobs;
+	CREATE(pcs, struct world_pc, pc_count);
+	CREATE(mobs, struct world_mob, mob_count);
+	CREATE(pc_blocks, struct world_block, blocks);
+	CREATE(near_list, int, pc_count);
+	near_map_init(&near_map, MAP_SIZE, MAP_SIZE);
+
+	for( i = 0; i < pc_count; i++ ){
+		pcs[i].x = 100 + rand_next()%field;
+		pcs[i].y = 100 + rand_next()%field;
+		pcs[i].char_id = 150000 + i;
+		block_add(world_block(pc_blocks, 0, pcs[i].x, pcs[i].y), i);
+	}
+	for( i = 0; i < mob_count; i++ ){
+		mobs[i].x = 100 - AI_RANGE + rand_next()%(field + 2*AI_RANGE);
+		mobs[i].y = 100 - AI_RANGE + rand_next()%(field + 2*AI_RANGE);
+	}
+
+	begin = gettick_us();
+	for( t = 0; t < NEAR_TICKS; t++ ){
+		for( i = 0; i < mob_count; i++ )
+			count[0] += ( near_scan(&mobs[i]) > 0 );
+	}
+	us[0] = gettick_us() - begin;
+
+	begin = gettick_us();
+	for( t = 1; t <= NEAR_TICKS; t++ ){
+		near_cover(t);
+		for( i = 0; i < mob_count; i++ )
+			count[1] += near_marked(&mobs[i], t);
+	}
+	us[1] = gettick_us() - begin;
+
+	found[0] = (int)(count[0]/NEAR_TICKS);
+	found[1] = (int)(count[1]/NEAR_TICKS);
+
+	for( i = 0; i < blocks; i++ )
+		aFree(pc_blocks[i].ids);
+	aFree(pc_blocks);
+	aFree(near_map.ai_block);
+	aFree(near_list);
+	aFree(mobs);
+	aFree(pcs);
+}
+
+
+int do_init(int argc, char **argv){
+	static const int sizes[] = { 100000, 200000, 300000 };
+	static const int crowds[][3] = { { 10, 100, 60 }, { 50, 300, 60 }, { 100, 500, 80 }, { 200, 1000, 120 } };
+	int i;
+
+	ShowStatus("==========\n");
+	ShowStatus("TEST: think schedule\n");
+	if( !check_schedule() ){
+		ShowFatalError("Test failed.\n");
+		exit(1);
+	}
+	ShowStatus("OK!\n");
+
+	ShowStatus("==========\n");
+	ShowStatus("BENCHMARK: AI sweeps vs think schedule, %d maps, %d players on %d maps, %d AI ticks\n",
+		WORLD_MAPS, WORLD_PCS, WORLD_PC_MAPS, AI_TICKS);
+	for( i = 0; i < ARRAYLENGTH(sizes); i++ ){
+		uint64 us;
+
+		world_init(sizes[i], WORLD_PCS);
+		visits = thinks = 0;
+		us = run_sweeps();
+		ShowStatus("%6d mobs: sweeps   %8.1f us/tick, %7.0f visits/tick, %6.0f thinks/tick\n", sizes[i],
+			(double)us/AI_TICKS, (double)visits/AI_TICKS, (double)thinks/AI_TICKS);
+		world_final();
+
+		world_init(sizes[i], WORLD_PCS);
+		visits = thinks = 0;
+		us = run_schedule();
+		ShowStatus("%6d mobs: schedule %8.1f us/tick, %7.0f visits/tick, %6.0f thinks/tick\n", sizes[i],
+			(double)us/AI_TICKS, (double)visits/AI_TICKS, (double)thinks/AI_TICKS);
+		world_final();
+	}
+
+	ShowStatus("==========\n");
+	ShowStatus("TEST: blocks marked in active AI range of the players\n");
+	if( !check_near() ){
+		ShowFatalError("Test failed.\n");
+		exit(1);
+	}
+	ShowStatus("OK!\n");
+
+	ShowStatus("==========\n");
+	ShowStatus("BENCHMARK: near-player test of the active monsters, %d AI ticks\n", NEAR_TICKS);
+	for( i = 0; i < ARRAYLENGTH(crowds); i++ ){
+		uint64 us[2];
+		int found[2];
+
+		near_bench(crowds[i][0], crowds[i][1], crowds[i][2], us, found);
+		ShowStatus("%4d players, %4d mobs in %dx%d cells: per-mob scan %7.1f us/tick, marked blocks %6.1f us/tick (near %d/%d)\n",
+			crowds[i][0], crowds[i][1], crowds[i][2], crowds[i][2],
+			(double)us[0]/NEAR_TICKS, (double)us[1]/NEAR_TICKS, found[0], found[1]);
+		if( found[0] != found[1] ){
+			ShowFatalError("Test failed.\n");
+			exit(1);
+		}
+	}
+
+	ShowStatus("Test passed.\n");
+	exit(0);
+
+return 0;
+}//end: do_init()
+
+
+void do_abort(){
+}//end: do_abort()
+
+
+void set_server_type(){
+	SERVER_TYPE = ATHENA_SERVER_NONE;
+}//end: set_server_type()
+
+
+void do_final(){
+}//end: do_final()
+
+
+int parse_console(const char* command){
+	return 0;
+}//end: parse_console
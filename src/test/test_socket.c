@@ -0,0 +1,270 @@
+#include "../common/cbasetypes.h"
+#include "../common/core.h"
+#include "../common/atomic.h"
+#include "../common/thread.h"
+#include "../common/socket.h"
+#include "../common/showmsg.h"
+#include "../common/timer.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#ifndef WIN32
+#include <unistd.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+#endif
+
+//
+// Echo server throughput with the epoll loop and with the io_uring backend.
+// Client threads keep a message in flight on each of their connections,
+// the server runs the usual do_timer/do_sockets loop and echoes everything back.
+//
+
+
+#define BENCH_THREADS 4
+#define BENCH_CONNS 64   // connections per client thread
+#define BENCH_MSGSIZE 64 // bytes per message, starting with the length (uint32)
+#define BENCH_MS 3000    // duration of each run
+
+static uint16 bench_port = 0;
+static volatile int32 bench_stop = 0;
+static volatile int32 bench_done = 0; // client threads that finished
+
+struct bench_client {
+	rAthread thread;
+	int fds[BENCH_CONNS];
+	uint32 seq;
+	uint64 messages;
+	int errors;
+};
+static struct bench_client clients[BENCH_THREADS];
+
+
+/*----------------------------
+ * 	Server
+ *----------------------------*/
+static int echo_parse(int fd){
+	if( session[fd]->flag.eof ){
+		do_close(fd);
+		return 0;
+	}
+	while( RFIFOREST(fd) >= 4 ){
+		int len = RFIFOL(fd,0);
+
+		if( len < 4 || len > 1024 ){
+			set_eof(fd);
+			return 0;
+		}
+		if( RFIFOREST(fd) < len )
+			return 0;
+		WFIFOHEAD(fd,len);
+		memcpy(WFIFOP(fd,0), RFIFOP(fd,0), len);
+		WFIFOSET(fd,len);
+		RFIFOSKIP(fd,len);
+	}
+	return 0;
+}
+
+static int sessions_open(int listen_fd){
+	int i, n = 0;
+
+	for( i = 1; i < fd_max; i++ )
+		if( session[i] && i != listen_fd )
+			n++;
+	return n;
+}
+
+static uint64 thread_cpu_us(void){
+#if defined(CLOCK_THREAD_CPUTIME_ID)
+	struct timespec ts;
+
+	clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+	return (uint64)ts.tv_sec*1000000 + ts.tv_nsec/1000;
+#else
+	return 0;
+#endif
+}
+
+
+/*----------------------------
+ * 	Clients (plain blocking sockets, no memory manager)
+ *----------------------------*/
+static bool send_all(int fd, const char* buf, int len){
+	while( len > 0 ){
+		int n = (int)send(fd, buf, len, 0);
+
+		if( n <= 0 )
+			return false;
+		buf += n;
+		len -= n;
+	}
+	return true;
+}
+
+static bool recv_all(int fd, char* buf, int len){
+	while( len > 0 ){
+		int n = (int)recv(fd, buf, len, 0);
+
+		if( n <= 0 )
+			return false;
+		buf += n;
+		len -= n;
+	}
+	return true;
+}
+
+static void *client_main(void *p){
+	struct bench_client* c = (struct bench_client*)p;
+	struct sockaddr_in addr;
+	char out[BENCH_MSGSIZE], in[BENCH_MSGSIZE];
+	int i, yes = 1;
+
+	memset(&addr, 0, sizeof(addr));
+	addr.sin_family = AF_INET;
+	addr.sin_addr.s_addr = htonl(0x7f000001);
+	addr.sin_port = htons(bench_port);
+	for( i = 0; i < BENCH_CONNS; i++ ){
+		c->fds[i] = (int)socket(AF_INET, SOCK_STREAM, 0);
+		setsockopt(c->fds[i], IPPROTO_TCP, TCP_NODELAY, (char*)&yes, sizeof(yes));
+		if( connect(c->fds[i], (struct sockaddr*)&addr, sizeof(addr)) != 0 ){
+			c->errors++;
+			goto done;
+		}
+	}
+
+	memset(out, 0, sizeof(out));
+	*(uint32*)out = BENCH_MSGSIZE;
+	while( !bench_stop ){
+		// one message on each connection, then collect the echoes
+		for( i = 0; i < BENCH_CONNS; i++ ){
+			*(uint32*)(out + 4) = c->seq + i;
+			if( !send_all(c->fds[i], out, BENCH_MSGSIZE) ){
+				c->errors++;
+				goto done;
+			}
+		}
+		for( i = 0; i < BENCH_CONNS; i++ ){
+			*(uint32*)(out + 4) = c->seq + i;
+			if( !recv_all(c->fds[i], in, BENCH_MSGSIZE) ){
+				c->errors++;
+				goto done;
+			}
+			if( memcmp(in, out, BENCH_MSGSIZE) != 0 )
+				c->errors++;
+		}
+		c->seq += BENCH_CONNS;
+		c->messages += BENCH_CONNS;
+	}
+
+done:
+	for( i = 0; i < BENCH_CONNS; i++ )
+		if( c->fds[i] > 0 )
+			close(c->fds[i]);
+	InterlockedIncrement(&bench_done);
+	return NULL;
+}
+
+
+/*----------------------------
+ * 	Benchmark
+ *----------------------------*/
+/// Runs the clients against the server loop.
+/// @return false if a client failed
+static bool bench(int listen_fd, const char* name){
+	uint64 messages = 0, cpu;
+	unsigned int begin, elapsed;
+	int i, errors = 0;
+
+	bench_stop = 0;
+	bench_done = 0;
+	memset(clients, 0, sizeof(clients));
+	for( i = 0; i < BENCH_THREADS; i++ ){
+		clients[i].thread = rathread_create(client_main, &clients[i]);
+		if( clients[i].thread == NULL ){
+			ShowError("unable to start client thread %d\n", i);
+			exit(1);
+		}
+	}
+
+	begin = gettick_nocache();
+	cpu = thread_cpu_us();
+	while( bench_done < BENCH_THREADS ){
+		do_sockets(do_timer(gettick_nocache()));
+		if( !bench_stop && DIFF_TICK(gettick_nocache(), begin) >= BENCH_MS )
+			InterlockedExchange(&bench_stop, 1);
+	}
+	elapsed = max(gettick_nocache() - begin, 1);
+	cpu = thread_cpu_us() - cpu;
+
+	for( i = 0; i < BENCH_THREADS; i++ ){
+		rathread_wait(clients[i].thread, NULL);
+		messages += clients[i].messages;
+		errors += clients[i].errors;
+	}
+
+	// let the server close the connections
+	begin = gettick_nocache();
+	while( sessions_open(listen_fd) > 0 && DIFF_TICK(gettick_nocache(), begin) < 5000 )
+		do_sockets(do_timer(gettick_nocache()) > 10 ? 10 : 0);
+
+	ShowStatus("%-8s %8u messages/s, server %.2f us CPU per message%s\n", name,
+		(unsigned int)(messages*1000/elapsed), messages ? (double)cpu/messages : 0., errors ? " (errors!)" : "");
+	return ( errors == 0 && sessions_open(listen_fd) == 0 );
+}
+
+
+int do_init(int argc, char **argv){
+	struct sockaddr_in addr;
+	socklen_t len = sizeof(addr);
+	int listen_fd;
+
+	ShowStatus("==========\n");
+	ShowStatus("BENCHMARK: echo server, %d connections, %d byte messages, %d ms per run\n", BENCH_THREADS*BENCH_CONNS, BENCH_MSGSIZE, BENCH_MS);
+
+	set_defaultparse(echo_parse);
+	ip_rules = 0;// the clients connect in a burst from 127.0.0.1, don't take it for an attack
+	socket_uring_enable(false);
+	listen_fd = make_listen_bind(0x7f000001, 0);
+	if( listen_fd <= 0 || getsockname(listen_fd, (struct sockaddr*)&addr, &len) != 0 ){
+		ShowFatalError("unable to listen\n");
+		exit(1);
+	}
+	bench_port = ntohs(addr.sin_port);
+
+	if( !bench(listen_fd, "epoll") ){
+		ShowFatalError("Test failed.\n");
+		exit(1);
+	}
+	if( socket_uring_enable(true) ){
+		if( !bench(listen_fd, "io_uring") || !socket_uring_enable(false) ){
+			ShowFatalError("Test failed.\n");
+			exit(1);
+		}
+	} else
+		ShowStatus("io_uring is not available, skipped.\n");
+
+	ShowStatus("Test passed.\n");
+	exit(0);
+
+return 0;
+}//end: do_init()
+
+
+void do_abort(){
+}//end: do_abort()
+
+
+void set_server_type(){
+	SERVER_TYPE = ATHENA_SERVER_NONE;
+}//end: set_server_type()
+
+
+void do_final(){
+}//end: do_final()
+
+
+int parse_console(const char* command){
+	return 0;
+}//end: parse_console
@@ -0,0 +1,360 @@
+#include "../common/cbasetypes.h"
+#include "../common/core.h"
+#include "../common/db.h"
+#include "../common/malloc.h"
+#include "../common/showmsg.h"
+#include "../common/timer.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+//
+// Checks the timer wheel against a reference model and compares its speed
+// with the binary heap it replaced (add/delete/expire with 100k and 1M live timers).
+//
+
+
+static uint32 seed = 12345;
+static unsigned int sim_now; // simulated tick, continued by each test
+static uint32 rand_next(void){
+	seed = seed*1103515245 + 12345;
+	return (seed>>8);
+}
+
+
+/*----------------------------
+ * 	Correctness
+ *----------------------------*/
+#define CHECK_TIMERS 200000
+
+struct check_timer {
+	int tid;
+	unsigned int tick; // expected tick
+	bool alive, fired;
+};
+
+static struct check_timer* check = NULL;
+static unsigned int check_now;
+static unsigned int check_last; // tick of the last executed timer in this do_timer call
+static int check_errors = 0;
+
+static int check_timer_func(int tid, unsigned int tick, int id, intptr_t data){
+	struct check_timer* c = &check[id];
+
+	if( !c->alive || c->fired || c->tid != tid ){
+		if( check_errors++ < 10 ) ShowError("timer %d executed but it was deleted or executed already\n", id);
+		return 0;
+	}
+	if( DIFF_TICK(c->tick, check_now) > 0 ){
+		if( check_errors++ < 10 ) ShowError("timer %d executed too early (%u > %u)\n", id, c->tick, check_now);
+	}
+	if( DIFF_TICK(check_now, c->tick) <= 1000 && tick != c->tick ){
+		if( check_errors++ < 10 ) ShowError("timer %d executed with tick %u, expected %u\n", id, tick, c->tick);
+	}
+	if( DIFF_TICK(c->tick, check_last) < 0 ){
+		if( check_errors++ < 10 ) ShowError("timer %d executed out of order (%u < %u)\n", id, c->tick, check_last);
+	}
+	check_last = c->tick;
+	c->fired = true;
+	return 0;
+}
+
+static unsigned int check_delay(void){
+	switch( rand_next()%4 ){
+		case 0: return rand_next()%300;
+		case 1: return rand_next()%20000;
+		case 2: return rand_next()%2000000;
+		default: return rand_next()%100000000;
+	}
+}
+
+static bool test_correctness(void){
+	int i, n = 0;
+
+	check = (struct check_timer*)aCalloc(CHECK_TIMERS, sizeof(struct check_timer));
+	check_now = sim_now;
+	check_errors = 0;
+
+	while( n < CHECK_TIMERS ){
+		// add a few
+		for( i = 0; i < 50 && n < CHECK_TIMERS; i++, n++ ){
+			check[n].tick = check_now + check_delay();
+			check[n].tid = add_timer(check[n].tick, check_timer_func, n, 0);
+			check[n].alive = true;
+		}
+		// delete or move a few
+		for( i = 0; i < 20; i++ ){
+			struct check_timer* c = &check[rand_next()%n];
+
+			if( !c->alive || c->fired )
+				continue;
+			if( rand_next()%2 ){
+				delete_timer(c->tid, check_timer_func);
+				c->alive = false;
+			} else {
+				c->tick = check_now + check_delay();
+				settick_timer(c->tid, c->tick);
+			}
+		}
+		check_now += rand_next()%(rand_next()%10 ? 50 : 200000);
+		check_last = 0;
+		do_timer(check_now);
+	}
+
+	// run everything
+	check_now += 100000000;
+	check_last = 0;
+	do_timer(check_now);
+
+	for( i = 0; i < CHECK_TIMERS; i++ ){
+		if( check[i].alive != check[i].fired ){
+			if( check_errors++ < 10 ) ShowError("timer %d alive=%d fired=%d\n", i, check[i].alive, check[i].fired);
+		}
+	}
+	sim_now = check_now;
+
+	aFree(check);
+	return (check_errors == 0);
+}
+
+
+// A second delete_timer of a deleted timer must not hit a new timer that got its id.
+static int stale_fired;
+static int stale_timer_func(int tid, unsigned int tick, int id, intptr_t data){
+	stale_fired++;
+	return 0;
+}
+
+static bool test_stale_delete(void){
+	int old_tid, new_tid;
+
+	stale_fired = 0;
+	old_tid = add_timer(sim_now + 1000, stale_timer_func, 0, 0);
+	delete_timer(old_tid, stale_timer_func);
+	new_tid = add_timer(sim_now + 1000, stale_timer_func, 1, 0);
+	if( new_tid == old_tid ){
+		ShowError("the id of a pending deleted timer was reused right away\n");
+		return false;
+	}
+	if( delete_timer(old_tid, stale_timer_func) == 0 ){
+		ShowError("stale delete_timer succeeded\n");
+		return false;
+	}
+	sim_now += 2000;
+	do_timer(sim_now);
+	if( stale_fired != 1 ){
+		ShowError("%d timers executed, expected 1\n", stale_fired);
+		return false;
+	}
+	return true;
+}
+
+
+/*----------------------------
+ * 	Benchmark
+ *----------------------------*/
+#define BENCH_STEPS 200  // simulated ticks of 20ms
+#define BENCH_CHURN 5    // percentage of the live timers added and deleted per tick
+
+// live timers, to pick the ones that get deleted
+static int* live = NULL;
+static int* live_ids = NULL; // id of each timer in live
+static int* live_pos = NULL; // position of each timer in live, by id
+static int live_num = 0;
+static int bench_next_id = 0;
+
+static void live_add(int id, int tid){
+	live[live_num] = tid;
+	live_ids[live_num] = id;
+	live_pos[id] = live_num++;
+}
+
+static void live_remove(int id){
+	int pos = live_pos[id];
+
+	live_num--;
+	live[pos] = live[live_num];
+	live_ids[pos] = live_ids[live_num];
+	live_pos[live_ids[pos]] = pos;
+}
+
+static int bench_timer_func(int tid, unsigned int tick, int id, intptr_t data){
+	live_remove(id);
+	return 0;
+}
+
+// The binary heap, as used before the timer wheel (deleted timers stay in the heap until they expire).
+struct heap_timer {
+	unsigned int tick;
+	int id;
+	bool alive;
+};
+static struct heap_timer* heap_data = NULL;
+static int* heap_free = NULL;
+static int heap_free_pos = 0;
+static BHEAP_VAR(int, heap);
+#define HEAP_MINTOPCMP(tid1,tid2) DIFF_TICK(heap_data[tid1].tick,heap_data[tid2].tick)
+
+static int heap_add(unsigned int tick, int id){
+	int tid = heap_free[--heap_free_pos];
+
+	heap_data[tid].tick = tick;
+	heap_data[tid].id = id;
+	heap_data[tid].alive = true;
+	BHEAP_ENSURE(heap, 1, 256);
+	BHEAP_PUSH(heap, tid, HEAP_MINTOPCMP, swap);
+	return tid;
+}
+
+static void heap_delete(int tid){
+	heap_data[tid].alive = false;
+}
+
+static void heap_do(unsigned int tick){
+	while( BHEAP_LENGTH(heap) ){
+		int tid = BHEAP_PEEK(heap);
+
+		if( DIFF_TICK(heap_data[tid].tick, tick) > 0 )
+			break;
+		BHEAP_POP(heap, HEAP_MINTOPCMP, swap);
+		if( heap_data[tid].alive )
+			bench_timer_func(tid, tick, heap_data[tid].id, 0);
+		heap_free[heap_free_pos++] = tid;
+	}
+}
+
+/// Runs the benchmark with about 'num' live timers.
+/// @param use_heap true to use the binary heap, false for the timer wheel
+/// @return elapsed milliseconds
+static unsigned int bench(int num, bool use_heap){
+	int max = num*2 + num*BENCH_CHURN/100*BENCH_STEPS + 1024;
+	unsigned int now = sim_now, begin;
+	int i, step;
+
+	live = (int*)aMalloc(max*sizeof(int));
+	live_ids = (int*)aMalloc(max*sizeof(int));
+	live_pos = (int*)aMalloc(max*sizeof(int));
+	live_num = 0;
+	bench_next_id = 0;
+	seed = 4711;
+	if( use_heap ){
+		heap_data = (struct heap_timer*)aMalloc(max*sizeof(struct heap_timer));
+		heap_free = (int*)aMalloc(max*sizeof(int));
+		for( heap_free_pos = 0; heap_free_pos < max; heap_free_pos++ )
+			heap_free[heap_free_pos] = max - 1 - heap_free_pos;
+		BHEAP_INIT(heap);
+	}
+
+	begin = gettick_nocache();
+
+	// walk steps, attacks, status changes... mostly short
+	for( i = 0; i < num; i++ ){
+		int id = bench_next_id++;
+		unsigned int tick = now + 1 + rand_next()%(i%10 ? 2000 : 600000);
+
+		live_add(id, use_heap ? heap_add(tick, id) : add_timer(tick, bench_timer_func, id, 0));
+	}
+
+	for( step = 0; step < BENCH_STEPS; step++ ){
+		int churn = num*BENCH_CHURN/100;
+
+		for( i = 0; i < churn; i++ ){
+			int id = bench_next_id++;
+			unsigned int tick = now + 1 + rand_next()%(i%10 ? 2000 : 600000);
+			int pos, tid;
+
+			live_add(id, use_heap ? heap_add(tick, id) : add_timer(tick, bench_timer_func, id, 0));
+
+			// most timers are deleted before they expire
+			pos = rand_next()%live_num;
+			tid = live[pos];
+			if( use_heap )
+				heap_delete(tid);
+			else
+				delete_timer(tid, bench_timer_func);
+			live_remove(live_ids[pos]);
+		}
+
+		now += 20;
+		if( use_heap )
+			heap_do(now);
+		else
+			do_timer(now);
+	}
+
+	begin = gettick_nocache() - begin;
+	if( !use_heap )
+		sim_now = now;
+
+	// cleanup
+	if( use_heap ){
+		BHEAP_CLEAR(heap);
+		aFree(heap_data);
+		aFree(heap_free);
+	} else {
+		while( live_num > 0 )
+			delete_timer(live[live_num-1], bench_timer_func), live_num--;
+	}
+	aFree(live);
+	aFree(live_ids);
+	aFree(live_pos);
+
+	return begin;
+}
+
+
+int do_init(int argc, char **argv){
+	static const int sizes[] = { 100000, 1000000 };
+	int i;
+
+	sim_now = gettick();
+
+	ShowStatus("==========\n");
+	ShowStatus("TEST: timer wheel correctness\n");
+	if( !test_correctness() ){
+		ShowFatalError("Test failed.\n");
+		exit(1);
+	}
+	ShowStatus("OK!\n");
+
+	ShowStatus("==========\n");
+	ShowStatus("TEST: delete_timer with a stale id\n");
+	if( !test_stale_delete() ){
+		ShowFatalError("Test failed.\n");
+		exit(1);
+	}
+	ShowStatus("OK!\n");
+
+	ShowStatus("==========\n");
+	ShowStatus("BENCHMARK: %d ticks, %d%% of the timers added and deleted per tick\n", BENCH_STEPS, BENCH_CHURN);
+	for( i = 0; i < ARRAYLENGTH(sizes); i++ ){
+		unsigned int heap_ms = bench(sizes[i], true);
+		unsigned int wheel_ms = bench(sizes[i], false);
+
+		ShowStatus("%7d timers: binary heap %6u ms, timer wheel %6u ms\n", sizes[i], heap_ms, wheel_ms);
+	}
+
+	ShowStatus("Test passed.\n");
+	exit(0);
+
+return 0;
+}//end: do_init()
+
+
+void do_abort(){
+}//end: do_abort()
+
+
+void set_server_type(){
+	SERVER_TYPE = ATHENA_SERVER_NONE;
+}//end: set_server_type()
+
+
+void do_final(){
+}//end: do_final()
+
+
+int parse_console(const char* command){
+	return 0;
+}//end: parse_console
@@ -7,6 +7,10 @@
 
 #ifndef _WIN32
 #include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <time.h>
 #endif
 
 #include "../common/mmo.h"
@@ -20,7 +24,9 @@
 char grf_list_file[256] = "conf/grf-files.txt";
 char map_list_file[256] = "db/map_index.txt";
 char map_cache_file[256];
+char bench_file[256];
 int rebuild = 0;
+int format = 1; // Format of the written cache (1 = compressed, 2 = see struct v2_header)
 
 FILE *map_cache_fp;
 
@@ -48,6 +54,52 @@ struct map_info {
 };
 
 
+// Map cache v2: the header, the index of the maps, then the cells of each map
+// starting on a page boundary. A cell takes V2_CELL_SIZE bytes, the first one holds
+// the V2_* terrain flags and the second one is zero. This is the layout of
+// struct mapcell in the map-server, so it can map the file and use the cells directly.
+#define V2_MAGIC "MCV2"
+#define V2_PAGE_SIZE 4096
+#define V2_CELL_SIZE 2
+#define V2_WALKABLE  0x01
+#define V2_SHOOTABLE 0x02
+#define V2_WATER     0x04
+
+struct v2_header {
+	char magic[4];
+	uint32 file_size;
+	uint32 map_count;
+	uint32 page_size; // Alignment of the cells of each map
+	uint32 cell_size;
+};
+
+struct v2_index {
+	char name[MAP_NAME_LENGTH];
+	int16 xs;
+	int16 ys;
+	uint32 offset; // Position of the cells in the file
+};
+
+// Maps of the v2 cache being written, the cells hold the V2_* flags
+struct v2_map {
+	char name[MAP_NAME_LENGTH];
+	struct map_data m;
+};
+struct v2_map *v2_maps = NULL;
+int v2_count = 0, v2_max = 0;
+
+
+// Converts a gat type to the V2_* flags (same as map_gat2cell)
+unsigned char gat2flags(unsigned char gat)
+{
+	switch (gat) {
+		case 1: return 0; // Non-walkable ground
+		case 3: return V2_WALKABLE|V2_SHOOTABLE|V2_WATER; // Walkable water
+		case 5: return V2_SHOOTABLE; // Gap (snipable)
+		default: return V2_WALKABLE|V2_SHOOTABLE;
+	}
+}
+
 // Reads a map from GRF's GAT and RSW files
 int read_map(char *name, struct map_data *m)
 {
@@ -159,6 +211,144 @@ int find_map(char *name)
 	return 0;
 }
 
+// Checks whether a map is in the v2 cache being written
+int v2_find_map(char *name)
+{
+	int i;
+
+	for (i = 0; i < v2_count; i++)
+		if (strcmp(name, v2_maps[i].name) == 0)
+			return 1;
+	return 0;
+}
+
+// Adds a map to the v2 cache being written, converting the gat types unless 'flags' is set
+void v2_add_map(char *name, struct map_data *m, int flags)
+{
+	struct v2_map *v;
+	size_t xy, num_cells = (size_t)m->xs*(size_t)m->ys;
+
+	if (v2_count == v2_max) {
+		v2_max += 256;
+		RECREATE(v2_maps, struct v2_map, v2_max);
+	}
+	v = &v2_maps[v2_count++];
+	memset(v->name, 0, sizeof(v->name));
+	strncpy(v->name, name, MAP_NAME_LENGTH-1);
+	v->m = *m;
+	if (!flags)
+		for (xy = 0; xy < num_cells; xy++)
+			v->m.cells[xy] = gat2flags(v->m.cells[xy]);
+}
+
+// Reads the maps of an existing cache (either format) into the v2 cache being written
+int v2_read_cache(FILE *fp)
+{
+	unsigned char *buf;
+	long size;
+
+	fseek(fp, 0, SEEK_END);
+	size = ftell(fp);
+	fseek(fp, 0, SEEK_SET);
+	buf = (unsigned char *)aMalloc(size);
+	if (fread(buf, 1, size, fp) != (size_t)size) {
+		aFree(buf);
+		return 0;
+	}
+
+	if (size >= (long)sizeof(struct v2_header) && memcmp(buf, V2_MAGIC, 4) == 0) {
+		uint32 i, count = GetULong(buf + 8);
+		struct v2_index *idx = (struct v2_index *)(buf + sizeof(struct v2_header));
+
+		for (i = 0; i < count; i++) {
+			struct map_data m;
+			const unsigned char *cells = buf + GetULong((unsigned char *)&idx[i].offset);
+			size_t xy;
+
+			m.xs = (int16)GetUShort((unsigned char *)&idx[i].xs);
+			m.ys = (int16)GetUShort((unsigned char *)&idx[i].ys);
+			m.cells = (unsigned char *)aMalloc((size_t)m.xs*(size_t)m.ys);
+			for (xy = 0; xy < (size_t)m.xs*(size_t)m.ys; xy++)
+				m.cells[xy] = cells[xy*V2_CELL_SIZE];
+			v2_add_map(idx[i].name, &m, 1);
+		}
+	} else if (size >= (long)sizeof(struct main_header)) {
+		uint16 i, count = GetUShort(buf + 4);
+		unsigned char *p = buf + sizeof(struct main_header);
+
+		for (i = 0; i < count; i++) {
+			struct map_info *info = (struct map_info *)p;
+			struct map_data m;
+			unsigned long len;
+
+			m.xs = (int16)GetUShort((unsigned char *)&info->xs);
+			m.ys = (int16)GetUShort((unsigned char *)&info->ys);
+			len = (unsigned long)m.xs*(unsigned long)m.ys;
+			m.cells = (unsigned char *)aMalloc(len);
+			decode_zip(m.cells, &len, p + sizeof(struct map_info), GetULong((unsigned char *)&info->len));
+			v2_add_map(info->name, &m, 0);
+			p += sizeof(struct map_info) + GetULong((unsigned char *)&info->len);
+		}
+	}
+
+	aFree(buf);
+	return 1;
+}
+
+// Writes the v2 cache
+void v2_write_cache(FILE *fp)
+{
+	struct v2_header h;
+	struct v2_index idx;
+	uint32 offset;
+	static const char zero[V2_PAGE_SIZE];
+	int i;
+
+	offset = sizeof(struct v2_header) + v2_count*sizeof(struct v2_index);
+	offset = (offset + V2_PAGE_SIZE - 1) / V2_PAGE_SIZE * V2_PAGE_SIZE;
+
+	fseek(fp, sizeof(struct v2_header), SEEK_SET);
+	for (i = 0; i < v2_count; i++) {
+		struct map_data *m = &v2_maps[i].m;
+		uint32 len = (uint32)m->xs*(uint32)m->ys*V2_CELL_SIZE;
+
+		memcpy(idx.name, v2_maps[i].name, MAP_NAME_LENGTH);
+		idx.xs = MakeShortLE(m->xs);
+		idx.ys = MakeShortLE(m->ys);
+		idx.offset = MakeLongLE(offset);
+		fwrite(&idx, sizeof(idx), 1, fp);
+		offset += (len + V2_PAGE_SIZE - 1) / V2_PAGE_SIZE * V2_PAGE_SIZE;
+	}
+
+	for (i = 0; i < v2_count; i++) {
+		struct map_data *m = &v2_maps[i].m;
+		size_t xy, num_cells = (size_t)m->xs*(size_t)m->ys;
+		long pos = ftell(fp);
+
+		// Align the cells of the map to a page
+		fwrite(zero, 1, (V2_PAGE_SIZE - pos%V2_PAGE_SIZE)%V2_PAGE_SIZE, fp);
+		for (xy = 0; xy < num_cells; xy++) {
+			unsigned char cell[V2_CELL_SIZE] = { m->cells[xy], 0 };
+			fwrite(cell, V2_CELL_SIZE, 1, fp);
+		}
+		aFree(m->cells);
+	}
+	// Pad the last map too, so every map covers whole pages
+	fwrite(zero, 1, (V2_PAGE_SIZE - ftell(fp)%V2_PAGE_SIZE)%V2_PAGE_SIZE, fp);
+
+	memcpy(h.magic, V2_MAGIC, 4);
+	h.file_size = MakeLongLE((uint32)ftell(fp));
+	h.map_count = MakeLongLE((uint32)v2_count);
+	h.page_size = MakeLongLE(V2_PAGE_SIZE);
+	h.cell_size = MakeLongLE(V2_CELL_SIZE);
+	fseek(fp, 0, SEEK_SET);
+	fwrite(&h, sizeof(h), 1, fp);
+
+	aFree(v2_maps);
+	v2_maps = NULL;
+	v2_count = v2_max = 0;
+}
+
 // Cuts the extension from a map name
 char *remove_extension(char *mapname)
 {
@@ -173,6 +363,170 @@ char *remove_extension(char *mapname)
 	return mapname;
 }
 
+#ifndef _WIN32
+// Returns a memory field of /proc/self/status in KB (RssAnon: private, RssFile: shared with the page cache)
+long rss_kb(const char *field)
+{
+	FILE *fp = fopen("/proc/self/status", "r");
+	char line[256];
+	long kb = 0;
+
+	if (fp == NULL)
+		return 0;
+	while (fgets(line, sizeof(line), fp))
+		if (strncmp(line, field, strlen(field)) == 0 && line[strlen(field)] == ':')
+			kb = atol(line + strlen(field) + 1);
+	fclose(fp);
+	return kb;
+}
+
+// Drops the clean pages of a file from the page cache, so the next run reads it from the disk
+void drop_cache(const char *file)
+{
+	int fd = open(file, O_RDONLY);
+
+	if (fd < 0)
+		return;
+	posix_fadvise(fd, 0, 0, POSIX_FADV_DONTNEED);
+	close(fd);
+}
+
+// Returns a monotonic time in milliseconds
+unsigned int bench_tick(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (unsigned int)(ts.tv_sec*1000 + ts.tv_nsec/1000000);
+}
+
+// Cells of the maps loaded by the benchmark
+struct bench_map {
+	int16 xs;
+	int16 ys;
+	unsigned char *cells; // V2_CELL_SIZE bytes per cell
+};
+
+// Reads every cell and sets the second byte of 4 cells per map (npc touch areas)
+int bench_use(struct bench_map *maps, int count)
+{
+	int i, walkable = 0;
+
+	for (i = 0; i < count; i++) {
+		size_t xy, num_cells = (size_t)maps[i].xs*(size_t)maps[i].ys;
+
+		for (xy = 0; xy < num_cells; xy++)
+			walkable += (maps[i].cells[xy*V2_CELL_SIZE]&V2_WALKABLE);
+		for (xy = 0; xy < num_cells; xy += num_cells/4 + 1)
+			maps[i].cells[xy*V2_CELL_SIZE + 1] = 1;
+	}
+	return walkable;
+}
+
+// Loads the maps of the v1 cache 'map_cache_file' and of the v2 cache 'bench_file'
+// the way the map-server does and compares the time and the memory it takes.
+// The file is dropped from the page cache before each run (cold boot).
+void bench(void)
+{
+	struct bench_map *maps = NULL;
+	int i, count = 0, walkable[2];
+	unsigned int tick;
+	long anon, file, size;
+	struct stat st;
+
+	// v2: map the file privately and point at the cells
+	{
+		int fd;
+		unsigned char *buf;
+
+		drop_cache(bench_file);
+		anon = rss_kb("RssAnon");
+		file = rss_kb("RssFile");
+		tick = bench_tick();
+		fd = open(bench_file, O_RDONLY);
+		if (fd < 0 || fstat(fd, &st) != 0) {
+			ShowError("Failure when opening map cache file %s\n", bench_file);
+			exit(EXIT_FAILURE);
+		}
+		buf = (unsigned char *)mmap(NULL, st.st_size, PROT_READ|PROT_WRITE, MAP_PRIVATE, fd, 0);
+		close(fd);
+		if (buf == MAP_FAILED || st.st_size < (off_t)sizeof(struct v2_header) || memcmp(buf, V2_MAGIC, 4) != 0) {
+			ShowError("%s is not a v2 map cache\n", bench_file);
+			exit(EXIT_FAILURE);
+		}
+		count = (int)GetULong(buf + 8);
+		CREATE(maps, struct bench_map, count);
+		for (i = 0; i < count; i++) {
+			struct v2_index *idx = (struct v2_index *)(buf + sizeof(struct v2_header)) + i;
+
+			maps[i].xs = (int16)GetUShort((unsigned char *)&idx->xs);
+			maps[i].ys = (int16)GetUShort((unsigned char *)&idx->ys);
+			maps[i].cells = buf + GetULong((unsigned char *)&idx->offset);
+		}
+		ShowInfo("v2: %d maps loaded in %u ms\n", count, bench_tick() - tick);
+		tick = bench_tick();
+		walkable[1] = bench_use(maps, count);
+		ShowInfo("v2: cells used in %u ms, %ld KB private, %ld KB shared\n", bench_tick() - tick,
+			rss_kb("RssAnon") - anon, rss_kb("RssFile") - file);
+		munmap(buf, st.st_size);
+		aFree(maps);
+	}
+
+	// v1: read the file and inflate every map into its own cells
+	{
+		FILE *fp;
+		unsigned char *buf, *p, *decode;
+
+		drop_cache(map_cache_file);
+		anon = rss_kb("RssAnon");
+		tick = bench_tick();
+		fp = fopen(map_cache_file, "rb");
+		if (fp == NULL) {
+			ShowError("Failure when opening map cache file %s\n", map_cache_file);
+			exit(EXIT_FAILURE);
+		}
+		fseek(fp, 0, SEEK_END);
+		size = ftell(fp);
+		fseek(fp, 0, SEEK_SET);
+		buf = (unsigned char *)aMalloc(size);
+		if (fread(buf, 1, size, fp) != (size_t)size || memcmp(buf, V2_MAGIC, 4) == 0) {
+			ShowError("%s is not a v1 map cache\n", map_cache_file);
+			exit(EXIT_FAILURE);
+		}
+		fclose(fp);
+		count = GetUShort(buf + 4);
+		CREATE(maps, struct bench_map, count);
+		decode = (unsigned char *)aMalloc(512*512);
+		p = buf + sizeof(struct main_header);
+		for (i = 0; i < count; i++) {
+			struct map_info *info = (struct map_info *)p;
+			unsigned long len, xy;
+
+			maps[i].xs = (int16)GetUShort((unsigned char *)&info->xs);
+			maps[i].ys = (int16)GetUShort((unsigned char *)&info->ys);
+			len = (unsigned long)maps[i].xs*(unsigned long)maps[i].ys;
+			decode_zip(decode, &len, p + sizeof(struct map_info), GetULong((unsigned char *)&info->len));
+			maps[i].cells = (unsigned char *)aCalloc(len, V2_CELL_SIZE);
+			for (xy = 0; xy < len; xy++)
+				maps[i].cells[xy*V2_CELL_SIZE] = gat2flags(decode[xy]);
+			p += sizeof(struct map_info) + GetULong((unsigned char *)&info->len);
+		}
+		aFree(decode);
+		aFree(buf);
+		ShowInfo("v1: %d maps loaded in %u ms\n", count, bench_tick() - tick);
+		tick = bench_tick();
+		walkable[0] = bench_use(maps, count);
+		ShowInfo("v1: cells used in %u ms, %ld KB private\n", bench_tick() - tick, rss_kb("RssAnon") - anon);
+		for (i = 0; i < count; i++)
+			aFree(maps[i].cells);
+		aFree(maps);
+	}
+
+	if (walkable[0] != walkable[1])
+		ShowWarning("The caches don't hold the same cells (%d/%d walkable)\n", walkable[0], walkable[1]);
+}
+#endif
+
 // Processes command-line arguments
 void process_args(int argc, char *argv[])
 {
@@ -190,6 +544,12 @@ void process_args(int argc, char *argv[])
 				strcpy(map_cache_file, argv[i]);
 		} else if(strcmp(argv[i], "-rebuild") == 0)
 			rebuild = 1;
+		else if(strcmp(argv[i], "-v2") == 0)
+			format = 2;
+		else if(strcmp(argv[i], "-bench") == 0) {
+			if(++i < argc)
+				strcpy(bench_file, argv[i]);
+		}
 	}
 
 }
@@ -213,6 +573,15 @@ int do_init(int argc, char** argv)
 	// Process the command-line arguments
 	process_args(argc, argv);
 
+	if(bench_file[0]) {
+#ifndef _WIN32
+		bench();
+#else
+		ShowError("The benchmark isn't available on this platform\n");
+#endif
+		return 0;
+	}
+
 	ShowStatus("Initializing grfio with %s\n", grf_list_file);
 	grfio_init(grf_list_file);
 
@@ -223,10 +592,21 @@ int do_init(int argc, char** argv)
 		if(map_cache_fp == NULL) {
 			ShowNotice("Existing map cache not found, forcing rebuild mode\n");
 			rebuild = 1;
-		} else
+		} else {
+			char magic[4];
+
+			if(format == 2) // Keep the maps of the existing cache, the file is written again
+				v2_read_cache(map_cache_fp);
+			else if(fread(magic, 1, 4, map_cache_fp) == 4 && memcmp(magic, V2_MAGIC, 4) == 0) {
+				ShowError("Map cache %s is in the v2 format, use -v2 or -rebuild\n", map_cache_file);
+				exit(EXIT_FAILURE);
+			}
 			fclose(map_cache_fp);
+		}
 	}
-	if(rebuild)
+	if(format == 2)
+		map_cache_fp = fopen(map_cache_file, "wb");
+	else if(rebuild)
 		map_cache_fp = fopen(map_cache_file, "w+b");
 	else
 		map_cache_fp = fopen(map_cache_file, "r+b");
@@ -244,7 +624,9 @@ int do_init(int argc, char** argv)
 	}
 
 	// Initialize the main header
-	if(rebuild) {
+	if(format == 2)
+		;
+	else if(rebuild) {
 		header.file_size = sizeof(struct main_header);
 		header.map_count = 0;
 	} else {
@@ -267,10 +649,13 @@ int do_init(int argc, char** argv)
 
 		name[MAP_NAME_LENGTH_EXT-1] = '\0';
 		remove_extension(name);
-		if(find_map(name))
+		if(format == 2 ? v2_find_map(name) : find_map(name))
 			ShowInfo("Map '"CL_WHITE"%s"CL_RESET"' already in cache.\n", name);
 		else if(read_map(name, &map)) {
-			cache_map(name, &map);
+			if(format == 2)
+				v2_add_map(name, &map, 0);
+			else
+				cache_map(name, &map);
 			ShowInfo("Map '"CL_WHITE"%s"CL_RESET"' successfully cached.\n", name);
 		} else
 			ShowError("Map '"CL_WHITE"%s"CL_RESET"' not found!\n", name);
@@ -282,8 +667,13 @@ int do_init(int argc, char** argv)
 
 	// Write the main header and close the map cache
 	ShowStatus("Closing map cache: %s\n", map_cache_file);
-	fseek(map_cache_fp, 0, SEEK_SET);
-	fwrite(&header, sizeof(struct main_header), 1, map_cache_fp);
+	if(format == 2) {
+		header.map_count = v2_count;
+		v2_write_cache(map_cache_fp);
+	} else {
+		fseek(map_cache_fp, 0, SEEK_SET);
+		fwrite(&header, sizeof(struct main_header), 1, map_cache_fp);
+	}
 	fclose(map_cache_fp);
 
 	ShowStatus("Finalizing grfio\n");